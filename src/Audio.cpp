@@ -14,33 +14,95 @@
 #include "mp3_decoder/mp3_decoder.h"
 #include "opus_decoder/opus_decoder.h"
 #include "vorbis_decoder/vorbis_decoder.h"
+#include "replaygain.h"
+
+#ifdef AUDIO_STATS // cycle count of one call, recorded in a per stage histogram
+  #define STAT_BEGIN(t)             uint32_t t = ESP.getCycleCount(); BaseType_t t##Core = xPortGetCoreID()
+  #define STAT_END(t, stage, bytes) statRecord(stage, t, t##Core, bytes)
+#else
+  #define STAT_BEGIN(t)             do {} while(0)
+  #define STAT_END(t, stage, bytes) do {} while(0)
+#endif
 
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 AudioBuffer::AudioBuffer(size_t maxBlockSize) {
-    mutex_buffer = xSemaphoreCreateRecursiveMutex();
     // if maxBlockSize isn't set use defaultspace (1600 bytes) is enough for aac and mp3 player
     if(maxBlockSize) m_resBuffSizeRAM = maxBlockSize;
     if(maxBlockSize) m_maxBlockSize = maxBlockSize;
 }
 
 AudioBuffer::~AudioBuffer() {
-    if(m_buffer) free(m_buffer);
-    m_buffer = NULL;
-    vSemaphoreDelete(mutex_buffer);
+    freeBuffer();
 }
 
-void AudioBuffer::setBufsize(int ram, int psram) {
+void AudioBuffer::setBufsize(int ram, int psram, bool mirror) {
     if(ram > -1) // -1 == default / no change
         m_buffSizeRAM = ram;
     if(psram > -1) m_buffSizePSRAM = psram;
+    m_f_mirror = mirror;
+}
+
+void AudioBuffer::freeBuffer() {
+#ifdef AUDIO_INBUFF_MIRROR
+    if(m_mirrorHeap) {
+        esp_mmu_unmap(m_buffer);
+        esp_mmu_unmap(m_buffer + m_buffSize);
+        free(m_mirrorHeap);
+        m_mirrorHeap = NULL;
+        m_buffer = NULL;
+    }
+#endif
+    if(m_buffer) free(m_buffer);
+    m_buffer = NULL;
+}
+
+bool AudioBuffer::initMirror() {
+    // maps the physical pages of a PSRAM block twice, the second mapping must follow the first one directly.
+    // Both mappings have their own cache lines, getReadPtr() keeps them coherent for the head of the buffer
+#ifdef AUDIO_INBUFF_MIRROR
+    const size_t page = CONFIG_MMU_PAGE_SIZE;
+    size_t       size = (m_buffSizePSRAM + page - 1) / page * page;
+    uint8_t*     heap = (uint8_t*)heap_caps_aligned_alloc(page, size, MALLOC_CAP_SPIRAM);
+    if(!heap) return false;
+
+    esp_paddr_t  p0 = 0, p = 0;
+    mmu_target_t target;
+    bool         ok = (esp_mmu_vaddr_to_paddr(heap, &p0, &target) == ESP_OK);
+    for(size_t i = page; ok && i < size; i += page) { // physically contiguous?
+        ok = (esp_mmu_vaddr_to_paddr(heap + i, &p, &target) == ESP_OK) && (p == p0 + i);
+    }
+    void* v1 = NULL;
+    void* v2 = NULL;
+    int   caps = MMU_MEM_CAP_READ | MMU_MEM_CAP_WRITE | MMU_MEM_CAP_8BIT;
+    if(ok) ok = (esp_mmu_map(p0, size, target, (mmu_mem_caps_t)caps, ESP_MMU_MMAP_FLAG_PADDR_SHARED, &v1) == ESP_OK);
+    if(ok) ok = (esp_mmu_map(p0, size, target, (mmu_mem_caps_t)caps, ESP_MMU_MMAP_FLAG_PADDR_SHARED, &v2) == ESP_OK);
+    if(ok && (uint8_t*)v1 == (uint8_t*)v2 + size) std::swap(v1, v2);
+    if(ok) ok = ((uint8_t*)v2 == (uint8_t*)v1 + size);
+    if(ok) ok = (esp_cache_msync(v2, 64, ESP_CACHE_MSYNC_FLAG_DIR_M2C) == ESP_OK); // the cache can be maintained
+    if(!ok) {
+        if(v1) esp_mmu_unmap(v1);
+        if(v2) esp_mmu_unmap(v2);
+        free(heap);
+        log_w("no double mapping of the input buffer, the wrap-around is copied");
+        return false;
+    }
+    m_mirrorHeap = heap;
+    m_buffer = (uint8_t*)v1;
+    m_buffSize = size;
+    return true;
+#else
+    return false;
+#endif
 }
 
 int32_t AudioBuffer::getBufsize() { return m_buffSize; }
 
 size_t AudioBuffer::init() {
-    if(m_buffer) free(m_buffer);
-    m_buffer = NULL;
-    if(psramInit() && m_buffSizePSRAM > 0) {
+    freeBuffer();
+    if(psramInit() && m_buffSizePSRAM > 0 && m_f_mirror && initMirror()) { // no reserved space
+        m_f_psram = true;
+    }
+    else if(psramInit() && m_buffSizePSRAM > 0) {
         // PSRAM found, AudioBuffer will be allocated in PSRAM
         m_f_psram = true;
         m_buffSize = m_buffSizePSRAM;
@@ -66,112 +128,78 @@ void AudioBuffer::changeMaxBlockSize(uint16_t mbs) {
 
 uint16_t AudioBuffer::getMaxBlockSize() { return m_maxBlockSize; }
 
+size_t AudioBuffer::advance(std::atomic<size_t>& idx, size_t n) {
+    // a CAS loop instead of load/store, a second task that reads or writes (header parsing) can not lose an update
+    size_t i = idx.load(std::memory_order_relaxed);
+    size_t next;
+    do {
+        next = i + n;
+        if(next >= 2 * m_buffSize) next -= 2 * m_buffSize;
+    } while(!idx.compare_exchange_weak(i, next, std::memory_order_release, std::memory_order_relaxed));
+    return next;
+}
+
 size_t AudioBuffer::freeSpace() {
-    if(m_readPtr == m_writePtr) {
-        if(m_f_start) m_freeSpace = m_buffSize;
-        else m_freeSpace = 0;
-    }
-    if(m_readPtr < m_writePtr) {
-        m_freeSpace = (m_endPtr - m_writePtr + 1) + (m_readPtr - m_buffer);
-    }
-    if(m_readPtr > m_writePtr) {
-        m_freeSpace = m_readPtr - m_writePtr;
-    }
-    return m_freeSpace;
+    return m_buffSize - bufferFilled();
 }
 
 size_t AudioBuffer::writeSpace() {
-    xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
-    if(m_readPtr == m_writePtr) {
-        if(m_f_start) m_writeSpace = m_endPtr - m_writePtr + 1;
-        else m_writeSpace = 0;
-    }
-    if(m_readPtr < m_writePtr) {
-        m_writeSpace = m_endPtr - m_writePtr + 1;
-    }
-    if(m_readPtr > m_writePtr) {
-        m_writeSpace = m_readPtr - m_writePtr ;
-    }
-    xSemaphoreGiveRecursive(mutex_buffer);
-    return m_writeSpace;
+    size_t w = pos(m_writeIdx.load(std::memory_order_relaxed));
+    return min(freeSpace(), m_buffSize - w); // up to the end of the buffer
 }
 
 size_t AudioBuffer::bufferFilled() {
-    xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
-    if(m_readPtr == m_writePtr) {
-        if(m_f_start) m_dataLength = 0;
-        else m_dataLength = (m_endPtr - m_readPtr + 1) + (m_writePtr - m_buffer);
-    }
-    if(m_readPtr < m_writePtr) {
-        m_dataLength = m_writePtr - m_readPtr;
-    }
-    if(m_readPtr > m_writePtr) {
-        m_dataLength = (m_endPtr - m_readPtr + 1) + (m_writePtr - m_buffer);
-    }
-    xSemaphoreGiveRecursive(mutex_buffer);
-    return m_dataLength;
+    size_t w = m_writeIdx.load(std::memory_order_acquire);
+    size_t r = m_readIdx.load(std::memory_order_acquire);
+    return (w >= r) ? w - r : w + 2 * m_buffSize - r;
 }
 
 size_t AudioBuffer::getMaxAvailableBytes() {
-    xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
-    if(m_readPtr == m_writePtr) {
-        if(m_f_start)m_dataLength = 0;
-        else m_dataLength = (m_endPtr - m_readPtr + 1) + (m_writePtr - m_buffer);
-    }
-    if(m_readPtr < m_writePtr) {
-        m_dataLength = m_writePtr - m_readPtr;
-    }
-    if(m_readPtr > m_writePtr) {
-        m_dataLength = (m_endPtr - m_readPtr + 1);
-    }
-    xSemaphoreGiveRecursive(mutex_buffer);
-    return m_dataLength;
+    size_t r = pos(m_readIdx.load(std::memory_order_relaxed));
+    return min(bufferFilled(), m_buffSize - r); // up to the end of the buffer
 }
 
 void AudioBuffer::bytesWritten(size_t bw) {
-    xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
-    m_writePtr += bw;
-    if(m_writePtr == m_endPtr + 1) { m_writePtr = m_buffer; }
-    if(m_writePtr > m_endPtr + 1) log_e("m_writePtr %i, m_endPtr %i", m_writePtr, m_endPtr);
-    if(bw && m_f_start) m_f_start = false;
-    xSemaphoreGiveRecursive(mutex_buffer);
+    if(bw > freeSpace()) log_e("write overflow %u, free %u", bw, freeSpace());
+    advance(m_writeIdx, bw); // publishes the written bytes
 }
 
 void AudioBuffer::bytesWasRead(size_t br) {
-    xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
-    m_readPtr += br;
-    if(m_readPtr >= m_endPtr) {
-        size_t tmp = m_readPtr - m_endPtr;
-        m_readPtr = m_buffer + tmp - 1;
-    }
-    xSemaphoreGiveRecursive(mutex_buffer);
+    advance(m_readIdx, br); // releases the space
 }
 
-uint8_t* AudioBuffer::getWritePtr() { return m_writePtr; }
+uint8_t* AudioBuffer::getWritePtr() { return m_buffer + pos(m_writeIdx.load(std::memory_order_relaxed)); }
 
 uint8_t* AudioBuffer::getReadPtr() {
-    xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
-    int32_t len = m_endPtr - m_readPtr;
+    size_t  r = pos(m_readIdx.load(std::memory_order_relaxed));
+    int32_t len = m_buffSize - r;
+#ifdef AUDIO_INBUFF_MIRROR
+    if(m_mirrorHeap) { // the frame continues in the second mapping: write the head back and drop the outdated mirror lines
+        if(len < m_maxBlockSize) {
+            size_t n = (m_maxBlockSize - len + 63) & ~63;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            esp_cache_msync(m_buffer, n, ESP_CACHE_MSYNC_FLAG_DIR_C2M);
+            esp_cache_msync(m_buffer + m_buffSize, n, ESP_CACHE_MSYNC_FLAG_DIR_M2C);
+        }
+        return m_buffer + r;
+    }
+#endif
     if(len < m_maxBlockSize) {                            // be sure the last frame is completed
-        memcpy(m_endPtr + 1, m_buffer, m_maxBlockSize - (len  - 1)); // cpy from m_buffer to m_endPtr with len
+        std::atomic_thread_fence(std::memory_order_acquire);
+        memcpy(m_buffer + m_buffSize, m_buffer, m_maxBlockSize - len); // cpy from the beginning into the reserved space
     }
-    xSemaphoreGiveRecursive(mutex_buffer);
-    return m_readPtr;
+    return m_buffer + r;
 }
 
-void AudioBuffer::resetBuffer() {
-    m_writePtr = m_buffer;
-    m_readPtr = m_buffer;
-    m_endPtr = m_buffer + m_buffSize;
-    m_f_start = true;
+void AudioBuffer::resetBuffer() { // the producer and the consumer must not run
+    m_writeIdx.store(0, std::memory_order_relaxed);
+    m_readIdx.store(0, std::memory_order_release);
     // memset(m_buffer, 0, m_buffSize); //Clear Inputbuffer
-    vSemaphoreDelete(mutex_buffer);
-    mutex_buffer = xSemaphoreCreateRecursiveMutex(); // free semaphore is it set
 }
 
-uint32_t AudioBuffer::getWritePos() { return m_writePtr - m_buffer; }
+uint32_t AudioBuffer::getWritePos() { return pos(m_writeIdx.load(std::memory_order_relaxed)); }
 
-uint32_t AudioBuffer::getReadPos() { return m_readPtr - m_buffer; }
+uint32_t AudioBuffer::getReadPos() { return pos(m_readIdx.load(std::memory_order_relaxed)); }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 // clang-format off
 Audio::Audio(bool internalDAC /* = false */, uint8_t channelEnabled /* = I2S_SLOT_MODE_STEREO */, uint8_t i2sPort) {
@@ -194,6 +222,12 @@ Audio::Audio(bool internalDAC /* = false */, uint8_t channelEnabled /* = I2S_SLO
     m_ibuff = (char*)__malloc_heap_psram(m_ibuffSize);
 
     if(!m_chbuf || !m_lastHost || !m_outBuff || !m_ibuff) log_e("oom");
+    m_mp3Ctx    = MP3Decoder_NewContext();   // decoder state of this instance, a second Audio object gets its own
+    m_aacCtx    = AACDecoder_NewContext();
+    m_flacCtx   = FLACDecoder_NewContext();
+    m_opusCtx   = OPUSDecoder_NewContext();
+    m_vorbisCtx = VORBISDecoder_NewContext();
+    m_playBuff = m_outBuff;
 
 #define AUDIO_INFO(...)                     \
     {                                       \
@@ -228,6 +262,9 @@ Audio::Audio(bool internalDAC /* = false */, uint8_t channelEnabled /* = I2S_SLO
     m_i2s_std_cfg.clk_cfg.clk_src        = I2S_CLK_SRC_DEFAULT;        // Select PLL_F160M as the default source clock
     m_i2s_std_cfg.clk_cfg.mclk_multiple  = I2S_MCLK_MULTIPLE_128;      // mclk = sample_rate * 256
     i2s_channel_init_std_mode(m_i2s_tx_handle, &m_i2s_std_cfg);
+    i2s_event_callbacks_t i2sCallbacks = {};
+    i2sCallbacks.on_sent = &Audio::i2sSentCallback; // a DMA buffer is free, wakes the audio task
+    i2s_channel_register_event_callback(m_i2s_tx_handle, &i2sCallbacks, this);
     I2Sstart(0);
     m_sampleRate = 44100;
 
@@ -270,14 +307,19 @@ Audio::Audio(bool internalDAC /* = false */, uint8_t channelEnabled /* = I2S_SLO
     i2s_zero_dma_buffer((i2s_port_t) m_i2s_num);
 
 #endif // ESP_IDF_VERSION_MAJOR == 5
-    for(int i = 0; i < 3; i++) {
-        m_filter[i].a0 = 1;
-        m_filter[i].a1 = 0;
-        m_filter[i].a2 = 0;
-        m_filter[i].b1 = 0;
-        m_filter[i].b2 = 0;
-    }
+    for(int i = 0; i < m_eqMaxBands; i++) {
+        m_eqBand[i] = {PEAKEQ, 1000, 1.0f, 0, false};
+        for(int j = 0; j < 3; j++) m_iirSet[j][i].flat = true;
+        m_iirRun[i].flat = true;
+    }
+    m_eqBand[0] = {LOWSHELF,   500, 0.7071f, 0, true}; // tone control, setTone()
+    m_eqBand[1] = {PEAKEQ,    3000, 2.5f,    0, true};
+    m_eqBand[2] = {HIGHSHELF, 6000, 0.7071f, 0, true};
+    memset(m_iirState, 0, sizeof(m_iirState));
+    computeVolumeTable();
     computeLimit();  // first init, vol = 21, vol_steps = 21
+    m_gainCur[LEFTCHANNEL]  = m_gainTarget & 0xFFFF;
+    m_gainCur[RIGHTCHANNEL] = m_gainTarget >> 16;
     startAudioTask();
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -285,6 +327,19 @@ Audio::~Audio() {
     // I2Sstop(m_i2s_num);
     // InBuff.~AudioBuffer(); #215 the AudioBuffer is automatically destroyed by the destructor
     setDefaults();
+    setPcmFifo(0); // stops the writer task before the channel is deleted
+    setMixerSource(NULL);
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY); // the writer task is gone, clips are mixed under the mutex only
+    for(int i = 0; i < m_clipMax; i++) if(m_clip[i].pcm) {free(m_clip[i].pcm); m_clip[i].pcm = NULL;}
+    m_clipCount = 0;
+    xSemaphoreGive(mutex_playAudioData);
+    Audio* mixTarget = m_mixTarget.load(std::memory_order_acquire);
+    if(mixTarget) mixTarget->setMixerSource(NULL); // this object was the source of another one
+    MP3Decoder_DeleteContext(m_mp3Ctx);       m_mp3Ctx    = NULL;
+    AACDecoder_DeleteContext(m_aacCtx);       m_aacCtx    = NULL;
+    FLACDecoder_DeleteContext(m_flacCtx);     m_flacCtx   = NULL;
+    OPUSDecoder_DeleteContext(m_opusCtx);     m_opusCtx   = NULL;
+    VORBISDecoder_DeleteContext(m_vorbisCtx); m_vorbisCtx = NULL;
     if(m_playlistBuff) {
         free(m_playlistBuff);
         m_playlistBuff = NULL;
@@ -299,17 +354,29 @@ Audio::~Audio() {
     if(m_outBuff)     {free(m_outBuff);      m_outBuff      = NULL; }
     if(m_ibuff)       {free(m_ibuff);        m_ibuff        = NULL;}
     if(m_lastM3U8host){free(m_lastM3U8host); m_lastM3U8host = NULL;}
+    setSpectrumAnalyzer(0, 0);
+    if(m_spRing)      {free(m_spRing);       m_spRing       = NULL;}
+    if(m_limRing)     {free(m_limRing);      m_limRing      = NULL;}
+    if(m_lmHist)      {free(m_lmHist);       m_lmHist       = NULL;}
+    if(m_tapRing)     {free(m_tapRing);      m_tapRing      = NULL;}
+    if(m_spWindow)    {free(m_spWindow);     m_spWindow     = NULL;}
+    if(m_spFft)       {free(m_spFft);        m_spFft        = NULL;}
+    if(m_srcCoef)     {free(m_srcCoef);      m_srcCoef      = NULL;}
+    if(m_srcIn)       {free(m_srcIn);        m_srcIn        = NULL;}
+    if(m_srcBuff)     {free(m_srcBuff);      m_srcBuff      = NULL;}
+    if(m_xfBuff)      {free(m_xfBuff);       m_xfBuff       = NULL;}
+    if(m_xfOut)       {free(m_xfOut);        m_xfOut        = NULL;}
 
     vSemaphoreDelete(mutex_playAudioData);
 }
 // clang-format on
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::setBufsize(int rambuf_sz, int psrambuf_sz) {
+void Audio::setBufsize(int rambuf_sz, int psrambuf_sz, bool mirror) {
     if(InBuff.isInitialized()) {
         log_e("Audio::setBufsize must not be called after audio is initialized");
         return;
     }
-    InBuff.setBufsize(rambuf_sz, psrambuf_sz);
+    InBuff.setBufsize(rambuf_sz, psrambuf_sz, mirror);
 };
 
 void Audio::initInBuff() {
@@ -343,11 +410,13 @@ void Audio::setDefaults() {
     stopSong();
     initInBuff(); // initialize InputBuffer if not already done
     InBuff.resetBuffer();
+    DecoderLock dl(this, CODEC_NONE);
     MP3Decoder_FreeBuffers();
     FLACDecoder_FreeBuffers();
     AACDecoder_FreeBuffers();
     OPUSDecoder_FreeBuffers();
     VORBISDecoder_FreeBuffers();
+    dl.unlock();
     if(m_playlistBuff) {
         free(m_playlistBuff);
         m_playlistBuff = NULL;
@@ -399,6 +468,13 @@ void Audio::setDefaults() {
     m_audioDataSize = 0;
     m_avr_bitrate = 0;     // the same as m_bitrate if CBR, median if VBR
     m_bitRate = 0;         // Bitrate still unknown
+    m_brBytes = 0;
+    resetVUmeter();        // clip counter of the new stream
+    m_brFrames = 0;
+    m_brHint = 0;          // connecttohost() keeps it for the same host
+    m_brHost[0] = '\0';
+    m_prebufStable = 0;
+    m_f_starved = false;
     m_bytesNotDecoded = 0; // counts all not decodable bytes
     m_chunkcount = 0;      // for chunked streams
    // byteCounter = 0;     // count received data
@@ -413,6 +489,20 @@ void Audio::setDefaults() {
     m_ID3Size = 0;
     m_haveNewFilePos = 0;
     m_validSamples = 0;
+    m_srcInFrames = 0;
+    m_trimSkip = 0;
+    m_f_trimEnd = false;
+    m_f_gapless = false;
+    m_f_decodeTail = false;
+    m_f_fileDataComplete = false;
+    m_fileBytesRead = 0;
+    m_f_setDecodeParamsOnce = true;
+    m_rgTrack = INT16_MIN; // ReplayGain comes with the tags of the next file
+    m_rgAlbum = INT16_MIN;
+    m_headerGain = 0;
+    computeLimit();
+    loudnessReset();
+    resetVUmeter();
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -420,6 +510,15 @@ void Audio::setConnectionTimeout(uint16_t timeout_ms, uint16_t timeout_ms_ssl) {
     if(timeout_ms) m_timeout_ms = timeout_ms;
     if(timeout_ms_ssl) m_timeout_ms_ssl = timeout_ms_ssl;
 }
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setPrebuffer(uint16_t target_ms, uint16_t min_ms, uint16_t max_ms) {
+    // audio in InBuff before a web stream starts, grows after underruns and shrinks after long stable periods
+    if(!min_ms) min_ms = 1;
+    if(max_ms < min_ms) max_ms = min_ms;
+    m_prebufMin_ms = min_ms;
+    m_prebufMax_ms = max_ms;
+    m_prebuf_ms = constrain(target_ms, min_ms, max_ms);
+}
 
 /*
     Text to speech API provides a speech endpoint based on our TTS (text-to-speech) model.
@@ -581,8 +680,17 @@ bool Audio::connecttohost(const char* host, const char* user, const char* pwd) {
         hostwoext[pos_colon] = '\0';         // Host without portnumber
     }
 
+    // reconnect to the same host (stream lost, playlist): the start threshold uses the bitrate measured so far
+    uint32_t brHint = 0;
+    if(!strncmp(hostwoext, m_brHost, sizeof(m_brHost) - 1)) {
+        brHint = measuredBitrate();
+        if(!brHint) brHint = m_brHint;
+    }
+
     setDefaults(); // no need to stop clients if connection is established (default is true)
 
+    m_brHint = brHint;
+    strncpy(m_brHost, hostwoext, sizeof(m_brHost) - 1);
     if(startsWith(l_host, "https")) m_f_ssl = true;
     else m_f_ssl = false;
 
@@ -859,64 +967,160 @@ bool Audio::connecttoFS(fs::FS& fs, const char* path, int32_t fileStartPos) {
     m_fileStartPos = fileStartPos;
     setDefaults(); // free buffers an set defaults
 
-    char *audioPath = (char *) __malloc_heap_psram(strlen(path) + 2);
-    if(!audioPath){
-        printProcessLog(AUDIOLOG_OUT_OF_MEMORY);
+    audiofile = openAudioFile(fs, path);
+    if(!audiofile) {
         xSemaphoreGive(mutex_playAudioData);
         return false;
     }
-    if(path[0] == '/'){strcpy(audioPath, path);}
-    else {audioPath[0] = '/'; strcpy(audioPath + 1, path);}
+
+    setDatamode(AUDIO_LOCALFILE);
+    m_fileSize = audiofile.size(); // TEST loop
+    m_codec = codecFromFileName(audiofile.name()); // m_codec is by default CODEC_NONE
+
+    bool ret = initializeDecoder();
+    if(ret) m_f_running = true;
+    else audiofile.close();
+    xSemaphoreGive(mutex_playAudioData);
+    return ret;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+File Audio::openAudioFile(fs::FS& fs, const char* path) {
+    // opens path, also with an ASCII fallback of the name, returns an invalid File if not found
+
+    File  file;
+    char* audioPath = (char*)__malloc_heap_psram(strlen(path) + 2);
+    if(!audioPath) {
+        printProcessLog(AUDIOLOG_OUT_OF_MEMORY);
+        return file;
+    }
+    if(path[0] == '/') { strcpy(audioPath, path); }
+    else {
+        audioPath[0] = '/';
+        strcpy(audioPath + 1, path);
+    }
 
     if(!fs.exists(audioPath)) {
         UTF8toASCII(audioPath);
-        if(!fs.exists(audioPath)){
+        if(!fs.exists(audioPath)) {
             printProcessLog(AUDIOLOG_FILE_NOT_FOUND, audioPath);
-            xSemaphoreGive(mutex_playAudioData);
             free(audioPath);
-            return false;
+            return file;
         }
     }
 
     AUDIO_INFO("Reading file: \"%s\"", audioPath);
-    audiofile = fs.open(audioPath);
-
-    if(!audiofile) {
-        printProcessLog(AUDIOLOG_FILE_READ_ERR, audioPath);
-        free(audioPath);
-        xSemaphoreGive(mutex_playAudioData);
-        return false;
-    }
-
-    setDatamode(AUDIO_LOCALFILE);
-    m_fileSize = audiofile.size(); // TEST loop
-
-    char* afn = NULL; // audioFileName
-    afn = strdup(audiofile.name());
+    file = fs.open(audioPath);
+    if(!file) printProcessLog(AUDIOLOG_FILE_READ_ERR, audioPath);
+    free(audioPath);
+    return file;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint8_t Audio::codecFromFileName(const char* name) {
+    uint8_t codec = CODEC_NONE;
+    char*   afn = strdup(name); // audioFileName
+    if(!afn) return codec;
 
     uint8_t dotPos = lastIndexOf(afn, ".");
     for(uint8_t i = dotPos + 1; i < strlen(afn); i++) { afn[i] = toLowerCase(afn[i]); }
 
-    if(endsWith(afn, ".mp3")) m_codec = CODEC_MP3; // m_codec is by default CODEC_NONE
-    if(endsWith(afn, ".m4a")) m_codec = CODEC_M4A;
-    if(endsWith(afn, ".aac")) m_codec = CODEC_AAC;
-    if(endsWith(afn, ".wav")) m_codec = CODEC_WAV;
-    if(endsWith(afn, ".flac")) m_codec = CODEC_FLAC;
-    if(endsWith(afn, ".opus")) m_codec = CODEC_OPUS;
-    if(endsWith(afn, ".ogg")) m_codec = CODEC_OGG;
-    if(endsWith(afn, ".oga")) m_codec = CODEC_OGG;
+    if(endsWith(afn, ".mp3")) codec = CODEC_MP3;
+    if(endsWith(afn, ".m4a")) codec = CODEC_M4A;
+    if(endsWith(afn, ".aac")) codec = CODEC_AAC;
+    if(endsWith(afn, ".wav")) codec = CODEC_WAV;
+    if(endsWith(afn, ".flac")) codec = CODEC_FLAC;
+    if(endsWith(afn, ".opus")) codec = CODEC_OPUS;
+    if(endsWith(afn, ".ogg")) codec = CODEC_OGG;
+    if(endsWith(afn, ".oga")) codec = CODEC_OGG;
+
+    if(codec == CODEC_NONE) AUDIO_INFO("The %s format is not supported", afn + dotPos);
+    free(afn);
+    return codec;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::queueNextFS(fs::FS& fs, const char* path) {
+    // gapless playback, the next file is opened now and played seamlessly when the current file ends,
+    // audio_eof_mp3() is still called for the finished file. Call it from the task that calls loop()
+
+    if(!path) { // guard
+        printProcessLog(AUDIOLOG_PATH_IS_NULL);
+        return false;
+    }
+    if(m_nextFile) m_nextFile.close();
+    m_nextCodec = CODEC_NONE;
+
+    m_nextFile = openAudioFile(fs, path);
+    if(!m_nextFile) return false;
+    m_nextCodec = codecFromFileName(m_nextFile.name());
+    if(m_nextCodec == CODEC_NONE) {
+        m_nextFile.close();
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::startNextFile() {
+    // the queued file replaces the current one at EOF, I2S and the output buffers are not touched, the remaining
+    // samples are played while the header of the next file is read. The decoder is kept if the codec is the same
 
-    if(m_codec == CODEC_NONE) AUDIO_INFO("The %s format is not supported", afn + dotPos);
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    char* afn = strdup(audiofile.name());
+    audiofile.close();
+    audiofile = m_nextFile;
+    m_nextFile = File();
+    if(m_xfState == XF_CAPTURE) { // crossfade, the head of this file is mixed with the captured tail
+        m_xfState = XF_MIX;
+        m_xfLen = 0;
+        m_xfPos = 0;
+    }
+
+    bool warm = (m_nextCodec == m_codec) && (m_codec == CODEC_MP3 || m_codec == CODEC_AAC || m_codec == CODEC_M4A || m_codec == CODEC_WAV);
+    if(!warm) { // FLAC, OPUS and VORBIS streams start with their own headers, the decoder is set up again
+        DecoderLock dl(this, m_codec);
+        if(m_codec == CODEC_MP3) MP3Decoder_FreeBuffers();
+        if(m_codec == CODEC_AAC || m_codec == CODEC_M4A) AACDecoder_FreeBuffers();
+        if(m_codec == CODEC_FLAC) FLACDecoder_FreeBuffers();
+        if(m_codec == CODEC_OPUS) OPUSDecoder_FreeBuffers();
+        if(m_codec == CODEC_VORBIS) VORBISDecoder_FreeBuffers();
+    }
 
     if(afn) {
+        if(audio_eof_mp3) audio_eof_mp3(afn);
+        AUDIO_INFO("End of file \"%s\"", afn);
         free(afn);
         afn = NULL;
     }
-    free(audioPath);
 
-    bool ret = initializeDecoder();
-    if(ret) m_f_running = true;
-    else audiofile.close();
+    // per file values, like setDefaults() but without stopping the song
+    InBuff.resetBuffer();
+    m_f_firstCall = true;
+    m_f_firstCurTimeCall = true;
+    m_f_m4aID3dataAreRead = false;
+    m_f_playing = false; // seek for the first syncword of the new file
+    m_f_gapless = true;  // no prebuffering
+    m_f_decodeTail = false;
+    m_audioCurrentTime = 0;
+    m_audioFileDuration = 0;
+    m_audioDataStart = 0;
+    m_audioDataSize = 0;
+    m_avr_bitrate = 0;
+    m_bitRate = 0;
+    m_bytesNotDecoded = 0;
+    m_controlCounter = 0;
+    m_fileSize = audiofile.size();
+    m_ID3Size = 0;
+    m_resumeFilePos = -1;
+    m_haveNewFilePos = 0;
+    m_trimSkip = 0;
+    m_f_trimEnd = false;
+    m_rgTrack = INT16_MIN;
+    m_rgAlbum = INT16_MIN;
+    m_headerGain = 0;
+    computeLimit();
+    loudnessReset();
+
+    m_codec = m_nextCodec;
+    m_nextCodec = CODEC_NONE;
+    bool ret = warm ? true : initializeDecoder(); // same decoder, no new allocation
     xSemaphoreGive(mutex_playAudioData);
     return ret;
 }
@@ -1334,9 +1538,9 @@ size_t Audio::readAudioHeader(uint32_t bytes) {
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 int Audio::read_WAV_Header(uint8_t* data, size_t len) {
-    static size_t   headerSize;
-    static uint32_t cs = 0;
-    static uint8_t  bts = 0;
+    size_t&   headerSize = m_wavHdr.headerSize;
+    uint32_t& cs = m_wavHdr.cs;
+    uint8_t&  bts = m_wavHdr.bts;
 
     if(m_controlCounter == 0) {
         m_controlCounter++;
@@ -1407,8 +1611,8 @@ int Audio::read_WAV_Header(uint8_t* data, size_t len) {
         AUDIO_INFO("DataBlockSize: %u", dbs);
         AUDIO_INFO("BitsPerSample: %u", bps);
 
-        if((bps != 8) && (bps != 16)) {
-            AUDIO_INFO("BitsPerSample is %u,  must be 8 or 16", bps);
+        if((bps != 8) && (bps != 16) && (bps != 24) && (bps != 32)) {
+            AUDIO_INFO("BitsPerSample is %u,  must be 8, 16, 24 or 32", bps);
             stopSong();
             return -1;
         }
@@ -1455,7 +1659,7 @@ int Audio::read_WAV_Header(uint8_t* data, size_t len) {
         size_t cs = *(data + 0) + (*(data + 1) << 8) + (*(data + 2) << 16) + (*(data + 3) << 24); // read chunkSize
         headerSize += 4;
         if(getDatamode() == AUDIO_LOCALFILE) m_contentlength = getFileSize();
-        if(cs) { m_audioDataSize = cs - 44; }
+        if(cs) { m_audioDataSize = cs; } // size of the data chunk
         else { // sometimes there is nothing here
             if(getDatamode() == AUDIO_LOCALFILE) m_audioDataSize = getFileSize() - headerSize;
             if(m_streamType == ST_WEBFILE) m_audioDataSize = m_contentlength - headerSize;
@@ -1469,11 +1673,11 @@ int Audio::read_WAV_Header(uint8_t* data, size_t len) {
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 int Audio::read_FLAC_Header(uint8_t* data, size_t len) {
-    static size_t   headerSize;
-    static size_t   retvalue = 0;
-    static bool     f_lastMetaBlock = false;
-    static uint32_t picPos = 0;
-    static uint32_t picLen = 0;
+    size_t&   headerSize = m_flacHdr.headerSize;
+    size_t&   retvalue = m_flacHdr.retvalue;
+    bool&     f_lastMetaBlock = m_flacHdr.f_lastMetaBlock;
+    uint32_t& picPos = m_flacHdr.picPos;
+    uint32_t& picLen = m_flacHdr.picLen;
 
     if(retvalue) {
         if(retvalue > len) { // if returnvalue > bufferfillsize
@@ -1541,7 +1745,7 @@ int Audio::read_FLAC_Header(uint8_t* data, size_t len) {
         m_controlCounter = FLAC_OKAY;
         m_audioDataStart = headerSize;
         m_audioDataSize = m_contentlength - m_audioDataStart;
-        FLACSetRawBlockParams(m_flacNumChannels, m_flacSampleRate, m_flacBitsPerSample, m_flacTotalSamplesInStream, m_audioDataSize);
+        {DecoderLock dl(this, CODEC_FLAC); FLACSetRawBlockParams(m_flacNumChannels, m_flacSampleRate, m_flacBitsPerSample, m_flacTotalSamplesInStream, m_audioDataSize);}
 		#ifndef AUDIO_NO_SD_FS   
         if(picLen) {
             size_t pos = audiofile.position();
@@ -1580,8 +1784,8 @@ int Audio::read_FLAC_Header(uint8_t* data, size_t len) {
         uint8_t bps = (nextval & 0x01) << 4;
         bps += (*(data + 16) >> 4) + 1;
         m_flacBitsPerSample = bps;
-        if((bps != 8) && (bps != 16)) {
-            log_e("bits per sample must be 8 or 16, is %i", bps);
+        if((bps != 8) && (bps != 16) && (bps != 20) && (bps != 24)) {
+            log_e("bits per sample must be 8, 16, 20 or 24, is %i", bps);
             stopSong();
             return -1;
         }
@@ -1643,6 +1847,11 @@ int Audio::read_FLAC_Header(uint8_t* data, size_t len) {
                 strncpy(m_chbuf, (const char *)data , commentLength);
                 m_chbuf[commentLength] = '\0';
                 if(audio_id3data) audio_id3data(m_chbuf);
+                char* eq = strchr(m_chbuf, '=');
+                if(eq && (m_chbuf[0] == 'R' || m_chbuf[0] == 'r')) { // REPLAYGAIN_*, R128_*
+                    *eq = '\0';
+                    replayGainTag(m_chbuf, eq + 1);
+                }
             }
             data += commentLength; idx += commentLength;
             if(idx > vendorLength + 3) {log_e("VORBIS COMMENT section is too long");}
@@ -1674,23 +1883,23 @@ int Audio::read_FLAC_Header(uint8_t* data, size_t len) {
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 int Audio::read_ID3_Header(uint8_t* data, size_t len) {
-    static size_t   id3Size;
-    static size_t   totalId3Size; // if we have more header, id3_1_size + id3_2_size + ....
-    static size_t   remainingHeaderBytes;
-    static size_t   universal_tmp = 0;
-    static uint8_t  ID3version;
-    static int      ehsz = 0;
-    static char     tag[5];
-    static char     frameid[5];
-    static size_t   framesize = 0;
-    static bool     compressed = false;
+    size_t&   id3Size = m_id3Hdr.id3Size;
+    size_t&   totalId3Size = m_id3Hdr.totalId3Size; // if we have more header, id3_1_size + id3_2_size + ....
+    size_t&   remainingHeaderBytes = m_id3Hdr.remainingHeaderBytes;
+    size_t&   universal_tmp = m_id3Hdr.universal_tmp;
+    uint8_t&  ID3version = m_id3Hdr.ID3version;
+    int&      ehsz = m_id3Hdr.ehsz;
+    char (&tag)[5] = m_id3Hdr.tag;
+    char (&frameid)[5] = m_id3Hdr.frameid;
+    size_t&   framesize = m_id3Hdr.framesize;
+    bool&     compressed = m_id3Hdr.compressed;
 #ifndef AUDIO_NO_SD_FS
-    static size_t   APIC_size[3] = {0};
-    static uint32_t APIC_pos[3] = {0};
-    static bool     SYLT_seen = false;
-    static size_t   SYLT_size = 0;
-    static uint32_t SYLT_pos = 0;
-    static uint8_t  numID3Header = 0;
+    size_t (&APIC_size)[3] = m_id3Hdr.APIC_size;
+    uint32_t (&APIC_pos)[3] = m_id3Hdr.APIC_pos;
+    bool&     SYLT_seen = m_id3Hdr.SYLT_seen;
+    size_t&   SYLT_size = m_id3Hdr.SYLT_size;
+    uint32_t& SYLT_pos = m_id3Hdr.SYLT_pos;
+    uint8_t&  numID3Header = m_id3Hdr.numID3Header;
 #endif
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_controlCounter == 0) { /* read ID3 tag and ID3 header size */
@@ -1849,6 +2058,8 @@ int Audio::read_ID3_Header(uint8_t* data, size_t len) {
             return 0;
         }
 
+        if(startsWith(tag, "TXXX") && framesize < 128 && framesize <= len) replayGainID3(data, framesize); // REPLAYGAIN_*
+
         if( // any lyrics embedded in file, passing it to external function
             startsWith(tag, "SYLT") || startsWith(tag, "TXXX") || startsWith(tag, "USLT")) {
             if(getDatamode() == AUDIO_LOCALFILE) {
@@ -2007,15 +2218,15 @@ int Audio::read_M4A_Header(uint8_t* data, size_t len) {
            |
          mdat contains the audio data                                                      */
 
-    static size_t headerSize = 0;
-    static size_t retvalue = 0;
-    static size_t atomsize = 0;
-    static size_t audioDataPos = 0;
-    static uint32_t picPos = 0;
-    static uint32_t picLen = 0;
+    size_t&   headerSize = m_m4aHdr.headerSize;
+    size_t&   retvalue = m_m4aHdr.retvalue;
+    size_t&   atomsize = m_m4aHdr.atomsize;
+    size_t&   audioDataPos = m_m4aHdr.audioDataPos;
+    uint32_t& picPos = m_m4aHdr.picPos;
+    uint32_t& picLen = m_m4aHdr.picLen;
 
     if(m_controlCounter == M4A_BEGIN) retvalue = 0;
-    static size_t cnt = 0;
+    size_t& cnt = m_m4aHdr.cnt;
     if(retvalue) {
         if(len > InBuff.getMaxBlockSize()) len = InBuff.getMaxBlockSize();
         if(retvalue > len) { // if returnvalue > bufferfillsize
@@ -2324,6 +2535,7 @@ uint32_t Audio::stopSong() {
     uint32_t pos = 0;
     if(m_f_running) {
         m_f_running = false;
+        fifoFlush(); // aborted, the buffered frames are not played
         if(getDatamode() == AUDIO_LOCALFILE) {
             m_streamType = ST_NONE;
             pos = getFilePos() - inBufferFilled();
@@ -2336,10 +2548,16 @@ uint32_t Audio::stopSong() {
         AUDIO_INFO("Closing audio file \"%s\"", audiofile.name());
         audiofile.close();
     }
+    if(m_nextFile) m_nextFile.close(); // drop the queued file
 	#endif
     memset(m_outBuff, 0, m_outbuffSize); // Clear OutputBuffer
-    memset(m_filterBuff, 0, sizeof(m_filterBuff)); // Clear FilterBuffer
+    memset(m_iirState, 0, sizeof(m_iirState)); // Clear FilterBuffer
+    fifoDrain(); // end of file (e.g. connecttoFS() in audio_eof_mp3), the tail of the finished track is played
     m_validSamples = 0;
+    m_srcInFrames = 0;
+    if(m_srcIn) memset(m_srcIn, 0, (m_srcMaxTaps - 1) * 2 * sizeof(int32_t)); // resampler history
+    m_xfState = XF_IDLE;
+    m_xfFill = 0;
     m_audioCurrentTime = 0;
     m_audioFileDuration = 0;
     m_codec = CODEC_NONE;
@@ -2355,109 +2573,203 @@ bool Audio::pauseResume() {
         retVal = true;
         if(!m_f_running) {
             memset(m_outBuff, 0, m_outbuffSize); // Clear OutputBuffer
+            fifoFlush();
             m_validSamples = 0;
+            m_srcInFrames = 0;
         }
     }
     xSemaphoreGive(mutex_playAudioData);
     return retVal;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::playChunk() {
+void Audio::processChunk() {
 
-    int16_t validSamples = 0;
-    static uint16_t count = 0;
-    size_t i2s_bytesConsumed = 0;
-    int16_t* sample[2] = {0};
-    int16_t* s2;
-    int sampleSize = (m_bitsPerSample / 8);
-    esp_err_t err = ESP_OK;
-    int i= 0;
+    // DSP pipeline, runs once per decoded frame. Every stage works on the whole block of interleaved stereo samples,
+    // int16 or int32 (24 bit hi-res), the result stays in m_outBuff (or m_srcBuff if resampled) and is sent to I2S by playChunk()
 
-    count = 0;
-    if(m_bitsPerSample == 8){
-        int16_t s16_1 = 0;
-        int16_t s16_2 = 0;
+    uint16_t frames = m_validSamples;
 
-        validSamples = m_validSamples; // double validsamples, make stereo
-        while(validSamples){
-            s16_1 = (m_outBuff[validSamples - 1] & 0xFF00);
-            s16_2 = (m_outBuff[validSamples - 1] & 0x00FF) << 8;
-            m_outBuff[validSamples * 2 - 1] = s16_1 - 0x8000;
-            m_outBuff[validSamples * 2 - 2] = s16_2 - 0x8000;
-            validSamples--;
+    if(m_f_hiRes) {
+        int32_t* block = (int32_t*)m_outBuff;
+        uint16_t maxFrames = m_outbuffSize / (2 * sizeof(int32_t));
+        if(getChannels() == 1) { // make stereo
+            if(frames > maxFrames) {
+                log_e("valid samples: %i greater than buffer size: %i", frames, maxFrames);
+                frames = maxFrames; // avoid buffer overrun
+            }
+            for(int i = frames - 1; i >= 0; i--) {
+                int32_t s32 = block[i];
+                block[2 * i + 1] = s32;
+                block[2 * i]     = s32;
+            }
         }
-        if(getChannels() == 1) m_validSamples *= 4;
-        else                   m_validSamples *= 2;
+        if(m_trimSkip || m_f_trimEnd) frames = gaplessTrim(block, frames); // gapless, encoder delay and padding
     }
-
-    if(m_channels == 1){
-        if(m_outbuffSize < m_validSamples * 2){
-            log_e("valid samples: %i greater than buffer size: %i", m_outbuffSize, m_validSamples);
-            m_validSamples = m_outbuffSize / 2; // avoid buffer overrun
+    else {
+        int16_t* block = m_outBuff;
+        uint16_t maxFrames = m_outbuffSize / (2 * sizeof(int16_t));
+        if(m_bitsPerSample == 8) { // two unsigned 8 bit samples are stored in one int16 word, make 16 bit signed
+            uint16_t words = m_validSamples;
+            if(words > maxFrames) words = maxFrames;
+            for(int i = words - 1; i >= 0; i--) {
+                int16_t w = m_outBuff[i];
+                m_outBuff[2 * i + 1] = (w & 0xFF00) - 0x8000;
+                m_outBuff[2 * i]     = ((w & 0x00FF) << 8) - 0x8000;
+            }
+            frames = (words * 2) / getChannels();
         }
-        int s16 = 0;
-        validSamples = m_validSamples; // double validsamples, make stereo
-        while(validSamples){
-            s16 = m_outBuff[validSamples - 1];
-            m_outBuff[validSamples * 2 - 1] = s16;
-            m_outBuff[validSamples * 2 - 2] = s16;
-            validSamples --;
+        if(getChannels() == 1) { // make stereo
+            if(frames > maxFrames) {
+                log_e("valid samples: %i greater than buffer size: %i", frames, maxFrames);
+                frames = maxFrames; // avoid buffer overrun
+            }
+            for(int i = frames - 1; i >= 0; i--) {
+                int16_t s16 = m_outBuff[i];
+                m_outBuff[2 * i + 1] = s16;
+                m_outBuff[2 * i]     = s16;
+            }
         }
-        m_validSamples *= 2;
+        if(m_trimSkip || m_f_trimEnd) frames = gaplessTrim(block, frames); // gapless, encoder delay and padding
+    }
+
+    if(!frames) {
+        m_validSamples = 0;
+        return;
+    }
+    if(m_f_srcActive) { // fixed output rate, the DSP chain runs on the resampled slices
+        uint8_t bps = m_f_hiRes ? sizeof(int32_t) : sizeof(int16_t);
+        memcpy((uint8_t*)m_srcIn + (m_srcTaps - 1) * 2 * bps, m_outBuff, frames * 2 * bps);
+        m_srcInFrames = frames;
+        m_validSamples = 0;
+        SRC_nextSlice();
+        return;
     }
+    processFrames(m_outBuff, frames);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::processFrames(void* block, uint16_t frames) {
+    // frames at the output rate, crossfade: the tail of the current file goes into the ring, the head of the next one is mixed
+    if(m_xfState != XF_IDLE && m_f_hiRes) { // the crossfade ring is 16 bit, a hi-res track is not faded
+        m_xfFill = 0;
+        m_xfState = XF_IDLE;
+    }
+    if(m_xfState == XF_CAPTURE) {
+        xfWrite((int16_t*)block, frames);
+        m_validSamples = 0;
+        return;
+    }
+    if(m_xfState == XF_MIX) xfMix((int16_t*)block, frames);
+    processDSP(block, frames);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> uint16_t Audio::gaplessTrim(T* block, uint16_t frames) {
+    // drops the encoder delay at the start and the padding at the end of a track, sample-accurate (LAME/Xing, iTunSMPB,
+    // m4a media duration and edit list)
+    if(m_trimSkip) {
+        uint16_t n = min((uint32_t)frames, m_trimSkip);
+        m_trimSkip -= n;
+        frames -= n;
+        if(frames) memmove(block, block + 2 * n, frames * 2 * sizeof(T));
+    }
+    if(m_f_trimEnd) {
+        if(frames > m_trimRemain) frames = m_trimRemain;
+        m_trimRemain -= frames;
+    }
+    return frames;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::processDSP(void* block, uint16_t frames) {
 
-    validSamples = m_validSamples;
+    // DSP chain on interleaved stereo frames at the output rate, playChunk() sends the block afterwards
+    // every block passes here (decoded, resampled slice, crossfade tail, mixer only), timed as STAT_DSP
 
-    while(validSamples) {
-        *sample = m_outBuff + i;
+    STAT_BEGIN(tDSP);
+    if(m_f_hiRes) DSPchain((int32_t*)block, frames);
+    else          DSPchain((int16_t*)block, frames);
 
-        computeVUlevel(*sample);
+    m_playBuff = block;
+    m_validSamples = frames;
+    m_curSample = 0;
+    m_clipAhead = 0;
 
-        //---------- Filterchain, can commented out if not used-------------
-        {
-            if(m_corr > 1) {
-                s2 = *sample;
-                s2[LEFTCHANNEL] /= m_corr;
-                s2[RIGHTCHANNEL] /= m_corr;
-            }
-            IIR_filterChain0(*sample);
-            IIR_filterChain1(*sample);
-            IIR_filterChain2(*sample);
-        }
-        //------------------------------------------------------------------
-        Gain(*sample);
-        if(m_f_internalDAC) {
-            s2 = *sample;
-            s2[LEFTCHANNEL] += 0x8000;
-            s2[RIGHTCHANNEL] += 0x8000;
-        }
-        i += m_bitsPerSample == 16 ? 2 : 1;
-        validSamples -= 1;
-    }
     if(audio_process_i2s) {
-        // processing the audio samples from external before forwarding them to i2s
+        // processing the audio samples from external before forwarding them to i2s, hi-res: 32 bit samples
         bool continueI2S = false;
-        audio_process_i2s((int16_t*)m_outBuff, m_validSamples, m_bitsPerSample, m_channels, &continueI2S);
-        if(!continueI2S) {
-            m_validSamples = 0;
-            count = 0;
-            return;
+        audio_process_i2s((int16_t*)block, frames, m_f_hiRes ? 32 : 16, 2, &continueI2S);
+        if(!continueI2S) m_validSamples = 0;
+    }
+    if(m_tapRing && m_tapSubs.load(std::memory_order_relaxed)) pcmTapWrite(block, m_validSamples); // subscribers read at their own pace
+    STAT_END(tDSP, STAT_DSP, frames * (m_f_hiRes ? 8 : 4));
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> void Audio::DSPchain(T* block, uint16_t frames) {
+
+    // T = int16_t: 16 bit samples, T = int32_t: 24 bit samples (right justified), shifted into the 32 bit slot at the end
+
+    computeVUlevel(block, frames);
+    if(m_f_loudness) loudnessTap(block, frames);
+    if(m_mixSrc) mixer(block, frames); // announcements over the program, EQ, limiter and volume apply to the sum
+    if(m_iirDirty.load(std::memory_order_relaxed)) IIR_update();
+    IIR_filterChain(block, frames); // can be commented out if not used
+    if(m_f_limiter) limiter(block, frames);
+    Gain(block, frames);
+    if(m_spBands) spectrumTap(block, frames);
+
+    if(sizeof(T) == sizeof(int32_t)) { // the EQ can overshoot 24 bit (Gain() skips unity), saturate before the shift
+        for(int i = 0; i < frames * 2; i++) {
+            int32_t v = block[i];
+            if(v > 8388607) v = 8388607; else if(v < -8388608) v = -8388608;
+            block[i] = (int32_t)((uint32_t)v << 8);
         }
     }
+    else if(m_f_internalDAC) {
+        for(int i = 0; i < frames * 2; i++) block[i] += 0x8000;
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::playChunk() {
+
+    // sends the processed stereo frames in m_playBuff to I2S, m_curSample points to the first frame that is not yet sent
 
-    validSamples = m_validSamples;
+    size_t    i2s_bytesConsumed = 0;
+    esp_err_t err = ESP_OK;
+    const int frameSize = m_f_hiRes ? 2 * sizeof(int32_t) : 2 * sizeof(int16_t);
 
+    if(m_validSamples <= 0) return;
 
+    Audio* mixTarget = m_mixTarget.load(std::memory_order_acquire);
+    if(mixTarget) { // this object is the secondary source of another one, nothing goes to the own I2S channel
+        i2s_bytesConsumed = mixTarget->mixerPush((uint8_t*)m_playBuff + m_curSample * frameSize, m_validSamples, m_f_hiRes, getOutputRate()) * frameSize;
+    }
+    else if(m_fifoBuf) { // the writer task drains the FIFO, the decoder can run ahead
+        i2s_bytesConsumed = fifoPush((uint8_t*)m_playBuff + m_curSample * frameSize, m_validSamples * frameSize);
+    }
+    else {
+        uint8_t* data = (uint8_t*)m_playBuff + m_curSample * frameSize;
+        uint32_t frames = m_validSamples;
+        if(m_clipCount) { // clips are mixed in just before I2S, one DMA buffer at a time
+            if(frames > m_clipSlice) frames = m_clipSlice;
+            if(frames > m_clipAhead) {
+                clipMix(data + m_clipAhead * frameSize, frames - m_clipAhead);
+                m_clipAhead = frames;
+            }
+        }
+        STAT_BEGIN(tI2S);
 #if(ESP_IDF_VERSION_MAJOR == 5)
-    err = i2s_channel_write(m_i2s_tx_handle, (int16_t*)m_outBuff + count, validSamples * (sampleSize * m_channels), &i2s_bytesConsumed, 40);
+        err = i2s_channel_write(m_i2s_tx_handle, data, frames * frameSize, &i2s_bytesConsumed, 40);
 #else
-    err = i2s_write((i2s_port_t)m_i2s_num, (int16_t*)m_outBuff + count, validSamples * (sampleSize * m_channels), &i2s_bytesConsumed, 40);
+        err = i2s_write((i2s_port_t)m_i2s_num, data, frames * frameSize, &i2s_bytesConsumed, 40);
 #endif
+        STAT_END(tI2S, STAT_I2S_WAIT, i2s_bytesConsumed);
+        uint16_t sent = i2s_bytesConsumed / frameSize;
+        m_clipAhead = (m_clipAhead > sent) ? m_clipAhead - sent : 0;
+    }
 
-    if(err != ESP_OK) goto exit;
-    m_validSamples -= i2s_bytesConsumed / (sampleSize * m_channels);
+    m_validSamples -= i2s_bytesConsumed / frameSize; // also after a timeout, the driver has taken a part of the block
+    m_curSample    += i2s_bytesConsumed / frameSize;
     if(m_validSamples < 0) { m_validSamples = 0; }
-    count += i2s_bytesConsumed / sampleSize;
+    if(err != ESP_OK) goto exit;
+    if(m_validSamples == 0 && m_srcInFrames) SRC_nextSlice();
 
     return;
 exit:
@@ -2773,8 +3085,8 @@ const char* Audio::parsePlaylist_M3U8() {
     // #EXTINF:10,title="text=\"Spot Block End\" amgTrackId=\"9876543\"",artist=" ",url="length=\"00:00:00\""
     // http://n3fa-e2.revma.ihrhls.com/zc7729/63_sdtszizjcjbz02/main/163374039.aac
 
-    static uint64_t xMedSeq = 0;
-    static boolean  f_mediaSeq_found = false;
+    uint64_t& xMedSeq = m_m3u8.xMedSeq;
+    boolean&  f_mediaSeq_found = m_m3u8.f_mediaSeq_found;
     boolean         f_EXTINF_found = false;
     char            llasc[21]; // uint64_t max = 18,446,744,073,709,551,615  thats 20 chars + \0
     if(m_f_firstM3U8call) {
@@ -3005,7 +3317,7 @@ const char* Audio::m3u8redirection(uint8_t* codec) {
         int16_t posCodec = indexOf(m_playlistContent[i], "CODECS=\"mp4a");
         if(posCodec > 0){
             bool found = false;
-            for(uint8_t j = 0; j < sizeof(codecString); j++){
+            for(uint8_t j = 0; j < sizeof(codecString) / sizeof(codecString[0]); j++){
                 if(indexOf(m_playlistContent[i], codecString[j]) > 0){
                     if(j < cS){cS = j; choosenLine = i;}
                     found = true;
@@ -3029,6 +3341,10 @@ const char* Audio::m3u8redirection(uint8_t* codec) {
     //         goto exit;
     //     }
     // }
+    const char* bw = strstr(m_playlistContent[choosenLine], ":BANDWIDTH="); // bit/s of the variant, for the prebuffer
+    if(!bw) bw = strstr(m_playlistContent[choosenLine], ",BANDWIDTH=");
+    if(bw) m_brHint = atoi(bw + 11);
+
     choosenLine++; // next line is the redirection url
 
     if(!startsWith(m_playlistContent[choosenLine], "http")) {
@@ -3177,19 +3493,16 @@ bool Audio::STfromEXTINF(char* str) {
 void Audio::processLocalFile() {
     if(!(audiofile && m_f_running && getDatamode() == AUDIO_LOCALFILE)) return; // guard
 
-    static uint32_t ctime = 0;
-    const uint32_t  timeout = 2500;                          // ms
-    const uint32_t  maxFrameSize = InBuff.getMaxBlockSize(); // every mp3/aac frame is not bigger
-    static bool     f_fileDataComplete;
-    static uint32_t byteCounter; // count received data
-    uint32_t        availableBytes = 0;
+    const uint32_t timeout = 2500;                          // ms
+    const uint32_t maxFrameSize = InBuff.getMaxBlockSize(); // every mp3/aac frame is not bigger
+    uint32_t       availableBytes = 0;
 
     if(m_f_firstCall) { // runs only one time per connection, prepare for start
         m_f_firstCall = false;
         m_f_stream = false;
-        f_fileDataComplete = false;
-        byteCounter = 0;
-        ctime = millis();
+        m_f_fileDataComplete = false;
+        m_fileBytesRead = 0;
+        m_headerStartTime = millis();
         if(m_codec == CODEC_M4A) seek_m4a_stsz(); // determine the pos of atom stsz
         if(m_codec == CODEC_M4A) seek_m4a_ilst(); // looking for metadata
         if(m_resumeFilePos == 0) m_resumeFilePos = -1; // parkposition
@@ -3199,15 +3512,17 @@ void Audio::processLocalFile() {
     availableBytes = 256 * 1024; // set some large value
 
     availableBytes = min(availableBytes, (uint32_t)InBuff.writeSpace());
-    availableBytes = min(availableBytes, audiofile.size() - byteCounter);
+    availableBytes = min(availableBytes, audiofile.size() - m_fileBytesRead);
     if(m_contentlength) {
         if(m_contentlength > getFilePos()) availableBytes = min(availableBytes, m_contentlength - getFilePos());
     }
-    if(m_audioDataSize) { availableBytes = min(availableBytes, m_audioDataSize + m_audioDataStart - byteCounter); }
+    if(m_audioDataSize) { availableBytes = min(availableBytes, m_audioDataSize + m_audioDataStart - m_fileBytesRead); }
 
+    STAT_BEGIN(tFill);
     int32_t bytesAddedToBuffer = audiofile.read(InBuff.getWritePtr(), availableBytes);
     if(bytesAddedToBuffer > 0) {
-        byteCounter += bytesAddedToBuffer; // Pull request #42
+        STAT_END(tFill, STAT_FILL, bytesAddedToBuffer);
+        m_fileBytesRead += bytesAddedToBuffer; // Pull request #42
         InBuff.bytesWritten(bytesAddedToBuffer);
     }
     if(!m_f_stream) {
@@ -3232,7 +3547,7 @@ void Audio::processLocalFile() {
             return;
         }
         if(m_controlCounter != 100) {
-            if((millis() - ctime) > timeout) {
+            if((millis() - m_headerStartTime) > timeout) {
                 log_e("audioHeader reading timeout");
                 m_f_running = false;
                 return;
@@ -3243,11 +3558,13 @@ void Audio::processLocalFile() {
             return;
         }
         else {
-            if((InBuff.freeSpace() > maxFrameSize) && (m_fileSize - byteCounter) > maxFrameSize && availableBytes) {
+            if(!m_f_gapless && (InBuff.freeSpace() > maxFrameSize) && (m_fileSize - m_fileBytesRead) > maxFrameSize && availableBytes) {
                 // fill the buffer before playing
                 return;
             }
+            if(m_codec == CODEC_MP3) {DecoderLock dl(this, m_codec); mp3_readGaplessInfo(InBuff.getReadPtr(), InBuff.bufferFilled());}
 
+            m_f_gapless = false;
             m_f_stream = true;
             AUDIO_INFO("stream ready");
             if(m_f_Log) log_i("m_audioDataStart %d", m_audioDataStart);
@@ -3267,7 +3584,11 @@ void Audio::processLocalFile() {
         if(m_codec == CODEC_M4A) {
             m_resumeFilePos = m4a_correctResumeFilePos(m_resumeFilePos);
         }
-        if(m_codec == CODEC_WAV) {
+        if(m_codec == CODEC_WAV && getBitsPerSample() > 16) { // whole frames
+            uint8_t blockAlign = getBitsPerSample() / 8 * getChannels();
+            m_resumeFilePos -= (uint32_t)(m_resumeFilePos - (int32_t)m_audioDataStart) % blockAlign;
+        }
+        else if(m_codec == CODEC_WAV) {
             while((m_resumeFilePos % 4) != 0){ // must be divisible by four
                 m_resumeFilePos++;
                 if(m_resumeFilePos >= m_fileSize) goto exit;
@@ -3276,6 +3597,7 @@ void Audio::processLocalFile() {
         if(m_codec == CODEC_FLAC) {
             m_resumeFilePos = flac_correctResumeFilePos(m_resumeFilePos);
             if(m_resumeFilePos == -1) goto exit;
+            DecoderLock dl(this, m_codec);
             FLACDecoderReset();
         }
         if(m_codec == CODEC_MP3) {
@@ -3285,67 +3607,81 @@ void Audio::processLocalFile() {
 
         audiofile.seek(m_resumeFilePos);
         InBuff.resetBuffer();
-        byteCounter = m_resumeFilePos;
-        f_fileDataComplete = false; // #570
+        m_fileBytesRead = m_resumeFilePos;
+        m_f_fileDataComplete = false; // #570
+        m_f_decodeTail = false;
 
         m_resumeFilePos = -1;
         m_f_stream = false;
     }
+    // crossfade, capture the tail? - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    if(m_xfSeconds && m_xfState == XF_IDLE && m_nextFile && m_f_stream && !m_f_loop && m_audioFileDuration && !m_f_hiRes) {
+        if(m_audioCurrentTime + m_xfSeconds + 2 >= m_audioFileDuration) xfStart(); // 2 s margin, the duration is an estimate
+    }
     // end of file reached? - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-    if(f_fileDataComplete && InBuff.bufferFilled() < InBuff.getMaxBlockSize()) {
-        if(InBuff.bufferFilled()) {
-            if(!readID3V1Tag()) {
-                if(m_validSamples) {
-                    return;
-                }
-            }
+    if(m_f_fileDataComplete && InBuff.bufferFilled() < InBuff.getMaxBlockSize()) {
+        if(!m_f_decodeTail) { // once, an ID3v1 tag is not audio, the audio task decodes the rest (less than one block)
+            xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+            if(readID3V1Tag()) InBuff.bytesWasRead(128);
+            m_f_decodeTail = true;
+            xSemaphoreGive(mutex_playAudioData);
         }
+        if(InBuff.bufferFilled() || m_validSamples) return; // the last frame is not decoded or not played yet, the
+                                                            // padding (m_trimRemain) is trimmed while it is decoded
 
         if(m_f_loop && m_f_stream) {                                                                                      // eof
             AUDIO_INFO("loop from: %lu to: %lu", (long unsigned int)getFilePos(), (long unsigned int)m_audioDataStart); // loop
             setFilePos(m_audioDataStart);
-            if(m_codec == CODEC_FLAC) FLACDecoderReset();
+            if(m_codec == CODEC_FLAC) {DecoderLock dl(this, m_codec); FLACDecoderReset();}
             m_audioCurrentTime = 0;
-            byteCounter = m_audioDataStart;
-            f_fileDataComplete = false;
+            m_fileBytesRead = m_audioDataStart;
+            m_f_fileDataComplete = false;
+            m_f_decodeTail = false;
             return;
         } // loop
 exit:
+        if(m_nextFile && audiofile) { // gapless, continue with the queued file
+            if(startNextFile()) return;
+        }
         char* afn = NULL;
         if(audiofile) afn = strdup(audiofile.name()); // store temporary the name
+        m_xfState = XF_IDLE;
+        m_xfFill = 0;
         m_f_running = false;
         m_streamType = ST_NONE;
         audiofile.close();
         AUDIO_INFO("Closing audio file \"%s\"", afn);
 
+        DecoderLock dl(this, m_codec);
         if(m_codec == CODEC_MP3) MP3Decoder_FreeBuffers();
         if(m_codec == CODEC_AAC) AACDecoder_FreeBuffers();
         if(m_codec == CODEC_M4A) AACDecoder_FreeBuffers();
         if(m_codec == CODEC_FLAC) FLACDecoder_FreeBuffers();
         if(m_codec == CODEC_OPUS) OPUSDecoder_FreeBuffers();
         if(m_codec == CODEC_VORBIS) VORBISDecoder_FreeBuffers();
+        dl.unlock();
+        m_audioCurrentTime = 0;
+        m_audioFileDuration = 0;
+        m_resumeFilePos = -1;
+        m_haveNewFilePos = 0;
+        m_codec = CODEC_NONE;
 
-        if(afn) {
+        if(afn) { // last, the callback may connect the next file
             if(audio_eof_mp3) audio_eof_mp3(afn);
             AUDIO_INFO("End of file \"%s\"", afn);
             free(afn);
             afn = NULL;
         }
-        m_audioCurrentTime = 0;
-        m_audioFileDuration = 0;
-        m_resumeFilePos = -1;
-        m_haveNewFilePos = 0;
-        m_codec = CODEC_NONE;
         return;
     }
-    if(byteCounter == audiofile.size()) { f_fileDataComplete = true; }
-    if(byteCounter == m_audioDataSize + m_audioDataStart) { f_fileDataComplete = true; }
+    if(m_fileBytesRead == audiofile.size()) { m_f_fileDataComplete = true; }
+    if(m_fileBytesRead == m_audioDataSize + m_audioDataStart) { m_f_fileDataComplete = true; }
 }
 #endif  // AUDIO_NO_SD_FS	
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::processWebStream() {
     const uint16_t  maxFrameSize = InBuff.getMaxBlockSize(); // every mp3/aac frame is not bigger
-    static uint32_t chunkSize;                               // chunkcount read from stream
+    uint32_t& chunkSize = m_webStream.chunkSize; // chunkcount read from stream
 
     // first call, set some values to default  - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_f_firstCall) { // runs only ont time per connection, prepare for start
@@ -3381,15 +3717,17 @@ void Audio::processWebStream() {
     // buffer fill routine - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(availableBytes) {
         availableBytes = min(availableBytes, (uint32_t)InBuff.writeSpace());
+        STAT_BEGIN(tFill);
         int16_t bytesAddedToBuffer = _client->read(InBuff.getWritePtr(), availableBytes);
 
         if(bytesAddedToBuffer > 0) {
+            STAT_END(tFill, STAT_FILL, bytesAddedToBuffer);
             if(m_f_metadata) m_metacount -= bytesAddedToBuffer;
             if(m_f_chunked) chunkSize -= bytesAddedToBuffer;
             InBuff.bytesWritten(bytesAddedToBuffer);
         }
 
-        if(InBuff.bufferFilled() > maxFrameSize && !m_f_stream) { // waiting for buffer filled
+        if(InBuff.bufferFilled() >= prebufferBytes(m_prebuf_ms) && !m_f_stream) { // waiting for buffer filled
             m_f_stream = true;                                    // ready to play the audio data
             AUDIO_INFO("stream ready");
         }
@@ -3420,10 +3758,10 @@ void Audio::processWebStream() {
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::processWebFile() {
     const uint32_t  maxFrameSize = InBuff.getMaxBlockSize(); // every mp3/aac frame is not bigger
-    static bool     f_webFileDataComplete;                   // all file data received
-    static uint32_t byteCounter;
-    static uint32_t chunkSize;                               // chunkcount read from stream
-    static size_t   audioDataCount;                          // counts the decoded audiodata only
+    bool&     f_webFileDataComplete = m_webFile.f_webFileDataComplete; // all file data received
+    uint32_t& byteCounter = m_webFile.byteCounter;
+    uint32_t& chunkSize = m_webFile.chunkSize;                         // chunkcount read from stream
+    size_t&   audioDataCount = m_webFile.audioDataCount;               // counts the decoded audiodata only
 
     // first call, set some values to default - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_f_firstCall) { // runs only ont time per connection, prepare for start
@@ -3461,9 +3799,11 @@ void Audio::processWebFile() {
     availableBytes = min(m_contentlength - byteCounter, availableBytes);
     if(m_audioDataSize) availableBytes = min(m_audioDataSize - (byteCounter - m_audioDataStart), availableBytes);
 
+    STAT_BEGIN(tFill);
     int16_t bytesAddedToBuffer = _client->read(InBuff.getWritePtr(), availableBytes);
 
     if(bytesAddedToBuffer > 0) {
+        STAT_END(tFill, STAT_FILL, bytesAddedToBuffer);
         byteCounter += bytesAddedToBuffer; // Pull request #42
         if(m_f_chunked) m_chunkcount -= bytesAddedToBuffer;
         if(m_controlCounter == 100) audioDataCount += bytesAddedToBuffer;
@@ -3525,12 +3865,14 @@ void Audio::processWebFile() {
 
         m_f_running = false;
         m_streamType = ST_NONE;
+        DecoderLock dl(this, m_codec);
         if(m_codec == CODEC_MP3) MP3Decoder_FreeBuffers();
         if(m_codec == CODEC_AAC) AACDecoder_FreeBuffers();
         if(m_codec == CODEC_M4A) AACDecoder_FreeBuffers();
         if(m_codec == CODEC_FLAC) FLACDecoder_FreeBuffers();
         if(m_codec == CODEC_OPUS) OPUSDecoder_FreeBuffers();
         if(m_codec == CODEC_VORBIS) VORBISDecoder_FreeBuffers();
+        dl.unlock();
         m_codec = CODEC_NONE;
         if(m_f_tts) {
             AUDIO_INFO("End of speech: \"%s\"", m_lastHost);
@@ -3551,15 +3893,15 @@ void Audio::processWebFile() {
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::processWebStreamTS() {
     uint32_t        availableBytes;                          // available bytes in stream
-    static bool     f_firstPacket;
-    static bool     f_chunkFinished;
-    static uint32_t byteCounter;    // count received data
-    static uint8_t  ts_packet[188]; // m3u8 transport stream is 188 bytes long
+    bool&     f_firstPacket = m_webTS.f_firstPacket;
+    bool&     f_chunkFinished = m_webTS.f_chunkFinished;
+    uint32_t& byteCounter = m_webTS.byteCounter;   // count received data
+    uint8_t (&ts_packet)[188] = m_webTS.ts_packet; // m3u8 transport stream is 188 bytes long
     uint8_t         ts_packetStart = 0;
     uint8_t         ts_packetLength = 0;
-    static uint8_t  ts_packetPtr = 0;
+    uint8_t& ts_packetPtr = m_webTS.ts_packetPtr;
     const uint8_t   ts_packetsize = 188;
-    static size_t   chunkSize = 0;
+    size_t& chunkSize = m_webTS.chunkSize;
 
     // first call, set some values to default - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_f_firstCall) { // runs only ont time per connection, prepare for start
@@ -3579,8 +3921,10 @@ void Audio::processWebStreamTS() {
     if(availableBytes) {
         uint8_t readedBytes = 0;
         if(m_f_chunked) chunkSize = chunkedDataTransfer(&readedBytes);
+        STAT_BEGIN(tFill);
         int res = _client->read(ts_packet + ts_packetPtr, ts_packetsize - ts_packetPtr);
         if(res > 0) {
+            STAT_END(tFill, STAT_FILL, res);
             ts_packetPtr += res;
             byteCounter += res;
             if(ts_packetPtr < ts_packetsize) return;
@@ -3623,7 +3967,7 @@ void Audio::processWebStreamTS() {
     }
     if(f_chunkFinished) {
         if(m_f_psramFound) {
-            if(InBuff.bufferFilled() < 150000) {
+            if(InBuff.bufferFilled() < prebufferBytes(2 * m_prebuf_ms)) { // load the next chunk
                 f_chunkFinished = false;
                 m_f_continue = true;
             }
@@ -3641,7 +3985,7 @@ void Audio::processWebStreamTS() {
 
     // buffer fill routine  - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(true) {                                                  // statement has no effect
-        if(InBuff.bufferFilled() > 150000 && !m_f_stream) {        // waiting for buffer filled
+        if(InBuff.bufferFilled() >= prebufferBytes(m_prebuf_ms) && !m_f_stream) { // waiting for buffer filled
             m_f_stream = true;                                    // ready to play the audio data
             uint16_t filltime = millis() - m_t0;
             AUDIO_INFO("stream ready");
@@ -3652,17 +3996,16 @@ void Audio::processWebStreamTS() {
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::processWebStreamHLS() {
-    const uint16_t maxFrameSize = InBuff.getMaxBlockSize(); // every mp3/aac frame is not bigger
     uint16_t       ID3BuffSize = 1024;
     if(m_f_psramFound) ID3BuffSize = 4096;
     uint32_t        availableBytes; // available bytes in stream
-    static bool     firstBytes;
-    static bool     f_chunkFinished;
-    static uint32_t byteCounter; // count received data
-    static size_t   chunkSize = 0;
-    static uint16_t ID3WritePtr;
-    static uint16_t ID3ReadPtr;
-    static uint8_t* ID3Buff;
+    bool&     firstBytes = m_webHLS.firstBytes;
+    bool&     f_chunkFinished = m_webHLS.f_chunkFinished;
+    uint32_t& byteCounter = m_webHLS.byteCounter; // count received data
+    size_t&   chunkSize = m_webHLS.chunkSize;
+    uint16_t& ID3WritePtr = m_webHLS.ID3WritePtr;
+    uint16_t& ID3ReadPtr = m_webHLS.ID3ReadPtr;
+    uint8_t*& ID3Buff = m_webHLS.ID3Buff;
 
     // first call, set some values to default - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(m_f_firstCall) { // runs only ont time per connection, prepare for start
@@ -3724,11 +4067,13 @@ void Audio::processWebStreamHLS() {
         }
 
         size_t bytesWasWritten = 0;
+        STAT_BEGIN(tFill);
         if(InBuff.writeSpace() >= availableBytes) {
         //    if(availableBytes > 1024) availableBytes = 1024; // 1K throttle
             bytesWasWritten = _client->read(InBuff.getWritePtr(), availableBytes);
         }
         else { bytesWasWritten = _client->read(InBuff.getWritePtr(), InBuff.writeSpace()); }
+        STAT_END(tFill, STAT_FILL, bytesWasWritten);
         InBuff.bytesWritten(bytesWasWritten);
 
         byteCounter += bytesWasWritten;
@@ -3741,7 +4086,7 @@ void Audio::processWebStreamHLS() {
 
     if(f_chunkFinished) {
         if(m_f_psramFound) {
-            if(InBuff.bufferFilled() < 150000) {
+            if(InBuff.bufferFilled() < prebufferBytes(2 * m_prebuf_ms)) { // load the next chunk
                 f_chunkFinished = false;
                 m_f_continue = true;
             }
@@ -3757,7 +4102,7 @@ void Audio::processWebStreamHLS() {
         if(streamDetection(availableBytes)) return;
     }
 
-    if(InBuff.bufferFilled() > maxFrameSize && !m_f_stream) { // waiting for buffer filled
+    if(InBuff.bufferFilled() >= prebufferBytes(m_prebuf_ms) && !m_f_stream) { // waiting for buffer filled
         m_f_stream = true;                                    // ready to play the audio data
         uint16_t filltime = millis() - m_t0;
         AUDIO_INFO("stream ready");
@@ -3771,9 +4116,20 @@ void Audio::playAudioData() {
         playChunk();
         return;
     } // play samples first
-    if(InBuff.bufferFilled() < InBuff.getMaxBlockSize()) return; // guard
+    if(m_xfState == XF_CAPTURE || (m_xfState == XF_MIX && !m_f_stream)) { // crossfade, output from the tail buffer
+        xfFeed();
+        return;
+    }
+    if(InBuff.bufferFilled() < InBuff.getMaxBlockSize() && !(m_f_decodeTail && InBuff.bufferFilled())) return; // guard
+    decodeFrame();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::decodeFrame() {
 
-    int bytesDecoded = sendBytes(InBuff.getReadPtr(), InBuff.getMaxBlockSize());
+    // one block, at the end of the file (m_f_decodeTail) the rest of the buffer, which can be less than one block
+    uint16_t len = min(InBuff.bufferFilled(), (size_t)InBuff.getMaxBlockSize());
+    bool     playing = m_f_playing;
+    int      bytesDecoded = sendBytes(InBuff.getReadPtr(), len);
 
     if(bytesDecoded < 0) { // no syncword found or decode error, try next chunk
         log_i("err bytesDecoded %i", bytesDecoded);
@@ -3787,7 +4143,10 @@ void Audio::playAudioData() {
             InBuff.bytesWasRead(bytesDecoded);
             return;
         }
-        if(bytesDecoded == 0) return; // syncword at pos0
+        if(bytesDecoded == 0) { // syncword at pos0
+            if(playing && len < InBuff.getMaxBlockSize()) InBuff.bytesWasRead(len); // incomplete last frame, nothing more will come
+            return;
+        }
     }
 
     return;
@@ -3800,8 +4159,8 @@ bool Audio::parseHttpResponseHeader() { // this is the response to a GET / reque
     uint32_t ctime = millis();
     uint32_t timeout = 4500; // ms
 
-    static uint32_t stime;
-    static bool     f_time = false;
+    uint32_t& stime = m_httpHdr.stime;
+    bool&     f_time = m_httpHdr.f_time;
     if(_client->available() == 0) {
         if(!f_time) {
             stime = millis();
@@ -4039,7 +4398,31 @@ lastToDo:
     return true;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+Audio::DecoderLock::DecoderLock(Audio* audio, uint8_t codec) : m_audio(audio), m_codec(codec) {
+    // the decoders work on globals, the lock swaps in this instance's copy. Same codec in two instances: one at a time
+    bool all = (codec == CODEC_NONE);
+    if(all || codec == CODEC_MP3)                         MP3Decoder_Lock(audio->m_mp3Ctx);
+    if(all || codec == CODEC_AAC || codec == CODEC_M4A)   AACDecoder_Lock(audio->m_aacCtx);
+    if(all || codec == CODEC_FLAC)                        FLACDecoder_Lock(audio->m_flacCtx);
+    if(all || codec == CODEC_OPUS)                        OPUSDecoder_Lock(audio->m_opusCtx);
+    if(all || codec == CODEC_VORBIS)                      VORBISDecoder_Lock(audio->m_vorbisCtx);
+}
+Audio::DecoderLock::~DecoderLock() {
+    unlock();
+}
+void Audio::DecoderLock::unlock() { // early release, e.g. before the samples go to I2S
+    if(!m_audio) return;
+    m_audio = NULL;
+    bool all = (m_codec == CODEC_NONE);
+    if(all || m_codec == CODEC_VORBIS)                    VORBISDecoder_Unlock();
+    if(all || m_codec == CODEC_OPUS)                      OPUSDecoder_Unlock();
+    if(all || m_codec == CODEC_FLAC)                      FLACDecoder_Unlock();
+    if(all || m_codec == CODEC_AAC || m_codec == CODEC_M4A) AACDecoder_Unlock();
+    if(all || m_codec == CODEC_MP3)                       MP3Decoder_Unlock();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 bool Audio::initializeDecoder() {
+    DecoderLock dl(this, m_codec);
     uint32_t gfH = 0;
     uint32_t hWM = 0;
     switch(m_codec) {
@@ -4430,7 +4813,7 @@ int Audio::findNextSync(uint8_t* data, size_t len) {
     //         -1 the sync word was not found within the block with the length len
 
     int             nextSync;
-    static uint32_t swnf = 0;
+    uint32_t& swnf = m_sync.swnf;
     if(m_codec == CODEC_WAV) {
         m_f_playing = true;
         nextSync = 0;
@@ -4495,6 +4878,7 @@ void Audio::setDecoderItems() {
         setSampleRate(FLACGetSampRate());
         setBitsPerSample(FLACGetBitsPerSample());
         setBitrate(FLACGetBitRate());
+        replayGainSet(FLACGetReplayGain(false), FLACGetReplayGain(true));
         if(FLACGetAudioDataStart() > 0){ // only flac-ogg, native flac sets audioDataStart in readFlacHeader()
             m_audioDataStart = FLACGetAudioDataStart();
             if(getFileSize()) m_audioDataSize = getFileSize() - m_audioDataStart;
@@ -4505,6 +4889,9 @@ void Audio::setDecoderItems() {
         setSampleRate(OPUSGetSampRate());
         setBitsPerSample(OPUSGetBitsPerSample());
         setBitrate(OPUSGetBitRate());
+        replayGainSet(OPUSGetReplayGain(false), OPUSGetReplayGain(true));
+        m_headerGain = OPUSGetOutputGain(); // RFC 7845: the output gain is always applied
+        computeLimit();
         if(OPUSGetAudioDataStart() > 0){
             m_audioDataStart = OPUSGetAudioDataStart();
             if(getFileSize()) m_audioDataSize = getFileSize() - m_audioDataStart;
@@ -4515,16 +4902,21 @@ void Audio::setDecoderItems() {
         setSampleRate(VORBISGetSampRate());
         setBitsPerSample(VORBISGetBitsPerSample());
         setBitrate(VORBISGetBitRate());
+        replayGainSet(VORBISGetReplayGain(false), VORBISGetReplayGain(true));
         if(VORBISGetAudioDataStart() > 0){
             m_audioDataStart = VORBISGetAudioDataStart();
             if(getFileSize()) m_audioDataSize = getFileSize() - m_audioDataStart;
         }
     }
-    if(getBitsPerSample() != 8 && getBitsPerSample() != 16) {
+    if(getBitsPerSample() != 8 && getBitsPerSample() != 16 && !(getBitsPerSample() > 16 && (m_codec == CODEC_FLAC || m_codec == CODEC_WAV))) {
         AUDIO_INFO("Bits per sample must be 8 or 16, found %i", getBitsPerSample());
         stopSong();
     }
-    if(getChannels() != 1 && getChannels() != 2) {
+    setHiRes();
+    if(getChannels() > 2 && m_codec == CODEC_VORBIS) { // the decoder delivers stereo
+        AUDIO_INFO("%i channels, downmixed to stereo", getChannels());
+    }
+    else if(getChannels() != 1 && getChannels() != 2) {
         AUDIO_INFO("Num of channels must be 1 or 2, found %i", getChannels());
         stopSong();
     }
@@ -4535,10 +4927,10 @@ void Audio::setDecoderItems() {
 int Audio::sendBytes(uint8_t* data, size_t len) {
 
     int32_t     bytesLeft;
-    static bool f_setDecodeParamsOnce = true;
     int         nextSync = 0;
+    DecoderLock dl(this, m_codec);
     if(!m_f_playing) {
-        f_setDecodeParamsOnce = true;
+        m_f_setDecodeParamsOnce = true;
         nextSync = findNextSync(data, len);
         if(nextSync == -1) return len;
         if(nextSync == 0) { m_f_playing = true; }
@@ -4551,12 +4943,13 @@ int Audio::sendBytes(uint8_t* data, size_t len) {
 
     if(m_codec == CODEC_NONE && m_playlistFormat == FORMAT_M3U8) return 0; // can happen when the m3u8 playlist is loaded
 
+    STAT_BEGIN(tDec);
     switch(m_codec) {
-        case CODEC_WAV:  m_decodeError = 0; bytesLeft = 0; break;
+        case CODEC_WAV:  m_decodeError = 0; bytesLeft = (getBitsPerSample() > 16) ? len % (getBitsPerSample() / 8 * getChannels()) : 0; break;
         case CODEC_MP3:  m_decodeError = MP3Decode(data, &bytesLeft, m_outBuff, 0); break;
         case CODEC_AAC:  m_decodeError = AACDecode(data, &bytesLeft, m_outBuff); break;
         case CODEC_M4A:  m_decodeError = AACDecode(data, &bytesLeft, m_outBuff); break;
-        case CODEC_FLAC: m_decodeError = FLACDecode(data, &bytesLeft, m_outBuff); break;
+        case CODEC_FLAC: FLACSetOutputBits(m_outputBits); m_decodeError = FLACDecode(data, &bytesLeft, m_outBuff); break;
         case CODEC_OPUS: m_decodeError = OPUSDecode(data, &bytesLeft, m_outBuff); break;
         case CODEC_VORBIS: m_decodeError = VORBISDecode(data, &bytesLeft, m_outBuff); break;
         default: {
@@ -4564,6 +4957,7 @@ int Audio::sendBytes(uint8_t* data, size_t len) {
             stopSong();
         }
     }
+    STAT_END(tDec, statDecodeStage(m_codec), len - bytesLeft);
 
     // m_decodeError - possible values are:
     //                   0: okay, no error
@@ -4600,7 +4994,11 @@ int Audio::sendBytes(uint8_t* data, size_t len) {
     char* st = NULL;
     std::vector<uint32_t> vec;
     switch(m_codec) {
-        case CODEC_WAV:     memmove(m_outBuff, data, len); // copy len data in outbuff and set validsamples and bytesdecoded=len
+        case CODEC_WAV:     if(getBitsPerSample() > 16) { // 24/32 bit, whole frames only, the rest is delivered again
+                                wavConvert(data, len - bytesLeft);
+                                break;
+                            }
+                            memmove(m_outBuff, data, len); // copy len data in outbuff and set validsamples and bytesdecoded=len
                             if(getBitsPerSample() == 16) m_validSamples = len / (2 * getChannels());
                             if(getBitsPerSample() == 8) m_validSamples = len / 2;
                             break;
@@ -4665,18 +5063,22 @@ int Audio::sendBytes(uint8_t* data, size_t len) {
 							#endif
                             break;
     }
-    if(f_setDecodeParamsOnce && m_validSamples) {
-        f_setDecodeParamsOnce = false;
+    m_brBytes  += bytesDecoded; // measured bitrate for the prebuffer, the last 10...20 seconds
+    m_brFrames += m_validSamples;
+    if(m_brFrames > 10 * getSampleRate()) { m_brBytes /= 2; m_brFrames /= 2; }
+    if(m_f_setDecodeParamsOnce && m_validSamples) {
+        m_f_setDecodeParamsOnce = false;
         setDecoderItems();
         m_PlayingStartTime = millis();
     }
 
     uint16_t bytesDecoderOut = m_validSamples;
-    if(m_channels == 2) bytesDecoderOut /= 2;
-    if(m_bitsPerSample == 16) bytesDecoderOut *= 2;
+    if(m_channels >= 2) bytesDecoderOut /= 2;
+    if(m_bitsPerSample > 8) bytesDecoderOut *= m_bitsPerSample / 8;
     computeAudioTime(bytesDecoded, bytesDecoderOut);
+    dl.unlock(); // the decoder is done with this frame, the other instance may decode while we play
 
-    m_curSample = 0;
+    processChunk();
     playChunk();
     return bytesDecoded;
 }
@@ -4685,13 +5087,13 @@ void Audio::computeAudioTime(uint16_t bytesDecoderIn, uint16_t bytesDecoderOut)
 
     if(getDatamode() != AUDIO_LOCALFILE && m_streamType != ST_WEBFILE) return; //guard
 
-    static uint64_t sumBytesIn         = 0;
-    static uint64_t sumBytesOut        = 0;
-    static uint32_t sumBitRate         = 0;
-    static uint32_t counter            = 0;
-    static uint32_t timeStamp          = 0;
-    static uint32_t deltaBytesIn       = 0;
-    static uint32_t nominalBitRate     = 0;
+    uint64_t& sumBytesIn = m_audioTime.sumBytesIn;
+    uint64_t& sumBytesOut = m_audioTime.sumBytesOut;
+    uint32_t& sumBitRate = m_audioTime.sumBitRate;
+    uint32_t& counter = m_audioTime.counter;
+    uint32_t& timeStamp = m_audioTime.timeStamp;
+    uint32_t& deltaBytesIn = m_audioTime.deltaBytesIn;
+    uint32_t& nominalBitRate = m_audioTime.nominalBitRate;
 
     if(m_f_firstCurTimeCall) { // first call
         m_f_firstCurTimeCall = false;
@@ -4712,7 +5114,7 @@ void Audio::computeAudioTime(uint16_t bytesDecoderIn, uint16_t bytesDecoderOut)
             nominalBitRate = getBitRate();
             m_avr_bitrate = nominalBitRate;
             m_audioFileDuration = m_audioDataSize  / (getSampleRate() * getChannels());
-            if(getBitsPerSample() == 16) m_audioFileDuration /= 2;
+            if(getBitsPerSample() > 8) m_audioFileDuration /= getBitsPerSample() / 8;
         }
     }
 
@@ -4835,7 +5237,7 @@ void Audio::printDecodeError(int r) {
             case ERR_FLAC_PREORDER_TOO_BIG: e = "PREORDER TOO BIG"; break;
             case ERR_FLAC_RESERVED_RESIDUAL_CODING: e = "RESERVED RESIDUAL CODING"; break;
             case ERR_FLAC_WRONG_RICE_PARTITION_NR: e = "WRONG RICE PARTITION NR"; break;
-            case ERR_FLAC_BITS_PER_SAMPLE_TOO_BIG: e = "BITS PER SAMPLE > 16"; break;
+            case ERR_FLAC_BITS_PER_SAMPLE_TOO_BIG: e = "BITS PER SAMPLE > 24"; break;
             case ERR_FLAC_BITS_PER_SAMPLE_UNKNOWN: e = "BITS PER SAMPLE UNKNOWN"; break;
             case ERR_FLAC_DECODER_ASYNC: e = "DECODER ASYNCHRON"; break;
             case ERR_FLAC_BITREADER_UNDERFLOW: e = "BITREADER ERROR"; break;
@@ -4982,6 +5384,8 @@ bool Audio::setAudioPlayPosition(uint16_t sec) {
 void Audio::setVolumeSteps(uint8_t steps) {
     m_vol_steps = steps;
     if(steps < 1) m_vol_steps = 64; /* avoid div-by-zero :-) */
+    computeVolumeTable();
+    computeLimit();
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint8_t Audio::maxVolume() { return m_vol_steps; };
@@ -5020,7 +5424,13 @@ bool Audio::setFilePos(uint32_t pos) {
     if(m_codec == CODEC_OPUS) return false;   // not impl. yet
     if(m_codec == CODEC_VORBIS) return false; // not impl. yet
     memset(m_outBuff, 0, m_outbuffSize);
+    fifoFlush();
     m_validSamples = 0;
+    m_srcInFrames = 0;
+    m_trimSkip = 0; // the gapless trim counts are invalid after a seek
+    m_f_trimEnd = false;
+    m_xfState = XF_IDLE; // a seek cancels the crossfade
+    m_xfFill = 0;
     m_resumeFilePos = pos;  // used in processLocalFile()
     m_haveNewFilePos = pos; // used in computeAudioCurrentTime()
 
@@ -5033,7 +5443,8 @@ bool Audio::audioFileSeek(const float speed) {
     // 1.5 is one and half speed
     if((speed > 1.5f) || (speed < 0.25f)) return false;
 
-    uint32_t srate = getSampleRate() * speed;
+    uint32_t srate = getOutputRate() * speed;
+    m_i2sRate = srate; // the clock that runs now, the next reconfigI2S() sets the output rate again
 #if ESP_IDF_VERSION_MAJOR == 5
     I2Sstop(0);
     m_i2s_std_cfg.clk_cfg.sample_rate_hz = srate;
@@ -5047,14 +5458,23 @@ bool Audio::audioFileSeek(const float speed) {
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 bool Audio::setSampleRate(uint32_t sampRate) {
     if(!sampRate) sampRate = 44100; // fuse, if there is no value -> set default #209
+    if(sampRate == m_sampleRate) return true;
     m_sampleRate = sampRate;
+    if(m_outputRate) { // fixed output rate, only the resampler changes
+        SRC_design();
+        return true;
+    }
+    limiterSetup();
+    loudnessSetup();
+    m_iirDirty.store(true, std::memory_order_relaxed); // must be recalculated after each samplerate change, we are in the
+    IIR_update();                                      // audio task and must not wait for a writer, see IIR_update()
     return true;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::getSampleRate() { return m_sampleRate; }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 bool Audio::setBitsPerSample(int bits) {
-    if((bits != 16) && (bits != 8)) return false;
+    if((bits != 8) && (bits != 16) && (bits != 20) && (bits != 24) && (bits != 32)) return false;
     m_bitsPerSample = bits;
     return true;
 }
@@ -5073,12 +5493,22 @@ uint8_t Audio::getChannels() {
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::reconfigI2S(){
 
+    uint8_t bits = m_f_hiRes ? 32 : 16;
+    if(m_i2sRate == getOutputRate() && m_i2sBits == bits) { // same rate (fixed output rate or gapless), the I2S clock keeps running (no gap, no pop)
+        memset(m_iirState, 0, sizeof(m_iirState));
+        return;
+    }
+    fifoDrain(); // the FIFO holds frames in the old format
+    m_i2sRate = getOutputRate();
+    m_i2sBits = bits;
+
 #if ESP_IDF_VERSION_MAJOR == 5
     I2Sstop(0);
-    m_i2s_std_cfg.clk_cfg.sample_rate_hz = m_sampleRate;
+    m_i2s_std_cfg.clk_cfg.sample_rate_hz = m_i2sRate;
 
-    if(!m_f_commFMT) m_i2s_std_cfg.slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO);
-    else             m_i2s_std_cfg.slot_cfg = I2S_STD_PCM_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_STEREO);
+    i2s_data_bit_width_t bw = m_f_hiRes ? I2S_DATA_BIT_WIDTH_32BIT : I2S_DATA_BIT_WIDTH_16BIT;
+    if(!m_f_commFMT) m_i2s_std_cfg.slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(bw, I2S_SLOT_MODE_STEREO);
+    else             m_i2s_std_cfg.slot_cfg = I2S_STD_PCM_SLOT_DEFAULT_CONFIG(bw, I2S_SLOT_MODE_STEREO);
     m_i2s_std_cfg.slot_cfg.slot_mask = I2S_STD_SLOT_BOTH;
 
     i2s_channel_reconfig_std_clock(m_i2s_tx_handle, &m_i2s_std_cfg.clk_cfg);
@@ -5086,13 +5516,41 @@ void Audio::reconfigI2S(){
     I2Sstart(0);
 #else
     m_i2s_config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
-    i2s_set_clk((i2s_port_t)m_i2s_num, m_sampleRate, I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_STEREO);
+    i2s_set_clk((i2s_port_t)m_i2s_num, m_i2sRate, m_f_hiRes ? I2S_BITS_PER_SAMPLE_32BIT : I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_STEREO);
 #endif
-    memset(m_filterBuff, 0, sizeof(m_filterBuff)); // Clear FilterBuffer
-    IIR_calculateCoefficients(m_gain0, m_gain1, m_gain2); // must be recalculated after each samplerate change
+    memset(m_iirState, 0, sizeof(m_iirState)); // Clear FilterBuffer
     return;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setHiRes() {
+    // 24 bit samples through the DSP chain and 32 bit I2S slots, only FLAC and WAV deliver more than 16 bit,
+    // the internal DAC is always 16 bit. The caller holds mutex_playAudioData and reconfigures I2S afterwards
+    // the FLAC decoder makes the same decision (FLACSetOutputBits), m_outBuff already holds a block in this format
+    bool hiRes = (m_outputBits == 32 && getBitsPerSample() > 16 && !m_f_internalDAC && (m_codec == CODEC_FLAC || m_codec == CODEC_WAV));
+    if(hiRes == m_f_hiRes) return;
+    m_f_hiRes = hiRes;
+    m_srcInFrames = 0;
+    m_srcPos = 0;
+    if(m_srcIn) memset(m_srcIn, 0, (m_srcMaxTaps - 1) * 2 * sizeof(int32_t)); // resampler history
+    memset(m_iirState, 0, sizeof(m_iirState));
+    m_iirDirty.store(true, std::memory_order_relaxed); // the EQ pre-attenuation depends on the sample type
+    IIR_update();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::wavConvert(uint8_t* data, uint32_t len) {
+    // 24 or 32 bit little endian PCM, the upper 24 bit go to m_outBuff as int32 (hi-res) or the upper 16 bit as int16
+    setHiRes(); // the first block comes before setDecoderItems(), the WAV header has already set the format
+    uint8_t  bytes = getBitsPerSample() / 8;
+    uint32_t n = len / bytes; // samples
+    for(uint32_t i = 0; i < n; i++) {
+        const uint8_t* p = data + i * bytes + bytes - 3;
+        int32_t        s = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+        if(m_f_hiRes) ((int32_t*)m_outBuff)[i] = s;
+        else m_outBuff[i] = (int16_t)(s >> 8);
+    }
+    m_validSamples = n / getChannels();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 bool Audio::setBitrate(int br) {
     m_bitRate = br;
     if(br) return true;
@@ -5109,6 +5567,7 @@ void Audio::setI2SCommFMT_LSB(bool commFMT) {
     //        Japanese or called LSBJ (Least Significant Bit Justified) format
 
     m_f_commFMT = commFMT;
+    m_i2sRate = 0; // next reconfigI2S() sets clock and slots
 
 #if ESP_IDF_VERSION_MAJOR < 5
     if(commFMT) {
@@ -5136,114 +5595,1083 @@ void Audio::setI2SCommFMT_LSB(bool commFMT) {
 #endif
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::computeVUlevel(int16_t sample[2]) {
-    static uint8_t sampleArray[2][4][8] = {0};
-    static uint8_t cnt0 = 0, cnt1 = 0, cnt2 = 0, cnt3 = 0, cnt4 = 0;
-    static bool    f_vu = false;
-
-    auto avg = [&](uint8_t* sampArr) { // lambda, inner function, compute the average of 8 samples
-        uint16_t av = 0;
-        for(int i = 0; i < 8; i++) { av += sampArr[i]; }
-        return av >> 3;
-    };
-
-    auto largest = [&](uint8_t* sampArr) { // lambda, inner function, compute the largest of 8 samples
-        uint16_t maxValue = 0;
-        for(int i = 0; i < 8; i++) {
-            if(maxValue < sampArr[i]) maxValue = sampArr[i];
-        }
-        return maxValue;
-    };
-
-    if(cnt0 == 64) {
-        cnt0 = 0;
-        cnt1++;
-    }
-    if(cnt1 == 8) {
-        cnt1 = 0;
-        cnt2++;
-    }
-    if(cnt2 == 8) {
-        cnt2 = 0;
-        cnt3++;
-    }
-    if(cnt3 == 8) {
-        cnt3 = 0;
-        cnt4++;
-        f_vu = true;
-    }
-    if(cnt4 == 8) { cnt4 = 0; }
-
-    if(!cnt0) { // store every 64th sample in the array[0]
-        sampleArray[LEFTCHANNEL][0][cnt1] = abs(sample[LEFTCHANNEL] >> 7);
-        sampleArray[RIGHTCHANNEL][0][cnt1] = abs(sample[RIGHTCHANNEL] >> 7);
-    }
-    if(!cnt1) { // store argest from 64 * 8 samples in the array[1]
-        sampleArray[LEFTCHANNEL][1][cnt2] = largest(sampleArray[LEFTCHANNEL][0]);
-        sampleArray[RIGHTCHANNEL][1][cnt2] = largest(sampleArray[RIGHTCHANNEL][0]);
-    }
-    if(!cnt2) { // store avg from 64 * 8 * 8 samples in the array[2]
-        sampleArray[LEFTCHANNEL][2][cnt3] = largest(sampleArray[LEFTCHANNEL][1]);
-        sampleArray[RIGHTCHANNEL][2][cnt3] = largest(sampleArray[RIGHTCHANNEL][1]);
-    }
-    if(!cnt3) { // store avg from 64 * 8 * 8 * 8 samples in the array[3]
-        sampleArray[LEFTCHANNEL][3][cnt4] = avg(sampleArray[LEFTCHANNEL][2]);
-        sampleArray[RIGHTCHANNEL][3][cnt4] = avg(sampleArray[RIGHTCHANNEL][2]);
-    }
-    if(f_vu) {
-        f_vu = false;
-        m_vuLeft = avg(sampleArray[LEFTCHANNEL][3]);
-        m_vuRight = avg(sampleArray[RIGHTCHANNEL][3]);
-    }
-    cnt1++;
+template <typename T> void Audio::computeVUlevel(T* block, uint16_t frames) {
+    // peak and RMS per channel over the block (one pass), smoothed with the attack and release times,
+    // the result is published as a snapshot for getVUmeter() and getVUlevel(), T = int32_t: 24 bit samples
+
+    if(!frames) return;
+
+    const int32_t fullScale = (sizeof(T) == sizeof(int16_t)) ? 32768 : 8388608;
+
+    int32_t  peak[2] = {0};
+    uint64_t sumSq[2] = {0};
+    uint32_t clipped[2] = {0};
+
+    for(int i = 0; i < frames * 2; i += 2) {
+        int32_t l = block[i + LEFTCHANNEL];
+        int32_t r = block[i + RIGHTCHANNEL];
+        if(l >= fullScale - 1 || l <= -fullScale) clipped[LEFTCHANNEL]++;
+        if(r >= fullScale - 1 || r <= -fullScale) clipped[RIGHTCHANNEL]++;
+        sumSq[LEFTCHANNEL]  += (int64_t)l * l;
+        sumSq[RIGHTCHANNEL] += (int64_t)r * r;
+        l = abs(l);
+        r = abs(r);
+        if(l > peak[LEFTCHANNEL])  peak[LEFTCHANNEL]  = l;
+        if(r > peak[RIGHTCHANNEL]) peak[RIGHTCHANNEL] = r;
+    }
+
+    // ballistics, once per block
+    uint32_t sr = getOutputRate();
+    if(!sr) sr = 44100;
+    float t = (float)frames / (float)sr; // block duration in seconds
+    float kAttack  = 1.0f - expf(-t * 1000.0f / m_vuAttack_ms);
+    float kRelease = 1.0f - expf(-t * 1000.0f / m_vuRelease_ms);
+
+    auto dBFS = [](float x) { return (x > 0) ? 20.0f * log10f(x) : -96.0f; }; // lambda, x: 0 ... 1.0
+
+    m_vuSeq.fetch_add(1, std::memory_order_acq_rel); // odd, snapshot is being written
+    for(int ch = LEFTCHANNEL; ch <= RIGHTCHANNEL; ch++) {
+        float p  = peak[ch] / (float)fullScale;
+        float ms = (float)sumSq[ch] / frames / ((float)fullScale * (float)fullScale);
+        m_vuEnvPeak[ch] += (p  - m_vuEnvPeak[ch]) * (p  > m_vuEnvPeak[ch] ? kAttack : kRelease);
+        m_vuEnvMs[ch]   += (ms - m_vuEnvMs[ch])   * (ms > m_vuEnvMs[ch]   ? kAttack : kRelease);
+        m_vu.peak[ch] = max(dBFS(m_vuEnvPeak[ch]), -96.0f);
+        m_vu.rms[ch]  = max(dBFS(sqrtf(m_vuEnvMs[ch])), -96.0f);
+        m_vu.clipped[ch] += clipped[ch];
+    }
+    m_vuSeq.fetch_add(1, std::memory_order_release); // even, snapshot is valid
+
+    m_vuLeft  = (uint8_t)(m_vuEnvPeak[LEFTCHANNEL]  * 127);
+    m_vuRight = (uint8_t)(m_vuEnvPeak[RIGHTCHANNEL] * 127);
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint16_t Audio::getVUlevel() {
-    // avg 0 ... 127
+    // peak 0 ... 127
     if(!m_f_running) return 0;
     return (m_vuLeft << 8) + m_vuRight;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::setTone(int8_t gainLowPass, int8_t gainBandPass, int8_t gainHighPass) {
-    // see https://www.earlevel.com/main/2013/10/13/biquad-calculator-v2/
-    // values can be between -40 ... +6 (dB)
-
-    m_gain0 = gainLowPass;
-    m_gain1 = gainBandPass;
-    m_gain2 = gainHighPass;
-
-    // gain, attenuation (set in digital filters)
-    int db = max(m_gain0, max(m_gain1, m_gain2));
-    m_corr = pow10f((float)db / 20);
-
-    IIR_calculateCoefficients(m_gain0, m_gain1, m_gain2);
-
-    /*
-          This will cause a clicking sound when adjusting the EQ.
-          Because when the EQ is adjusted, the IIR filter will be cleared and played,
-          mixed in the audio data frame, and a click-like sound will be produced.
-
-          int16_t tmp[2]; tmp[0] = 0; tmp[1]= 0;
-
-          IIR_filterChain0(tmp, true ); // flush the filter
-          IIR_filterChain1(tmp, true ); // flush the filter
-          IIR_filterChain2(tmp, true ); // flush the filter
-        */
+void Audio::getVUmeter(vu_meter_t* vu) {
+    // lock-free, copies the last snapshot, retries if the audio task has updated it meanwhile
+    // the meter taps the decoded signal before EQ and gain, clipped counts since the last connecttoXXX
+    uint32_t seq;
+    do {
+        seq = m_vuSeq.load(std::memory_order_acquire);
+        if(seq & 1) continue;
+        memcpy(vu, &m_vu, sizeof(vu_meter_t));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((seq & 1) || seq != m_vuSeq.load(std::memory_order_relaxed));
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::forceMono(bool m) { // #100 mono option
-    m_f_forceMono = m;          // false stereo, true mono
+void Audio::resetVUmeter() { // the caller holds mutex_playAudioData, the audio task does not write meanwhile
+    m_vuSeq.fetch_add(1, std::memory_order_acq_rel);
+    m_vu.clipped[LEFTCHANNEL] = m_vu.clipped[RIGHTCHANNEL] = 0;
+    m_vuSeq.fetch_add(1, std::memory_order_release);
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::setBalance(int8_t bal) { // bal -16...16
-    if(bal < -16) bal = -16;
-    if(bal > 16) bal = 16;
-    m_balance = bal;
-
+void Audio::setVUmeter(uint16_t attack_ms, uint16_t release_ms) {
+    m_vuAttack_ms  = max(attack_ms, (uint16_t)1);
+    m_vuRelease_ms = max(release_ms, (uint16_t)1);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setLoudnessMeter(bool enable) {
+    // EBU R128 / ITU-R BS.1770 loudness of the decoded audio (before EQ and volume), momentary, short-term and integrated
+    if(enable && !m_lmHist) {
+        m_lmHist = (uint32_t*)__malloc_heap_psram(m_lmBins * sizeof(uint32_t));
+        if(!m_lmHist) {
+            log_e("oom");
+            return false;
+        }
+    }
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    if(enable && !m_f_loudness) {
+        loudnessSetup();
+        loudnessReset();
+    }
+    m_f_loudness = enable;
+    if(!enable) m_f_agc = false;
+    xSemaphoreGive(mutex_playAudioData);
     computeLimit();
+    return true;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::setVolume(uint8_t vol, uint8_t curve) { // curve 0: default, curve 1: flat at the beginning
+void Audio::getLoudness(loudness_t* ld) {
+    // lock-free, like getVUmeter()
+    uint32_t seq;
+    do {
+        seq = m_lmSeq.load(std::memory_order_acquire);
+        if(seq & 1) continue;
+        memcpy(ld, &m_lm, sizeof(loudness_t));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((seq & 1) || seq != m_lmSeq.load(std::memory_order_relaxed));
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setAutoGain(bool enable, int8_t target_LUFS, uint8_t maxGain_dB) {
+    // slow loudness normalization for streams without ReplayGain tags, target: -30 ... -10 LUFS, max: 0 ... 20 dB
+    // the gain follows the integrated loudness with max. 1 dB/s and is folded into the volume like ReplayGain
+    if(enable && !m_f_loudness && !setLoudnessMeter(true)) return false;
+    m_agcTarget = constrain(target_LUFS, -30, -10);
+    m_agcMax = min(maxGain_dB, (uint8_t)20);
+    m_f_agc = enable;
+    if(!enable) m_agcGain.store(0, std::memory_order_relaxed);
+    computeLimit();
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::loudnessSetup() {
+    // K-weighting for the output rate (BS.1770 pre-filter and RLB highpass), the caller holds mutex_playAudioData or is the audio task
+    uint32_t sr = getOutputRate();
+    if(!sr) sr = 44100;
+    double K = tan(M_PI * 1681.974450955533 / sr);
+    double Q = 0.7071752369554196;
+    double Vh = pow(10.0, 3.999843853973347 / 20.0);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+    m_lmK[0] = (float)((Vh + Vb * K / Q + K * K) / a0);
+    m_lmK[1] = (float)(2.0 * (K * K - Vh) / a0);
+    m_lmK[2] = (float)((Vh - Vb * K / Q + K * K) / a0);
+    m_lmK[3] = (float)(2.0 * (K * K - 1.0) / a0);
+    m_lmK[4] = (float)((1.0 - K / Q + K * K) / a0);
+    K = tan(M_PI * 38.13547087602444 / sr);
+    Q = 0.5003270373238773;
+    a0 = 1.0 + K / Q + K * K;
+    m_lmHp[0] = (float)(2.0 * (K * K - 1.0) / a0);
+    m_lmHp[1] = (float)((1.0 - K / Q + K * K) / a0);
+    m_lmSub = sr / 10;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::loudnessReset() { // new stream or file, the auto gain keeps its value as start point
+    if(m_lmHist) memset(m_lmHist, 0, m_lmBins * sizeof(uint32_t));
+    memset(m_lmZ, 0, sizeof(m_lmZ));
+    m_lmSum = 0;
+    m_lmCnt = 0;
+    m_lmIdx = 0;
+    m_lmFill = 0;
+    m_lmBlocks = 0;
+    m_lmUngated = 0;
+    m_lmSeq.fetch_add(1, std::memory_order_acq_rel);
+    m_lm.momentary = m_lm.shortTerm = m_lm.integrated = -96.0f;
+    m_lmSeq.fetch_add(1, std::memory_order_release);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> void Audio::loudnessTap(T* block, uint16_t frames) {
+    // two biquads (transposed direct form II) per channel and a sum of squares, everything else runs every 100 ms
+    const float scale = (sizeof(T) == sizeof(int16_t)) ? 1.0f / 32768 : 1.0f / 8388608;
+    const float b0 = m_lmK[0], b1 = m_lmK[1], b2 = m_lmK[2], a1 = m_lmK[3], a2 = m_lmK[4];
+    const float h1 = m_lmHp[0], h2 = m_lmHp[1];
+    const int   chans = (getChannels() == 1) ? 1 : 2; // mono is counted once
+
+    for(int i = 0; i < frames; i++) {
+        for(int ch = 0; ch < chans; ch++) {
+            float* z = m_lmZ[ch];
+            float  x = block[2 * i + ch] * scale;
+            float  y = b0 * x + z[0];
+            z[0] = b1 * x - a1 * y + z[1];
+            z[1] = b2 * x - a2 * y;
+            x = y;
+            y = x + z[2];
+            z[2] = -2.0f * x - h1 * y + z[3];
+            z[3] = x - h2 * y;
+            m_lmSum += y * y;
+        }
+        if(++m_lmCnt == m_lmSub) loudnessBlock();
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::loudnessBlock() {
+    // every 100 ms: momentary (400 ms) and short-term (3 s) windows, gating blocks of 400 ms with 75% overlap go into a
+    // histogram, the integrated loudness is gated at -70 LUFS and 10 LU below the ungated level (updated every second)
+
+    auto LUFS = [](double ms) { return (ms > 0) ? -0.691 + 10.0 * log10(ms) : -96.0; }; // lambda
+    const float bin = 0.2f;
+
+    m_lmRing[m_lmIdx] = m_lmSum / m_lmSub;
+    m_lmIdx = (m_lmIdx + 1) % 30;
+    if(m_lmFill < 30) m_lmFill++;
+    m_lmSum = 0;
+    m_lmCnt = 0;
+
+    float zM = 0, zS = 0;
+    for(int i = 1; i <= m_lmFill; i++) {
+        float z = m_lmRing[(m_lmIdx + 30 - i) % 30];
+        if(i <= 4) zM += z;
+        zS += z;
+    }
+    zM /= min(m_lmFill, (uint8_t)4);
+    zS /= m_lmFill;
+    float lM = max((float)LUFS(zM), -96.0f);
+    float lS = max((float)LUFS(zS), -96.0f);
+    float lI = m_lm.integrated;
+
+    if(m_lmFill >= 4 && lM > -70.0f && m_lmHist) {
+        int b = (int)((lM + 70.0f) / bin);
+        m_lmHist[min(b, m_lmBins - 1)]++;
+        m_lmUngated += zM;
+        m_lmBlocks++;
+    }
+    if(m_lmBlocks && (m_lmIdx % 10 == 0 || m_lmBlocks < 10)) {
+        float  rel = LUFS(m_lmUngated / m_lmBlocks) - 10.0f;
+        double sum = 0;
+        uint32_t n = 0;
+        for(int b = max((int)((rel + 70.0f) / bin), 0); b < m_lmBins; b++) {
+            if(!m_lmHist[b]) continue;
+            sum += m_lmHist[b] * pow(10.0, (-70.0 + (b + 0.5) * bin + 0.691) / 10.0); // mean square of the bin center
+            n += m_lmHist[b];
+        }
+        if(n) lI = LUFS(sum / n);
+    }
+
+    if(m_f_agc && m_lmBlocks >= 10) { // after one second of audio, 1 dB/s
+        int32_t want = (int32_t)((m_agcTarget - lI) * 256);
+        want = constrain(want, -(int32_t)m_agcMax * 256, (int32_t)m_agcMax * 256);
+        int32_t g = m_agcGain.load(std::memory_order_relaxed);
+        int32_t d = constrain(want - g, -26, 26);
+        if(d) {
+            m_agcGain.store(g + d, std::memory_order_relaxed);
+            computeLimit();
+        }
+    }
+
+    m_lmSeq.fetch_add(1, std::memory_order_acq_rel); // odd, snapshot is being written
+    m_lm.momentary = lM;
+    m_lm.shortTerm = lS;
+    m_lm.integrated = lI;
+    m_lm.gain = m_agcGain.load(std::memory_order_relaxed) / 256.0f;
+    m_lmSeq.fetch_add(1, std::memory_order_release); // even, snapshot is valid
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setSpectrumAnalyzer(uint8_t bands, uint8_t updateRate) {
+    // bands: 0 (off) ... 32, logarithmically spaced from fs/512 to fs/2 (fs: the output rate decimated to <= 24kHz),
+    // updateRate: 1 ... 50 Hz
+    // the analyzer runs in its own low priority task and never blocks the audio task
+
+    if(m_spTaskHandle) { // reconfigure, stop the running analyzer first
+        vTaskDelete(m_spTaskHandle);
+        m_spTaskHandle = nullptr;
+        if(m_spSeq.load() & 1) m_spSeq.fetch_add(1); // task was deleted while publishing
+    }
+    m_spBands = 0;
+    if(bands == 0) return true;
+
+    if(bands > m_spMaxBands) bands = m_spMaxBands;
+    m_spRate = constrain(updateRate, 1, 50);
+
+    if(!m_spRing) m_spRing = (int16_t*)__malloc_heap_psram(m_spRingSize * sizeof(int16_t));
+    if(!m_spWindow) m_spWindow = (int16_t*)__malloc_heap_psram(m_spFftSize * sizeof(int16_t));
+    if(!m_spFft) m_spFft = (int32_t*)heap_caps_malloc(m_spFftSize * 2 * sizeof(int32_t), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+    if(!m_spRing || !m_spWindow || !m_spFft) {
+        log_e("oom");
+        return false;
+    }
+    memset(m_spRing, 0, m_spRingSize * sizeof(int16_t));
+    for(int i = 0; i < m_spFftSize; i++) { // Hann window, Q15
+        m_spWindow[i] = (int16_t)(32767.0f * (0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / m_spFftSize)));
+    }
+
+    // band edges in FFT bins, at least one bin per band
+    m_spEdge[0] = 1;
+    for(int b = 1; b <= bands; b++) {
+        uint16_t e = (uint16_t)(powf(m_spFftSize / 2, (float)b / bands) + 0.5f);
+        if(e <= m_spEdge[b - 1]) e = m_spEdge[b - 1] + 1;
+        if(e > m_spFftSize / 2) e = m_spFftSize / 2;
+        m_spEdge[b] = e;
+    }
+    for(int b = 0; b < m_spMaxBands; b++) m_spOut[b] = -96.0f;
+
+    m_spBands = bands;
+    xTaskCreate(&Audio::spectrumTaskWrapper, "Spectrum", 3000, this, 1, &m_spTaskHandle);
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint8_t Audio::getSpectrum(float* bands, uint8_t maxBands) {
+    // lock-free, copies the last band magnitudes in dBFS, returns the number of bands
+    uint8_t  n = min(m_spBands, maxBands);
+    uint32_t seq;
+    do {
+        seq = m_spSeq.load(std::memory_order_acquire);
+        if(seq & 1) continue;
+        memcpy(bands, m_spOut, n * sizeof(float));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((seq & 1) || seq != m_spSeq.load(std::memory_order_relaxed));
+    return n;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> void Audio::spectrumTap(T* block, uint16_t frames) {
+    // mono mix, decimated to <= 24kHz (44.1/48kHz by 2, 96kHz by 4...), written into the analyzer ring, the ring is never
+    // read by the audio task
+    uint32_t rate = getOutputRate();
+    uint8_t  decim = 1;
+    while(rate / decim > 24000 && decim < 16) decim++;
+    uint8_t  shift = (sizeof(T) == sizeof(int16_t)) ? 0 : 8; // the ring is 16 bit
+    uint32_t w = m_spWrite.load(std::memory_order_relaxed);
+    for(int i = 0; i < frames * 2; i += 2) {
+        m_spAcc += (block[i + LEFTCHANNEL] >> shift) + (block[i + RIGHTCHANNEL] >> shift);
+        if(++m_spDecimCnt < decim) continue;
+        m_spRing[w++ & (m_spRingSize - 1)] = m_spAcc / (2 * decim);
+        m_spAcc = 0;
+        m_spDecimCnt = 0;
+    }
+    m_spWrite.store(w, std::memory_order_release);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::spectrumTaskWrapper(void* param) {
+    Audio* runner = static_cast<Audio*>(param);
+    runner->spectrumTask();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::spectrumTask() {
+    // windowed 512 point FFT (R4FFT from the AAC decoder) over the newest samples of the ring
+    const float ref = 8388608.0f * 8388608.0f; // power of a full scale sine (2^23 after R4FFT), 0 dBFS
+    int32_t*    x = m_spFft;
+
+    while(true) {
+        vTaskDelay((1000 / m_spRate) / portTICK_PERIOD_MS);
+        if(!m_f_running) continue;
+
+        uint32_t w = m_spWrite.load(std::memory_order_acquire);
+        for(int i = 0; i < m_spFftSize; i++) {
+            int32_t s = m_spRing[(w - m_spFftSize + i) & (m_spRingSize - 1)];
+            x[2 * i] = ((s * m_spWindow[i]) >> 15) << 8; // 5 guard bits are required
+            x[2 * i + 1] = 0;
+        }
+        if(m_spWrite.load(std::memory_order_acquire) - w > m_spRingSize - m_spFftSize) continue; // overwritten while copying
+
+        R4FFT(1, x); // tabidx 1: 512 points
+
+        m_spSeq.fetch_add(1, std::memory_order_acq_rel);
+        for(int b = 0; b < m_spBands; b++) {
+            int64_t pMax = 0;
+            for(int k = m_spEdge[b]; k < m_spEdge[b + 1]; k++) {
+                int64_t p = (int64_t)x[2 * k] * x[2 * k] + (int64_t)x[2 * k + 1] * x[2 * k + 1];
+                if(p > pMax) pMax = p;
+            }
+            m_spOut[b] = pMax ? max(10.0f * log10f((float)pMax / ref), -96.0f) : -96.0f;
+        }
+        m_spSeq.fetch_add(1, std::memory_order_release);
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setPcmTap(uint32_t frames) {
+    // ring for the PCM tap, frames: 0 (off) or 4096 ... 65536 (rounded up to a power of two), 16 bit stereo
+    // the audio task writes every block sent to I2S and never waits, slow subscribers lose the oldest frames
+    // subscribers peek into the ring without a lock, so it can only be changed while nobody is subscribed
+    if(frames && frames < 4096) frames = 4096;
+    if(frames > 65536) frames = 65536;
+    uint32_t size = 1;
+    while(size < frames) size <<= 1;
+
+    uint8_t subs = 0;
+    if(!m_tapSubs.compare_exchange_strong(subs, m_tapLock, std::memory_order_acq_rel)) { // no subscribe meanwhile
+        log_e("PCM tap in use, unsubscribe first");
+        return false;
+    }
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    if(m_tapRing) {
+        free(m_tapRing);
+        m_tapRing = NULL;
+    }
+    m_tapMask = 0;
+    if(frames) {
+        m_tapRing = (int16_t*)__malloc_heap_psram(size * 2 * sizeof(int16_t));
+        if(m_tapRing) m_tapMask = size - 1;
+    }
+    xSemaphoreGive(mutex_playAudioData);
+    m_tapSubs.store(0, std::memory_order_release);
+    if(frames && !m_tapRing) {
+        log_e("oom");
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+int8_t Audio::pcmTapSubscribe() {
+    // returns the subscriber id or -1, reading starts with the next block
+    uint8_t subs = m_tapSubs.load(std::memory_order_relaxed);
+    for(int8_t id = 0; id < m_tapMaxSubs; id++) {
+        if(subs & m_tapLock) return -1; // setPcmTap() is changing the ring
+        if(subs & (1 << id)) continue;
+        m_tapRead[id].store(m_tapWrite.load(std::memory_order_acquire), std::memory_order_relaxed);
+        m_tapOverruns[id].store(0, std::memory_order_relaxed);
+        if(m_tapSubs.compare_exchange_strong(subs, subs | (1 << id), std::memory_order_acq_rel)) return id;
+        id = -1; // another task was faster, start again
+    }
+    return -1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::pcmTapUnsubscribe(int8_t id) {
+    if(id < 0 || id >= m_tapMaxSubs) return;
+    m_tapSubs.fetch_and(~(1 << id), std::memory_order_acq_rel);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::pcmTapPeek(int8_t id, const int16_t** frames) {
+    // zero copy, returns the number of contiguous frames at *frames (interleaved L R), pcmTapConsume() releases them
+    // if the writer has overtaken the subscriber, the read position jumps forward and the overrun counter is incremented
+    *frames = NULL;
+    if(id < 0 || id >= m_tapMaxSubs || !m_tapRing) return 0;
+    uint32_t w = m_tapWrite.load(std::memory_order_acquire);
+    uint32_t r = m_tapRead[id].load(std::memory_order_relaxed);
+    uint32_t size = m_tapMask + 1;
+    if(m_tapClaim.load(std::memory_order_acquire) - r > size) { // already overwritten
+        r = w - size / 2;
+        m_tapRead[id].store(r, std::memory_order_relaxed);
+        m_tapOverruns[id].fetch_add(1, std::memory_order_relaxed);
+    }
+    uint32_t n = min(w - r, size - (r & m_tapMask)); // up to the end of the ring
+    *frames = m_tapRing + 2 * (r & m_tapMask);
+    return n;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::pcmTapConsume(int8_t id, uint32_t frames) {
+    // returns false if the peeked frames were overwritten while they were used (counted as overrun)
+    if(id < 0 || id >= m_tapMaxSubs) return false;
+    uint32_t r = m_tapRead[id].load(std::memory_order_relaxed);
+    m_tapRead[id].store(r + frames, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire); // the frames are read before the claim is checked
+    if(m_tapClaim.load(std::memory_order_acquire) - r > m_tapMask + 1) {
+        m_tapOverruns[id].fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::pcmTapRead(int8_t id, int16_t* buff, uint32_t frames) {
+    // copying variant of pcmTapPeek() / pcmTapConsume(), returns the number of valid frames in buff
+    uint32_t done = 0;
+    while(done < frames) {
+        const int16_t* p;
+        uint32_t n = min(pcmTapPeek(id, &p), frames - done);
+        if(!n) break;
+        memcpy(buff + 2 * done, p, n * 2 * sizeof(int16_t));
+        if(pcmTapConsume(id, n)) done += n;
+    }
+    return done;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::pcmTapOverruns(int8_t id) {
+    if(id < 0 || id >= m_tapMaxSubs) return 0;
+    return m_tapOverruns[id].load(std::memory_order_relaxed);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::pcmTapWrite(void* block, uint16_t frames) {
+    // audio task, the claim is published before the ring is written, so readers can detect overwritten frames
+    uint32_t w = m_tapWrite.load(std::memory_order_relaxed);
+    uint32_t n = min((uint32_t)frames, m_tapMask + 1);
+    uint32_t o = (frames - n) * 2; // a block longer than the ring, only its end is kept
+    m_tapClaim.store(w + n, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(uint32_t i = 0; i < n * 2; i++) {
+        int16_t s = m_f_hiRes ? (int16_t)(((int32_t*)block)[o + i] >> 16) : ((int16_t*)block)[o + i];
+        if(m_f_internalDAC) s -= 0x8000; // remove the DAC offset
+        m_tapRing[2 * ((w + i / 2) & m_tapMask) + (i & 1)] = s;
+    }
+    m_tapWrite.store(w + n, std::memory_order_release);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setPcmFifo(uint16_t ms) {
+    // FIFO for processed PCM between the audio task and a dedicated I2S writer task, ms: 0 (off, the audio task writes
+    // to I2S directly) or 20 ... 2000. The buffer is sized for 48kHz 32 bit frames, higher rates or 16 bit frames fit more
+    // or less time. The audio task decodes ahead in bursts, the writer task keeps the DMA filled at a steady rate
+    if(ms && ms < 20) ms = 20;
+    if(ms > 2000) ms = 2000;
+
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    if(m_fifoTaskHandle) { // the writer finishes its current I2S write and ends itself
+        m_f_fifoRun.store(false, std::memory_order_release);
+        xTaskNotifyGive(m_fifoTaskHandle);
+        while(m_fifoTaskHandle) vTaskDelay(1);
+    }
+    if(m_fifoBuf) {
+        free(m_fifoBuf);
+        m_fifoBuf = NULL;
+    }
+    m_fifo_ms = ms;
+    m_fifoSize = 0;
+    m_fifoW.store(0, std::memory_order_relaxed);
+    m_fifoR.store(0, std::memory_order_relaxed);
+    m_fifoDrop.store(0, std::memory_order_relaxed);
+    m_fifoClipTo = 0;
+    bool ok = true;
+    if(ms) {
+        uint32_t size = 1;
+        while(size < (uint32_t)ms * 48 * 8) size <<= 1;
+        m_fifoBuf = (uint8_t*)__malloc_heap_psram(size);
+        if(m_fifoBuf) {
+            m_fifoSize = size;
+            m_f_fifoRun.store(true, std::memory_order_release);
+            xTaskCreate(&Audio::fifoTaskWrapper, "I2SWriter", AUDIO_FIFO_TASK_STACK_SIZE, this, AUDIO_TASK_PRIORITY + 1, &m_fifoTaskHandle);
+        }
+        else {
+            log_e("oom");
+            ok = false;
+        }
+    }
+    xSemaphoreGive(mutex_playAudioData);
+    return ok;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint16_t Audio::getPcmFifoLevel() { // ms
+    if(!m_fifoBuf) return 0;
+    uint32_t bytesPerMs = getOutputRate() * (m_f_hiRes ? 8 : 4) / 1000;
+    if(!bytesPerMs) return 0;
+    return (m_fifoW.load(std::memory_order_relaxed) - m_fifoR.load(std::memory_order_relaxed)) / bytesPerMs;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::getPcmFifoUnderruns() { return m_fifoUnderruns.load(std::memory_order_relaxed); }
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::fifoTarget() { // fill level in bytes, whole frames
+    uint8_t  frameSize = m_f_hiRes ? 8 : 4;
+    uint32_t t = (uint32_t)m_fifo_ms * getOutputRate() / 1000 * frameSize;
+    if(t > m_fifoSize) t = m_fifoSize - m_fifoSize % frameSize;
+    return t;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::fifoPush(const uint8_t* data, uint32_t bytes) {
+    // audio task (or the holder of mutex_playAudioData), never blocks, returns the number of bytes taken
+    uint32_t w = m_fifoW.load(std::memory_order_relaxed);
+    uint32_t fill = w - m_fifoR.load(std::memory_order_acquire);
+    uint32_t target = fifoTarget();
+    if(fill >= target) return 0;
+    if(bytes > target - fill) bytes = target - fill;
+    bytes -= bytes % (m_f_hiRes ? 8 : 4); // whole frames
+    uint32_t pos = w & (m_fifoSize - 1);
+    uint32_t n = min(bytes, m_fifoSize - pos); // up to the end of the ring
+    memcpy(m_fifoBuf + pos, data, n);
+    memcpy(m_fifoBuf, data + n, bytes - n);
+    m_fifoW.store(w + bytes, std::memory_order_release);
+    if(m_fifoTaskHandle) xTaskNotifyGive(m_fifoTaskHandle);
+    return bytes;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::fifoFlush() { // stop, pause, seek: the writer skips the buffered frames
+    if(!m_fifoBuf) return;
+    m_fifoDrop.store(m_fifoW.load(std::memory_order_relaxed), std::memory_order_release);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::fifoDrain() { // format change, the buffered frames are played first (max. 2s)
+    if(!m_fifoBuf || !m_fifoTaskHandle) return;
+    uint32_t t = millis();
+    while(m_fifoW.load(std::memory_order_relaxed) != m_fifoR.load(std::memory_order_acquire) && millis() - t < 2000) vTaskDelay(1);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::fifoTaskWrapper(void* param) {
+    Audio* runner = static_cast<Audio*>(param);
+    runner->fifoTask();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::fifoTask() {
+    // I2S writer, blocks in the I2S write until the DMA has room, sleeps until the audio task pushes new frames
+    bool f_playing = false;
+    while(m_f_fifoRun.load(std::memory_order_acquire)) {
+        uint32_t r = m_fifoR.load(std::memory_order_relaxed);
+        uint32_t d = m_fifoDrop.load(std::memory_order_acquire);
+        if((int32_t)(d - r) > 0) { // flushed
+            r = d;
+            m_fifoR.store(r, std::memory_order_release);
+            f_playing = false;
+        }
+        uint32_t pos = r & (m_fifoSize - 1);
+        uint32_t n = min(m_fifoW.load(std::memory_order_acquire) - r, m_fifoSize - pos);
+        if(!n) {
+            if(f_playing && m_f_running) m_fifoUnderruns.fetch_add(1, std::memory_order_relaxed);
+            f_playing = false;
+            ulTaskNotifyTake(pdTRUE, 10 / portTICK_PERIOD_MS);
+            continue;
+        }
+        if(n > 4096) n = 4096;
+        if(m_clipCount) { // clips are mixed in just before I2S, one DMA buffer at a time
+            uint32_t frameSize = m_f_hiRes ? 8 : 4;
+            if(n > m_clipSlice * frameSize) n = m_clipSlice * frameSize;
+            uint32_t from = ((int32_t)(m_fifoClipTo - r) > 0) ? m_fifoClipTo : r;
+            if((int32_t)(r + n - from) > 0) clipMix(m_fifoBuf + (from & (m_fifoSize - 1)), (r + n - from) / frameSize);
+            m_fifoClipTo = r + n;
+        }
+        size_t    written = 0;
+        esp_err_t err;
+        STAT_BEGIN(tI2S);
+#if(ESP_IDF_VERSION_MAJOR == 5)
+        err = i2s_channel_write(m_i2s_tx_handle, m_fifoBuf + pos, n, &written, 40);
+#else
+        err = i2s_write((i2s_port_t)m_i2s_num, m_fifoBuf + pos, n, &written, 40);
+#endif
+        STAT_END(tI2S, STAT_I2S_WAIT, written);
+        if(err != ESP_OK && err != ESP_ERR_TIMEOUT) log_e("i2s err %i", err);
+        m_fifoR.store(r + written, std::memory_order_release);
+        f_playing = true;
+        if(m_audioTaskHandle && written) xTaskNotifyGive(m_audioTaskHandle); // room in the FIFO
+    }
+    m_fifoTaskHandle = nullptr;
+    vTaskDelete(nullptr);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setMixerSource(Audio* source) {
+    // source: a second Audio object (connecttospeech, openai_speech, a local clip...) that is played over this one, the program
+    // keeps running and is ducked while the source plays, see setDucking(). NULL: detach. The source is constructed with its
+    // own I2S port (no pins needed), nothing is sent to it while attached, its loop() must be called as usual
+    if(source == this) return false;
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    if(m_mixSrc) { // the source's audio task must not be inside mixerPush()
+        xSemaphoreTake(m_mixSrc->mutex_playAudioData, portMAX_DELAY);
+        m_mixSrc->m_mixTarget.store(nullptr, std::memory_order_release);
+        m_mixSrc->m_validSamples = 0; // pending frames were meant for the mixer
+        xSemaphoreGive(m_mixSrc->mutex_playAudioData);
+        m_mixSrc = NULL;
+    }
+    if(m_mixRing) {
+        free(m_mixRing);
+        m_mixRing = NULL;
+    }
+    m_mixW.store(0, std::memory_order_relaxed);
+    m_mixR.store(0, std::memory_order_relaxed);
+    m_mixPhase = 0;
+    m_mixPrev[0] = m_mixPrev[1] = m_mixNext[0] = m_mixNext[1] = 0;
+    m_duckGain = 1 << 24;
+    bool ok = true;
+    if(source) {
+        if(source->m_mixSrc || m_mixTarget.load(std::memory_order_relaxed)) ok = false; // no chains
+        if(ok) m_mixRing = (int16_t*)__malloc_heap_psram(m_mixFrames * 2 * sizeof(int16_t));
+        if(ok && !m_mixRing) {
+            log_e("oom");
+            ok = false;
+        }
+        if(ok) {
+            xSemaphoreTake(source->mutex_playAudioData, portMAX_DELAY);
+            Audio* expected = nullptr;
+            ok = source->m_mixTarget.compare_exchange_strong(expected, this, std::memory_order_acq_rel); // one target per source
+            xSemaphoreGive(source->mutex_playAudioData);
+        }
+        if(ok) m_mixSrc = source;
+        else if(m_mixRing) {
+            free(m_mixRing);
+            m_mixRing = NULL;
+        }
+    }
+    xSemaphoreGive(mutex_playAudioData);
+    return ok;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setDucking(int8_t duck_dB, uint16_t attack_ms, uint16_t release_ms) {
+    // level of the program while the mixer source plays (-60 ... 0 dB), ramp times down (attack) and back up (release)
+    duck_dB = constrain(duck_dB, -60, 0);
+    m_duckLevel = (uint32_t)(16777216.0f * powf(10.0f, duck_dB / 20.0f));
+    m_duckAttack_ms = attack_ms;
+    m_duckRelease_ms = release_ms;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::mixerPush(const uint8_t* data, uint32_t frames, bool hiRes, uint32_t rate) {
+    // audio task of the source, never blocks, returns the number of frames taken. Hi-res frames (24 bit in 32 bit slots) are cut to 16 bit
+    uint32_t w = m_mixW.load(std::memory_order_relaxed);
+    uint32_t space = m_mixFrames - (w - m_mixR.load(std::memory_order_acquire));
+    if(frames > space) frames = space;
+    if(!frames) return 0;
+    m_mixRate.store(rate, std::memory_order_relaxed);
+    for(uint32_t i = 0; i < frames; i++) {
+        uint32_t pos = ((w + i) & (m_mixFrames - 1)) * 2;
+        if(hiRes) {
+            m_mixRing[pos]     = ((const int32_t*)data)[2 * i] >> 16;
+            m_mixRing[pos + 1] = ((const int32_t*)data)[2 * i + 1] >> 16;
+        }
+        else {
+            m_mixRing[pos]     = ((const int16_t*)data)[2 * i];
+            m_mixRing[pos + 1] = ((const int16_t*)data)[2 * i + 1];
+        }
+    }
+    m_mixW.store(w + frames, std::memory_order_release);
+    return frames;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> void Audio::mixer(T* block, uint16_t frames) {
+    // block level mix in int32: program * duck gain + source, the source is resampled (linear) from its rate to the output rate
+    uint32_t r = m_mixR.load(std::memory_order_relaxed);
+    uint32_t w = m_mixW.load(std::memory_order_acquire);
+    bool     active = (w != r) || m_mixSrc->m_f_running;
+    uint32_t target = active ? m_duckLevel : (1 << 24);
+    if(!active && m_duckGain == target && !m_mixNext[0] && !m_mixNext[1] && !m_mixPrev[0] && !m_mixPrev[1]) return; // idle
+
+    const int32_t maxV = (sizeof(T) == sizeof(int32_t)) ? 0x7FFFFF : 0x7FFF;
+    const uint8_t up = (sizeof(T) == sizeof(int32_t)) ? 8 : 0; // 16 bit source into 24 bit samples
+    uint32_t dstRate = m_i2sRate ? m_i2sRate : 44100;
+    uint32_t srcRate = m_mixRate.load(std::memory_order_relaxed);
+    uint32_t step = srcRate ? ((uint64_t)srcRate << 16) / dstRate : 65536;
+    uint32_t ramp_ms = (target < m_duckGain) ? m_duckAttack_ms : m_duckRelease_ms;
+    uint32_t delta = ((1 << 24) - m_duckLevel) / (ramp_ms * dstRate / 1000 + 1) + 1; // per frame
+    uint32_t r0 = r;
+
+    for(int i = 0; i < frames; i++) {
+        if(m_duckGain > target) m_duckGain = (m_duckGain - target > delta) ? m_duckGain - delta : target;
+        else if(m_duckGain < target) m_duckGain = (target - m_duckGain > delta) ? m_duckGain + delta : target;
+        int32_t g = m_duckGain >> 9; // Q15
+        for(int c = 0; c < 2; c++) {
+            int32_t src = m_mixPrev[c] + (((m_mixNext[c] - m_mixPrev[c]) * (int32_t)(m_mixPhase >> 1)) >> 15);
+            int32_t v = (int32_t)(((int64_t)block[2 * i + c] * g) >> 15) + (src << up);
+            block[2 * i + c] = (v > maxV) ? maxV : (v < -maxV) ? -maxV : v;
+        }
+        m_mixPhase += step;
+        while(m_mixPhase >= 65536) {
+            m_mixPhase -= 65536;
+            m_mixPrev[0] = m_mixNext[0];
+            m_mixPrev[1] = m_mixNext[1];
+            if(r != w) { // otherwise the source is starved (or done), fade to zero
+                uint32_t pos = (r & (m_mixFrames - 1)) * 2;
+                m_mixNext[0] = m_mixRing[pos];
+                m_mixNext[1] = m_mixRing[pos + 1];
+                r++;
+            }
+            else m_mixNext[0] = m_mixNext[1] = 0;
+        }
+    }
+    if(r != r0) {
+        m_mixR.store(r, std::memory_order_release);
+        if(m_mixSrc->m_audioTaskHandle) xTaskNotifyGive(m_mixSrc->m_audioTaskHandle); // room in the ring
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::playIdle() {
+    // this object plays nothing (stopped, paused, connecting), mixer source and clips are still heard: silence through the
+    // DSP chain, the mixer source is added there, the clips in playChunk() or the I2S writer
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    if(m_validSamples) playChunk(); // rest of the last block
+    else {
+        const uint16_t frames = 256;
+        bool f_mix = false;
+        if(m_mixSrc) {
+            uint32_t avail = m_mixW.load(std::memory_order_acquire) - m_mixR.load(std::memory_order_relaxed);
+            uint32_t srcRate = m_mixRate.load(std::memory_order_relaxed);
+            uint32_t dstRate = m_i2sRate ? m_i2sRate : 44100;
+            uint32_t need = (uint32_t)(((uint64_t)frames * srcRate) / dstRate) + 1; // source frames for one block
+            f_mix = avail && (avail >= need || !m_mixSrc->m_f_running); // whole blocks while the source runs, the rest at its end
+        }
+        if(f_mix || clipsPlaying()) {
+            memset(m_outBuff, 0, frames * 2 * (m_f_hiRes ? sizeof(int32_t) : sizeof(int16_t)));
+            processDSP(m_outBuff, frames);
+            playChunk();
+        }
+    }
+    xSemaphoreGive(mutex_playAudioData);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+int8_t Audio::loadClip(const int16_t* pcm, uint32_t frames, uint8_t channels, uint32_t sampleRate) {
+    // copies decoded 16 bit PCM (mono or interleaved stereo) into PSRAM, returns the clip number for playClip() or -1
+    if(!pcm || !frames || (channels != 1 && channels != 2) || !sampleRate) return -1;
+    int16_t* buf = (int16_t*)__malloc_heap_psram(frames * 2 * sizeof(int16_t));
+    if(!buf) {log_e("oom"); return -1;}
+    for(uint32_t i = 0; i < frames; i++) {
+        buf[2 * i]     = pcm[i * channels];
+        buf[2 * i + 1] = pcm[i * channels + channels - 1];
+    }
+    return clipAdd(buf, frames, sampleRate);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+int8_t Audio::clipAdd(int16_t* buf, uint32_t frames, uint32_t sampleRate) {
+    // takes over buf (stereo frames, PSRAM), frees it if there is no free slot
+    int8_t id = -1;
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    for(int i = 0; i < m_clipMax; i++) if(!m_clip[i].pcm) {id = i; break;}
+    if(id >= 0) {
+        m_clip[id].frames = frames;
+        m_clip[id].rate = sampleRate;
+        m_clip[id].f_unload = false;
+        m_clip[id].pcm = buf;
+        m_clipCount++;
+    }
+    xSemaphoreGive(mutex_playAudioData);
+    if(id < 0) {log_e("no free clip slot"); free(buf);}
+    return id;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+#ifndef AUDIO_NO_SD_FS
+int8_t Audio::loadClip(fs::FS& fs, const char* path) {
+    // 16 bit PCM WAV, mono or stereo, any sample rate (resampled while playing). The samples are read into the clip
+    // buffer, mono into its upper half and spread to stereo frames in place
+    File f = fs.open(path);
+    if(!f) {log_e("clip %s not found", path); return -1;}
+    uint8_t  hdr[12];
+    uint8_t  channels = 0;
+    uint16_t bits = 0;
+    uint32_t rate = 0;
+    int8_t   id = -1;
+    if(f.read(hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {log_e("clip %s is not a WAV file", path); f.close(); return -1;}
+    while(f.read(hdr, 8) == 8) {
+        uint32_t len = hdr[4] | (hdr[5] << 8) | (hdr[6] << 16) | (hdr[7] << 24);
+        if(!memcmp(hdr, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if(len < 16 || f.read(fmt, 16) != 16) break;
+            if((fmt[0] | (fmt[1] << 8)) != 1) break; // PCM only
+            channels = fmt[2];
+            rate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | (fmt[7] << 24);
+            bits = fmt[14] | (fmt[15] << 8);
+            f.seek(f.position() + len - 16 + (len & 1));
+        }
+        else if(!memcmp(hdr, "data", 4)) {
+            if(bits != 16 || (channels != 1 && channels != 2) || !rate) break;
+            uint32_t frames = len / (2 * channels);
+            if(!frames) break;
+            int16_t* buf = (int16_t*)__malloc_heap_psram(frames * 2 * sizeof(int16_t));
+            if(!buf) {log_e("oom"); break;}
+            int16_t* dst = buf + (2 - channels) * frames; // mono: upper half
+            if(f.read((uint8_t*)dst, frames * 2 * channels) != frames * 2 * channels) {free(buf); break;}
+            if(channels == 1) {
+                for(uint32_t i = 0; i < frames; i++) { // frame i is written below dst[i], not read yet
+                    int16_t x = dst[i];
+                    buf[2 * i] = buf[2 * i + 1] = x;
+                }
+            }
+            id = clipAdd(buf, frames, rate);
+            break;
+        }
+        else f.seek(f.position() + len + (len & 1));
+    }
+    f.close();
+    if(id < 0) log_e("clip %s: no 16 bit PCM data", path);
+    return id;
+}
+#endif
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::unloadClip(int8_t clip) {
+    // stops the voices that play the clip, waits until the mixer has let go of them and frees the memory. The slot is
+    // marked first, playClip() checks the mark under the same mutex and can't start a new voice while we wait
+    if(clip < 0 || clip >= m_clipMax) return false;
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    bool ok = m_clip[clip].pcm && !m_clip[clip].f_unload;
+    if(ok) m_clip[clip].f_unload = true;
+    xSemaphoreGive(mutex_playAudioData);
+    if(!ok) return false;
+    uint32_t t = millis();
+    for(int v = 0; v < AUDIO_CLIP_VOICES; v++) {
+        uint8_t expected = VOICE_PLAY;
+        if(m_voice[v].clip == clip) m_voice[v].state.compare_exchange_strong(expected, VOICE_STOP, std::memory_order_acq_rel);
+        while(m_voice[v].clip == clip && m_voice[v].state.load(std::memory_order_acquire) != VOICE_IDLE) {
+            if(millis() - t > 500) {
+                log_e("clip %i is still in use", clip);
+                xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+                m_clip[clip].f_unload = false; // still loaded, a later unloadClip() can try again
+                xSemaphoreGive(mutex_playAudioData);
+                return false;
+            }
+            vTaskDelay(1);
+        }
+    }
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    free(m_clip[clip].pcm);
+    m_clip[clip].pcm = NULL;
+    m_clip[clip].f_unload = false;
+    m_clipCount--;
+    xSemaphoreGive(mutex_playAudioData);
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+int8_t Audio::playClip(int8_t clip, int8_t gain_dB) {
+    // starts a loaded clip on a free voice, mixed into the output with the next DMA buffer, no allocation. Returns the voice or -1
+    if(clip < 0 || clip >= m_clipMax) return -1;
+    int8_t voice = -1;
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY); // like loadClip() and unloadClip(), which can't free the clip in between
+    for(int v = 0; v < AUDIO_CLIP_VOICES && m_clip[clip].pcm && !m_clip[clip].f_unload; v++) {
+        uint8_t expected = VOICE_IDLE;
+        if(!m_voice[v].state.compare_exchange_strong(expected, VOICE_SETUP, std::memory_order_acquire)) continue;
+        m_voice[v].clip = clip;
+        m_voice[v].gain = (int16_t)min(32767.0f, 32768.0f * powf(10.0f, constrain(gain_dB, -60, 0) / 20.0f));
+        m_voice[v].pos = 0;
+        m_voice[v].state.store(VOICE_PLAY, std::memory_order_release);
+        voice = v;
+        break;
+    }
+    xSemaphoreGive(mutex_playAudioData);
+    if(voice >= 0 && m_audioTaskHandle) xTaskNotifyGive(m_audioTaskHandle); // idle: the audio task starts the output
+    return voice;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::stopClip(int8_t voice) {
+    for(int v = 0; v < AUDIO_CLIP_VOICES; v++) {
+        if(voice >= 0 && v != voice) continue;
+        uint8_t expected = VOICE_PLAY;
+        m_voice[v].state.compare_exchange_strong(expected, VOICE_STOP, std::memory_order_acq_rel);
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::clipsPlaying() {
+    for(int v = 0; v < AUDIO_CLIP_VOICES; v++) if(m_voice[v].state.load(std::memory_order_relaxed) != VOICE_IDLE) return true;
+    return false;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::clipMix(uint8_t* data, uint32_t frames) {
+    // adds the playing voices to frames that are about to be written to I2S (after the DSP chain: hi-res samples are in
+    // the upper 24 bit of the slot, the internal DAC gets offset binary). Runs in the audio task or in the I2S writer
+    uint32_t dstRate = m_i2sRate ? m_i2sRate : 44100;
+    for(int v = 0; v < AUDIO_CLIP_VOICES; v++) {
+        voice_t* vc = &m_voice[v];
+        uint8_t  state = vc->state.load(std::memory_order_acquire);
+        if(state == VOICE_STOP) {vc->state.store(VOICE_IDLE, std::memory_order_release); continue;}
+        if(state != VOICE_PLAY) continue;
+        const clip_t* c = &m_clip[vc->clip];
+        uint32_t step = ((uint64_t)c->rate << 16) / dstRate;
+        bool     done = false;
+        for(uint32_t i = 0; i < frames; i++) {
+            uint32_t idx = vc->pos >> 16;
+            if(idx + 1 >= c->frames) {done = true; break;}
+            int32_t frac = (vc->pos & 0xFFFF) >> 1; // Q15
+            for(int ch = 0; ch < 2; ch++) {
+                int32_t a = c->pcm[2 * idx + ch];
+                int32_t b = c->pcm[2 * idx + 2 + ch];
+                int32_t x = ((a + (((b - a) * frac) >> 15)) * vc->gain) >> 15;
+                if(m_f_hiRes) {
+                    int32_t* s = (int32_t*)data + 2 * i + ch;
+                    int64_t  y = (int64_t)*s + ((int64_t)x << 16);
+                    *s = (y > INT32_MAX) ? INT32_MAX : (y < INT32_MIN) ? INT32_MIN : (int32_t)y;
+                }
+                else {
+                    int16_t* s = (int16_t*)data + 2 * i + ch;
+                    int32_t  y = (m_f_internalDAC ? (int16_t)(*s - 0x8000) : *s) + x;
+                    y = (y > 32767) ? 32767 : (y < -32768) ? -32768 : y;
+                    *s = m_f_internalDAC ? (int16_t)(y + 0x8000) : (int16_t)y;
+                }
+            }
+            vc->pos += step;
+        }
+        if(done) {
+            uint8_t expected = VOICE_PLAY;
+            vc->state.compare_exchange_strong(expected, VOICE_IDLE, std::memory_order_release);
+        }
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::getStats(uint8_t stage, stats_t* st) {
+    // snapshot of one stage, the histogram is written by the task that runs the stage, no lock is taken: it is copied
+    // like getVUmeter() does, again if the writer has updated it meanwhile (the 64 bit sums can't be read atomically)
+    if(!st) return false;
+    memset(st, 0, sizeof(stats_t));
+#ifdef AUDIO_STATS
+    if(stage >= STAT_STAGES) return false;
+    if(m_statReset.load(std::memory_order_acquire) & (1 << stage)) return true; // cleared, no new call yet
+    stat_hist_t  snap;
+    stat_hist_t* h = &snap;
+    uint32_t     seq;
+    do {
+        seq = m_statSeq[stage].load(std::memory_order_acquire);
+        if(seq & 1) continue;
+        memcpy(&snap, &m_stat[stage], sizeof(stat_hist_t));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((seq & 1) || seq != m_statSeq[stage].load(std::memory_order_relaxed));
+    st->count  = h->count;
+    st->min    = h->count ? h->min : 0;
+    st->max    = h->max;
+    st->cycles = h->cycles;
+    st->bytes  = h->bytes;
+    uint32_t total = 0;
+    for(int i = 0; i < 128; i++) total += h->bucket[i];
+    if(!total) return true;
+    uint32_t sum = 0, n50 = (total + 1) / 2, n99 = total - total / 100;
+    for(int i = 0; i < 128; i++) {
+        if(!h->bucket[i]) continue;
+        sum += h->bucket[i];
+        uint64_t edge = (i < 4) ? i : ((uint64_t)(5 + (i & 3)) << ((i >> 2) - 1)) - 1; // highest value of the bucket
+        if(edge > st->max) edge = st->max;
+        if(!st->p50 && sum >= n50) st->p50 = edge;
+        if(sum >= n99) { st->p99 = edge; break; }
+    }
+    return true;
+#else
+    (void)stage;
+    return false;
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::resetStats() {
+#ifdef AUDIO_STATS
+    m_statReset.store((1 << STAT_STAGES) - 1, std::memory_order_release); // the writer of each stage clears its own histogram
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+#ifdef AUDIO_STATS
+void Audio::statRecord(uint8_t stage, uint32_t t0, BaseType_t core, uint32_t bytes) {
+    uint32_t dt = ESP.getCycleCount() - t0;
+    if(xPortGetCoreID() != core) return; // the task was moved, the cycle counters of the two cores are not in sync
+    stat_hist_t* h = &m_stat[stage];
+    m_statSeq[stage].fetch_add(1, std::memory_order_acq_rel); // odd, the histogram is being written
+    if(m_statReset.load(std::memory_order_relaxed) & (1 << stage)) {
+        memset(h, 0, sizeof(stat_hist_t));
+        m_statReset.fetch_and(~(1 << stage), std::memory_order_release);
+    }
+    uint8_t idx = dt; // 4 buckets per octave: 0..3 linear, then exponent and the two bits below the leading one
+    if(dt >= 4) {
+        uint8_t e = 31 - __builtin_clz(dt);
+        idx = ((e - 1) << 2) + ((dt >> (e - 2)) & 3);
+    }
+    h->bucket[idx]++;
+    if(!h->count || dt < h->min) h->min = dt;
+    if(dt > h->max) h->max = dt;
+    h->cycles += dt;
+    h->bytes  += bytes;
+    h->count++;
+    m_statSeq[stage].fetch_add(1, std::memory_order_release); // even, valid
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint8_t Audio::statDecodeStage(uint8_t codec) {
+    switch(codec) {
+        case CODEC_MP3:    return STAT_DECODE_MP3;
+        case CODEC_AAC:    return STAT_DECODE_AAC;
+        case CODEC_M4A:    return STAT_DECODE_AAC;
+        case CODEC_FLAC:   return STAT_DECODE_FLAC;
+        case CODEC_OPUS:   return STAT_DECODE_OPUS;
+        case CODEC_VORBIS: return STAT_DECODE_VORBIS;
+        default:           return STAT_DECODE_WAV;
+    }
+}
+#endif
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setTone(int8_t gainLowPass, int8_t gainBandPass, int8_t gainHighPass) {
+    // see https://www.earlevel.com/main/2013/10/13/biquad-calculator-v2/
+    // values can be between -40 ... +6 (dB)
+
+    IIR_lock();
+    m_eqBand[0].gain = constrain(gainLowPass, -40, 6);  // lowshelf  500Hz
+    m_eqBand[1].gain = constrain(gainBandPass, -40, 6); // peakEQ   3000Hz
+    m_eqBand[2].gain = constrain(gainHighPass, -40, 6); // highshelf 6000Hz
+    IIR_calculateCoefficients();
+    IIR_unlock();
+
+    /*
+          Flushing the filters would cause a clicking sound when adjusting the EQ.
+          The new coefficients are therefore not written into the running filter, the audio task takes them over
+          at the beginning of the next block and interpolates from the old to the new values across this block.
+        */
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setEqBand(uint8_t band, uint8_t type, uint16_t freq, float q, int8_t gain) {
+    // parametric equalizer, band 0...2 are used by setTone(), the cost grows with the number of used bands
+    // type: LOWSHELF, PEAKEQ, HIGHSHELF, LOWPASS, HIGHPASS, freq: 20...20000Hz, q: 0.1...20, gain: -40...+12 (dB)
+
+    if(band >= m_eqMaxBands || type > HIGHPASS) return false;
+    IIR_lock();
+    m_eqBand[band].type = type;
+    m_eqBand[band].freq = constrain(freq, 20, 20000);
+    m_eqBand[band].q    = constrain(q, 0.1f, 20.0f);
+    m_eqBand[band].gain = constrain(gain, -40, 12);
+    m_eqBand[band].used = true;
+    IIR_calculateCoefficients();
+    IIR_unlock();
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::clearEqBand(uint8_t band) {
+    if(band >= m_eqMaxBands) return;
+    IIR_lock();
+    m_eqBand[band].used = false;
+    IIR_calculateCoefficients();
+    IIR_unlock();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::forceMono(bool m) { // #100 mono option
+    m_f_forceMono = m;          // false stereo, true mono
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setBalance(int8_t bal) { // bal -16...16
+    if(bal < -16) bal = -16;
+    if(bal > 16) bal = 16;
+    m_balance = bal;
+
+    computeLimit();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setVolume(uint8_t vol, uint8_t curve) { // curve 0: default, curve 1: flat at the beginning
 
     uint16_t v = ESP_ARDUINO_VERSION_MAJOR * 100 + ESP_ARDUINO_VERSION_MINOR * 10 + ESP_ARDUINO_VERSION_PATCH;
     if(v < 207) AUDIO_INFO("Do not use this ancient Adruino version V%d.%d.%d", ESP_ARDUINO_VERSION_MAJOR, ESP_ARDUINO_VERSION_MINOR, ESP_ARDUINO_VERSION_PATCH);
@@ -5261,35 +6689,241 @@ uint8_t Audio::getVolume() { return m_vol; }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint8_t Audio::getI2sPort() { return m_i2s_num; }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::computeVolumeTable() { // is calculated when the number of volume steps changes
+    // Q15 gain (32768 == 1.0) for every volume step and both volume curves, Gain() needs no floating point
+    double log1 = log(1);
+    for(int vol = 0; vol <= m_vol_steps; vol++) {
+        double v0 = (double)pow(vol, 2) / pow(m_vol_steps, 2); // square (default)
+        double v1 = 0;                                          // logarithmic
+        if(vol > 0 && m_vol_steps > 1) { v1 = vol * ((std::exp(log1 + (vol - 1) * (std::log(m_vol_steps) - log1) / (m_vol_steps - 1))) / m_vol_steps) / m_vol_steps; }
+        if(vol > 0 && m_vol_steps == 1) { v1 = 1; }
+        m_volTable[0][vol] = (uint16_t)round(constrain(v0, 0.0, 1.0) * 32768);
+        m_volTable[1][vol] = (uint16_t)round(constrain(v1, 0.0, 1.0) * 32768);
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::computeLimit() {    // is calculated when the volume or balance changes
-    double l = 1, r = 1, v = 1; // assume 100%
+    uint32_t v = m_volTable[m_curve][min(m_vol, (uint16_t)m_vol_steps)];
+    int32_t g = m_headerGain; // header gain + ReplayGain or auto gain, 1/256 dB, folded into the volume
+    int16_t rg = (m_rgMode == RG_ALBUM && m_rgAlbum != INT16_MIN) ? m_rgAlbum : m_rgTrack;
+    if(m_rgMode != RG_OFF) g = m_rgPreamp * 256;
+    if(m_rgMode != RG_OFF && rg != INT16_MIN) g += rg;
+    else if(m_f_agc) g += m_agcGain.load(std::memory_order_relaxed); // no tags, the loudness meter normalizes
+    if(g) {
+        uint32_t f = (uint32_t)lrintf(powf(10.0f, g / (256.0f * 20.0f)) * 32768); // Q15
+        v = min((uint32_t)(((uint64_t)v * f) >> 15), (uint32_t)65535); // 16 bit per channel, max. +6dB
+    }
+    uint32_t l = v, r = v; // Q15
 
     /* balance is left -16...+16 right */
     /* TODO: logarithmic scaling of balance, too? */
-    if(m_balance < 0) { r -= (double)abs(m_balance) / 16; }
-    else if(m_balance > 0) { l -= (double)abs(m_balance) / 16; }
-
-    switch(m_curve) {
-        case 0:
-            v = (double)pow(m_vol, 2) / pow(m_vol_steps, 2); // square (default)
-            break;
-        case 1: // logarithmic
-            double log1 = log(1);
-            if(m_vol > 0) { v = m_vol * ((std::exp(log1 + (m_vol - 1) * (std::log(m_vol_steps) - log1) / (m_vol_steps - 1))) / m_vol_steps) / m_vol_steps; }
-            else { v = 0; }
-            break;
-    }
+    if(m_balance < 0) { r = r * (16 + m_balance) / 16; }
+    else if(m_balance > 0) { l = l * (16 - m_balance) / 16; }
 
-    m_limit_left = l * v;
-    m_limit_right = r * v;
+    m_gainTarget.store(l | (r << 16), std::memory_order_release); // both channels at once, taken over in Gain()
 
-    // log_i("m_limit_left %f,  m_limit_right %f ",m_limit_left, m_limit_right);
+    // log_i("gain left %lu,  gain right %lu ", l, r);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> void Audio::Gain(T* block, uint16_t frames) {
+    // Q15 integer gain, if the volume or balance has changed, the gain moves linearly to the new value across
+    // the block (no zipper noise), 24 bit samples need a 64 bit product
+    typedef typename std::conditional<sizeof(T) == sizeof(int16_t), int32_t, int64_t>::type acc_t;
+    const acc_t maxV = (sizeof(T) == sizeof(int16_t)) ? 32767 : 8388607; // ReplayGain can amplify
+    uint32_t target = m_gainTarget.load(std::memory_order_acquire);
+    int32_t  tgt[2] = {(int32_t)(target & 0xFFFF), (int32_t)(target >> 16)};
+
+    for(int ch = LEFTCHANNEL; ch <= RIGHTCHANNEL; ch++) {
+        T*      s = block + ch;
+        int32_t g = m_gainCur[ch];
+        if(g == tgt[ch]) {
+            if(g == 32768) continue; // unity gain
+            for(int i = 0; i < frames; i++) {
+                acc_t y = ((acc_t)*s * g + 0x4000) >> 15;
+                *s = (T)(y > maxV ? maxV : (y < -maxV ? -maxV : y));
+                s += 2;
+            }
+        }
+        else if(frames) {
+            int32_t acc = g * 256; // Q15.8, fine steps
+            int32_t step = ((tgt[ch] - g) * 256) / frames;
+            for(int i = 0; i < frames; i++) {
+                acc += step;
+                acc_t y = ((acc_t)*s * (acc >> 8) + 0x4000) >> 15;
+                *s = (T)(y > maxV ? maxV : (y < -maxV ? -maxV : y));
+                s += 2;
+            }
+            m_gainCur[ch] = tgt[ch];
+        }
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::setReplayGain(uint8_t mode, int8_t preamp_dB) {
+    // mode: RG_OFF, RG_TRACK, RG_ALBUM (falls back to the track gain), preamp: -15 ... +15 dB
+    // the gain of the tags is folded into the volume, together with the volume the gain is limited to +6dB
+    if(mode > RG_ALBUM) mode = RG_ALBUM;
+    if(preamp_dB < -15) preamp_dB = -15;
+    if(preamp_dB > 15) preamp_dB = 15;
+    m_rgMode = mode;
+    m_rgPreamp = preamp_dB;
+    computeLimit();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::replayGainTag(const char* key, const char* value) {
+    int16_t g;
+    bool    album;
+    if(!replayGainParse(key, value, &g, &album)) return;
+    if(album) replayGainSet(INT16_MIN, g);
+    else      replayGainSet(g, INT16_MIN);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::replayGainSet(int16_t track, int16_t album) { // 1/256 dB, INT16_MIN: not given
+    if(track == INT16_MIN && album == INT16_MIN) return;
+    if(track != INT16_MIN) m_rgTrack = track;
+    if(album != INT16_MIN) m_rgAlbum = album;
+    if(m_f_Log) log_i("ReplayGain track %.2f dB, album %.2f dB", m_rgTrack == INT16_MIN ? 0 : m_rgTrack / 256.0, m_rgAlbum == INT16_MIN ? 0 : m_rgAlbum / 256.0);
+    computeLimit();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::replayGainID3(const uint8_t* frame, uint32_t size) {
+    // TXXX: encoding, description '\0' value, the UTF-16 encodings (1, 2) are reduced to ASCII
+    char     buf[2][48];
+    uint8_t  w = (frame[0] == 1 || frame[0] == 2) ? 2 : 1; // bytes per character
+    uint32_t i = 1;
+    for(int f = 0; f < 2; f++) {
+        uint8_t n = 0;
+        if(w == 2 && i + 1 < size && (frame[i] | frame[i + 1]) == 0xFF && (frame[i] & frame[i + 1]) == 0xFE) i += 2; // BOM
+        while(i + w <= size) {
+            uint8_t c = (w == 2) ? (frame[i] | frame[i + 1]) : frame[i];
+            i += w;
+            if(c == 0) break;
+            if(n < sizeof(buf[0]) - 1) buf[f][n++] = c;
+        }
+        buf[f][n] = '\0';
+    }
+    replayGainTag(buf[0], buf[1]);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setLimiter(bool enable, int8_t threshold_dB, uint8_t ratio, uint16_t attack_ms, uint16_t release_ms, uint8_t lookahead_ms) {
+    // look-ahead peak limiter / compressor after the equalizer, threshold: -30 ... 0 dBFS, ratio: 0 (limiter) or 1 ... 20,
+    // attack: 1 ... 100 ms, release: 10 ... 2000 ms, look-ahead: 0 ... 10 ms (the audio is delayed by this time)
+    // The EQ does not clip: 16 bit samples are attenuated by the EQ and the limiter restores the level, 24 bit samples
+    // (hi-res) keep the boost in the int32 headroom. In both cases the limiter only pulls the peaks down.
+
+    if(enable && !m_limRing) {
+        m_limRing = (int32_t*)__malloc_heap_psram(m_limRingSize * 2 * sizeof(int32_t));
+        if(!m_limRing) {
+            log_e("oom");
+            return false;
+        }
+    }
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    m_limThr = (int32_t)(constrain(threshold_dB, -30, 0) / 6.0206f * 65536.0f);
+    m_limRatio = min(ratio, (uint8_t)20);
+    m_limAttack_ms = constrain(attack_ms, 1, 100);
+    m_limRelease_ms = constrain(release_ms, 10, 2000);
+    m_limLookahead_ms = min(lookahead_ms, (uint8_t)10);
+    bool changed = (enable != m_f_limiter);
+    m_f_limiter = enable;
+    if(changed) { // the EQ pre-attenuation depends on the limiter
+        IIR_lock();
+        IIR_calculateCoefficients();
+        IIR_unlock();
+    }
+    if(enable && changed) { // empty delay line and unity gain
+        memset(m_limRing, 0, m_limRingSize * 2 * sizeof(int32_t));
+        m_limW = 0;
+        m_limPk = 0;
+        m_limCnt = 0;
+        m_limGr = 32768;
+        m_limG = m_limGt = m_limMakeup.load(std::memory_order_relaxed) << 8;
+        m_limStep = 0;
+        for(int i = 0; i < 32; i++) m_limHold[i] = 32768;
+    }
+    limiterSetup();
+    xSemaphoreGive(mutex_playAudioData);
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::limiterSetup() {
+    // rate dependent values, has to be called if the output rate changes, the caller holds mutex_playAudioData or is the audio task
+    uint32_t sr = getOutputRate();
+    if(!sr) sr = 44100;
+    m_limDelay = min((uint32_t)m_limLookahead_ms * sr / 1000, (uint32_t)m_limRingSize - m_limSub);
+    m_limHoldLen = m_limDelay / m_limSub + 1;
+    m_limKa = (int32_t)((1.0f - expf(-(float)m_limSub * 1000.0f / (m_limAttack_ms * sr))) * 32768.0f);
+    m_limKr = (int32_t)((1.0f - expf(-(float)m_limSub * 1000.0f / (m_limRelease_ms * sr))) * 32768.0f);
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::Gain(int16_t* sample) {
-    /* important: these multiplications must all be signed ints, or the result will be invalid */
-    sample[LEFTCHANNEL]  *= m_limit_left ;
-    sample[RIGHTCHANNEL] *= m_limit_right;
+template <typename T> void Audio::limiter(T* block, uint16_t frames) {
+    // the detector sees the samples when they enter the delay line, the gain is applied when they leave it,
+    // so the gain is already down when a peak arrives. Every m_limSub frames a new gain is computed, in between
+    // the gain moves linearly (integer only, Q20)
+
+    const int32_t maxV = (sizeof(T) == sizeof(int16_t)) ? 32767 : 8388607;
+    const int32_t fsLog = (sizeof(T) == sizeof(int16_t)) ? (15 << 16) : (23 << 16);
+    const int32_t makeup = m_limMakeup.load(std::memory_order_relaxed);
+    const uint16_t mask = m_limRingSize - 1;
+
+    for(int i = 0; i < frames * 2; i += 2) {
+        int32_t  l = block[i + LEFTCHANNEL];
+        int32_t  r = block[i + RIGHTCHANNEL];
+        uint32_t a = max(abs(l), abs(r));
+        if(a > m_limPk) m_limPk = a;
+
+        uint16_t w = m_limW & mask;
+        uint16_t d = (m_limW - m_limDelay) & mask;
+        m_limW++;
+        m_limRing[2 * w + LEFTCHANNEL] = l;
+        m_limRing[2 * w + RIGHTCHANNEL] = r;
+        l = m_limRing[2 * d + LEFTCHANNEL];
+        r = m_limRing[2 * d + RIGHTCHANNEL];
+
+        l = (int32_t)(((int64_t)l * m_limG + (1 << 19)) >> 20);
+        r = (int32_t)(((int64_t)r * m_limG + (1 << 19)) >> 20);
+        block[i + LEFTCHANNEL]  = (T)constrain(l, -maxV - 1, maxV);
+        block[i + RIGHTCHANNEL] = (T)constrain(r, -maxV - 1, maxV);
+        m_limG += m_limStep;
+
+        if(++m_limCnt == m_limSub) limiterGain(fsLog, makeup);
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::limiterGain(int32_t fsLog, int32_t makeup) {
+    // static curve in the log2 domain (Q16): above the threshold the level rises only by 1/ratio,
+    // the lowest target within the look-ahead is followed with the attack and release coefficients
+
+    auto log2Q16 = [](uint32_t x) -> int32_t { // x > 0, log2(1 + f) ~ f + 0.3431 * f * (1 - f)
+        int32_t  n = 31 - __builtin_clz(x);
+        uint32_t f = (n >= 16 ? x >> (n - 16) : x << (16 - n)) - 65536;
+        return (n << 16) + f + (int32_t)(((uint64_t)f * (65536 - f) * 22487) >> 32);
+    };
+    auto exp2Q15 = [](int32_t y) -> int32_t { // y <= 0, 2^f ~ 1 + f * (0.6565 + 0.3435 * f)
+        int32_t  i = y >> 16;
+        uint32_t f = y & 0xFFFF;
+        uint32_t m = 65536 + (uint32_t)(((uint64_t)f * (43025 + ((22512 * f) >> 16))) >> 16);
+        return (1 - i) < 31 ? (int32_t)(m >> (1 - i)) : 0;
+    };
+
+    int32_t  tgt = 32768;
+    uint32_t pk = ((uint64_t)m_limPk * makeup) >> 12;
+    if(pk) {
+        int32_t over = log2Q16(pk) - fsLog - m_limThr;
+        if(over > 0) tgt = exp2Q15(-(m_limRatio ? over - over / m_limRatio : over));
+    }
+    m_limPk = 0;
+    m_limCnt = 0;
+
+    m_limHold[m_limHoldIdx++ & 31] = tgt;
+    int32_t tMin = tgt;
+    for(int i = 1; i < m_limHoldLen; i++) tMin = min(tMin, m_limHold[(m_limHoldIdx - 1 - i) & 31]);
+
+    int32_t k = (tMin < m_limGr) ? m_limKa : m_limKr;
+    m_limGr += ((tMin - m_limGr) * k) >> 15;
+
+    m_limG = m_limGt;
+    m_limGt = (int32_t)(((int64_t)m_limGr * makeup) >> 7); // Q15 * Q12 -> Q20
+    m_limStep = (m_limGt - m_limG) / m_limSub;
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint32_t Audio::inBufferFilled() {
@@ -5307,251 +6941,548 @@ uint32_t Audio::inBufferSize() {
     return InBuff.getBufsize();
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-//            ***     D i g i t a l   b i q u a d r a t i c     f i l t e r     ***
+//            ***     C r o s s f a d e     ***
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::IIR_calculateCoefficients(int8_t G0, int8_t G1, int8_t G2) { // Infinite Impulse Response (IIR) filters
+bool Audio::setCrossfade(uint8_t seconds) {
+    // 0: off (gapless only), 1...10 s equal-power crossfade between the current file and the file queued with queueNextFS()
+    // There is only one decoder, so the tail of the current file is decoded ahead into a PSRAM buffer (at most m_xfDecodes
+    // frames per audio task cycle) and played from there. The head of the next file is mixed with that buffer in real time.
 
-    // G1 - gain low shelf   set between -40 ... +6 dB
-    // G2 - gain peakEQ      set between -40 ... +6 dB
-    // G3 - gain high shelf  set between -40 ... +6 dB
-    // https://www.earlevel.com/main/2012/11/26/biquad-c-source-code/
-
-    if(getSampleRate() < 1000) return; // fuse
-
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-    if(G0 < -40) G0 = -40; // -40dB -> Vin*0.01
-    if(G0 > 6) G0 = 6;     // +6dB -> Vin*2
-    if(G1 < -40) G1 = -40;
-    if(G1 > 6) G1 = 6;
-    if(G2 < -40) G2 = -40;
-    if(G2 > 6) G2 = 6;
-
-    const float FcLS = 500;    // Frequency LowShelf[Hz]
-    const float FcPKEQ = 3000; // Frequency PeakEQ[Hz]
-    float       FcHS = 6000;   // Frequency HighShelf[Hz]
-
-    if(getSampleRate() < FcHS * 2 - 100) { // Prevent HighShelf filter from clogging
-        FcHS = getSampleRate() / 2 - 100;
-        // according to the sampling theorem, the sample rate must be at least 2 * 6000 >= 12000Hz for a filter
-        // frequency of 6000Hz. If this is not the case, the filter frequency (plus a reserve of 100Hz) is lowered
-        AUDIO_INFO("Highshelf frequency lowered, from 6000Hz to %luHz", (long unsigned int)FcHS);
-    }
-    float K, norm, Q, Fc, V;
-
-    // LOWSHELF
-    Fc = (float)FcLS / (float)getSampleRate(); // Cutoff frequency
-    K = tanf((float)PI * Fc);
-    V = powf(10, fabs(G0) / 20.0);
-
-    if(G0 >= 0) { // boost
-        norm = 1 / (1 + sqrtf(2) * K + K * K);
-        m_filter[LOWSHELF].a0 = (1 + sqrtf(2 * V) * K + V * K * K) * norm;
-        m_filter[LOWSHELF].a1 = 2 * (V * K * K - 1) * norm;
-        m_filter[LOWSHELF].a2 = (1 - sqrtf(2 * V) * K + V * K * K) * norm;
-        m_filter[LOWSHELF].b1 = 2 * (K * K - 1) * norm;
-        m_filter[LOWSHELF].b2 = (1 - sqrtf(2) * K + K * K) * norm;
-    }
-    else { // cut
-        norm = 1 / (1 + sqrtf(2 * V) * K + V * K * K);
-        m_filter[LOWSHELF].a0 = (1 + sqrtf(2) * K + K * K) * norm;
-        m_filter[LOWSHELF].a1 = 2 * (K * K - 1) * norm;
-        m_filter[LOWSHELF].a2 = (1 - sqrtf(2) * K + K * K) * norm;
-        m_filter[LOWSHELF].b1 = 2 * (V * K * K - 1) * norm;
-        m_filter[LOWSHELF].b2 = (1 - sqrtf(2 * V) * K + V * K * K) * norm;
-    }
-
-    // PEAK EQ
-    Fc = (float)FcPKEQ / (float)getSampleRate(); // Cutoff frequency
-    K = tanf((float)PI * Fc);
-    V = powf(10, fabs(G1) / 20.0);
-    Q = 2.5;      // Quality factor
-    if(G1 >= 0) { // boost
-        norm = 1 / (1 + 1 / Q * K + K * K);
-        m_filter[PEAKEQ].a0 = (1 + V / Q * K + K * K) * norm;
-        m_filter[PEAKEQ].a1 = 2 * (K * K - 1) * norm;
-        m_filter[PEAKEQ].a2 = (1 - V / Q * K + K * K) * norm;
-        m_filter[PEAKEQ].b1 = m_filter[PEAKEQ].a1;
-        m_filter[PEAKEQ].b2 = (1 - 1 / Q * K + K * K) * norm;
-    }
-    else { // cut
-        norm = 1 / (1 + V / Q * K + K * K);
-        m_filter[PEAKEQ].a0 = (1 + 1 / Q * K + K * K) * norm;
-        m_filter[PEAKEQ].a1 = 2 * (K * K - 1) * norm;
-        m_filter[PEAKEQ].a2 = (1 - 1 / Q * K + K * K) * norm;
-        m_filter[PEAKEQ].b1 = m_filter[PEAKEQ].a1;
-        m_filter[PEAKEQ].b2 = (1 - V / Q * K + K * K) * norm;
-    }
-
-    // HIGHSHELF
-    Fc = (float)FcHS / (float)getSampleRate(); // Cutoff frequency
-    K = tanf((float)PI * Fc);
-    V = powf(10, fabs(G2) / 20.0);
-    if(G2 >= 0) { // boost
-        norm = 1 / (1 + sqrtf(2) * K + K * K);
-        m_filter[HIFGSHELF].a0 = (V + sqrtf(2 * V) * K + K * K) * norm;
-        m_filter[HIFGSHELF].a1 = 2 * (K * K - V) * norm;
-        m_filter[HIFGSHELF].a2 = (V - sqrtf(2 * V) * K + K * K) * norm;
-        m_filter[HIFGSHELF].b1 = 2 * (K * K - 1) * norm;
-        m_filter[HIFGSHELF].b2 = (1 - sqrtf(2) * K + K * K) * norm;
+    if(seconds > 10) seconds = 10;
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    m_xfState = XF_IDLE;
+    m_xfFill = 0;
+    m_xfSeconds = 0;
+    if(m_xfBuff) {free(m_xfBuff); m_xfBuff = NULL;}
+    m_xfAlloc = 0;
+    if(seconds) {
+        if(!m_f_psramFound) {
+            AUDIO_INFO("crossfade works only with PSRAM!");
+            xSemaphoreGive(mutex_playAudioData);
+            return false;
+        }
+        m_xfSeconds = seconds;
+        if(!m_xfOut) m_xfOut = (int16_t*)__malloc_heap_psram(m_xfOutFrames * 2 * sizeof(int16_t));
+        if(!m_xfOut || !xfAlloc(m_xfSeconds * (getOutputRate() ? getOutputRate() : 44100))) { // xfStart() grows it for a higher rate
+            log_e("oom");
+            m_xfSeconds = 0;
+            xSemaphoreGive(mutex_playAudioData);
+            return false;
+        }
+        for(int i = 0; i <= 256; i++) m_xfSin[i] = (int16_t)(32767.0f * sinf((float)PI / 2 * i / 256)); // quarter sine, Q15
     }
-    else {
-        norm = 1 / (V + sqrtf(2 * V) * K + K * K);
-        m_filter[HIFGSHELF].a0 = (1 + sqrtf(2) * K + K * K) * norm;
-        m_filter[HIFGSHELF].a1 = 2 * (K * K - 1) * norm;
-        m_filter[HIFGSHELF].a2 = (1 - sqrtf(2) * K + K * K) * norm;
-        m_filter[HIFGSHELF].b1 = 2 * (K * K - V) * norm;
-        m_filter[HIFGSHELF].b2 = (V - sqrtf(2 * V) * K + K * K) * norm;
+    xSemaphoreGive(mutex_playAudioData);
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::xfAlloc(uint32_t frames) {
+    // the ring holds at least this number of frames, the content is lost if it has to grow
+    if(frames <= m_xfAlloc) return true;
+    int16_t* p = (int16_t*)__malloc_heap_psram(frames * 2 * sizeof(int16_t));
+    if(!p) return false;
+    if(m_xfBuff) free(m_xfBuff);
+    m_xfBuff = p;
+    m_xfAlloc = frames;
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::xfStart() {
+    // called from processLocalFile(), the remaining playing time of the current file is less than the crossfade time
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    m_xfRead = 0;
+    m_xfWrite = 0;
+    m_xfFill = 0;
+    m_xfRate = getOutputRate();
+    m_xfSize = m_xfSeconds * m_xfRate; // frames, the fade is at most m_xfSeconds long
+    m_xfBusy_us = 0;
+    if(xfAlloc(m_xfSize)) m_xfState = XF_CAPTURE;
+    else log_e("oom, no crossfade");
+    xSemaphoreGive(mutex_playAudioData);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::xfWrite(int16_t* block, uint16_t frames) {
+    // appends frames (output rate) to the ring, frames that don't fit are dropped
+    if(frames > m_xfSize - m_xfFill) {
+        log_w("crossfade buffer overflow");
+        frames = m_xfSize - m_xfFill;
+    }
+    for(int i = 0; i < frames; i++) {
+        m_xfBuff[2 * m_xfWrite]     = block[2 * i];
+        m_xfBuff[2 * m_xfWrite + 1] = block[2 * i + 1];
+        if(++m_xfWrite == m_xfSize) m_xfWrite = 0;
+    }
+    m_xfFill += frames;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::xfFeed() {
+    // while the tail is captured (or the next file is starting): decode ahead into the ring, play from the ring
+
+    int64_t t = esp_timer_get_time();
+    if(m_xfState == XF_CAPTURE) {
+        uint32_t reserve = (m_outbuffSize / 4) * (getOutputRate() / getSampleRate() + 1); // frames of one decoded block, maybe resampled
+        for(int i = 0; i < m_xfDecodes; i++) {
+            if(m_xfSize - m_xfFill < reserve) break;
+            if(InBuff.bufferFilled() < InBuff.getMaxBlockSize() && !(m_f_decodeTail && InBuff.bufferFilled())) break;
+            decodeFrame(); // processFrames() writes into the ring
+        }
+    }
+    uint16_t n = min(m_xfFill, (uint32_t)m_xfOutFrames);
+    for(int i = 0; i < n; i++) {
+        m_xfOut[2 * i]     = m_xfBuff[2 * m_xfRead];
+        m_xfOut[2 * i + 1] = m_xfBuff[2 * m_xfRead + 1];
+        if(++m_xfRead == m_xfSize) m_xfRead = 0;
+    }
+    m_xfFill -= n;
+    m_xfBusy_us += esp_timer_get_time() - t;
+    if(n) {
+        processDSP(m_xfOut, n);
+        playChunk();
     }
-
-    //    log_i("LS a0=%f, a1=%f, a2=%f, b1=%f, b2=%f", m_filter[0].a0, m_filter[0].a1, m_filter[0].a2,
-    //                                                  m_filter[0].b1, m_filter[0].b2);
-    //    log_i("EQ a0=%f, a1=%f, a2=%f, b1=%f, b2=%f", m_filter[1].a0, m_filter[1].a1, m_filter[1].a2,
-    //                                                  m_filter[1].b1, m_filter[1].b2);
-    //    log_i("HS a0=%f, a1=%f, a2=%f, b1=%f, b2=%f", m_filter[2].a0, m_filter[2].a1, m_filter[2].a2,
-    //                                                  m_filter[2].b1, m_filter[2].b2);
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-// clang-format off
-void Audio::IIR_filterChain0(int16_t iir_in[2], bool clear) { // Infinite Impulse Response (IIR) filters
-
-    uint8_t z1 = 0, z2 = 1;
-    enum : uint8_t { in = 0, out = 1 };
-    float          inSample[2];
-    float          outSample[2];
-    static int16_t iir_out[2];
-
-    if(clear) {
-        memset(m_filterBuff, 0, sizeof(m_filterBuff)); // zero IIR filterbuffer
-        iir_out[0] = 0;
-        iir_out[1] = 0;
-        iir_in[0] = 0;
-        iir_in[1] = 0;
-    }
-
-    inSample[LEFTCHANNEL] = (float)(iir_in[LEFTCHANNEL]);
-    inSample[RIGHTCHANNEL] = (float)(iir_in[RIGHTCHANNEL]);
-
-    outSample[LEFTCHANNEL] =
-        m_filter[0].a0 * inSample[LEFTCHANNEL] + m_filter[0].a1 * m_filterBuff[0][z1][in][LEFTCHANNEL] +
-        m_filter[0].a2 * m_filterBuff[0][z2][in][LEFTCHANNEL] - m_filter[0].b1 * m_filterBuff[0][z1][out][LEFTCHANNEL] -
-        m_filter[0].b2 * m_filterBuff[0][z2][out][LEFTCHANNEL];
-
-    m_filterBuff[0][z2][in][LEFTCHANNEL] = m_filterBuff[0][z1][in][LEFTCHANNEL];
-    m_filterBuff[0][z1][in][LEFTCHANNEL] = inSample[LEFTCHANNEL];
-    m_filterBuff[0][z2][out][LEFTCHANNEL] = m_filterBuff[0][z1][out][LEFTCHANNEL];
-    m_filterBuff[0][z1][out][LEFTCHANNEL] = outSample[LEFTCHANNEL];
-    iir_out[LEFTCHANNEL] = (int16_t)outSample[LEFTCHANNEL];
-
-    outSample[RIGHTCHANNEL] = m_filter[0].a0 * inSample[RIGHTCHANNEL] +
-                              m_filter[0].a1 * m_filterBuff[0][z1][in][RIGHTCHANNEL] +
-                              m_filter[0].a2 * m_filterBuff[0][z2][in][RIGHTCHANNEL] -
-                              m_filter[0].b1 * m_filterBuff[0][z1][out][RIGHTCHANNEL] -
-                              m_filter[0].b2 * m_filterBuff[0][z2][out][RIGHTCHANNEL];
-
-    m_filterBuff[0][z2][in][RIGHTCHANNEL] = m_filterBuff[0][z1][in][RIGHTCHANNEL];
-    m_filterBuff[0][z1][in][RIGHTCHANNEL] = inSample[RIGHTCHANNEL];
-    m_filterBuff[0][z2][out][RIGHTCHANNEL] = m_filterBuff[0][z1][out][RIGHTCHANNEL];
-    m_filterBuff[0][z1][out][RIGHTCHANNEL] = outSample[RIGHTCHANNEL];
-    iir_out[RIGHTCHANNEL] = (int16_t)outSample[RIGHTCHANNEL];
-
-    iir_in[LEFTCHANNEL] = iir_out[LEFTCHANNEL];
-    iir_in[RIGHTCHANNEL] = iir_out[RIGHTCHANNEL];
-    return;
+void Audio::xfMix(int16_t* block, uint16_t frames) {
+    // head of the next file (block) * sin + tail of the previous file (ring) * cos, in place
+
+    int64_t t = esp_timer_get_time();
+    if(m_xfRate != getOutputRate() && !xfResample(getOutputRate())) { // I2S has been reconfigured for the next file
+        log_e("oom, crossfade skipped");
+        m_xfFill = 0;
+        m_xfState = XF_IDLE;
+        return;
+    }
+    if(!m_xfLen) m_xfLen = max(m_xfFill, (uint32_t)1); // the fade covers what is left of the tail
+
+    uint16_t n = min(m_xfFill, (uint32_t)frames);
+    for(int i = 0; i < n; i++) {
+        uint32_t x = ((uint64_t)m_xfPos << 16) / m_xfLen; // 0 ... 65536
+        uint32_t y = 65536 - x;
+        int32_t  gIn  = m_xfSin[x >> 8] + (((m_xfSin[min(x >> 8, (uint32_t)255) + 1] - m_xfSin[x >> 8]) * (int32_t)(x & 0xFF)) >> 8);
+        int32_t  gOut = m_xfSin[y >> 8] + (((m_xfSin[min(y >> 8, (uint32_t)255) + 1] - m_xfSin[y >> 8]) * (int32_t)(y & 0xFF)) >> 8);
+        int32_t  l = (block[2 * i] * gIn + m_xfBuff[2 * m_xfRead] * gOut) >> 15;
+        int32_t  r = (block[2 * i + 1] * gIn + m_xfBuff[2 * m_xfRead + 1] * gOut) >> 15;
+        block[2 * i]     = constrain(l, -32768, 32767);
+        block[2 * i + 1] = constrain(r, -32768, 32767);
+        if(++m_xfRead == m_xfSize) m_xfRead = 0;
+        m_xfPos++;
+    }
+    m_xfFill -= n;
+    m_xfBusy_us += esp_timer_get_time() - t;
+
+    if(!m_xfFill) { // done, report the additional load
+        uint32_t fade_ms = (uint64_t)m_xfPos * 1000 / getOutputRate();
+        m_xfLoad = fade_ms ? min((uint32_t)(m_xfBusy_us / 10 / fade_ms), (uint32_t)100) : 0;
+        AUDIO_INFO("crossfade %lu ms, load %u%%", (long unsigned)fade_ms, m_xfLoad);
+        m_xfState = XF_IDLE;
+    }
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::IIR_filterChain1(int16_t iir_in[2], bool clear) { // Infinite Impulse Response (IIR) filters
-
-    uint8_t z1 = 0, z2 = 1;
-    enum : uint8_t { in = 0, out = 1 };
-    float          inSample[2];
-    float          outSample[2];
-    static int16_t iir_out[2];
-
-    if(clear) {
-        memset(m_filterBuff, 0, sizeof(m_filterBuff)); // zero IIR filterbuffer
-        iir_out[0] = 0;
-        iir_out[1] = 0;
-        iir_in[0] = 0;
-        iir_in[1] = 0;
+bool Audio::xfResample(uint32_t rate) {
+    // the next file runs at another output rate, the rest of the tail is converted into a new ring (linear
+    // interpolation, good enough for a signal that fades out), called once per crossfade
+    uint32_t n = m_xfFill ? (uint64_t)(m_xfFill - 1) * rate / m_xfRate + 1 : 0; // the last one is not beyond the tail
+    uint32_t size = max(n, (uint32_t)(m_xfSeconds * rate));
+    int16_t* p = (int16_t*)__malloc_heap_psram(size * 2 * sizeof(int16_t));
+    if(!p) return false;
+    for(uint32_t j = 0; j < n; j++) {
+        uint64_t pos = (uint64_t)j * m_xfRate;                   // in units of 1 / rate input frames, no drift
+        uint32_t k = pos / rate, f = ((pos % rate) << 15) / rate; // frame and Q15 fraction
+        uint32_t a = (m_xfRead + k) % m_xfSize, b = (k + 1 < m_xfFill) ? (m_xfRead + k + 1) % m_xfSize : a;
+        p[2 * j]     = m_xfBuff[2 * a] + (((m_xfBuff[2 * b] - m_xfBuff[2 * a]) * (int32_t)f) >> 15);
+        p[2 * j + 1] = m_xfBuff[2 * a + 1] + (((m_xfBuff[2 * b + 1] - m_xfBuff[2 * a + 1]) * (int32_t)f) >> 15);
+    }
+    AUDIO_INFO("crossfade tail resampled from %lu Hz to %lu Hz", (long unsigned)m_xfRate, (long unsigned)rate);
+    free(m_xfBuff);
+    m_xfBuff = p;
+    m_xfAlloc = size;
+    m_xfSize = size;
+    m_xfRead = 0;
+    m_xfWrite = n % size;
+    m_xfFill = n;
+    m_xfRate = rate;
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint8_t Audio::getCrossfadeLoad() {
+    // CPU time of the last crossfade (decode ahead, copy, mix) in percent of the fade duration
+    return m_xfLoad;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//            ***     S a m p l e   r a t e   c o n v e r t e r     ***
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setOutputRate(uint32_t rate, uint8_t quality) {
+    // rate 0: I2S follows the sample rate of the source (default)
+    // rate 44100 or 48000: I2S runs at this fixed rate, every source (8...96kHz) is resampled, no reconfiguration on track changes
+    // quality: SRC_LOW (8 taps), SRC_MEDIUM (16 taps), SRC_HIGH (32 taps)
+
+    if(rate != 0 && rate != 44100 && rate != 48000) return false;
+    if(quality > SRC_HIGH) quality = SRC_HIGH;
+
+    if(rate) {
+        if(!m_srcCoef) m_srcCoef = (int16_t*)heap_caps_malloc((m_srcMaxPhases + 1) * m_srcMaxTaps * sizeof(int16_t), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+        if(!m_srcIn)   m_srcIn   = __malloc_heap_psram((m_srcMaxTaps - 1 + m_outbuffSize / 4) * 2 * sizeof(int32_t)); // hi-res: 24 bit in int32
+        if(!m_srcBuff) m_srcBuff = __malloc_heap_psram(m_srcOutFrames * 2 * sizeof(int32_t));
+        if(!m_srcCoef || !m_srcIn || !m_srcBuff) {
+            log_e("oom");
+            return false;
+        }
     }
 
-    inSample[LEFTCHANNEL] = (float)(iir_in[LEFTCHANNEL]);
-    inSample[RIGHTCHANNEL] = (float)(iir_in[RIGHTCHANNEL]);
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    m_outputRate = rate;
+    m_srcQuality = quality;
+    m_validSamples = 0;
+    SRC_design();
+    IIR_lock();
+    IIR_calculateCoefficients(); // the DSP chain runs at the output rate
+    IIR_unlock();
+    limiterSetup();
+    loudnessSetup();
+    reconfigI2S();
+    xSemaphoreGive(mutex_playAudioData);
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+bool Audio::setOutputBits(uint8_t bits) {
+    // 16: I2S always runs with 16 bit slots (default)
+    // 32: 24 bit FLAC and WAV sources bypass the 16 bit truncation, the DSP chain runs with 24 bit samples, I2S with 32 bit slots
+    if(bits != 16 && bits != 32) return false;
+    if(bits == 32 && m_f_internalDAC) return false;
+    xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
+    m_outputBits = bits;
+    m_validSamples = 0; // a pending block has the old format
+    if(m_codec == CODEC_FLAC) {DecoderLock dl(this, m_codec); FLACSetOutputBits(bits);}
+    setHiRes();
+    reconfigI2S();
+    xSemaphoreGive(mutex_playAudioData);
+    return true;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::getOutputRate() {
+    // rate of the DSP chain and the I2S clock
+    return m_outputRate ? m_outputRate : m_sampleRate;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::SRC_design() {
 
-    outSample[LEFTCHANNEL] =
-        m_filter[1].a0 * inSample[LEFTCHANNEL] + m_filter[1].a1 * m_filterBuff[1][z1][in][LEFTCHANNEL] +
-        m_filter[1].a2 * m_filterBuff[1][z2][in][LEFTCHANNEL] - m_filter[1].b1 * m_filterBuff[1][z1][out][LEFTCHANNEL] -
-        m_filter[1].b2 * m_filterBuff[1][z2][out][LEFTCHANNEL];
+    // polyphase lowpass, windowed sinc (Blackman), (phases + 1) rows of taps coefficients in Q14,
+    // each row is normalized to unity gain at DC, the extra row is needed for the interpolation between phases
+    // Q14 because the sum of the absolute coefficients reaches ~2.0 (32 taps), so a full scale input can't overflow the int32 accumulator
 
-    m_filterBuff[1][z2][in][LEFTCHANNEL] = m_filterBuff[1][z1][in][LEFTCHANNEL];
-    m_filterBuff[1][z1][in][LEFTCHANNEL] = inSample[LEFTCHANNEL];
-    m_filterBuff[1][z2][out][LEFTCHANNEL] = m_filterBuff[1][z1][out][LEFTCHANNEL];
-    m_filterBuff[1][z1][out][LEFTCHANNEL] = outSample[LEFTCHANNEL];
-    iir_out[LEFTCHANNEL] = (int16_t)outSample[LEFTCHANNEL];
+    static const uint8_t taps[3]      = {8, 16, 32};
+    static const uint8_t phaseBits[3] = {6, 6, 7};
 
-    outSample[RIGHTCHANNEL] = m_filter[1].a0 * inSample[RIGHTCHANNEL] +
-                              m_filter[1].a1 * m_filterBuff[1][z1][in][RIGHTCHANNEL] +
-                              m_filter[1].a2 * m_filterBuff[1][z2][in][RIGHTCHANNEL] -
-                              m_filter[1].b1 * m_filterBuff[1][z1][out][RIGHTCHANNEL] -
-                              m_filter[1].b2 * m_filterBuff[1][z2][out][RIGHTCHANNEL];
+    m_srcPos = 0;
+    m_srcInFrames = 0;
+    m_f_srcActive = m_outputRate && m_srcCoef && (m_sampleRate != m_outputRate);
+    if(!m_f_srcActive) return;
 
-    m_filterBuff[1][z2][in][RIGHTCHANNEL] = m_filterBuff[1][z1][in][RIGHTCHANNEL];
-    m_filterBuff[1][z1][in][RIGHTCHANNEL] = inSample[RIGHTCHANNEL];
-    m_filterBuff[1][z2][out][RIGHTCHANNEL] = m_filterBuff[1][z1][out][RIGHTCHANNEL];
-    m_filterBuff[1][z1][out][RIGHTCHANNEL] = outSample[RIGHTCHANNEL];
-    iir_out[RIGHTCHANNEL] = (int16_t)outSample[RIGHTCHANNEL];
+    m_srcTaps = taps[m_srcQuality];
+    m_srcPhaseBits = phaseBits[m_srcQuality];
+    m_f_srcInterp = (m_srcQuality != SRC_LOW);
+    m_srcStep = ((uint64_t)m_sampleRate << 32) / m_outputRate;
+    memset(m_srcIn, 0, (m_srcTaps - 1) * 2 * sizeof(int32_t)); // history
 
-    iir_in[LEFTCHANNEL] = iir_out[LEFTCHANNEL];
-    iir_in[RIGHTCHANNEL] = iir_out[RIGHTCHANNEL];
-    return;
+    const int   half = m_srcTaps / 2;
+    const int   phases = 1 << m_srcPhaseBits;
+    const float fc = (m_outputRate < m_sampleRate ? (float)m_outputRate / m_sampleRate : 1.0f) * 0.9f; // cutoff, relative to fs/2 of the source
+    float       h[m_srcMaxTaps];
+
+    for(int p = 0; p <= phases; p++) {
+        float sum = 0;
+        for(int j = 0; j < m_srcTaps; j++) {
+            float x = j - (half - 1) - (float)p / phases; // distance to the interpolated point in source frames
+            float t = (float)PI * x / half;
+            float w = 0.42f + 0.5f * cosf(t) + 0.08f * cosf(2 * t);
+            h[j] = (x == 0) ? w : w * sinf((float)PI * fc * x) / ((float)PI * fc * x);
+            sum += h[j];
+        }
+        for(int j = 0; j < m_srcTaps; j++) {
+            m_srcCoef[p * m_srcTaps + j] = (int16_t)constrain(lroundf(h[j] / sum * 16384.0f), -32768L, 32767L);
+        }
+    }
 }
 //------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-void Audio::IIR_filterChain2(int16_t iir_in[2], bool clear) { // Infinite Impulse Response (IIR) filters
+template <typename S> uint16_t Audio::SRC_process() {
+
+    // resamples up to m_srcOutFrames frames from m_srcIn into m_srcBuff, returns the number of frames
+    // m_srcIn holds taps - 1 frames history followed by m_srcInFrames new frames, m_srcPos is the read position (Q32)
+    // S = int32_t: 24 bit samples, 64 bit accumulator
+
+    typedef typename std::conditional<sizeof(S) == sizeof(int16_t), int32_t, int64_t>::type acc_t;
+    const int32_t maxV = (sizeof(S) == sizeof(int16_t)) ? 32767 : 8388607;
+    const S*      in = (const S*)m_srcIn;
+    S*            out = (S*)m_srcBuff;
+    const uint8_t T = m_srcTaps;
+    const uint8_t shift = 32 - m_srcPhaseBits;
+    uint16_t      n = 0;
+
+    while(n < m_srcOutFrames) {
+        uint32_t k = m_srcPos >> 32;
+        if(k >= m_srcInFrames) break;
+        uint32_t       frac = (uint32_t)m_srcPos;
+        const S*       x = in + 2 * k;
+        acc_t          l = 0x2000, r = 0x2000; // rounding
+        if(m_f_srcInterp) { // linear interpolation between two neighbouring phases
+            const int16_t* c = m_srcCoef + (frac >> shift) * T;
+            int32_t        w = (frac << m_srcPhaseBits) >> 17; // Q15
+            for(int j = 0; j < T; j++) {
+                int32_t cj = c[j] + (((c[j + T] - c[j]) * w) >> 15);
+                l += (acc_t)x[2 * j] * cj;
+                r += (acc_t)x[2 * j + 1] * cj;
+            }
+        }
+        else { // nearest phase
+            const int16_t* c = m_srcCoef + (((frac >> (shift - 1)) + 1) >> 1) * T;
+            for(int j = 0; j < T; j++) {
+                l += (acc_t)x[2 * j] * c[j];
+                r += (acc_t)x[2 * j + 1] * c[j];
+            }
+        }
+        out[2 * n + LEFTCHANNEL]  = (S)constrain(l >> 14, (acc_t)(-maxV - 1), (acc_t)maxV);
+        out[2 * n + RIGHTCHANNEL] = (S)constrain(r >> 14, (acc_t)(-maxV - 1), (acc_t)maxV);
+        m_srcPos += m_srcStep;
+        n++;
+    }
+    if((m_srcPos >> 32) >= m_srcInFrames) { // block consumed, the last taps - 1 frames become the history
+        memmove(m_srcIn, in + 2 * m_srcInFrames, (T - 1) * 2 * sizeof(S));
+        m_srcPos -= (uint64_t)m_srcInFrames << 32;
+        m_srcInFrames = 0;
+    }
+    return n;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::SRC_nextSlice() {
+    // next resampled slice through the DSP chain, m_validSamples stays non-zero while decoded frames are pending
+    while(m_validSamples <= 0 && m_srcInFrames) {
+        uint16_t n = m_f_hiRes ? SRC_process<int32_t>() : SRC_process<int16_t>();
+        if(n) processFrames(m_srcBuff, n);
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//            ***     D i g i t a l   b i q u a d r a t i c     f i l t e r     ***
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::IIR_calculateCoefficients() { // Infinite Impulse Response (IIR) filters
 
-    uint8_t z1 = 0, z2 = 1;
-    enum : uint8_t { in = 0, out = 1 };
-    float          inSample[2];
-    float          outSample[2];
-    static int16_t iir_out[2];
+    // computes the biquads of all used bands in m_eqBand[], bands 0...2 are the tone control (setTone)
+    // has to be called if a band or the samplerate changes, the caller holds the writer lock (IIR_lock)
+    // https://www.earlevel.com/main/2012/11/26/biquad-c-source-code/
 
-    if(clear) {
-        memset(m_filterBuff, 0, sizeof(m_filterBuff)); // zero IIR filterbuffer
-        iir_out[0] = 0;
-        iir_out[1] = 0;
-        iir_in[0] = 0;
-        iir_in[1] = 0;
-    }
+    if(getOutputRate() < 1000) return; // fuse
 
-    inSample[LEFTCHANNEL] = (float)(iir_in[LEFTCHANNEL]);
-    inSample[RIGHTCHANNEL] = (float)(iir_in[RIGHTCHANNEL]);
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-    outSample[LEFTCHANNEL] =
-        m_filter[2].a0 * inSample[LEFTCHANNEL] + m_filter[2].a1 * m_filterBuff[2][z1][in][LEFTCHANNEL] +
-        m_filter[2].a2 * m_filterBuff[2][z2][in][LEFTCHANNEL] - m_filter[2].b1 * m_filterBuff[2][z1][out][LEFTCHANNEL] -
-        m_filter[2].b2 * m_filterBuff[2][z2][out][LEFTCHANNEL];
+    // gain, attenuation (set in digital filters)
+    int8_t db = 0;
+    for(int i = 0; i < m_eqMaxBands; i++) {
+        if(m_eqBand[i].used && m_eqBand[i].type <= HIGHSHELF) db = max(db, m_eqBand[i].gain);
+    }
+    m_corr = pow10f((float)db / 20);
+    // 24 bit samples (hi-res) have headroom in int32, with the limiter on the boost stays there and the limiter pulls
+    // the peaks down. Otherwise the EQ attenuates by m_corr and the limiter, if it is on, restores the level
+    bool headroom = m_f_limiter && m_f_hiRes;
+    m_limMakeup.store((int32_t)lrintf((headroom ? 1.0f : max(m_corr, 1.0f)) * 4096), std::memory_order_relaxed);
+
+    // fixed point coefficients for IIR_filterChain(), a stage with 0 dB gain is an identity and will be skipped,
+    // the level correction (m_corr) is folded into the feed forward coefficients of the first active stage
+    float        att = (m_corr > 1 && !headroom) ? 1.0f / m_corr : 1.0f;
+    auto         q = [&](float c) { return (int32_t)lrintf(c * (float)(1 << m_iirFracBits)); };
+    iir_stage_t* stage = m_iirSet[m_iirBack]; // back buffer, owned by the writer
+    filter_t     flt;
+
+    for(int i = 0; i < m_eqMaxBands; i++) {
+        stage[i].flat = !m_eqBand[i].used || (m_eqBand[i].gain == 0 && m_eqBand[i].type <= HIGHSHELF);
+        if(stage[i].flat) continue;
+        IIR_calculateBiquad(&m_eqBand[i], &flt);
+        stage[i].a0 = q(flt.a0 * att);
+        stage[i].a1 = q(flt.a1 * att);
+        stage[i].a2 = q(flt.a2 * att);
+        stage[i].b1 = q(flt.b1);
+        stage[i].b2 = q(flt.b2);
+        att = 1.0f;
+    }
+    // publish: the back buffer becomes the middle buffer (marked as new), the audio task takes it over at the
+    // beginning of the next block, the former middle buffer is the new back buffer
+    m_iirBack = m_iirMiddle.exchange(m_iirBack | 0x80, std::memory_order_acq_rel) & 0x03;
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::IIR_update() { // audio task
 
-    m_filterBuff[2][z2][in][LEFTCHANNEL] = m_filterBuff[2][z1][in][LEFTCHANNEL];
-    m_filterBuff[2][z1][in][LEFTCHANNEL] = inSample[LEFTCHANNEL];
-    m_filterBuff[2][z2][out][LEFTCHANNEL] = m_filterBuff[2][z1][out][LEFTCHANNEL];
-    m_filterBuff[2][z1][out][LEFTCHANNEL] = outSample[LEFTCHANNEL];
-    iir_out[LEFTCHANNEL] = (int16_t)outSample[LEFTCHANNEL];
+    // recalculates the coefficients after a samplerate change (m_iirDirty), if a writer (setTone, setEqBand) holds the
+    // lock it is not waited for, the flag stays set and the next block tries again
 
-    outSample[RIGHTCHANNEL] = m_filter[2].a0 * inSample[RIGHTCHANNEL] +
-                              m_filter[2].a1 * m_filterBuff[2][z1][in][RIGHTCHANNEL] +
-                              m_filter[2].a2 * m_filterBuff[2][z2][in][RIGHTCHANNEL] -
-                              m_filter[2].b1 * m_filterBuff[2][z1][out][RIGHTCHANNEL] -
-                              m_filter[2].b2 * m_filterBuff[2][z2][out][RIGHTCHANNEL];
+    if(!IIR_tryLock()) return;
+    m_iirDirty.store(false, std::memory_order_relaxed);
+    IIR_calculateCoefficients();
+    IIR_unlock();
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::IIR_calculateBiquad(const eq_band_t* band, filter_t* flt) {
+
+    // LOWSHELF, HIGHSHELF: gain -40 ... +12 dB, q = 0.707 is Butterworth
+    // PEAKEQ:              gain -40 ... +12 dB, q = bandwidth
+    // LOWPASS, HIGHPASS:   gain is ignored,      q = resonance
+
+    float Fc = band->freq;
+    if(getOutputRate() < Fc * 2 + 200) { // Prevent filter from clogging
+        Fc = getOutputRate() / 2 - 100;
+        // according to the sampling theorem, the sample rate must be at least 2 * Fc for a filter frequency of Fc.
+        // If this is not the case, the filter frequency (plus a reserve of 100Hz) is lowered
+        AUDIO_INFO("Filter frequency lowered, from %uHz to %luHz", band->freq, (long unsigned int)Fc);
+    }
+
+    float K = tanf((float)PI * Fc / (float)getOutputRate());
+    float V = powf(10, fabs(band->gain) / 20.0);
+    float Q = band->q;
+    float norm;
+
+    switch(band->type) {
+        case LOWSHELF:
+            if(band->gain >= 0) { // boost
+                norm = 1 / (1 + K / Q + K * K);
+                flt->a0 = (1 + sqrtf(V) / Q * K + V * K * K) * norm;
+                flt->a1 = 2 * (V * K * K - 1) * norm;
+                flt->a2 = (1 - sqrtf(V) / Q * K + V * K * K) * norm;
+                flt->b1 = 2 * (K * K - 1) * norm;
+                flt->b2 = (1 - K / Q + K * K) * norm;
+            }
+            else { // cut
+                norm = 1 / (1 + sqrtf(V) / Q * K + V * K * K);
+                flt->a0 = (1 + K / Q + K * K) * norm;
+                flt->a1 = 2 * (K * K - 1) * norm;
+                flt->a2 = (1 - K / Q + K * K) * norm;
+                flt->b1 = 2 * (V * K * K - 1) * norm;
+                flt->b2 = (1 - sqrtf(V) / Q * K + V * K * K) * norm;
+            }
+            break;
+        case PEAKEQ:
+            if(band->gain >= 0) { // boost
+                norm = 1 / (1 + 1 / Q * K + K * K);
+                flt->a0 = (1 + V / Q * K + K * K) * norm;
+                flt->a1 = 2 * (K * K - 1) * norm;
+                flt->a2 = (1 - V / Q * K + K * K) * norm;
+                flt->b1 = flt->a1;
+                flt->b2 = (1 - 1 / Q * K + K * K) * norm;
+            }
+            else { // cut
+                norm = 1 / (1 + V / Q * K + K * K);
+                flt->a0 = (1 + 1 / Q * K + K * K) * norm;
+                flt->a1 = 2 * (K * K - 1) * norm;
+                flt->a2 = (1 - 1 / Q * K + K * K) * norm;
+                flt->b1 = flt->a1;
+                flt->b2 = (1 - V / Q * K + K * K) * norm;
+            }
+            break;
+        case HIGHSHELF:
+            if(band->gain >= 0) { // boost
+                norm = 1 / (1 + K / Q + K * K);
+                flt->a0 = (V + sqrtf(V) / Q * K + K * K) * norm;
+                flt->a1 = 2 * (K * K - V) * norm;
+                flt->a2 = (V - sqrtf(V) / Q * K + K * K) * norm;
+                flt->b1 = 2 * (K * K - 1) * norm;
+                flt->b2 = (1 - K / Q + K * K) * norm;
+            }
+            else { // cut
+                norm = 1 / (V + sqrtf(V) / Q * K + K * K);
+                flt->a0 = (1 + K / Q + K * K) * norm;
+                flt->a1 = 2 * (K * K - 1) * norm;
+                flt->a2 = (1 - K / Q + K * K) * norm;
+                flt->b1 = 2 * (K * K - V) * norm;
+                flt->b2 = (V - sqrtf(V) / Q * K + K * K) * norm;
+            }
+            break;
+        case LOWPASS:
+            norm = 1 / (1 + K / Q + K * K);
+            flt->a0 = K * K * norm;
+            flt->a1 = 2 * flt->a0;
+            flt->a2 = flt->a0;
+            flt->b1 = 2 * (K * K - 1) * norm;
+            flt->b2 = (1 - K / Q + K * K) * norm;
+            break;
+        case HIGHPASS:
+            norm = 1 / (1 + K / Q + K * K);
+            flt->a0 = 1 * norm;
+            flt->a1 = -2 * flt->a0;
+            flt->a2 = flt->a0;
+            flt->b1 = 2 * (K * K - 1) * norm;
+            flt->b2 = (1 - K / Q + K * K) * norm;
+            break;
+    }
 
-    m_filterBuff[2][z2][in][RIGHTCHANNEL] = m_filterBuff[2][z1][in][RIGHTCHANNEL];
-    m_filterBuff[2][z1][in][RIGHTCHANNEL] = inSample[RIGHTCHANNEL];
-    m_filterBuff[2][z2][out][RIGHTCHANNEL] = m_filterBuff[2][z1][out][RIGHTCHANNEL];
-    m_filterBuff[2][z1][out][RIGHTCHANNEL] = outSample[RIGHTCHANNEL];
-    iir_out[RIGHTCHANNEL] = (int16_t)outSample[RIGHTCHANNEL];
+    //    log_i("type %i a0=%f, a1=%f, a2=%f, b1=%f, b2=%f", band->type, flt->a0, flt->a1, flt->a2, flt->b1, flt->b2);
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// clang-format off
+template <typename T> void Audio::IIR_filterChain(T* block, uint16_t frames) { // Infinite Impulse Response (IIR) filters
+
+    // cascaded fixed point biquads (direct form I), coefficients Q4.28, 64 bit accumulator, the truncation error
+    // is fed back into the next sample (fraction saving). Each stage runs over the whole block, the filter memory
+    // is held in local variables while the block is processed. Only the active (not flat) stages are processed.
+    // New coefficients (published by IIR_calculateCoefficients) are taken over at the beginning of a block and
+    // interpolated across this block, so changing the EQ does not click.
+
+    if(!frames) return;
+
+    if(m_iirMiddle.load(std::memory_order_acquire) & 0x80) { // new coefficient set available, swap front and middle
+        m_iirFront = m_iirMiddle.exchange(m_iirFront, std::memory_order_acq_rel) & 0x03;
+        const iir_stage_t* tgt = m_iirSet[m_iirFront];
+        const iir_stage_t  identity = {1 << m_iirFracBits, 0, 0, 0, 0, true};
+        uint8_t numActive = 0;
+
+        for(int f = 0; f < m_eqMaxBands; f++) {
+            if(m_iirRun[f].flat && tgt[f].flat) continue;
+            if(m_iirRun[f].flat) memset(m_iirState[f], 0, sizeof(m_iirState[f])); // stage becomes active, empty memory
+            const iir_stage_t* from = m_iirRun[f].flat ? &identity : &m_iirRun[f];
+            const iir_stage_t* to   = tgt[f].flat      ? &identity : &tgt[f];
+            IIR_filterStage(block, frames, f, from, to);
+            if(!tgt[f].flat) m_iirActive[numActive++] = f;
+        }
+        for(int f = 0; f < m_eqMaxBands; f++) m_iirRun[f] = tgt[f];
+        m_iirNumActive = numActive;
+        return;
+    }
 
-    iir_in[LEFTCHANNEL] = iir_out[LEFTCHANNEL];
-    iir_in[RIGHTCHANNEL] = iir_out[RIGHTCHANNEL];
-    return;
+    for(int n = 0; n < m_iirNumActive; n++) { // no active stage: bypass
+        const uint8_t f = m_iirActive[n];
+        IIR_filterStage(block, frames, f, &m_iirRun[f], NULL);
+    }
+}
+//------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+template <typename T> void Audio::IIR_filterStage(T* block, uint16_t frames, uint8_t f, const iir_stage_t* st, const iir_stage_t* to) {
+
+    // one biquad over the whole block, if 'to' is set the coefficients move linearly from 'st' to 'to'
+    // T = int32_t: 24 bit samples, the 64 bit accumulator has enough headroom, the output may exceed 24 bit by 12 dB
+    // (EQ boost without pre-attenuation, overshoot), the limiter or DSPchain() clamps it before the shift into the slot
+
+    const int32_t maxV = (sizeof(T) == sizeof(int16_t)) ? 32767 : 0x1FFFFFF;
+
+    int32_t a0 = st->a0, a1 = st->a1, a2 = st->a2, b1 = st->b1, b2 = st->b2;
+    int32_t da0 = 0, da1 = 0, da2 = 0, db1 = 0, db2 = 0;
+    if(to) {
+        da0 = ((int64_t)to->a0 - a0) / frames; da1 = ((int64_t)to->a1 - a1) / frames; da2 = ((int64_t)to->a2 - a2) / frames;
+        db1 = ((int64_t)to->b1 - b1) / frames; db2 = ((int64_t)to->b2 - b2) / frames;
+    }
+
+    for(int ch = LEFTCHANNEL; ch <= RIGHTCHANNEL; ch++) {
+        int32_t* z = m_iirState[f][ch];
+        int32_t x1 = z[0], x2 = z[1], y1 = z[2], y2 = z[3], err = z[4];
+        int32_t c0 = a0, c1 = a1, c2 = a2, d1 = b1, d2 = b2;
+        T* s = block + ch;
+
+        for(int i = 0; i < frames; i++) {
+            int32_t x0 = *s;
+            int64_t acc = (int64_t)c0 * x0 + (int64_t)c1 * x1 + (int64_t)c2 * x2
+                        - (int64_t)d1 * y1 - (int64_t)d2 * y2 + err;
+            int32_t y0 = (int32_t)(acc >> m_iirFracBits);
+            err = (int32_t)(acc - ((int64_t)y0 << m_iirFracBits));
+            x2 = x1; x1 = x0;
+            y2 = y1; y1 = y0;
+            if(y0 > maxV) y0 = maxV; else if(y0 < -maxV - 1) y0 = -maxV - 1;
+            *s = (T)y0;
+            s += 2;
+            if(to) { c0 += da0; c1 += da1; c2 += da2; d1 += db1; d2 += db2; } // interpolation, not taken if steady
+        }
+        z[0] = x1; z[1] = x2; z[2] = y1; z[3] = y2; z[4] = err;
+    }
 }
 // clang-format on
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -5564,14 +7495,9 @@ bool Audio::ts_parsePacket(uint8_t* packet, uint8_t* packetStart, uint8_t* packe
 
     (void)PAYLOAD_SIZE; // suppress [-Wunused-variable]
 
-    typedef struct {
-        int number = 0;
-        int pids[PID_ARRAY_LEN];
-    } pid_array;
-
-    static pid_array pidsOfPMT;
-    static int       PES_DataLength = 0;
-    static int       pidOfAAC = 0;
+    pid_array& pidsOfPMT = m_tsParse.pidsOfPMT;
+    int&       PES_DataLength = m_tsParse.PES_DataLength;
+    int&       pidOfAAC = m_tsParse.pidOfAAC;
 
     if(packet == NULL) {
         if(m_f_Log) log_i("parseTS reset");
@@ -5647,7 +7573,7 @@ bool Audio::ts_parsePacket(uint8_t* packet, uint8_t* packetStart, uint8_t* packe
         return true;
     }
     else if(PID == pidOfAAC) {
-        static uint8_t fillData = 0;
+        uint8_t& fillData = m_tsParse.fillData;
         if(m_f_Log) log_i("AAC");
         uint8_t posOfPacketStart = 4;
         if(AFL >= 0) {
@@ -5749,8 +7675,8 @@ bool Audio::ts_parsePacket(uint8_t* packet, uint8_t* packetStart, uint8_t* packe
 //    W E B S T R E A M  -  H E L P   F U N C T I O N S
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint16_t Audio::readMetadata(uint16_t maxBytes, bool first) {
-    static uint16_t pos_ml = 0; // determines the current position in metaline
-    static uint16_t metalen = 0;
+    uint16_t& pos_ml = m_meta.pos_ml; // determines the current position in metaline
+    uint16_t& metalen = m_meta.metalen;
     uint16_t        res = 0;
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     if(first) {
@@ -5947,24 +7873,45 @@ bool Audio::readID3V1Tag() {
 }
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 boolean Audio::streamDetection(uint32_t bytesAvail) {
-    static uint32_t tmr_slow = millis();
-    static uint32_t tmr_lost = millis();
-    static uint8_t  cnt_slow = 0;
-    static uint8_t  cnt_lost = 0;
-
-    // if within one second the content of the audio buffer falls below the size of an audio frame 100 times,
-    // issue a message
+    uint32_t& tmr_slow = m_streamDet.tmr_slow;
+    uint32_t& tmr_lost = m_streamDet.tmr_lost;
+    uint8_t&  cnt_slow = m_streamDet.cnt_slow;
+    uint8_t&  cnt_lost = m_streamDet.cnt_lost;
+
+    // less than one frame in the buffer: underrun, the next start waits longer. After a minute without underrun
+    // the prebuffer target is reduced again
+    if(!m_prebufStable) m_prebufStable = millis();
+    if(InBuff.bufferFilled() < InBuff.getMaxBlockSize()) {
+        if(!m_f_starved && m_prebuf_ms < m_prebufMax_ms) {
+            m_prebuf_ms = min((uint32_t)m_prebufMax_ms, (uint32_t)m_prebuf_ms * 3 / 2);
+            if(m_f_Log) AUDIO_INFO("underrun, prebuffer %u ms", m_prebuf_ms);
+        }
+        m_f_starved = true;
+        m_prebufStable = millis();
+    }
+    else m_f_starved = false;
+    if(millis() - m_prebufStable > 60000) {
+        m_prebufStable = millis();
+        if(m_prebuf_ms > m_prebufMin_ms) {
+            m_prebuf_ms = max((uint32_t)m_prebufMin_ms, (uint32_t)m_prebuf_ms * 3 / 4);
+            if(m_f_Log) AUDIO_INFO("stable stream, prebuffer %u ms", m_prebuf_ms);
+        }
+    }
+
+    // if within one second the content of the audio buffer falls below the low watermark (a quarter of the prebuffer)
+    // 100 times, issue a message
+    uint32_t lowWater = prebufferBytes(m_prebuf_ms / 4);
     if(tmr_slow + 1000 < millis()) {
         tmr_slow = millis();
         if(cnt_slow > 100) AUDIO_INFO("slow stream, dropouts are possible");
         cnt_slow = 0;
     }
-    if(InBuff.bufferFilled() < InBuff.getMaxBlockSize()) cnt_slow++;
+    if(InBuff.bufferFilled() < lowWater) cnt_slow++;
     if(bytesAvail) {
         tmr_lost = millis() + 1000;
         cnt_lost = 0;
     }
-    if(InBuff.bufferFilled() > InBuff.getMaxBlockSize() * 2) return false; // enough data available to play
+    if(InBuff.bufferFilled() > lowWater) return false; // enough data available to play
 
     // if no audio data is received within three seconds, a new connection attempt is started.
     if(tmr_lost < millis()) {
@@ -5985,6 +7932,26 @@ boolean Audio::streamDetection(uint32_t bytesAvail) {
     }
     return false;
 }
+//-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::measuredBitrate() {
+    // bit/s of the input stream, after at least one second of decoded audio
+    uint32_t sr = getSampleRate();
+    if(sr && m_brFrames >= sr) return (uint64_t)m_brBytes * 8 * sr / m_brFrames;
+    return 0;
+}
+//-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Audio::prebufferBytes(uint32_t ms) {
+    // bytes of the input stream that hold ms of audio: measured bitrate, else the one of the last connection to this host
+    // or the m3u8 BANDWIDTH, else the announced one (icy-br, header), else a guess
+    uint32_t br = measuredBitrate();
+    if(!br) br = m_brHint;
+    if(!br) br = m_bitRate;
+    if(!br) br = (m_codec == CODEC_FLAC || m_codec == CODEC_WAV) ? 1411200 : 128000;
+    uint32_t bytes = (uint64_t)br * ms / 8000;
+    uint32_t lo = InBuff.getMaxBlockSize();
+    uint32_t hi = max(lo, (uint32_t)InBuff.getBufsize() * 3 / 4); // must be reachable, also without PSRAM
+    return constrain(bytes, lo, hi);
+}
 #ifndef AUDIO_NO_SD_FS	
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::seek_m4a_ilst() {
@@ -6047,6 +8014,8 @@ void Audio::seek_m4a_ilst() {
         seekpos = at.pos + 8; // 4 bytes size + 4 bytes name
     }
 
+    m4a_readFreeform(at.pos, at.size);
+
     int len = tmp.size - 8;
     if(len > 1024) len = 1024;
     //    log_i("found at pos %i, len %i", seekpos, len);
@@ -6096,6 +8065,55 @@ void Audio::seek_m4a_ilst() {
     return;
 }
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::m4a_readFreeform(uint32_t ilstPos, uint32_t ilstSize) {
+    // freeform atoms: ilst -> ---- -> mean "com.apple.iTunes", name "iTunSMPB", data " 00000000 00000840 000001CC 0000000000A3E5F4 ..."
+    // iTunSMPB: the 2nd, 3rd and 4th value (hex) are the encoder delay, the padding and the number of valid samples
+    // replaygain_track_gain, replaygain_album_gain: "-7.89 dB"
+
+    char     buf[256];
+    uint32_t pos = ilstPos + 8;
+
+    while(pos + 8 < ilstPos + ilstSize) {
+        audiofile.seek(pos);
+        if(audiofile.read((uint8_t*)buf, 8) != 8) break;
+        uint32_t size = bigEndian((uint8_t*)buf, 4);
+        if(size < 8) break;
+        if(memcmp(buf + 4, "----", 4) == 0 && size < sizeof(buf)) {
+            int len = audiofile.read((uint8_t*)buf, size - 8);
+            if(len <= 0) break;
+            buf[len] = '\0';
+            char key[32] = {0};
+            int  val = -1;
+            int  p = 0;
+            while(p + 8 <= len) { // mean, name, data
+                int s = bigEndian((uint8_t*)buf + p, 4);
+                if(s < 8 || p + s > len) break;
+                if(memcmp(buf + p + 4, "name", 4) == 0 && s > 12) { // size, 'name', version + flags, key
+                    int n = min(s - 12, (int)sizeof(key) - 1);
+                    memcpy(key, buf + p + 12, n);
+                    key[n] = '\0';
+                }
+                if(memcmp(buf + p + 4, "data", 4) == 0 && s > 16) val = p + 16; // size, 'data', type, locale, value
+                p += s;
+            }
+            if(val > 0) {
+                if(!strcmp(key, "iTunSMPB")) {
+                    unsigned int       delay = 0, padding = 0;
+                    unsigned long long samples = 0;
+                    if(sscanf(buf + val, "%*x %x %x %llx", &delay, &padding, &samples) == 3) {
+                        m_trimSkip = delay;
+                        m_trimRemain = samples;
+                        m_f_trimEnd = (samples > 0);
+                        if(m_f_Log) log_i("gapless: delay %u, padding %u, samples %llu", delay, padding, samples);
+                    }
+                }
+                else replayGainTag(key, buf + val);
+            }
+        }
+        pos += size;
+    }
+}
+//-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Audio::seek_m4a_stsz() {
     // stsz says what size each sample is in bytes. This is important for the decoder to be able to start at a chunk,
     // and then go through each sample by its size. The stsz atom can be behind the audio block. Therefore, searching
@@ -6137,6 +8155,8 @@ void Audio::seek_m4a_stsz() {
 
     uint32_t stsdPos = 0;
     uint16_t stsdSize = 0;
+    uint32_t mdhdPos = 0;
+    uint32_t elstPos = 0;
     boolean  found = false;
     uint32_t seekpos = 0;
     uint32_t filesize = getFileSize();
@@ -6164,6 +8184,8 @@ void Audio::seek_m4a_stsz() {
                 stsdPos = tmp.pos;
                 stsdSize = tmp.size;
             }
+            if(strcmp(tmp.name, "mdhd") == 0) mdhdPos = tmp.pos; // duration in samples
+            if(strcmp(tmp.name, "edts") == 0) elstPos = tmp.pos + 8; // edit list, the first edit skips the priming
         }
         if(!found) goto noSuccess;
         seekpos = at.pos + 8; // 4 bytes size + 4 bytes name
@@ -6190,6 +8212,30 @@ void Audio::seek_m4a_stsz() {
             AUDIO_INFO("ch; %i, bps: %i, sr: %i", channel, bps, srate);
         }
     }
+    if(mdhdPos) { // gapless without iTunSMPB (seek_m4a_ilst() overrides): the media duration counts the valid samples, the
+                  // last AAC frame is padded. A positive media time of the first edit is the encoder delay (priming)
+        uint8_t  d[32];
+        audiofile.seek(mdhdPos + 8);
+        audiofile.readBytes((char*)d, 32);
+        bool     v1 = (d[0] == 1);
+        uint32_t timescale = bigEndian(d + (v1 ? 20 : 12), 4);
+        uint64_t duration = v1 ? ((uint64_t)bigEndian(d + 24, 4) << 32 | bigEndian(d + 28, 4)) : bigEndian(d + 16, 4);
+        int64_t  mediaTime = 0;
+        if(elstPos) {
+            audiofile.seek(elstPos);
+            audiofile.readBytes((char*)d, 32);
+            if(!memcmp(d + 4, "elst", 4) && bigEndian(d + 12, 4)) { // at least one entry
+                if(d[8] == 1) mediaTime = (int64_t)((uint64_t)bigEndian(d + 24, 4) << 32 | bigEndian(d + 28, 4));
+                else          mediaTime = (int32_t)bigEndian(d + 20, 4);
+            }
+        }
+        if(timescale == getSampleRate() && duration > (uint64_t)max(mediaTime, (int64_t)0)) {
+            if(mediaTime > 0) m_trimSkip = mediaTime;
+            m_trimRemain = duration - max(mediaTime, (int64_t)0);
+            m_f_trimEnd = true;
+            if(m_f_Log) log_i("gapless: media time %lli, duration %llu", mediaTime, duration);
+        }
+    }
     audiofile.seek(0);
     return;
 
@@ -6345,6 +8391,38 @@ exit:
 }
 #endif  // AUDIO_NO_SD_FS
 //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void Audio::mp3_readGaplessInfo(uint8_t* data, int32_t len) {
+    // the first frame of a LAME (or FFmpeg) encoded file is the Xing/Info frame, it is decoded to silence and holds the
+    // number of frames, the encoder delay and the padding, the decoder itself adds 529 samples delay
+
+    int32_t pos = MP3FindSyncWord(data, len);
+    if(pos < 0 || len - pos < 192) return;
+    uint8_t* h = data + pos;
+    bool     mpeg1 = ((h[1] & 0x18) == 0x18);
+    bool     mono = ((h[3] & 0xC0) == 0xC0);
+    uint16_t spf = mpeg1 ? 1152 : 576; // samples per frame
+    uint8_t* x = h + (mpeg1 ? (mono ? 21 : 36) : (mono ? 13 : 21)); // behind the side info
+    if(memcmp(x, "Xing", 4) && memcmp(x, "Info", 4)) return;
+
+    uint32_t flags = bigEndian(x + 4, 4);
+    uint32_t frames = 0, delay = 0, padding = 0;
+    uint8_t* p = x + 8;
+    if(flags & 0x01) { frames = bigEndian(p, 4); p += 4; }
+    if(flags & 0x02) p += 4;   // bytes
+    if(flags & 0x04) p += 100; // TOC
+    if(flags & 0x08) p += 4;   // quality
+    if(!memcmp(p, "LAME", 4) || !memcmp(p, "Lavc", 4) || !memcmp(p, "Lavf", 4)) {
+        delay   = (p[21] << 4) | (p[22] >> 4);
+        padding = ((p[22] & 0x0F) << 8) | p[23];
+    }
+    m_trimSkip = spf + delay + 529; // Info frame + encoder delay + decoder delay
+    if(frames && frames * spf > delay + padding) {
+        m_trimRemain = frames * spf - delay - padding;
+        m_f_trimEnd = true;
+    }
+    if(m_f_Log) log_i("gapless: frames %lu, delay %lu, padding %lu", (long unsigned)frames, (long unsigned)delay, (long unsigned)padding);
+}
+//-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 uint8_t Audio::determineOggCodec(uint8_t* data, uint16_t len) {
     // if we have contentType == application/ogg; codec cn be OPUS, FLAC or VORBIS
     // let's have a look, what it is
@@ -6372,7 +8450,7 @@ void Audio::startAudioTask() {
         return;
     }
     m_f_audioTaskIsRunning = true;
-    xTaskCreate(&Audio::taskWrapper, "PeriodicTask", 3300, this, 4, &m_audioTaskHandle);
+    xTaskCreate(&Audio::taskWrapper, "PeriodicTask", AUDIO_TASK_STACK_SIZE, this, AUDIO_TASK_PRIORITY, &m_audioTaskHandle);
 }
 
 void Audio::stopAudioTask()  {
@@ -6394,16 +8472,35 @@ void Audio::taskWrapper(void *param) {
 
 void Audio::audioTask() {
     while (m_f_audioTaskIsRunning) {
-        vTaskDelay(7 / portTICK_PERIOD_MS);  // periodically every 7 ms
+        // woken when I2S has room (DMA buffer sent, IDF5) or the I2S writer has drained the PCM FIFO,
+        // at the latest after AUDIO_TASK_POLL_MS (IDF4, no output running, waiting for data)
+        uint32_t ms = AUDIO_TASK_POLL_MS;
+        if(m_fifoTaskHandle && m_fifoW.load(std::memory_order_relaxed) - m_fifoR.load(std::memory_order_acquire) >= fifoTarget())
+            ms = 50; // FIFO full, the writer wakes us after its next I2S write
+        ulTaskNotifyTake(pdTRUE, ms / portTICK_PERIOD_MS);
         performAudioTask();
     }
     vTaskDelete(nullptr);  // Delete this task
 }
+#if ESP_IDF_VERSION_MAJOR == 5
+bool IRAM_ATTR Audio::i2sSentCallback(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) { // ISR
+    Audio*     self = static_cast<Audio*>(user_ctx);
+    BaseType_t woken = pdFALSE;
+    if(self->m_audioTaskHandle && !self->m_fifoTaskHandle) vTaskNotifyGiveFromISR(self->m_audioTaskHandle, &woken);
+    return woken == pdTRUE;
+}
+#endif
 
 void Audio::performAudioTask() {
-    if(!m_f_running) return;
-    if(!m_f_stream) return;
+    if(!m_f_running || (!m_f_stream && !m_xfFill)) { // nothing of our own to play
+        if(m_mixSrc || m_clipCount) playIdle();
+        return;
+    }
     xSemaphoreTake(mutex_playAudioData, portMAX_DELAY);
     playAudioData();
+    for(int i = 0; i < 8 && m_fifoBuf && m_f_running; i++) { // fill the PCM FIFO in a burst
+        if(m_fifoW.load(std::memory_order_relaxed) - m_fifoR.load(std::memory_order_acquire) >= fifoTarget()) break;
+        playAudioData();
+    }
     xSemaphoreGive(mutex_playAudioData);
 }
@@ -24,6 +24,7 @@
 #include <FFat.h>
 #endif // AUDIO_NO_SD_FS
 #include <atomic>
+#include <type_traits>
 
 #if ESP_IDF_VERSION_MAJOR == 5
 #include <driver/i2s_std.h>
@@ -31,9 +32,31 @@
 #include <driver/i2s.h>
 #endif
 
+#if ESP_IDF_VERSION_MAJOR == 5 && ESP_IDF_VERSION_MINOR >= 1 && defined(CONFIG_SPIRAM)
+#define AUDIO_INBUFF_MIRROR // the input buffer can be mapped twice in a row (MMU)
+#include <esp_mmu_map.h>
+#include <esp_cache.h>
+#endif
+
 #ifndef I2S_GPIO_UNUSED
   #define I2S_GPIO_UNUSED -1 // = I2S_PIN_NO_CHANGE in IDF < 5
 #endif
+#ifndef AUDIO_TASK_STACK_SIZE
+  #define AUDIO_TASK_STACK_SIZE 3300
+#endif
+#ifndef AUDIO_FIFO_TASK_STACK_SIZE
+  #define AUDIO_FIFO_TASK_STACK_SIZE 3000 // I2S writer task, see setPcmFifo()
+#endif
+#ifndef AUDIO_TASK_PRIORITY
+  #define AUDIO_TASK_PRIORITY 4 // the I2S writer task (setPcmFifo) runs one above
+#endif
+#ifndef AUDIO_TASK_POLL_MS
+  #define AUDIO_TASK_POLL_MS 7 // longest sleep of the audio task if no I2S event wakes it
+#endif
+#ifndef AUDIO_CLIP_VOICES
+  #define AUDIO_CLIP_VOICES 4 // clips that can play at the same time, see playClip()
+#endif
+// #define AUDIO_STATS // per stage cycle histograms, see getStats(), costs nothing if not defined
 using namespace std;
 
 extern __attribute__((weak)) void audio_info(const char*);
@@ -63,7 +86,7 @@ class AudioBuffer {
 // AudioBuffer will be allocated in PSRAM, If PSRAM not available or has not enough space AudioBuffer will be
 // allocated in FlashRAM with reduced size
 //
-//  m_buffer            m_readPtr                 m_writePtr                 m_endPtr
+//  m_buffer            readPos                   writePos                  m_buffSize
 //   |                       |<------dataLength------->|<------ writeSpace ----->|
 //   ▼                       ▼                         ▼                         ▼
 //   ---------------------------------------------------------------------------------------------------------------
@@ -73,10 +96,11 @@ class AudioBuffer {
 //
 //
 //
-//   if the space between m_readPtr and buffend < m_resBuffSize copy data from the beginning to resBuff
-//   so that the mp3/aac/flac frame is always completed
+//   if the space between readPos and buffend < m_maxBlockSize copy data from the beginning to resBuff
+//   so that the mp3/aac/flac frame is always completed. With setBufsize(..., mirror = true) the PSRAM pages are mapped
+//   a second time directly behind the buffer, the frame is read through this mapping: no copy and no reserved space
 //
-//  m_buffer                      m_writePtr                 m_readPtr        m_endPtr
+//  m_buffer                      writePos                   readPos          m_buffSize
 //   |                                 |<-------writeSpace------>|<--dataLength-->|
 //   ▼                                 ▼                         ▼                ▼
 //   ---------------------------------------------------------------------------------------------------------------
@@ -84,14 +108,15 @@ class AudioBuffer {
 //   ---------------------------------------------------------------------------------------------------------------
 //   |<---  ------dataLength--  ------>|<-------freeSpace------->|
 //
-//
+//  lock-free single producer (network / file) and single consumer (decoder): the read and write indices are atomic and
+//  run from 0 to 2 * m_buffSize - 1, so a full buffer (distance m_buffSize) and an empty one (distance 0) are distinct
 
 public:
     AudioBuffer(size_t maxBlockSize = 0);       // constructor
     ~AudioBuffer();                             // frees the buffer
     size_t   init();                            // set default values
     bool     isInitialized() { return m_f_init; };
-    void     setBufsize(int ram, int psram);
+    void     setBufsize(int ram, int psram, bool mirror = false);
     int32_t  getBufsize();
     void     changeMaxBlockSize(uint16_t mbs);  // is default 1600 for mp3 and aac, set 16384 for FLAC
     uint16_t getMaxBlockSize();                 // returns maxBlockSize
@@ -109,42 +134,81 @@ public:
     bool     havePSRAM() { return m_f_psram; };
 
 protected:
-    SemaphoreHandle_t mutex_buffer;
+    size_t   pos(size_t idx) { return (idx < m_buffSize) ? idx : idx - m_buffSize; } // index -> offset in m_buffer
+    size_t   advance(std::atomic<size_t>& idx, size_t n);
+    void     freeBuffer();
+    bool     initMirror();
     size_t            m_buffSizePSRAM    = UINT16_MAX * 10;   // most webstreams limit the advance to 100...300Kbytes
     size_t            m_buffSizeRAM      = 1600 * 10;
     size_t            m_buffSize         = 0;
-    size_t            m_freeSpace        = 0;
-    size_t            m_writeSpace       = 0;
-    size_t            m_dataLength       = 0;
     size_t            m_resBuffSizeRAM   = 2048;     // reserved buffspace, >= one wav  frame
     size_t            m_resBuffSizePSRAM = 4096 * 4; // reserved buffspace, >= one flac frame
     size_t            m_maxBlockSize     = 1600;
     uint8_t*          m_buffer           = NULL;
-    uint8_t*          m_writePtr         = NULL;
-    uint8_t*          m_readPtr          = NULL;
-    uint8_t*          m_endPtr           = NULL;
-    bool              m_f_start          = true;
+    std::atomic<size_t> m_writeIdx{0};           // written by the producer only, 0 ... 2 * m_buffSize - 1
+    std::atomic<size_t> m_readIdx{0};            // written by the consumer only
     bool              m_f_init           = false;
     bool              m_f_psram          = false;    // PSRAM is available (and used...)
+    bool              m_f_mirror         = false;    // double mapping requested
+    uint8_t*          m_mirrorHeap       = NULL;     // the allocation behind the double mapping, NULL: not mirrored
 };
 //----------------------------------------------------------------------------------------------------------------------
 
+struct MP3DecoderContext;  // decoder state per Audio instance, opaque here
+struct AACDecoderContext;
+struct FLACDecoderContext;
+struct OPUSDecoderContext;
+struct VORBISDecoderContext;
+
 class Audio : private AudioBuffer{
 
+private:
     AudioBuffer InBuff; // instance of input buffer
 
 public:
+    typedef enum { LOWSHELF = 0, PEAKEQ = 1, HIGHSHELF = 2, LOWPASS = 3, HIGHPASS = 4 } FilterType;
+    typedef enum { SRC_LOW = 0, SRC_MEDIUM = 1, SRC_HIGH = 2 } SrcQuality;
+    typedef enum { RG_OFF = 0, RG_TRACK = 1, RG_ALBUM = 2 } ReplayGainMode;
+    typedef enum { STAT_FILL = 0, STAT_DECODE_MP3 = 1, STAT_DECODE_AAC = 2, STAT_DECODE_FLAC = 3, STAT_DECODE_OPUS = 4,
+                   STAT_DECODE_VORBIS = 5, STAT_DECODE_WAV = 6, STAT_DSP = 7, STAT_I2S_WAIT = 8, STAT_STAGES = 9 } StatStage;
+
+    typedef struct _vu_meter{
+        float    peak[2];        // dBFS, left, right
+        float    rms[2];         // dBFS, left, right
+        uint32_t clipped[2];     // number of clipped samples since connecttoXXX, measured before EQ and gain
+    } vu_meter_t;
+
+    typedef struct _loudness{
+        float    momentary;      // LUFS, 400 ms
+        float    shortTerm;      // LUFS, 3 s
+        float    integrated;     // LUFS, gated, since the start of the stream or file
+        float    gain;           // dB, applied by the auto gain
+    } loudness_t;
+
+    typedef struct _stats{
+        uint32_t count;          // calls since resetStats()
+        uint32_t min;            // CPU cycles per call
+        uint32_t max;
+        uint32_t p50;            // upper edge of the histogram bucket, within 25%
+        uint32_t p99;
+        uint64_t cycles;         // sum of all calls
+        uint64_t bytes;          // moved by this stage, bytes / cycles * getCpuFreqMHz() = MB/s
+    } stats_t;
+
     Audio(bool internalDAC = false, uint8_t channelEnabled = 3, uint8_t i2sPort = I2S_NUM_0); // #99
     ~Audio();
-    void setBufsize(int rambuf_sz, int psrambuf_sz);
+    void setBufsize(int rambuf_sz, int psrambuf_sz, bool mirror = false);
     bool openai_speech(const String& api_key, const String& model, const String& input, const String& voice, const String& response_format, const String& speed);
     bool connecttohost(const char* host, const char* user = "", const char* pwd = "");
     bool connecttospeech(const char* speech, const char* lang);
 	#ifndef AUDIO_NO_SD_FS
     bool connecttoFS(fs::FS &fs, const char* path, int32_t m_fileStartPos = -1);
+    bool queueNextFS(fs::FS &fs, const char* path);
 	#endif
     bool setFileLoop(bool input);//TEST loop
     void setConnectionTimeout(uint16_t timeout_ms, uint16_t timeout_ms_ssl);
+    void setPrebuffer(uint16_t target_ms = 2000, uint16_t min_ms = 500, uint16_t max_ms = 10000);
+    uint16_t getPrebuffer() { return m_prebuf_ms; } // current target, adapted to the network jitter
     bool setAudioPlayPosition(uint16_t sec);
     bool setFilePos(uint32_t pos);
     bool audioFileSeek(const float speed);
@@ -173,11 +237,49 @@ public:
     uint32_t getAudioCurrentTime();
     uint32_t getTotalPlayingTime();
     uint16_t getVUlevel();
+    void     getVUmeter(vu_meter_t* vu);
+    void     setVUmeter(uint16_t attack_ms, uint16_t release_ms);
+    bool     setLoudnessMeter(bool enable);
+    void     getLoudness(loudness_t* ld);
+    bool     setAutoGain(bool enable, int8_t target_LUFS = -18, uint8_t maxGain_dB = 12);
+    bool     setOutputBits(uint8_t bits);
+    bool     setLimiter(bool enable, int8_t threshold_dB = -1, uint8_t ratio = 0, uint16_t attack_ms = 5, uint16_t release_ms = 100, uint8_t lookahead_ms = 5);
+    void     setReplayGain(uint8_t mode, int8_t preamp_dB = 0);
+    bool     setCrossfade(uint8_t seconds);
+    uint8_t  getCrossfadeLoad();
+    bool     setOutputRate(uint32_t rate, uint8_t quality = SRC_MEDIUM);
+    uint32_t getOutputRate();
+    bool     setSpectrumAnalyzer(uint8_t bands, uint8_t updateRate);
+    uint8_t  getSpectrum(float* bands, uint8_t maxBands);
+    bool     setPcmTap(uint32_t frames);
+    int8_t   pcmTapSubscribe();
+    void     pcmTapUnsubscribe(int8_t id);
+    uint32_t pcmTapPeek(int8_t id, const int16_t** frames);
+    bool     pcmTapConsume(int8_t id, uint32_t frames);
+    uint32_t pcmTapRead(int8_t id, int16_t* buff, uint32_t frames);
+    uint32_t pcmTapOverruns(int8_t id);
+    bool     setPcmFifo(uint16_t ms);
+    uint16_t getPcmFifoLevel();
+    uint32_t getPcmFifoUnderruns();
+    bool     setMixerSource(Audio* source);
+    void     setDucking(int8_t duck_dB = -15, uint16_t attack_ms = 150, uint16_t release_ms = 1000);
+    int8_t   loadClip(const int16_t* pcm, uint32_t frames, uint8_t channels, uint32_t sampleRate);
+#ifndef AUDIO_NO_SD_FS
+    int8_t   loadClip(fs::FS& fs, const char* path); // 16 bit PCM WAV
+#endif
+    bool     unloadClip(int8_t clip);
+    int8_t   playClip(int8_t clip, int8_t gain_dB = 0);
+    void     stopClip(int8_t voice = -1); // -1: all voices
+    bool     getStats(uint8_t stage, stats_t* st); // false if AUDIO_STATS is not defined
+    void     resetStats();
 
     uint32_t inBufferFilled(); // returns the number of stored bytes in the inputbuffer
     uint32_t inBufferFree();   // returns the number of free bytes in the inputbuffer
     uint32_t inBufferSize();   // returns the size of the inputbuffer in bytes
     void setTone(int8_t gainLowPass, int8_t gainBandPass, int8_t gainHighPass);
+    bool setEqBand(uint8_t band, uint8_t type, uint16_t freq, float q, int8_t gain);
+    void clearEqBand(uint8_t band);
+    uint8_t getEqBands() { return m_eqMaxBands; }
     void setI2SCommFMT_LSB(bool commFMT);
     int getCodec() {return m_codec;}
     const char *getCodecname() {return codecname[m_codec];}
@@ -199,6 +301,11 @@ private:
   void            initInBuff();
   bool            httpPrint(const char* host);
   void            processLocalFile();
+#ifndef AUDIO_NO_SD_FS
+  File            openAudioFile(fs::FS& fs, const char* path);
+  uint8_t         codecFromFileName(const char* name);
+  bool            startNextFile();
+#endif
   void            processWebStream();
   void            processWebFile();
   void            processWebStreamTS();
@@ -230,11 +337,60 @@ private:
   bool            setBitsPerSample(int bits);
   bool            setChannels(int channels);
   void            reconfigI2S();
+  void            setHiRes();
+  void            wavConvert(uint8_t* data, uint32_t len);
   bool            setBitrate(int br);
+  void            processChunk();
   void            playChunk();
-  void            computeVUlevel(int16_t sample[2]);
+  template <typename T> void computeVUlevel(T* block, uint16_t frames);
+  void            resetVUmeter();
+  template <typename T> void loudnessTap(T* block, uint16_t frames);
+  void            loudnessSetup();
+  void            loudnessReset();
+  void            loudnessBlock();
+  template <typename T> uint16_t gaplessTrim(T* block, uint16_t frames);
+  void            processFrames(void* block, uint16_t frames);
+  void            processDSP(void* block, uint16_t frames);
+  template <typename T> void DSPchain(T* block, uint16_t frames);
+  template <typename T> void limiter(T* block, uint16_t frames);
+  void            limiterSetup();
+  void            limiterGain(int32_t fsLog, int32_t makeup);
+  void            decodeFrame();
+  bool            xfAlloc(uint32_t frames);
+  void            xfStart();
+  void            xfWrite(int16_t* block, uint16_t frames);
+  void            xfFeed();
+  void            xfMix(int16_t* block, uint16_t frames);
+  bool            xfResample(uint32_t rate);
+  void            SRC_design();
+  template <typename T> uint16_t SRC_process();
+  void            SRC_nextSlice();
+  template <typename T> void spectrumTap(T* block, uint16_t frames);
+  void            pcmTapWrite(void* block, uint16_t frames);
+  uint32_t        fifoTarget();
+  uint32_t        fifoPush(const uint8_t* data, uint32_t bytes);
+  uint32_t        mixerPush(const uint8_t* data, uint32_t frames, bool hiRes, uint32_t rate);
+  void            playIdle();
+  int8_t          clipAdd(int16_t* buf, uint32_t frames, uint32_t sampleRate);
+  void            clipMix(uint8_t* data, uint32_t frames);
+  bool            clipsPlaying();
+  template <typename T> void mixer(T* block, uint16_t frames);
+  void            fifoFlush();
+#ifdef AUDIO_STATS
+  void            statRecord(uint8_t stage, uint32_t t0, BaseType_t core, uint32_t bytes);
+  uint8_t         statDecodeStage(uint8_t codec);
+#endif
+  void            fifoDrain();
+  static void     fifoTaskWrapper(void* param);
+  void            fifoTask();
+  static void     spectrumTaskWrapper(void* param);
+  void            spectrumTask();
+  void            computeVolumeTable();
   void            computeLimit();
-  void            Gain(int16_t* sample);
+  template <typename T> void Gain(T* block, uint16_t frames);
+  void            replayGainTag(const char* key, const char* value);
+  void            replayGainSet(int16_t track, int16_t album);
+  void            replayGainID3(const uint8_t* frame, uint32_t size);
   void            showstreamtitle(const char* ml);
   bool            parseContentType(char* ct);
   bool            parseHttpResponseHeader();
@@ -242,13 +398,11 @@ private:
   esp_err_t       I2Sstart(uint8_t i2s_num);
   esp_err_t       I2Sstop(uint8_t i2s_num);
   void            urlencode(char* buff, uint16_t buffLen, bool spacesOnly = false);
-  void            IIR_filterChain0(int16_t iir_in[2], bool clear = false);
-  void            IIR_filterChain1(int16_t iir_in[2], bool clear = false);
-  void            IIR_filterChain2(int16_t iir_in[2], bool clear = false);
+  template <typename T> void IIR_filterChain(T* block, uint16_t frames);
   inline void     setDatamode(uint8_t dm) { m_datamode = dm; }
   inline uint8_t  getDatamode() { return m_datamode; }
   inline uint32_t streamavail() { return _client ? _client->available() : 0; }
-  void            IIR_calculateCoefficients(int8_t G1, int8_t G2, int8_t G3);
+  void            IIR_calculateCoefficients();
   bool            ts_parsePacket(uint8_t* packet, uint8_t* packetStart, uint8_t* packetLength);
 
   //+++ create a T A S K  for playAudioData(), output via I2S +++
@@ -257,18 +411,25 @@ private:
   static void     taskWrapper(void *param);
   void            audioTask();
   void            performAudioTask();
+#if ESP_IDF_VERSION_MAJOR == 5
+  static bool     i2sSentCallback(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+#endif
 
   //+++ W E B S T R E A M  -  H E L P   F U N C T I O N S +++
   uint16_t readMetadata(uint16_t b, bool first = false);
   size_t   chunkedDataTransfer(uint8_t* bytes);
   bool     readID3V1Tag();
   boolean  streamDetection(uint32_t bytesAvail);
+  uint32_t measuredBitrate();
+  uint32_t prebufferBytes(uint32_t ms);
   void     seek_m4a_stsz();
   void     seek_m4a_ilst();
+  void     m4a_readFreeform(uint32_t ilstPos, uint32_t ilstSize);
   uint32_t m4a_correctResumeFilePos(uint32_t resumeFilePos);
   uint32_t ogg_correctResumeFilePos(uint32_t resumeFilePos);
   int32_t  flac_correctResumeFilePos(uint32_t resumeFilePos);
   int32_t  mp3_correctResumeFilePos(uint32_t resumeFilePos);
+  void     mp3_readGaplessInfo(uint8_t* data, int32_t len);
   uint8_t  determineOggCodec(uint8_t* data, uint16_t len);
 
   //++++ implement several function with respect to the index of string ++++
@@ -453,7 +614,6 @@ private:
                  CODEC_AACP = 6, CODEC_OPUS = 7, CODEC_OGG = 8, CODEC_VORBIS = 9};
     enum : int { ST_NONE = 0, ST_WEBFILE = 1, ST_WEBSTREAM = 2};
     typedef enum { LEFTCHANNEL=0, RIGHTCHANNEL=1 } SampleIndex;
-    typedef enum { LOWSHELF = 0, PEAKEQ = 1, HIFGSHELF =2 } FilterType;
 
     typedef struct _filter{
         float a0;
@@ -463,12 +623,73 @@ private:
         float b2;
     } filter_t;
 
+    typedef struct _eq_band{
+        uint8_t  type;           // FilterType
+        uint16_t freq;           // Hz
+        float    q;
+        int8_t   gain;           // dB
+        bool     used;
+    } eq_band_t;
+
+    typedef struct _iir_stage{   // fixed point biquad, Q4.28
+        int32_t a0;
+        int32_t a1;
+        int32_t a2;
+        int32_t b1;
+        int32_t b2;
+        bool    flat;            // 0 dB, identity, not processed
+    } iir_stage_t;
+
+    void IIR_calculateBiquad(const eq_band_t* band, filter_t* flt);
+    template <typename T> void IIR_filterStage(T* block, uint16_t frames, uint8_t f, const iir_stage_t* st, const iir_stage_t* to);
+    void IIR_lock()   { while(m_iirWriteLock.test_and_set(std::memory_order_acquire)) vTaskDelay(1); } // UI writers only
+    bool IIR_tryLock() { return !m_iirWriteLock.test_and_set(std::memory_order_acquire); } // audio task, never waits
+    void IIR_unlock() { m_iirWriteLock.clear(std::memory_order_release); }
+    void IIR_update();
+
+    class DecoderLock { // binds this instance's decoder contexts while in scope, CODEC_NONE: all decoders
+      public:
+        DecoderLock(Audio* audio, uint8_t codec);
+        ~DecoderLock();
+        void unlock();
+      private:
+        Audio*  m_audio;
+        uint8_t m_codec;
+    };
+
+    typedef struct _clip{
+        int16_t* pcm;            // stereo frames, PSRAM
+        uint32_t frames;
+        uint32_t rate;
+        bool     f_unload;       // unloadClip() waits for the voices, playClip() doesn't start a new one
+    } clip_t;
+
+    typedef struct _voice{
+        std::atomic<uint8_t> state{0}; // VOICE_IDLE ... VOICE_STOP
+        int8_t   clip = -1;
+        int16_t  gain = 0;       // Q15
+        uint64_t pos = 0;        // frames in the clip, Q16
+    } voice_t;
+    enum : uint8_t { VOICE_IDLE = 0, VOICE_SETUP = 1, VOICE_PLAY = 2, VOICE_STOP = 3 };
+
+#ifdef AUDIO_STATS
+    typedef struct _stat_hist{
+        uint32_t bucket[128];    // 4 buckets per octave of cycles
+        uint32_t count;
+        uint32_t min;
+        uint32_t max;
+        uint64_t cycles;
+        uint64_t bytes;
+    } stat_hist_t;
+#endif
+
     typedef struct _pis_array{
         int number;
         int pids[4];
     } pid_array;
 #ifndef AUDIO_NO_SD_FS
     File                  audiofile;    // @suppress("Abstract class cannot be instantiated")
+    File                  m_nextFile;   // gapless, queued by queueNextFS()
 	#endif  // AUDIO_NO_SD_FS	
     WiFiClient            client;       // @suppress("Abstract class cannot be instantiated")
     WiFiClientSecure      clientsecure; // @suppress("Abstract class cannot be instantiated")
@@ -498,7 +719,8 @@ private:
     const size_t    m_frameSizeFLAC   = 4096 * 4;
     const size_t    m_frameSizeOPUS   = 1024;
     const size_t    m_frameSizeVORBIS = 4096 * 2;
-    const size_t    m_outbuffSize     = 4096 * 2;
+    const size_t    m_outbuffSize     = 4096 * 4;
+    static const uint8_t m_eqMaxBands = 10;         // parametric equalizer, 3 tone control bands + 7
 
     static const uint8_t m_tsPacketSize  = 188;
     static const uint8_t m_tsHeaderSize  = 4;
@@ -511,7 +733,7 @@ private:
     char*           m_lastM3U8host = NULL;
     char*           m_playlistBuff = NULL;          // stores playlistdata
     const uint16_t  m_plsBuffEntryLen = 256;        // length of each entry in playlistBuff
-    filter_t        m_filter[3];                    // digital filters
+    eq_band_t       m_eqBand[m_eqMaxBands];         // parametric equalizer, 0...2 tone control
     int             m_LFcount = 0;                  // Detection of end of header
     uint32_t        m_sampleRate=16000;
     uint32_t        m_bitRate=0;                    // current bitrate given fom decoder
@@ -522,8 +744,14 @@ private:
     int8_t          m_balance = 0;                  // -16 (mute left) ... +16 (mute right)
     uint16_t        m_vol = 21;                     // volume
     uint8_t         m_vol_steps = 21;               // default
-    double          m_limit_left = 0;               // limiter 0 ... 1, left channel
-    double          m_limit_right = 0;              // limiter 0 ... 1, right channel
+    uint16_t        m_volTable[2][256];             // Q15 gain of every volume step, [curve][vol]
+    std::atomic<uint32_t> m_gainTarget{0};          // Q15 gain, left: bit 0...15, right: bit 16...31
+    int16_t         m_rgTrack = INT16_MIN;          // ReplayGain of the current file, 1/256 dB, INT16_MIN: no tag
+    int16_t         m_rgAlbum = INT16_MIN;
+    int16_t         m_headerGain = 0;               // 1/256 dB, Opus output gain, applied in every ReplayGain mode
+    uint8_t         m_rgMode = RG_OFF;
+    int8_t          m_rgPreamp = 0;                 // dB
+    int32_t         m_gainCur[2] = {0};             // Q15 gain in use, owned by the audio task
     uint8_t         m_curve = 0;                    // volume characteristic
     uint8_t         m_bitsPerSample = 16;           // bitsPerSample
     uint8_t         m_channels = 2;
@@ -535,16 +763,186 @@ private:
     uint8_t         m_filterType[2];                // lowpass, highpass
     uint8_t         m_streamType = ST_NONE;
     uint8_t         m_ID3Size = 0;                  // lengt of ID3frame - ID3header
-    uint8_t         m_vuLeft = 0;                   // average value of samples, left channel
-    uint8_t         m_vuRight = 0;                  // average value of samples, right channel
+    uint8_t         m_vuLeft = 0;                   // peak value of samples, left channel
+    uint8_t         m_vuRight = 0;                  // peak value of samples, right channel
+    vu_meter_t      m_vu = {};                      // snapshot, read by getVUmeter()
+    std::atomic<uint32_t> m_vuSeq{0};               // odd while the snapshot is being written
+    float           m_vuEnvPeak[2] = {0};           // peak envelope 0 ... 1.0
+    float           m_vuEnvMs[2] = {0};             // mean square envelope 0 ... 1.0
+    uint16_t        m_vuAttack_ms = 5;
+    uint16_t        m_vuRelease_ms = 500;
+    static const uint16_t m_lmBins = 375;           // loudness histogram, -70 ... +5 LUFS in 0.2 LU steps
+    uint32_t*       m_lmHist = NULL;                // 400 ms gating blocks per bin
+    float           m_lmK[5] = {0};                 // K-weighting shelf b0 b1 b2 a1 a2, the highpass has b = 1 -2 1
+    float           m_lmHp[2] = {0};                // highpass a1 a2
+    float           m_lmZ[2][4] = {{0}};            // filter states per channel
+    float           m_lmSum = 0;                    // sum of squares of the current 100 ms block
+    float           m_lmRing[30] = {0};             // mean squares of the last 100 ms blocks (3 s)
+    uint8_t         m_lmIdx = 0;
+    uint8_t         m_lmFill = 0;                   // valid entries in m_lmRing
+    uint16_t        m_lmSub = 4410;                 // frames per 100 ms
+    uint16_t        m_lmCnt = 0;
+    uint32_t        m_lmBlocks = 0;                 // gating blocks above -70 LUFS
+    double          m_lmUngated = 0;                // their summed mean squares
+    loudness_t      m_lm = {};                      // snapshot, read by getLoudness()
+    std::atomic<uint32_t> m_lmSeq{0};               // odd while the snapshot is being written
+    std::atomic<int16_t>  m_agcGain{0};             // auto gain, 1/256 dB, folded into the volume
+    int8_t          m_agcTarget = -18;              // LUFS
+    uint8_t         m_agcMax = 12;                  // dB
+    bool            m_f_loudness = false;
+    bool            m_f_agc = false;
+    static const uint16_t m_limRingSize = 512;      // limiter look-ahead delay line, frames
+    static const uint8_t  m_limSub = 16;            // frames per gain computation
+    int32_t*        m_limRing = NULL;               // interleaved L/R
+    uint16_t        m_limW = 0;                     // write index
+    uint16_t        m_limDelay = 0;                 // look-ahead in frames
+    int32_t         m_limHold[32];                  // target gains of the last sub blocks (Q15)
+    uint8_t         m_limHoldIdx = 0;
+    uint8_t         m_limHoldLen = 1;               // sub blocks covered by the look-ahead
+    uint32_t        m_limPk = 0;                    // peak of the current sub block
+    uint8_t         m_limCnt = 0;                   // frames in the current sub block
+    int32_t         m_limGr = 32768;                // smoothed gain reduction, Q15
+    int32_t         m_limG = 1 << 20;               // applied gain incl. makeup, Q20
+    int32_t         m_limGt = 1 << 20;              // end of the current ramp
+    int32_t         m_limStep = 0;
+    int32_t         m_limThr = 0;                   // threshold, log2 Q16 relative to full scale
+    int32_t         m_limKa = 32768;                // attack coefficient per sub block, Q15
+    int32_t         m_limKr = 32768;                // release coefficient per sub block, Q15
+    std::atomic<int32_t> m_limMakeup{4096};         // level correction of the EQ (m_corr), Q12
+    uint16_t        m_limAttack_ms = 5;
+    uint16_t        m_limRelease_ms = 100;
+    uint8_t         m_limLookahead_ms = 5;
+    uint8_t         m_limRatio = 0;                 // 0: limiter (infinite ratio)
+    bool            m_f_limiter = false;
+    static const uint16_t m_spFftSize = 512;        // spectrum analyzer
+    static const uint16_t m_spRingSize = 1024;
+    static const uint8_t  m_spMaxBands = 32;
+    int16_t*        m_spRing = NULL;                // decimated mono samples, written by the audio task
+    int16_t*        m_spWindow = NULL;              // Hann, Q15
+    int32_t*        m_spFft = NULL;                 // complex, interleaved
+    std::atomic<uint32_t> m_spWrite{0};             // ring write index
+    std::atomic<uint32_t> m_spSeq{0};               // odd while m_spOut is being written
+    float           m_spOut[m_spMaxBands] = {0};    // band magnitudes dBFS, read by getSpectrum()
+    uint16_t        m_spEdge[m_spMaxBands + 1] = {0};
+    int32_t         m_spAcc = 0;
+    uint8_t         m_spDecimCnt = 0;
+    uint8_t         m_spBands = 0;                  // 0: analyzer off
+    uint8_t         m_spRate = 20;                  // updates per second
+    TaskHandle_t    m_spTaskHandle = nullptr;
+    static const uint8_t  m_tapMaxSubs = 4;         // PCM tap, one writer (audio task), up to 4 readers
+    int16_t*        m_tapRing = NULL;               // 16 bit stereo frames as sent to I2S
+    uint32_t        m_tapMask = 0;                  // ring size in frames - 1
+    std::atomic<uint32_t> m_tapClaim{0};            // frames the writer is about to write
+    std::atomic<uint32_t> m_tapWrite{0};            // frames written
+    std::atomic<uint32_t> m_tapRead[m_tapMaxSubs];  // read position per subscriber
+    std::atomic<uint32_t> m_tapOverruns[m_tapMaxSubs];
+    std::atomic<uint8_t>  m_tapSubs{0};             // bit mask of the used subscriber slots
+    static const uint8_t  m_tapLock = 0x80;         // in m_tapSubs while setPcmTap() changes the ring
+    uint8_t*        m_fifoBuf = NULL;               // PCM FIFO between the DSP chain and the I2S writer task
+    uint32_t        m_fifoSize = 0;                 // bytes, power of two
+    uint16_t        m_fifo_ms = 0;                  // fill level the audio task decodes ahead
+    std::atomic<uint32_t> m_fifoW{0};               // bytes written by the audio task
+    std::atomic<uint32_t> m_fifoR{0};               // bytes sent to I2S by the writer task
+    std::atomic<uint32_t> m_fifoDrop{0};            // the writer skips everything before this position
+    std::atomic<uint32_t> m_fifoUnderruns{0};
+    std::atomic<bool>     m_f_fifoRun{false};
+    TaskHandle_t    m_fifoTaskHandle = nullptr;
+    MP3DecoderContext*    m_mp3Ctx = NULL;      // one state per decoder, swapped in by DecoderLock
+    AACDecoderContext*    m_aacCtx = NULL;
+    FLACDecoderContext*   m_flacCtx = NULL;
+    OPUSDecoderContext*   m_opusCtx = NULL;
+    VORBISDecoderContext* m_vorbisCtx = NULL;
+    static const uint16_t m_mixFrames = 8192;       // mixer ring, 16 bit stereo frames, power of two
+    Audio*          m_mixSrc = NULL;                // secondary source (announcements) mixed into this object's output
+    std::atomic<Audio*>   m_mixTarget{nullptr};     // set in the secondary source: its frames go to the target's mixer
+    int16_t*        m_mixRing = NULL;
+    std::atomic<uint32_t> m_mixW{0};                // frames written by the source's audio task
+    std::atomic<uint32_t> m_mixR{0};                // frames mixed by this audio task
+    std::atomic<uint32_t> m_mixRate{0};             // sample rate of the frames in the ring
+    uint32_t        m_mixPhase = 0;                 // linear interpolation between m_mixPrev and m_mixNext, Q16
+    int16_t         m_mixPrev[2] = {0, 0};
+    int16_t         m_mixNext[2] = {0, 0};
+    uint32_t        m_duckLevel = 2983425;          // Q24, gain of this object's samples while the source plays (-15 dB)
+    uint32_t        m_duckGain = 1 << 24;           // Q24, current gain, ramps towards m_duckLevel or 1.0
+    uint16_t        m_duckAttack_ms = 150;
+    uint16_t        m_duckRelease_ms = 1000;
+    static const uint8_t  m_clipMax = 16;           // loaded clips
+    static const uint16_t m_clipSlice = 512;        // frames per I2S write while clips are loaded (one DMA buffer)
+    clip_t          m_clip[m_clipMax] = {};
+    voice_t         m_voice[AUDIO_CLIP_VOICES];
+    uint8_t         m_clipCount = 0;
+    uint16_t        m_clipAhead = 0;                // frames of the current block after m_curSample that are mixed already
+    uint32_t        m_fifoClipTo = 0;               // FIFO position up to which the I2S writer has mixed the clips
+#ifdef AUDIO_STATS
+    stat_hist_t     m_stat[STAT_STAGES] = {};       // each stage is written by one task only
+    std::atomic<uint16_t> m_statReset{0};           // stages to be cleared by their writer, bit per stage
+    std::atomic<uint32_t> m_statSeq[STAT_STAGES] = {}; // odd while the histogram of the stage is being written
+#endif
+    static const uint8_t  m_srcMaxTaps = 32;        // sample rate converter
+    static const uint16_t m_srcMaxPhases = 128;
+    static const uint16_t m_srcOutFrames = 1024;    // frames per resampled slice
+    uint32_t        m_outputRate = 0;               // 0: I2S follows the source, otherwise fixed
+    uint32_t        m_i2sRate = 0;                  // current I2S clock
+    uint8_t         m_i2sBits = 16;                 // current I2S slot width
+    uint8_t         m_outputBits = 16;              // 32: 24 bit sources (FLAC, WAV) are played with 32 bit slots
+    bool            m_f_hiRes = false;              // samples in m_outBuff are int32 (24 bit, right justified)
+    int16_t*        m_srcCoef = NULL;               // (phases + 1) * taps, Q14
+    void*           m_srcIn = NULL;                 // taps - 1 frames history + one decoded block, interleaved L/R, int16 or int32
+    void*           m_srcBuff = NULL;               // resampled slice, interleaved L/R, int16 or int32
+    uint64_t        m_srcPos = 0;                   // read position in m_srcIn frames, Q32
+    uint64_t        m_srcStep = 0;                  // source rate / output rate, Q32
+    uint16_t        m_srcInFrames = 0;              // new frames in m_srcIn, 0: nothing pending
+    uint8_t         m_srcTaps = 16;
+    uint8_t         m_srcPhaseBits = 6;
+    uint8_t         m_srcQuality = SRC_MEDIUM;
+    bool            m_f_srcActive = false;
+    bool            m_f_srcInterp = true;
+    uint32_t        m_trimSkip = 0;                 // gapless, frames to drop at the start (encoder + decoder delay)
+    uint32_t        m_trimRemain = 0;               // frames left until the encoder padding
+    uint8_t         m_nextCodec = CODEC_NONE;       // codec of m_nextFile
+    bool            m_f_trimEnd = false;            // m_trimRemain is valid
+    bool            m_f_gapless = false;            // switched to the queued file, no prebuffering
+    bool            m_f_decodeTail = false;         // file read completely, the audio task decodes the rest, even a partial block
+    bool            m_f_fileDataComplete = false;   // processLocalFile(), the file is read up to the end of the audio data
+    uint32_t        m_fileBytesRead = 0;            // processLocalFile(), file position of the next read
+    uint32_t        m_headerStartTime = 0;          // processLocalFile(), timeout of the header parsing
+    bool            m_f_setDecodeParamsOnce = true; // sendBytes(), setDecoderItems() after the first decoded frame
+    enum : uint8_t { XF_IDLE = 0, XF_CAPTURE = 1, XF_MIX = 2 };
+    static const uint16_t m_xfOutFrames = 1024;     // crossfade, frames per block from the ring
+    static const uint8_t  m_xfDecodes = 3;          // max. decoded frames per audio task cycle while capturing
+    int16_t*        m_xfBuff = NULL;                // ring (PSRAM), tail of the current file, interleaved L/R
+    int16_t*        m_xfOut = NULL;                 // block read from the ring
+    int16_t         m_xfSin[257];                   // quarter sine, Q15, equal-power gains
+    volatile uint8_t m_xfState = XF_IDLE;
+    uint8_t         m_xfSeconds = 0;                // 0: no crossfade
+    uint8_t         m_xfLoad = 0;                   // % CPU of the last crossfade
+    uint32_t        m_xfSize = 0;                   // ring size in frames, m_xfSeconds at the output rate
+    uint32_t        m_xfAlloc = 0;                  // frames allocated
+    uint32_t        m_xfRead = 0;
+    uint32_t        m_xfWrite = 0;
+    volatile uint32_t m_xfFill = 0;                 // frames in the ring
+    uint32_t        m_xfLen = 0;                    // fade length in frames
+    uint32_t        m_xfPos = 0;                    // fade position in frames
+    uint32_t        m_xfRate = 0;                   // output rate while capturing
+    int64_t         m_xfBusy_us = 0;
     int16_t*        m_outBuff = NULL;               // Interleaved L/R
+    void*           m_playBuff = NULL;              // block sent by playChunk(), m_outBuff, m_srcBuff or m_xfOut
     int16_t         m_validSamples = {0};           // #144
-    int16_t         m_curSample{0};
+    int16_t         m_curSample{0};                 // first frame in m_outBuff not yet sent to I2S
     uint16_t        m_datamode{0};                  // Statemaschine
     int16_t         m_decodeError = 0;              // Stores the return value of the decoder
     uint16_t        m_streamTitleHash = 0;          // remember streamtitle, ignore multiple occurence in metadata
     uint16_t        m_timeout_ms = 250;
     uint16_t        m_timeout_ms_ssl = 2700;
+    uint16_t        m_prebuf_ms = 2000;             // web streams start playing with this much audio in InBuff
+    uint16_t        m_prebufMin_ms = 500;
+    uint16_t        m_prebufMax_ms = 10000;
+    uint32_t        m_prebufStable = 0;             // millis() of the stream start or the last underrun
+    bool            m_f_starved = false;            // InBuff holds less than one frame
+    uint32_t        m_brBytes = 0;                  // measured bitrate: bytes given to the decoder ...
+    uint32_t        m_brFrames = 0;                 // ... and the frames it returned
+    uint32_t        m_brHint = 0;                   // bit/s before the first measurement: last connection to m_brHost, m3u8 BANDWIDTH
+    char            m_brHost[64] = {0};             // host of the current web stream
     uint8_t         m_flacBitsPerSample = 0;        // bps should be 16
     uint8_t         m_flacNumChannels = 0;          // can be read out in the FLAC file header
     uint32_t        m_flacSampleRate = 0;           // can be read out in the FLAC file header
@@ -594,19 +992,131 @@ private:
     float           m_audioCurrentTime = 0;
     uint32_t        m_audioDataStart = 0;           // in bytes
     size_t          m_audioDataSize = 0;            //
-    float           m_filterBuff[3][2][2][2];       // IIR filters memory for Audio DSP
+    iir_stage_t     m_iirSet[3][m_eqMaxBands];      // fixed point coefficients of m_eqBand[], triple buffer
+    iir_stage_t     m_iirRun[m_eqMaxBands];         // coefficients in use, owned by the audio task
+    std::atomic<uint8_t> m_iirMiddle{1};            // index of the middle buffer, bit 7: new set available
+    uint8_t         m_iirFront = 0;                 // read by the audio task
+    uint8_t         m_iirBack = 2;                  // written by IIR_calculateCoefficients()
+    std::atomic_flag m_iirWriteLock = ATOMIC_FLAG_INIT; // serializes the writers (UI and IIR_update)
+    std::atomic<bool> m_iirDirty{false};            // samplerate changed, IIR_update() recalculates
+    int32_t         m_iirState[m_eqMaxBands][2][5]; // IIR filters memory [stage][channel][x1, x2, y1, y2, err]
+    uint8_t         m_iirActive[m_eqMaxBands];      // indices of the stages that are not flat
+    uint8_t         m_iirNumActive = 0;             // 0: bypass
+    static const uint8_t m_iirFracBits = 28;        // coefficients Q4.28
     float           m_corr = 1.0;					// correction factor for level adjustment
     size_t          m_i2s_bytesWritten = 0;         // set in i2s_write() but not used
     size_t          m_fileSize = 0;                 // size of the file
     uint16_t        m_filterFrequency[2];
-    int8_t          m_gain0 = 0;                    // cut or boost filters (EQ)
-    int8_t          m_gain1 = 0;
-    int8_t          m_gain2 = 0;
 
     pid_array       m_pidsOfPMT;
     int16_t         m_pidOfAAC;
     uint8_t         m_packetBuff[m_tsPacketSize];
     int16_t         m_pesDataLength = 0;
+
+    // state of the header parsers and stream readers between two calls, per object: two objects can play at the same time
+    struct { // read_WAV_Header()
+        size_t    headerSize = 0;
+        uint32_t  cs = 0;
+        uint8_t   bts = 0;
+    } m_wavHdr;
+    struct { // read_FLAC_Header()
+        size_t    headerSize = 0;
+        size_t    retvalue = 0;
+        bool      f_lastMetaBlock = false;
+        uint32_t  picPos = 0;
+        uint32_t  picLen = 0;
+    } m_flacHdr;
+    struct { // read_ID3_Header()
+        size_t    id3Size = 0;
+        size_t    totalId3Size = 0;
+        size_t    remainingHeaderBytes = 0;
+        size_t    universal_tmp = 0;
+        uint8_t   ID3version = 0;
+        int       ehsz = 0;
+        char      tag[5] = {};
+        char      frameid[5] = {};
+        size_t    framesize = 0;
+        bool      compressed = false;
+#ifndef AUDIO_NO_SD_FS
+        size_t    APIC_size[3] = {};
+        uint32_t  APIC_pos[3] = {};
+        bool      SYLT_seen = false;
+        size_t    SYLT_size = 0;
+        uint32_t  SYLT_pos = 0;
+        uint8_t   numID3Header = 0;
+#endif
+    } m_id3Hdr;
+    struct { // read_M4A_Header()
+        size_t    headerSize = 0;
+        size_t    retvalue = 0;
+        size_t    atomsize = 0;
+        size_t    audioDataPos = 0;
+        uint32_t  picPos = 0;
+        uint32_t  picLen = 0;
+        size_t    cnt = 0;
+    } m_m4aHdr;
+    struct { // parsePlaylist_M3U8()
+        uint64_t  xMedSeq = 0;
+        boolean   f_mediaSeq_found = false;
+    } m_m3u8;
+    struct { // processWebStream()
+        uint32_t  chunkSize = 0;
+    } m_webStream;
+    struct { // processWebFile()
+        bool      f_webFileDataComplete = false;
+        uint32_t  byteCounter = 0;
+        uint32_t  chunkSize = 0;
+        size_t    audioDataCount = 0;
+    } m_webFile;
+    struct { // processWebStreamTS()
+        bool      f_firstPacket = false;
+        bool      f_chunkFinished = false;
+        uint32_t  byteCounter = 0;
+        uint8_t   ts_packet[188] = {};
+        uint8_t   ts_packetPtr = 0;
+        size_t    chunkSize = 0;
+    } m_webTS;
+    struct { // processWebStreamHLS()
+        bool      firstBytes = false;
+        bool      f_chunkFinished = false;
+        uint32_t  byteCounter = 0;
+        size_t    chunkSize = 0;
+        uint16_t  ID3WritePtr = 0;
+        uint16_t  ID3ReadPtr = 0;
+        uint8_t*  ID3Buff = NULL;
+    } m_webHLS;
+    struct { // parseHttpResponseHeader()
+        uint32_t  stime = 0;
+        bool      f_time = false;
+    } m_httpHdr;
+    struct { // findNextSync()
+        uint32_t  swnf = 0;
+    } m_sync;
+    struct { // computeAudioTime()
+        uint64_t  sumBytesIn = 0;
+        uint64_t  sumBytesOut = 0;
+        uint32_t  sumBitRate = 0;
+        uint32_t  counter = 0;
+        uint32_t  timeStamp = 0;
+        uint32_t  deltaBytesIn = 0;
+        uint32_t  nominalBitRate = 0;
+    } m_audioTime;
+    struct { // ts_parsePacket()
+        pid_array pidsOfPMT = {};
+        int       PES_DataLength = 0;
+        int       pidOfAAC = 0;
+        uint8_t   fillData = 0;
+    } m_tsParse;
+    struct { // readMetadata()
+        uint16_t  pos_ml = 0;
+        uint16_t  metalen = 0;
+    } m_meta;
+    struct { // streamDetection()
+        uint32_t  tmr_slow = 0;
+        uint32_t  tmr_lost = 0;
+        uint8_t   cnt_slow = 0;
+        uint8_t   cnt_lost = 0;
+    } m_streamDet;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
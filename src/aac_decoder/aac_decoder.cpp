@@ -7,6 +7,7 @@
  ************************************************************************************/
 
 #include "aac_decoder.h"
+#include <utility>
 
 const uint32_t SQRTHALF             = 0x5a82799a;    /* sqrt(0.5), format = Q31 */
 const uint32_t Q28_2                = 0x20000000;    /* Q28: 2.0 */
@@ -86,6 +87,20 @@ PulseInfo_t          m_pulseInfo[2]; // [MAX_NCHANS_ELEM]
 aac_BitStreamInfo_t  m_aac_BitStreamInfo;
 PSInfoSBR_t         *m_PSInfoSBR;
 
+// every mutable global above, swapped in and out as a whole when another AACDecoderContext takes over
+#define AAC_CONTEXT_VARS(X) \
+    X(m_PSInfoBase) X(m_AACDecInfo) X(m_AACFrameInfo) X(m_fhADTS) X(m_fhADIF) X(m_pce) X(m_pulseInfo) \
+    X(m_aac_BitStreamInfo) X(m_PSInfoSBR)
+
+struct AACDecoderContext {
+#define X(v) decltype(::v) v;
+    AAC_CONTEXT_VARS(X)
+#undef X
+};
+
+AACDecoderContext_t *m_AACContextActive = NULL;
+SemaphoreHandle_t    m_AACContextMutex = NULL;
+
 //----------------------------------------------------------------------------------------------------------------------
 inline int32_t MULSHIFT32(int32_t x, int32_t y){
     int32_t z; z = (int64_t)x * (int64_t)y >> 32;
@@ -1780,6 +1795,63 @@ void AACDecoder_FreeBuffers(void) {
 
 //    log_i("AACDecoder: %lu bytes memory was freed", ESP.getFreeHeap() - i);
 }
+/***********************************************************************************************************************
+ * Function:    AACDecoder_NewContext, AACDecoder_DeleteContext
+ *
+ * Description: creates / destroys an independent decoder state, one per player instance
+ *
+ * Inputs:      context returned by AACDecoder_NewContext (Delete)
+ *
+ * Outputs:     none
+ *
+ * Return:      new context or NULL if out of memory (New)
+ *
+ * Notes:       a deleted context gives its buffers back, no need to call AACDecoder_FreeBuffers before
+ **********************************************************************************************************************/
+AACDecoderContext_t* AACDecoder_NewContext(){
+    if(!m_AACContextMutex) m_AACContextMutex = xSemaphoreCreateRecursiveMutex();
+    AACDecoderContext_t* ctx = (AACDecoderContext_t*)calloc(1, sizeof(AACDecoderContext_t));
+    if(!ctx) log_e("not enough memory to allocate a aacdecoder context");
+    return ctx;
+}
+void AACDecoder_DeleteContext(AACDecoderContext_t* ctx){
+    if(!ctx) return;
+    AACDecoder_Lock(ctx);
+    AACDecoder_FreeBuffers();
+    AACDecoder_SwapContext(ctx); // the previous owner's leftovers go back into the globals, the context is empty now
+    m_AACContextActive = NULL;
+    AACDecoder_Unlock();
+    free(ctx);
+}
+/***********************************************************************************************************************
+ * Function:    AACDecoder_Lock, AACDecoder_Unlock
+ *
+ * Description: makes ctx the state all other AAC functions work on, until the matching unlock
+ *
+ * Inputs:      context returned by AACDecoder_NewContext
+ *
+ * Outputs:     none
+ *
+ * Return:      none
+ *
+ * Notes:       recursive, other tasks block in Lock until the owner has unlocked. Switching to another context swaps
+ *              the globals, re-locking the active one is free
+ **********************************************************************************************************************/
+void AACDecoder_Lock(AACDecoderContext_t* ctx){
+    xSemaphoreTakeRecursive(m_AACContextMutex, portMAX_DELAY);
+    if(ctx == m_AACContextActive) return;
+    if(m_AACContextActive) AACDecoder_SwapContext(m_AACContextActive);
+    AACDecoder_SwapContext(ctx);
+    m_AACContextActive = ctx;
+}
+void AACDecoder_Unlock(){
+    xSemaphoreGiveRecursive(m_AACContextMutex);
+}
+void AACDecoder_SwapContext(AACDecoderContext_t* ctx){
+#define X(v) std::swap(ctx->v, ::v);
+    AAC_CONTEXT_VARS(X)
+#undef X
+}
 
 /***********************************************************************************************************************
  * Function:    AACDecoder_IsInit
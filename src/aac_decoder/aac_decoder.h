@@ -431,6 +431,12 @@ typedef struct _PSInfoSBR {
     int32_t      XBuf[32+8][64][2];
 } PSInfoSBR_t;
 
+typedef struct AACDecoderContext AACDecoderContext_t; // opaque, one per player instance
+AACDecoderContext_t* AACDecoder_NewContext();
+void AACDecoder_DeleteContext(AACDecoderContext_t* ctx);
+void AACDecoder_Lock(AACDecoderContext_t* ctx);
+void AACDecoder_Unlock();
+void AACDecoder_SwapContext(AACDecoderContext_t* ctx);
 bool AACDecoder_AllocateBuffers(void);
 int32_t AACFlushCodec();
 void AACDecoder_FreeBuffers(void);
@@ -10,7 +10,10 @@
  *
  */
 #include "flac_decoder.h"
+#include "../replaygain.h"
 #include "vector"
+#include <new>
+#include <utility>
 using namespace std;
 
 FLACFrameHeader_t*   FLACFrameHeader;
@@ -51,6 +54,30 @@ uint8_t          s_flacPageNr = 0;
 int32_t**        s_samplesBuffer = NULL;
 uint16_t         s_maxBlocksize = MAX_BLOCKSIZE;
 int32_t          s_nBytes = 0;
+uint8_t          s_flacOutputBits = 16; // 32: samples > 16 bit are written as int32 (24 bit, right justified)
+int16_t          s_flacReplayGain[2] = {INT16_MIN, INT16_MIN}; // track, album in 1/256 dB, INT16_MIN: no tag
+uint16_t         s_flacSegmLenTmp = 0;
+int32_t          s_flacSbl = 0;
+
+// every mutable global above, swapped in and out as a whole when another FLACDecoderContext takes over
+#define FLAC_CONTEXT_VARS(X) \
+    X(FLACFrameHeader) X(FLACMetadataBlock) X(s_flacSegmTableVec) X(coefs) X(s_flacBlockPicItem) X(s_flac_bitBuffer) \
+    X(s_flacBitrate) X(s_flacBlockPicLenUntilFrameEnd) X(s_flacCurrentFilePos) X(s_flacBlockPicPos) X(s_flacBlockPicLen) \
+    X(s_flacAudioDataStart) X(s_flacRemainBlockPicLen) X(s_blockSize) X(s_blockSizeLeft) X(s_flacValidSamples) \
+    X(s_rIndex) X(s_offset) X(s_flacStatus) X(s_flacInptr) X(s_flacCompressionRatio) X(s_flacBitBufferLen) \
+    X(s_f_flacParseOgg) X(s_f_bitReaderError) X(s_flac_pageSegments) X(s_flacStreamTitle) X(s_flacVendorString) \
+    X(s_f_flacNewStreamtitle) X(s_f_flacFirstCall) X(s_f_oggWrapper) X(s_f_lastMetaDataBlock) \
+    X(s_f_flacNewMetadataBlockPicture) X(s_flacPageNr) X(s_samplesBuffer) X(s_maxBlocksize) X(s_nBytes) \
+    X(s_flacOutputBits) X(s_flacReplayGain) X(s_flacSegmLenTmp) X(s_flacSbl)
+
+struct FLACDecoderContext {
+#define X(v) decltype(::v) v{};
+    FLAC_CONTEXT_VARS(X)
+#undef X
+};
+
+FLACDecoderContext_t* s_flacContextActive = NULL;
+SemaphoreHandle_t     s_flacContextMutex = NULL;
 
 //----------------------------------------------------------------------------------------------------------------------
 //          FLAC INI SECTION
@@ -130,7 +157,47 @@ void FLACDecoder_FreeBuffers(){
     s_flacBlockPicItem.clear(); s_flacBlockPicItem.shrink_to_fit();
 }
 //----------------------------------------------------------------------------------------------------------------------
+FLACDecoderContext_t* FLACDecoder_NewContext(){ // independent decoder state, one per player instance
+    if(!s_flacContextMutex) s_flacContextMutex = xSemaphoreCreateRecursiveMutex();
+    FLACDecoderContext_t* ctx = new (std::nothrow) FLACDecoderContext_t;
+    if(!ctx) {log_e("not enough memory to allocate a flacdecoder context"); return NULL;}
+    ctx->s_f_flacFirstCall = true; // same start values as the globals
+    ctx->s_maxBlocksize = MAX_BLOCKSIZE;
+    ctx->s_flacOutputBits = 16;
+    ctx->s_flacReplayGain[0] = ctx->s_flacReplayGain[1] = INT16_MIN;
+    return ctx;
+}
+//----------------------------------------------------------------------------------------------------------------------
+void FLACDecoder_DeleteContext(FLACDecoderContext_t* ctx){ // frees the buffers too
+    if(!ctx) return;
+    FLACDecoder_Lock(ctx);
+    FLACDecoder_FreeBuffers();
+    FLACDecoder_SwapContext(ctx); // the previous owner's leftovers go back into the globals
+    s_flacContextActive = NULL;
+    FLACDecoder_Unlock();
+    delete ctx;
+}
+//----------------------------------------------------------------------------------------------------------------------
+void FLACDecoder_Lock(FLACDecoderContext_t* ctx){ // recursive, ctx stays active until the matching unlock
+    xSemaphoreTakeRecursive(s_flacContextMutex, portMAX_DELAY);
+    if(ctx == s_flacContextActive) return;
+    if(s_flacContextActive) FLACDecoder_SwapContext(s_flacContextActive);
+    FLACDecoder_SwapContext(ctx);
+    s_flacContextActive = ctx;
+}
+//----------------------------------------------------------------------------------------------------------------------
+void FLACDecoder_Unlock(){
+    xSemaphoreGiveRecursive(s_flacContextMutex);
+}
+//----------------------------------------------------------------------------------------------------------------------
+void FLACDecoder_SwapContext(FLACDecoderContext_t* ctx){ // vectors swap their heap pointers only
+#define X(v) std::swap(ctx->v, ::v);
+    FLAC_CONTEXT_VARS(X)
+#undef X
+}
+//----------------------------------------------------------------------------------------------------------------------
 void FLACDecoder_setDefaults(){
+    s_flacReplayGain[0] = s_flacReplayGain[1] = INT16_MIN;
     coefs.clear(); coefs.shrink_to_fit();
     s_flacSegmTableVec.clear(); s_flacSegmTableVec.shrink_to_fit();
     s_flacBlockPicItem.clear(); s_flacBlockPicItem.shrink_to_fit();
@@ -534,6 +601,9 @@ int32_t parseMetaDataBlockHeader(uint8_t *inbuf, int16_t nBytes){
                         vb[6] = flac_x_ps_strndup((const char*)(inbuf + pos + 4 + 12), min((uint32_t)127, commemtStringLength - 12));
                         //log_w("TRACKNUMBER: %s", vb[6]);
                     }
+                    if(commemtStringLength < 48 && (*(inbuf + pos + 4) == 'R' || *(inbuf + pos + 4) == 'r')){
+                        flacReplayGain((const char*)(inbuf + pos + 4), commemtStringLength);
+                    }
                     if((FLAC_specialIndexOf(inbuf + pos + 4, "METADATA_BLOCK_PICTURE", 23) == 0) || (FLAC_specialIndexOf(inbuf + pos + 4, "metadata_block_picture", 23) == 0)){
                         //log_w("METADATA_BLOCK_PICTURE found, commemtStringLength %i", commemtStringLength);
                         s_flacBlockPicLen = commemtStringLength - 23;
@@ -593,12 +663,11 @@ int8_t FLACDecode(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){ //  MAIN
 
     int32_t             ret = 0;
     uint16_t        segmLen = 0;
-    static uint16_t segmLenTmp = 0;
 
     if(s_f_flacFirstCall){ // determine if ogg or flag
         s_f_flacFirstCall = false;
         s_nBytes = 0;
-        segmLenTmp = 0;
+        s_flacSegmLenTmp = 0;
         if(FLAC_specialIndexOf(inbuf, "OggS", 5) == 0){
             s_f_oggWrapper = true;
             s_f_flacParseOgg = true;
@@ -607,16 +676,16 @@ int8_t FLACDecode(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){ //  MAIN
 
     if(s_f_oggWrapper){
 
-        if(segmLenTmp){ // can't skip more than 16K
-            if(segmLenTmp > 16384){
+        if(s_flacSegmLenTmp){ // can't skip more than 16K
+            if(s_flacSegmLenTmp > 16384){
                 s_flacCurrentFilePos += 16384;
                 *bytesLeft -= 16384;
-                segmLenTmp -= 16384;
+                s_flacSegmLenTmp -= 16384;
             }
             else{
-                s_flacCurrentFilePos += segmLenTmp;
-                *bytesLeft -= segmLenTmp;
-                segmLenTmp  = 0;
+                s_flacCurrentFilePos += s_flacSegmLenTmp;
+                *bytesLeft -= s_flacSegmLenTmp;
+                s_flacSegmLenTmp  = 0;
             }
             return FLAC_PARSE_OGG_DONE;
         }
@@ -694,7 +763,7 @@ int8_t FLACDecode(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){ //  MAIN
                 break;
         }
         if(segmLen > 16384){
-            segmLenTmp = segmLen;
+            s_flacSegmLenTmp = segmLen;
             return FLAC_PARSE_OGG_DONE;
         }
         *bytesLeft -= segmLen;
@@ -708,7 +777,6 @@ int8_t FLACDecode(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){ //  MAIN
 int8_t FLACDecodeNative(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){
 
     int32_t bl = *bytesLeft;
-    static int32_t sbl = 0;
 
     if(s_flacStatus != OUT_SAMPLES){
         s_rIndex = 0;
@@ -719,7 +787,7 @@ int8_t FLACDecodeNative(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){
         int32_t ret = flacDecodeFrame (inbuf, bytesLeft);
         if(ret != 0) return ret;
         if(*bytesLeft < MAX_BLOCKSIZE) return FLAC_DECODE_FRAMES_LOOP; // need more data
-        sbl += bl - *bytesLeft;
+        s_flacSbl += bl - *bytesLeft;
     }
 
     if(s_flacStatus == DECODE_SUBFRAMES){
@@ -728,7 +796,7 @@ int8_t FLACDecodeNative(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){
         int32_t ret = decodeSubframes(bytesLeft);
         if(ret != 0) return ret;
         s_flacStatus = OUT_SAMPLES;
-        sbl += bl - *bytesLeft;
+        s_flacSbl += bl - *bytesLeft;
     }
 
     if(s_flacStatus == OUT_SAMPLES){  // Write the decoded samples
@@ -738,19 +806,31 @@ int8_t FLACDecodeNative(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf){
         if(s_blockSize < s_flacOutBuffSize + s_offset) blockSize = s_blockSize - s_offset;
         else blockSize = s_flacOutBuffSize;
 
-        for (int32_t i = 0; i < blockSize; i++) {
-            for (int32_t j = 0; j < FLACMetadataBlock->numChannels; j++) {
-                int32_t val = s_samplesBuffer[j][i + s_offset];
-                if (FLACMetadataBlock->bitsPerSample == 8) val += 128;
-                outbuf[2*i+j] = val;
+        uint8_t bps = FLACMetadataBlock->bitsPerSample;
+        if(s_flacOutputBits == 32 && bps > 16) { // hi-res, 24 bit in int32, 16 bit sources are always written as int16
+            int32_t* out32 = (int32_t*)outbuf;
+            for (int32_t i = 0; i < blockSize; i++) {
+                for (int32_t j = 0; j < FLACMetadataBlock->numChannels; j++) {
+                    out32[2*i+j] = s_samplesBuffer[j][i + s_offset] << (24 - bps);
+                }
+            }
+        }
+        else {
+            for (int32_t i = 0; i < blockSize; i++) {
+                for (int32_t j = 0; j < FLACMetadataBlock->numChannels; j++) {
+                    int32_t val = s_samplesBuffer[j][i + s_offset];
+                    if (bps == 8) val += 128;
+                    if (bps > 16) val >>= (bps - 16);
+                    outbuf[2*i+j] = val;
+                }
             }
         }
 
         s_flacValidSamples = blockSize * FLACMetadataBlock->numChannels;
         s_offset += blockSize;
-        if(sbl > 0){
-            s_flacCompressionRatio = (float)((s_flacValidSamples * 2) * FLACMetadataBlock->numChannels) / sbl; // valid samples are 16 bit
-            sbl = 0;
+        if(s_flacSbl > 0){
+            s_flacCompressionRatio = (float)((s_flacValidSamples * 2) * FLACMetadataBlock->numChannels) / s_flacSbl; // valid samples are 16 bit
+            s_flacSbl = 0;
             s_flacBitrate = FLACMetadataBlock->sampleRate * FLACMetadataBlock->bitsPerSample * FLACMetadataBlock->numChannels;
             s_flacBitrate /= s_flacCompressionRatio;
       //      log_e("s_flacBitrate %i, s_flacCompressionRatio %f, FLACMetadataBlock->sampleRate %i ", s_flacBitrate, s_flacCompressionRatio, FLACMetadataBlock->sampleRate);
@@ -794,7 +874,7 @@ int8_t flacDecodeFrame(uint8_t *inbuf, int32_t *bytesLeft){
         if(FLACFrameHeader->sampleSizeCode == 5) FLACMetadataBlock->bitsPerSample = 20;
         if(FLACFrameHeader->sampleSizeCode == 6) FLACMetadataBlock->bitsPerSample = 24;
     }
-    if(FLACMetadataBlock->bitsPerSample > 16) return ERR_FLAC_BITS_PER_SAMPLE_TOO_BIG;
+    if(FLACMetadataBlock->bitsPerSample > 24) return ERR_FLAC_BITS_PER_SAMPLE_TOO_BIG;
     if(FLACMetadataBlock->bitsPerSample < 8 ) return ERR_FLAC_BITS_PER_SAMPLE_UNKNOWN;
     if(!FLACMetadataBlock->sampleRate){
         if(FLACFrameHeader->sampleRateCode == 1)  FLACMetadataBlock->sampleRate =  88200;
@@ -867,6 +947,21 @@ uint8_t FLACGetBitsPerSample(){
     return FLACMetadataBlock->bitsPerSample;
 }
 //----------------------------------------------------------------------------------------------------------------------
+void flacReplayGain(const char* comment, uint32_t len){
+    int16_t g;
+    bool    album;
+    if(replayGainComment(comment, len, &g, &album)) s_flacReplayGain[album] = g;
+}
+//----------------------------------------------------------------------------------------------------------------------
+int16_t FLACGetReplayGain(bool album){
+    return s_flacReplayGain[album];
+}
+//----------------------------------------------------------------------------------------------------------------------
+void FLACSetOutputBits(uint8_t bits){
+    // 16 or 32
+    s_flacOutputBits = bits;
+}
+//----------------------------------------------------------------------------------------------------------------------
 uint8_t FLACGetChannels(){
     if(!FLACMetadataBlock) return 0;
     return FLACMetadataBlock->numChannels;
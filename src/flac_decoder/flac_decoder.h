@@ -153,6 +153,12 @@ int32_t          FLACparseOGG(uint8_t* inbuf, int32_t* bytesLeft);
 vector<uint32_t> FLACgetMetadataBlockPicture();
 int32_t          parseFlacFirstPacket(uint8_t* inbuf, int16_t nBytes);
 int32_t          parseMetaDataBlockHeader(uint8_t* inbuf, int16_t nBytes);
+typedef struct FLACDecoderContext FLACDecoderContext_t; // opaque, one per player instance
+FLACDecoderContext_t* FLACDecoder_NewContext();
+void             FLACDecoder_DeleteContext(FLACDecoderContext_t* ctx);
+void             FLACDecoder_Lock(FLACDecoderContext_t* ctx);
+void             FLACDecoder_Unlock();
+void             FLACDecoder_SwapContext(FLACDecoderContext_t* ctx);
 bool             FLACDecoder_AllocateBuffers(void);
 void             FLACDecoder_setDefaults();
 void             FLACDecoder_ClearBuffer();
@@ -165,6 +171,9 @@ int8_t           flacDecodeFrame(uint8_t* inbuf, int32_t* bytesLeft);
 uint16_t         FLACGetOutputSamps();
 uint64_t         FLACGetTotoalSamplesInStream();
 uint8_t          FLACGetBitsPerSample();
+void             FLACSetOutputBits(uint8_t bits);
+int16_t          FLACGetReplayGain(bool album);
+void             flacReplayGain(const char* comment, uint32_t len);
 uint8_t          FLACGetChannels();
 uint32_t         FLACGetSampRate();
 uint32_t         FLACGetBitRate();
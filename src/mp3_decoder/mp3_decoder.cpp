@@ -6,6 +6,7 @@
  *  Updated on: 27.05.2024
  */
 #include "mp3_decoder.h"
+#include <utility>
 /* clip to range [-2^n, 2^n - 1] */
 #if 0 //Fast on ARM:
 #define CLIP_2N(y, n) { \
@@ -52,6 +53,22 @@ ScaleFactorInfoSub_t m_ScaleFactorInfoSub[m_MAX_NGRAN][m_MAX_NCHAN];
 ScaleFactorJS_t *m_ScaleFactorJS;
 SubbandInfo_t *m_SubbandInfo;
 MP3DecInfo_t *m_MP3DecInfo;
+uint8_t m_underflowCounter = 0; // http://macslons-irish-pub-radio.stream.laut.fm/macslons-irish-pub-radio
+
+// every mutable global above, swapped in and out as a whole when another MP3DecoderContext takes over
+#define MP3_CONTEXT_VARS(X) \
+    X(m_MP3FrameInfo) X(m_SFBandTable) X(m_sMode) X(m_MPEGVersion) X(m_FrameHeader) X(m_SideInfoSub) X(m_SideInfo) \
+    X(m_CriticalBandInfo) X(m_DequantInfo) X(m_HuffmanInfo) X(m_IMDCTInfo) X(m_ScaleFactorInfoSub) X(m_ScaleFactorJS) \
+    X(m_SubbandInfo) X(m_MP3DecInfo) X(m_underflowCounter)
+
+struct MP3DecoderContext {
+#define X(v) decltype(::v) v;
+    MP3_CONTEXT_VARS(X)
+#undef X
+};
+
+MP3DecoderContext_t *m_MP3ContextActive = NULL;
+SemaphoreHandle_t    m_MP3ContextMutex = NULL;
 
 const uint16_t huffTable[4242] PROGMEM = {
     /* huffTable01[9] */
@@ -1382,7 +1399,6 @@ int32_t MP3Decode( uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf, int32_t
    int32_t offset, bitOffset, mainBits, gr, ch, fhBytes, siBytes, freeFrameBytes;
    int32_t prevBitOffset, sfBlockBits, huffBlockBits;
     uint8_t *mainPtr;
-    static uint8_t underflowCounter = 0; // http://macslons-irish-pub-radio.stream.laut.fm/macslons-irish-pub-radio
 
     /* unpack frame header */
     fhBytes = UnpackFrameHeader(inbuf);
@@ -1445,7 +1461,7 @@ int32_t MP3Decode( uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf, int32_t
         /* fill main data buffer with enough new data for this frame */
         if (m_MP3DecInfo->mainDataBytes >= m_MP3DecInfo->mainDataBegin) {
             /* adequate "old" main data available (i.e. bit reservoir) */
-            underflowCounter = 0;
+            m_underflowCounter = 0;
             memmove(m_MP3DecInfo->mainBuf,
                     m_MP3DecInfo->mainBuf + m_MP3DecInfo->mainDataBytes - m_MP3DecInfo->mainDataBegin,
                     m_MP3DecInfo->mainDataBegin);
@@ -1458,12 +1474,12 @@ int32_t MP3Decode( uint8_t *inbuf, int32_t *bytesLeft, int16_t *outbuf, int32_t
             mainPtr = m_MP3DecInfo->mainBuf;
         } else {
             /* not enough data in bit reservoir from previous frames (perhaps starting in middle of file) */
-            underflowCounter ++;
+            m_underflowCounter ++;
             memcpy(m_MP3DecInfo->mainBuf + m_MP3DecInfo->mainDataBytes, inbuf, m_MP3DecInfo->nSlots);
             m_MP3DecInfo->mainDataBytes += m_MP3DecInfo->nSlots;
             inbuf += m_MP3DecInfo->nSlots;
             *bytesLeft -= (m_MP3DecInfo->nSlots);
-            if(underflowCounter < 4){
+            if(m_underflowCounter < 4){
                 return ERR_MP3_NONE;
             }
             MP3ClearBadFrame( outbuf);
@@ -1651,6 +1667,63 @@ void MP3Decoder_FreeBuffers()
 
 //    log_i("MP3Decoder: %lu bytes memory was freed", ESP.getFreeHeap() - i);
 }
+/***********************************************************************************************************************
+ * Function:    MP3Decoder_NewContext, MP3Decoder_DeleteContext
+ *
+ * Description: creates / destroys an independent decoder state, one per player instance
+ *
+ * Inputs:      context returned by MP3Decoder_NewContext (Delete)
+ *
+ * Outputs:     none
+ *
+ * Return:      new context or NULL if out of memory (New)
+ *
+ * Notes:       a deleted context gives its buffers back, no need to call MP3Decoder_FreeBuffers before
+ **********************************************************************************************************************/
+MP3DecoderContext_t* MP3Decoder_NewContext(){
+    if(!m_MP3ContextMutex) m_MP3ContextMutex = xSemaphoreCreateRecursiveMutex();
+    MP3DecoderContext_t* ctx = (MP3DecoderContext_t*)calloc(1, sizeof(MP3DecoderContext_t));
+    if(!ctx) log_e("not enough memory to allocate a mp3decoder context");
+    return ctx;
+}
+void MP3Decoder_DeleteContext(MP3DecoderContext_t* ctx){
+    if(!ctx) return;
+    MP3Decoder_Lock(ctx);
+    MP3Decoder_FreeBuffers();
+    MP3Decoder_SwapContext(ctx); // the previous owner's leftovers go back into the globals, the context is empty now
+    m_MP3ContextActive = NULL;
+    MP3Decoder_Unlock();
+    free(ctx);
+}
+/***********************************************************************************************************************
+ * Function:    MP3Decoder_Lock, MP3Decoder_Unlock
+ *
+ * Description: makes ctx the state all other MP3 functions work on, until the matching unlock
+ *
+ * Inputs:      context returned by MP3Decoder_NewContext
+ *
+ * Outputs:     none
+ *
+ * Return:      none
+ *
+ * Notes:       recursive, other tasks block in Lock until the owner has unlocked. Switching to another context swaps
+ *              the globals (a few hundred bytes), re-locking the active one is free
+ **********************************************************************************************************************/
+void MP3Decoder_Lock(MP3DecoderContext_t* ctx){
+    xSemaphoreTakeRecursive(m_MP3ContextMutex, portMAX_DELAY);
+    if(ctx == m_MP3ContextActive) return;
+    if(m_MP3ContextActive) MP3Decoder_SwapContext(m_MP3ContextActive);
+    MP3Decoder_SwapContext(ctx);
+    m_MP3ContextActive = ctx;
+}
+void MP3Decoder_Unlock(){
+    xSemaphoreGiveRecursive(m_MP3ContextMutex);
+}
+void MP3Decoder_SwapContext(MP3DecoderContext_t* ctx){
+#define X(v) std::swap(ctx->v, ::v);
+    MP3_CONTEXT_VARS(X)
+#undef X
+}
 
 /***********************************************************************************************************************
  * H U F F M A N N
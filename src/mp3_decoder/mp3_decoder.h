@@ -455,6 +455,11 @@ const uint32_t csa[8][2] PROGMEM = {
  */
 
 // prototypes
+typedef struct MP3DecoderContext MP3DecoderContext_t; // opaque, one per player instance
+MP3DecoderContext_t* MP3Decoder_NewContext();
+void MP3Decoder_DeleteContext(MP3DecoderContext_t* ctx);
+void MP3Decoder_Lock(MP3DecoderContext_t* ctx);
+void MP3Decoder_Unlock();
 bool MP3Decoder_AllocateBuffers(void);
 bool MP3Decoder_IsInit();
 void MP3Decoder_FreeBuffers();
@@ -469,6 +474,7 @@ int32_t  MP3GetBitrate();
 int32_t  MP3GetOutputSamps();
 
 //internally used
+void MP3Decoder_SwapContext(MP3DecoderContext_t* ctx);
 void MP3Decoder_ClearBuffer(void);
 void PolyphaseMono(int16_t *pcm, int32_t *vbuf, const uint32_t* coefBase);
 void PolyphaseStereo(int16_t *pcm, int32_t *vbuf, const uint32_t* coefBase);
@@ -33,6 +33,7 @@
 
 #include "celt.h"
 #include "opus_decoder.h"
+#include <utility>
 
 CELTDecoder  *s_celtDec;
 band_ctx_t    s_band_ctx;
@@ -48,6 +49,17 @@ int32_t*      s_trim_offsetBuff;    // mem in clt_compute_allocation
 uint8_t*      s_collapse_masksBuff; // mem n celt_decode_with_ec
 int16_t*      s_tmpBuff;            // mem in deinterleave_hadamard and interleave_hadamard
 
+// every mutable global above, swapped together with the OPUS context that owns it
+#define CELT_CONTEXT_VARS(X) \
+    X(s_celtDec) X(s_band_ctx) X(s_ec) X(s_freqBuff) X(s_iyBuff) X(s_normBuff) X(s_XBuff) X(s_bits1Buff) X(s_bits2Buff) \
+    X(s_threshBuff) X(s_trim_offsetBuff) X(s_collapse_masksBuff) X(s_tmpBuff)
+
+struct CELTDecoderContext {
+#define X(v) decltype(::v) v;
+    CELT_CONTEXT_VARS(X)
+#undef X
+};
+
 const uint32_t CELT_GET_AND_CLEAR_ERROR_REQUEST = 10007;
 const uint32_t CELT_SET_CHANNELS_REQUEST        = 10008;
 const uint32_t CELT_SET_END_BAND_REQUEST        = 10012;
@@ -2053,6 +2065,20 @@ void CELTDecoder_FreeBuffers(){
     if(s_tmpBuff)            { free(s_tmpBuff),            s_tmpBuff =            NULL; }
 }
 //----------------------------------------------------------------------------------------------------------------------
+CELTDecoderContext_t* CELTDecoder_NewContext(){
+    return (CELTDecoderContext_t*)calloc(1, sizeof(CELTDecoderContext_t));
+}
+//----------------------------------------------------------------------------------------------------------------------
+void CELTDecoder_DeleteContext(CELTDecoderContext_t* ctx){ // buffers must have been freed while it was active
+    free(ctx);
+}
+//----------------------------------------------------------------------------------------------------------------------
+void CELTDecoder_SwapContext(CELTDecoderContext_t* ctx){
+#define X(v) std::swap(ctx->v, ::v);
+    CELT_CONTEXT_VARS(X)
+#undef X
+}
+//----------------------------------------------------------------------------------------------------------------------
 void CELTDecoder_ClearBuffer(void){
     size_t omd = celt_decoder_get_size(2);
     memset(s_celtDec, 0, omd * sizeof(char));
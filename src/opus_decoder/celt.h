@@ -588,6 +588,10 @@ void     unquant_energy_finalise(int16_t *oldEBands, int32_t *fine_quant, int32_
                                  int32_t C);
 uint32_t celt_pvq_u_row(uint32_t row, uint32_t data);
 
+typedef struct CELTDecoderContext CELTDecoderContext_t;
+CELTDecoderContext_t* CELTDecoder_NewContext();
+void     CELTDecoder_DeleteContext(CELTDecoderContext_t* ctx);
+void     CELTDecoder_SwapContext(CELTDecoderContext_t* ctx);
 bool     CELTDecoder_AllocateBuffers(void);
 void     CELTDecoder_FreeBuffers();
 void     CELTDecoder_ClearBuffer(void);
@@ -10,8 +10,11 @@
 //----------------------------------------------------------------------------------------------------------------------
 #include "opus_decoder.h"
 #include "celt.h"
+#include "../replaygain.h"
 #include "Arduino.h"
 #include <vector>
+#include <new>
+#include <utility>
 
 
 // global vars
@@ -33,6 +36,8 @@ bool      s_f_lastPage = false;
 bool      s_f_nextChunk = false;
 
 uint8_t   s_opusChannels = 0;
+int16_t   s_opusOutputGain = 0;                         // OpusHead, Q7.8 dB
+int16_t   s_opusReplayGain[2] = {INT16_MIN, INT16_MIN}; // track, album in 1/256 dB, INT16_MIN: no tag
 uint8_t   s_mode = 0;
 uint8_t   s_opusCountCode =  0;
 uint8_t   s_opusPageNr = 0;
@@ -60,6 +65,40 @@ float     s_opusCompressionRatio = 0;
 
 std::vector <uint32_t>s_opusBlockPicItem;
 
+// state kept between calls of opusDecodePage3() and opus_FramePacking_Code1..3(), a packet can span several calls
+int8_t    s_opusConfigNr = 0;
+uint16_t  s_opusSamplesPerFrame = 0;
+uint16_t  s_opusC1fs = 0;
+uint16_t  s_opusFirstFrameLength = 0;
+uint16_t  s_opusSecondFrameLength = 0;
+uint16_t  s_opusC3PaddingBytes = 0;
+uint16_t  s_opusC3fs = 0;
+uint8_t   s_opusC3M = 0;
+bool      s_f_opusC3v = false;
+bool      s_f_opusC3p = false;
+
+// every mutable global above, swapped in and out as a whole when another OPUSDecoderContext takes over
+#define OPUS_CONTEXT_VARS(X) \
+    X(s_f_opusParseOgg) X(s_f_newSteamTitle) X(s_f_opusNewMetadataBlockPicture) X(s_f_opusStereoFlag) \
+    X(s_f_continuedPage) X(s_f_firstPage) X(s_f_lastPage) X(s_f_nextChunk) X(s_opusChannels) X(s_opusOutputGain) \
+    X(s_opusReplayGain) X(s_mode) X(s_opusCountCode) X(s_opusPageNr) X(s_frameCount) X(s_opusOggHeaderSize) \
+    X(s_bandWidth) X(s_opusSamplerate) X(s_opusSegmentLength) X(s_opusCurrentFilePos) X(s_opusAudioDataStart) \
+    X(s_opusBlockPicLen) X(s_blockPicLenUntilFrameEnd) X(s_opusRemainBlockPicLen) X(s_opusCommentBlockSize) \
+    X(s_opusBlockPicPos) X(s_opusBlockLen) X(s_opusChbuf) X(s_opusValidSamples) X(s_opusSegmentTable) \
+    X(s_opusSegmentTableSize) X(s_opusSegmentTableRdPtr) X(s_opusError) X(s_opusCompressionRatio) \
+    X(s_opusBlockPicItem) X(s_opusConfigNr) X(s_opusSamplesPerFrame) X(s_opusC1fs) X(s_opusFirstFrameLength) \
+    X(s_opusSecondFrameLength) X(s_opusC3PaddingBytes) X(s_opusC3fs) X(s_opusC3M) X(s_f_opusC3v) X(s_f_opusC3p)
+
+struct OPUSDecoderContext {
+#define X(v) decltype(::v) v{};
+    OPUS_CONTEXT_VARS(X)
+#undef X
+    CELTDecoderContext_t* celt = NULL;
+};
+
+OPUSDecoderContext_t* s_opusContextActive = NULL;
+SemaphoreHandle_t     s_opusContextMutex = NULL;
+
 bool OPUSDecoder_AllocateBuffers(){
     s_opusChbuf = (char*)malloc(512);
     if(!CELTDecoder_AllocateBuffers()) {log_e("CELT not init"); return false;}
@@ -86,6 +125,41 @@ void OPUSDecoder_FreeBuffers(){
     if(s_opusSegmentTable) {free(s_opusSegmentTable); s_opusSegmentTable = NULL;}
     CELTDecoder_FreeBuffers();
 }
+OPUSDecoderContext_t* OPUSDecoder_NewContext(){ // independent decoder state, one per player instance
+    if(!s_opusContextMutex) s_opusContextMutex = xSemaphoreCreateRecursiveMutex();
+    OPUSDecoderContext_t* ctx = new (std::nothrow) OPUSDecoderContext_t;
+    if(ctx) ctx->celt = CELTDecoder_NewContext();
+    if(!ctx || !ctx->celt) {log_e("not enough memory to allocate a opusdecoder context"); delete ctx; return NULL;}
+    ctx->s_opusReplayGain[0] = ctx->s_opusReplayGain[1] = INT16_MIN; // same start values as the globals
+    ctx->s_opusSegmentTableRdPtr = -1;
+    return ctx;
+}
+void OPUSDecoder_DeleteContext(OPUSDecoderContext_t* ctx){ // frees the buffers too
+    if(!ctx) return;
+    OPUSDecoder_Lock(ctx);
+    OPUSDecoder_FreeBuffers();
+    OPUSDecoder_SwapContext(ctx); // the previous owner's leftovers go back into the globals
+    s_opusContextActive = NULL;
+    OPUSDecoder_Unlock();
+    CELTDecoder_DeleteContext(ctx->celt);
+    delete ctx;
+}
+void OPUSDecoder_Lock(OPUSDecoderContext_t* ctx){ // recursive, ctx stays active until the matching unlock
+    xSemaphoreTakeRecursive(s_opusContextMutex, portMAX_DELAY);
+    if(ctx == s_opusContextActive) return;
+    if(s_opusContextActive) OPUSDecoder_SwapContext(s_opusContextActive);
+    OPUSDecoder_SwapContext(ctx);
+    s_opusContextActive = ctx;
+}
+void OPUSDecoder_Unlock(){
+    xSemaphoreGiveRecursive(s_opusContextMutex);
+}
+void OPUSDecoder_SwapContext(OPUSDecoderContext_t* ctx){
+#define X(v) std::swap(ctx->v, ::v);
+    OPUS_CONTEXT_VARS(X)
+#undef X
+    CELTDecoder_SwapContext(ctx->celt);
+}
 void OPUSDecoder_ClearBuffers(){
     if(s_opusChbuf)        memset(s_opusChbuf, 0, 512);
     if(s_opusSegmentTable) memset(s_opusSegmentTable, 0, 256 * sizeof(int16_t));
@@ -96,6 +170,8 @@ void OPUSsetDefaults(){
     s_f_opusNewMetadataBlockPicture = false;
     s_f_opusStereoFlag = false;
     s_opusChannels = 0;
+    s_opusOutputGain = 0;
+    s_opusReplayGain[0] = s_opusReplayGain[1] = INT16_MIN;
     s_frameCount = 0;
     s_mode = 0;
     s_opusSamplerate = 0;
@@ -215,8 +291,8 @@ int32_t opusDecodePage3(uint8_t* inbuf, int32_t* bytesLeft, uint32_t segmentLeng
 
 
     uint8_t endband = 21;
-    static int8_t configNr = 0;
-    static uint16_t samplesPerFrame = 0;
+    int8_t&   configNr = s_opusConfigNr;
+    uint16_t& samplesPerFrame = s_opusSamplesPerFrame;
 
     int32_t ret = 0;
 
@@ -348,7 +424,7 @@ int8_t opus_FramePacking_Code1(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outb
 
 
     int32_t ret = 0;
-    static uint16_t c1fs = 0;
+    uint16_t& c1fs = s_opusC1fs;
     if(*frameCount == 0){
         packetLen--;
         inbuf++;
@@ -404,8 +480,8 @@ int8_t opus_FramePacking_Code2(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outb
 
 //  log_w("OPUS countCode 2 packetLen %i", packetLen);
     int32_t ret = 0;
-    static uint16_t firstFrameLength = 0;
-    static uint16_t secondFrameLength = 0;
+    uint16_t& firstFrameLength = s_opusFirstFrameLength;
+    uint16_t& secondFrameLength = s_opusSecondFrameLength;
 
     if(*frameCount == 0){
         uint8_t b1 = inbuf[1];
@@ -547,11 +623,11 @@ int8_t opus_FramePacking_Code3(uint8_t *inbuf, int32_t *bytesLeft, int16_t *outb
      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
 */
-    static uint16_t paddingBytes = 0;
-    static uint16_t fs = 0;
-    static uint8_t M = 0;
-    static bool v = false;
-    static bool p = false;
+    uint16_t& paddingBytes = s_opusC3PaddingBytes;
+    uint16_t& fs = s_opusC3fs;
+    uint8_t&  M = s_opusC3M;
+    bool&     v = s_f_opusC3v;
+    bool&     p = s_f_opusC3p;
     int32_t ret = 0;
     uint8_t paddingLength = 0;
     if(*frameCount == 0){
@@ -620,6 +696,13 @@ uint8_t OPUSGetChannels(){
 uint32_t OPUSGetSampRate(){
     return s_opusSamplerate;
 }
+int16_t OPUSGetReplayGain(bool album){
+    return s_opusReplayGain[album];
+}
+//----------------------------------------------------------------------------------------------------------------------
+int16_t OPUSGetOutputGain(){ // OpusHead, Q7.8 dB
+    return s_opusOutputGain;
+}
 uint8_t OPUSGetBitsPerSample(){
     return 16;
 }
@@ -699,6 +782,13 @@ int8_t parseOpusTOC(uint8_t TOC_Byte){  // https://www.rfc-editor.org/rfc/rfc671
     return configNr;
 }
 //----------------------------------------------------------------------------------------------------------------------
+void opusReplayGain(const char* comment, uint32_t len){
+    // R128 gains are relative to the output of OpusHead (RFC 7845 5.2.1), Audio applies the output gain always
+    int16_t g;
+    bool    album;
+    if(replayGainComment(comment, len, &g, &album)) s_opusReplayGain[album] = g;
+}
+//----------------------------------------------------------------------------------------------------------------------
 int32_t parseOpusComment(uint8_t *inbuf, int32_t nBytes){      // reference https://exiftool.org/TagNames/Vorbis.html#Comments
                                                        // reference https://www.rfc-editor.org/rfc/rfc7845#section-5
     int32_t idx = OPUS_specialIndexOf(inbuf, "OpusTags", 10);
@@ -736,6 +826,7 @@ int32_t parseOpusComment(uint8_t *inbuf, int32_t nBytes){      // reference http
         if(idx == -1) idx = OPUS_specialIndexOf(inbuf + pos, "TITLE=", 10);
         if(idx == 0){ title = strndup((const char*)(inbuf + pos + 6), commentStringLen - 6);
         }
+        if(commentStringLen < 48 && (*(inbuf + pos) == 'R' || *(inbuf + pos) == 'r')) opusReplayGain((const char*)(inbuf + pos), commentStringLen);
         idx = OPUS_specialIndexOf(inbuf + pos, "metadata_block_picture=", 25);
         if(idx == -1) idx = OPUS_specialIndexOf(inbuf + pos, "METADATA_BLOCK_PICTURE=", 25);
         if(idx == 0){
@@ -798,7 +889,7 @@ int32_t parseOpusHead(uint8_t *inbuf, int32_t nBytes){  // reference https://wik
     s_opusSamplerate = sampleRate;
     if(channelMap > 1) return ERR_OPUS_EXTRA_CHANNELS_UNSUPPORTED;
 
-    (void)outputGain;
+    s_opusOutputGain = (int16_t)outputGain;
 
     CELTDecoder_ClearBuffer();
     s_opusError = celt_decoder_init(s_opusChannels); if(s_opusError < 0) {log_e("CELT not init"); return false;}
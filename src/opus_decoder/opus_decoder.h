@@ -32,6 +32,12 @@ enum : int8_t  {OPUS_CONTINUE = 110,
                 ERR_OPUS_CELT_END_BAND = -26,
                 ERR_CELT_OPUS_INTERNAL_ERROR = -27};
 
+typedef struct OPUSDecoderContext OPUSDecoderContext_t; // opaque, one per player instance
+OPUSDecoderContext_t* OPUSDecoder_NewContext();
+void             OPUSDecoder_DeleteContext(OPUSDecoderContext_t* ctx);
+void             OPUSDecoder_Lock(OPUSDecoderContext_t* ctx);
+void             OPUSDecoder_Unlock();
+void             OPUSDecoder_SwapContext(OPUSDecoderContext_t* ctx);
 bool             OPUSDecoder_AllocateBuffers();
 void             OPUSDecoder_FreeBuffers();
 void             OPUSDecoder_ClearBuffers();
@@ -46,6 +52,8 @@ int8_t           opus_FramePacking_Code3(uint8_t *inbuf, int32_t *bytesLeft, sho
 uint8_t          OPUSGetChannels();
 uint32_t         OPUSGetSampRate();
 uint8_t          OPUSGetBitsPerSample();
+int16_t          OPUSGetReplayGain(bool album);
+int16_t          OPUSGetOutputGain();
 uint32_t         OPUSGetBitRate();
 uint16_t         OPUSGetOutputSamps();
 uint32_t         OPUSGetAudioDataStart();
@@ -55,6 +63,7 @@ int32_t          OPUSFindSyncWord(unsigned char* buf, int32_t nBytes);
 int32_t          OPUSparseOGG(uint8_t* inbuf, int32_t* bytesLeft);
 int32_t          parseOpusHead(uint8_t* inbuf, int32_t nBytes);
 int32_t          parseOpusComment(uint8_t* inbuf, int32_t nBytes);
+void             opusReplayGain(const char* comment, uint32_t len);
 int8_t           parseOpusTOC(uint8_t TOC_Byte);
 int32_t          opus_packet_get_samples_per_frame(const uint8_t* data, int32_t Fs);
 
@@ -0,0 +1,37 @@
+/*
+ * replaygain.h
+ *
+ *  ReplayGain and R128 loudness tags, one parser for the Vorbis comments (FLAC, Vorbis, Opus) and the tags read by
+ *  Audio (ID3 TXXX, APE, M4A freeform)
+ */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <ctype.h>
+
+// REPLAYGAIN_TRACK_GAIN=-7.89 dB (reference -18 LUFS), R128_TRACK_GAIN=-1234 (Q7.8 dB, reference -23 LUFS), _ALBUM_GAIN
+// gain: 1/256 dB relative to the ReplayGain reference, clamped to +-32 dB, false if the key is no gain tag
+static inline bool replayGainParse(const char* key, const char* value, int16_t* gain, bool* album) {
+    int32_t g;
+    if(!strcasecmp(key, "REPLAYGAIN_TRACK_GAIN") || !strcasecmp(key, "REPLAYGAIN_ALBUM_GAIN")) g = lrintf(strtof(value, NULL) * 256);
+    else if(!strcasecmp(key, "R128_TRACK_GAIN") || !strcasecmp(key, "R128_ALBUM_GAIN")) g = atoi(value) + 5 * 256;
+    else return false;
+    *gain = (int16_t)(g < -32 * 256 ? -32 * 256 : g > 32 * 256 ? 32 * 256 : g);
+    *album = (toupper(key[strlen(key) - 10]) == 'A'); // ..._ALBUM_GAIN, ..._TRACK_GAIN
+    return true;
+}
+
+// "KEY=value" of a Vorbis comment, not terminated
+static inline bool replayGainComment(const char* comment, uint32_t len, int16_t* gain, bool* album) {
+    char c[48];
+    if(len >= sizeof(c)) return false;
+    memcpy(c, comment, len);
+    c[len] = '\0';
+    char* v = strchr(c, '=');
+    if(!v) return false;
+    *v++ = '\0';
+    return replayGainParse(c, v, gain, album);
+}
@@ -22,8 +22,11 @@
 //----------------------------------------------------------------------------------------------------------------------
 #include "vorbis_decoder.h"
 #include "lookup.h"
+#include "../replaygain.h"
 #include "alloca.h"
 #include <vector>
+#include <new>
+#include <utility>
 using namespace std;
 
 #define __malloc_heap_psram(size) \
@@ -47,6 +50,8 @@ uint16_t  s_setupHeaderLength = 0;
 uint8_t   s_pageNr = 0;
 uint16_t  s_oggHeaderSize = 0;
 uint8_t   s_vorbisChannels = 0;
+int16_t   s_vorbisDmx[8][3];       // > 2 channels: downmix gain left, gain right (Q14), 0: set, 1: add
+int16_t   s_vorbisReplayGain[2] = {INT16_MIN, INT16_MIN}; // track, album in 1/256 dB, INT16_MIN: no tag
 uint16_t  s_vorbisSamplerate = 0;
 uint16_t  s_lastSegmentTableLen = 0;
 uint8_t  *s_lastSegmentTable = NULL;
@@ -90,6 +95,30 @@ vorbis_dsp_state_t    *s_dsp_state = NULL;
 
 vector<uint32_t>s_vorbisBlockPicItem;
 
+// every mutable global above, swapped in and out as a whole when another VORBISDecoderContext takes over
+#define VORBIS_CONTEXT_VARS(X) \
+    X(s_f_vorbisNewSteamTitle) X(s_f_vorbisNewMetadataBlockPicture) X(s_f_oggFirstPage) X(s_f_oggContinuedPage) \
+    X(s_f_oggLastPage) X(s_f_parseOggDone) X(s_f_lastSegmentTable) X(s_f_vorbisStr_found) \
+    X(s_identificatonHeaderLength) X(s_vorbisCommentHeaderLength) X(s_setupHeaderLength) X(s_pageNr) \
+    X(s_oggHeaderSize) X(s_vorbisChannels) X(s_vorbisDmx) X(s_vorbisReplayGain) X(s_vorbisSamplerate) \
+    X(s_lastSegmentTableLen) X(s_lastSegmentTable) X(s_vorbisBitRate) X(s_vorbisSegmentLength) \
+    X(s_vorbisBlockPicLenUntilFrameEnd) X(s_vorbisCurrentFilePos) X(s_vorbisAudioDataStart) X(s_vorbisChbuf) \
+    X(s_vorbisValidSamples) X(s_commentBlockSegmentSize) X(s_vorbisOldMode) X(s_blocksizes) X(s_vorbisBlockPicPos) \
+    X(s_vorbisBlockPicLen) X(s_vorbisRemainBlockPicLen) X(s_commentLength) X(s_nrOfCodebooks) X(s_nrOfFloors) \
+    X(s_nrOfResidues) X(s_nrOfMaps) X(s_nrOfModes) X(s_vorbisSegmentTable) X(s_oggPage3Len) \
+    X(s_vorbisSegmentTableSize) X(s_vorbisSegmentTableRdPtr) X(s_vorbisError) X(s_vorbisCompressionRatio) \
+    X(s_bitReader) X(s_codebooks) X(s_floor_param) X(s_floor_type) X(s_residue_param) X(s_map_param) \
+    X(s_mode_param) X(s_dsp_state) X(s_vorbisBlockPicItem)
+
+struct VORBISDecoderContext {
+#define X(v) decltype(::v) v{};
+    VORBIS_CONTEXT_VARS(X)
+#undef X
+};
+
+VORBISDecoderContext_t* s_vorbisContextActive = NULL;
+SemaphoreHandle_t       s_vorbisContextMutex = NULL;
+
 
 bool VORBISDecoder_AllocateBuffers(){
     s_vorbisSegmentTable = (uint16_t*)__calloc_heap_psram(256, sizeof(uint16_t));
@@ -105,11 +134,45 @@ void VORBISDecoder_FreeBuffers(){
 
     clearGlobalConfigurations();
 }
+VORBISDecoderContext_t* VORBISDecoder_NewContext(){ // independent decoder state, one per player instance
+    if(!s_vorbisContextMutex) s_vorbisContextMutex = xSemaphoreCreateRecursiveMutex();
+    VORBISDecoderContext_t* ctx = new (std::nothrow) VORBISDecoderContext_t;
+    if(!ctx) {log_e("not enough memory to allocate a vorbisdecoder context"); return NULL;}
+    ctx->s_f_parseOggDone = true; // same start values as the globals
+    ctx->s_vorbisReplayGain[0] = ctx->s_vorbisReplayGain[1] = INT16_MIN;
+    ctx->s_vorbisSegmentTableRdPtr = -1;
+    return ctx;
+}
+void VORBISDecoder_DeleteContext(VORBISDecoderContext_t* ctx){ // frees the buffers too
+    if(!ctx) return;
+    VORBISDecoder_Lock(ctx);
+    VORBISDecoder_FreeBuffers();
+    VORBISDecoder_SwapContext(ctx); // the previous owner's leftovers go back into the globals
+    s_vorbisContextActive = NULL;
+    VORBISDecoder_Unlock();
+    delete ctx;
+}
+void VORBISDecoder_Lock(VORBISDecoderContext_t* ctx){ // recursive, ctx stays active until the matching unlock
+    xSemaphoreTakeRecursive(s_vorbisContextMutex, portMAX_DELAY);
+    if(ctx == s_vorbisContextActive) return;
+    if(s_vorbisContextActive) VORBISDecoder_SwapContext(s_vorbisContextActive);
+    VORBISDecoder_SwapContext(ctx);
+    s_vorbisContextActive = ctx;
+}
+void VORBISDecoder_Unlock(){
+    xSemaphoreGiveRecursive(s_vorbisContextMutex);
+}
+void VORBISDecoder_SwapContext(VORBISDecoderContext_t* ctx){
+#define X(v) std::swap(ctx->v, ::v);
+    VORBIS_CONTEXT_VARS(X)
+#undef X
+}
 void VORBISDecoder_ClearBuffers(){
     if(s_vorbisChbuf) memset(s_vorbisChbuf, 0, 256);
     bitReader_clear();
 }
 void VORBISsetDefaults(){
+    s_vorbisReplayGain[0] = s_vorbisReplayGain[1] = INT16_MIN;
     s_pageNr = 0;
     s_f_vorbisNewSteamTitle = false;  // streamTitle
     s_f_vorbisNewMetadataBlockPicture = false;
@@ -438,6 +501,9 @@ uint32_t VORBISGetBitRate(){
 uint32_t VORBISGetAudioDataStart(){
     return s_vorbisAudioDataStart;
 }
+int16_t VORBISGetReplayGain(bool album){
+    return s_vorbisReplayGain[album];
+}
 uint16_t VORBISGetOutputSamps(){
     return s_vorbisValidSamples; // 1024
 }
@@ -509,11 +575,12 @@ int32_t parseVorbisFirstPacket(uint8_t *inbuf, int16_t nBytes){ // 4.2.2. Identi
         return -1;
     }
 
-    if(channels < 1 || channels > 2){
+    if(channels < 1 || channels > 8){
         log_e("nr of channels is not valid ch=%i", channels);
         return -1;
     }
     s_vorbisChannels = channels;
+    if(channels > 2) vorbisDownmixInit();
 
     if(sampleRate < 4096 || sampleRate > 64000){
         log_e("sampleRate is not valid sr=%i", sampleRate);
@@ -527,6 +594,37 @@ int32_t parseVorbisFirstPacket(uint8_t *inbuf, int16_t nBytes){ // 4.2.2. Identi
 
 }
 //----------------------------------------------------------------------------------------------------------------------
+void vorbisDownmixInit(){
+    // stereo downmix for 3...8 channels in Vorbis channel order (Vorbis I spec 4.3.9), ITU-R BS.775 gains:
+    // front 1.0, center and surround 0.707, rear center 0.5 to both sides, LFE is dropped.
+    // Normalized to a gain sum of 1.0 per side, so the downmix can not clip
+    enum {FL, FR, FC, LFE, SL, SR, RC};
+    const uint8_t order[6][8] = {
+        {FL, FC, FR},                      // 3.0
+        {FL, FR, SL, SR},                  // quad
+        {FL, FC, FR, SL, SR},              // 5.0
+        {FL, FC, FR, SL, SR, LFE},         // 5.1
+        {FL, FC, FR, SL, SR, RC, LFE},     // 6.1
+        {FL, FC, FR, SL, SR, SL, SR, LFE}, // 7.1, side and rear go to the same side
+    };
+    const float gain[7][2] = {{1.0f, 0}, {0, 1.0f}, {0.7071f, 0.7071f}, {0, 0}, {0.7071f, 0}, {0, 0.7071f}, {0.5f, 0.5f}};
+
+    const uint8_t* o = order[s_vorbisChannels - 3];
+    float sum = 0;
+    for(int i = 0; i < s_vorbisChannels; i++) sum += gain[o[i]][0]; // the layouts are symmetric
+    for(int i = 0; i < s_vorbisChannels; i++) {
+        s_vorbisDmx[i][0] = (int16_t)(gain[o[i]][0] / sum * 16384.0f);
+        s_vorbisDmx[i][1] = (int16_t)(gain[o[i]][1] / sum * 16384.0f);
+        s_vorbisDmx[i][2] = (i > 0);
+    }
+}
+//----------------------------------------------------------------------------------------------------------------------
+void vorbisReplayGain(const char* comment){
+    int16_t g;
+    bool    album;
+    if(replayGainComment(comment, strlen(comment), &g, &album)) s_vorbisReplayGain[album] = g;
+}
+//----------------------------------------------------------------------------------------------------------------------
 int32_t parseVorbisComment(uint8_t *inbuf, int16_t nBytes){      // reference https://xiph.org/vorbis/doc/v-comment.html
 
     // first bytes are: '.vorbis'
@@ -580,6 +678,8 @@ int32_t parseVorbisComment(uint8_t *inbuf, int16_t nBytes){      // reference ht
         if(idx != 0) idx =  VORBIS_specialIndexOf((uint8_t*)s_vorbisChbuf, "TITLE=", 10);
         if(idx == 0){ title = strndup((const char*)(s_vorbisChbuf + 6), commentLength - 6); s_commentLength = 0;}
 
+        if(cl < 48 && (s_vorbisChbuf[0] == 'R' || s_vorbisChbuf[0] == 'r')) vorbisReplayGain(s_vorbisChbuf);
+
         idx =        VORBIS_specialIndexOf((uint8_t*)s_vorbisChbuf, "metadata_block_picture=", 25);
         if(idx != 0) idx =  VORBIS_specialIndexOf((uint8_t*)s_vorbisChbuf, "METADATA_BLOCK_PICTURE", 25);
         if(idx == 0){
@@ -3177,12 +3277,14 @@ int32_t vorbis_dsp_pcmout(int16_t *outBuff, int32_t outBuffSize) {
                 n = outBuffSize;
                 log_e("outBufferSize too small, must be min %i (int16_t) words", n);
             }
-            for(i = 0; i < s_vorbisChannels; i++){
+            for(i = 0; i < s_vorbisChannels; i++){ // > 2 channels: downmixed to stereo while interleaving
+                bool dmx = (s_vorbisChannels > 2);
                 mdct_unroll_lap(s_blocksizes[0], s_blocksizes[1],
                                 s_dsp_state->lW, s_dsp_state->W, s_dsp_state->work[i],
                                 s_dsp_state->mdctright[i], _vorbis_window(s_blocksizes[0] >> 1),
                                 _vorbis_window(s_blocksizes[1] >> 1),
-                                outBuff + i, s_vorbisChannels,
+                                dmx ? outBuff : outBuff + i, dmx ? 2 : s_vorbisChannels,
+                                dmx ? s_vorbisDmx[i] : NULL,
                                 s_dsp_state->out_begin,
                                 s_dsp_state->out_begin + n);
             }
@@ -3215,8 +3317,16 @@ int32_t *_vorbis_window(int32_t left) {
     }
 }
 //---------------------------------------------------------------------------------------------------------------------
+inline void vorbis_downmix(int16_t *out, int32_t v, const int16_t *dmx) {
+    int32_t l = (v * dmx[0] + 0x2000) >> 14;
+    int32_t r = (v * dmx[1] + 0x2000) >> 14;
+    if(dmx[2]) { out[0] = CLIP_TO_15(out[0] + l); out[1] = CLIP_TO_15(out[1] + r); }
+    else       { out[0] = l;  out[1] = r; }
+}
+//---------------------------------------------------------------------------------------------------------------------
 void mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t *in, int32_t *right, const int32_t *w0, const int32_t *w1, int16_t *out,
-                     int32_t step, int32_t start, /* samples, this frame */
+                     int32_t step, const int16_t *dmx, /* NULL or stereo downmix gains of this channel */
+                     int32_t start, /* samples, this frame */
                      int32_t end /* samples, this frame */) {
     int32_t       *l = in + (W && lW ? n1 >> 1 : n0 >> 1);
     int32_t       *r = right + (lW ? n1 >> 2 : n0 >> 2);
@@ -3238,7 +3348,8 @@ void mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t *in,
         start -= off;
         end -= n;
         while(r > post) {
-            *out = CLIP_TO_15((*--r) >> 9);
+            int32_t v = CLIP_TO_15((*--r) >> 9);
+            if(dmx) vorbis_downmix(out, v, dmx); else *out = v;
             out += step;
         }
     }
@@ -3255,7 +3366,8 @@ void mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t *in,
     end -= n;
     while(r > post) {
         l -= 2;
-        *out = CLIP_TO_15((MULT31(*--r, *--wR) + MULT31(*l, *wL++)) >> 9);
+        int32_t v = CLIP_TO_15((MULT31(*--r, *--wR) + MULT31(*l, *wL++)) >> 9);
+        if(dmx) vorbis_downmix(out, v, dmx); else *out = v;
         out += step;
     }
 
@@ -3269,7 +3381,8 @@ void mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t *in,
     wR -= off;
     wL += off;
     while(r < post) {
-        *out = CLIP_TO_15((MULT31(*r++, *--wR) - MULT31(*l, *wL++)) >> 9);
+        int32_t v = CLIP_TO_15((MULT31(*r++, *--wR) - MULT31(*l, *wL++)) >> 9);
+        if(dmx) vorbis_downmix(out, v, dmx); else *out = v;
         out += step;
         l += 2;
     }
@@ -3281,7 +3394,8 @@ void mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t *in,
         post = l + n * 2;
         l += off * 2;
         while(l < post) {
-            *out = CLIP_TO_15((-*l) >> 9);
+            int32_t v = CLIP_TO_15((-*l) >> 9);
+            if(dmx) vorbis_downmix(out, v, dmx); else *out = v;
             out += step;
             l += 2;
         }
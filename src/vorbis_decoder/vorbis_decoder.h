@@ -217,6 +217,12 @@ inline int32_t CLIP_TO_15(int32_t x) {
 //----------------------------------------------------------------------------------------------------------------------
 
 // ogg impl
+typedef struct VORBISDecoderContext VORBISDecoderContext_t; // opaque, one per player instance
+VORBISDecoderContext_t* VORBISDecoder_NewContext();
+void                  VORBISDecoder_DeleteContext(VORBISDecoderContext_t* ctx);
+void                  VORBISDecoder_Lock(VORBISDecoderContext_t* ctx);
+void                  VORBISDecoder_Unlock();
+void                  VORBISDecoder_SwapContext(VORBISDecoderContext_t* ctx);
 bool                  VORBISDecoder_AllocateBuffers();
 void                  VORBISDecoder_FreeBuffers();
 void                  VORBISDecoder_ClearBuffers();
@@ -227,6 +233,7 @@ uint8_t               VORBISGetChannels();
 uint32_t              VORBISGetSampRate();
 uint32_t              VORBISGetAudioDataStart();
 uint8_t               VORBISGetBitsPerSample();
+int16_t               VORBISGetReplayGain(bool album);
 uint32_t              VORBISGetBitRate();
 uint16_t              VORBISGetOutputSamps();
 char*                 VORBISgetStreamTitle();
@@ -240,6 +247,8 @@ int32_t               vorbisDecodePage4(uint8_t* inbuf, int32_t* bytesLeft, uint
 int32_t               parseVorbisComment(uint8_t* inbuf, int16_t nBytes);
 int32_t               parseVorbisCodebook();
 int32_t               parseVorbisFirstPacket(uint8_t* inbuf, int16_t nBytes);
+void                  vorbisDownmixInit();
+void                  vorbisReplayGain(const char* comment);
 uint16_t              continuedOggPackets(uint8_t* inbuf);
 int32_t               vorbis_book_unpack(codebook_t* s);
 uint32_t              decpack(int32_t entry, int32_t used_entry, uint8_t quantvals, codebook_t* b, int32_t maptype);
@@ -292,7 +301,7 @@ void                  mdct_step7(int32_t* x, int32_t n, int32_t step);
 void                  mdct_step8(int32_t* x, int32_t n, int32_t step);
 int32_t               vorbis_book_decodevv_add(codebook_t* book, int32_t** a, int32_t offset, uint8_t ch, int32_t n, int32_t point);
 int32_t               vorbis_dsp_pcmout(int16_t* outBuff, int32_t outBuffSize);
-void                  mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t* in, int32_t* right, const int32_t* w0, const int32_t* w1, int16_t* out, int32_t step, int32_t start, /* samples, this frame */
+void                  mdct_unroll_lap(int32_t n0, int32_t n1, int32_t lW, int32_t W, int32_t* in, int32_t* right, const int32_t* w0, const int32_t* w1, int16_t* out, int32_t step, const int16_t* dmx, int32_t start, /* samples, this frame */
                                 int32_t end /* samples, this frame */);
 
 // some helper functions
@@ -0,0 +1,164 @@
+/*
+ * bench_dsp.cpp
+ *
+ *  old per-sample output path (VU cascade, three float biquads and the double Gain() called for every frame, as
+ *  playChunk() did before the block pipeline) against the block-wise DSP chain, on the decoded test files
+ */
+#define private public // processDSP() and the sample rate setup are private
+#include "test_util.h"
+#undef private
+
+//----------------------------------------------------------------------------------------------------------------------
+//  the former per-sample path, same arithmetic and the same static state as before
+//----------------------------------------------------------------------------------------------------------------------
+struct legacy_t {
+    struct { float a0, a1, a2, b1, b2; } filter[3];
+    float   filterBuff[3][2][2][2] = {};
+    float   corr = 1.0;
+    double  limitLeft = 1, limitRight = 1;
+    uint8_t vuLeft = 0, vuRight = 0;
+};
+
+static void legacyVU(legacy_t* L, int16_t sample[2]) {
+    static uint8_t sampleArray[2][4][8] = {0};
+    static uint8_t cnt0 = 0, cnt1 = 0, cnt2 = 0, cnt3 = 0, cnt4 = 0;
+    static bool    f_vu = false;
+    auto avg = [&](uint8_t* a) { uint16_t av = 0; for(int i = 0; i < 8; i++) av += a[i]; return av >> 3; };
+    auto largest = [&](uint8_t* a) { uint16_t m = 0; for(int i = 0; i < 8; i++) if(m < a[i]) m = a[i]; return m; };
+    if(cnt0 == 64) { cnt0 = 0; cnt1++; }
+    if(cnt1 == 8) { cnt1 = 0; cnt2++; }
+    if(cnt2 == 8) { cnt2 = 0; cnt3++; }
+    if(cnt3 == 8) { cnt3 = 0; cnt4++; f_vu = true; }
+    if(cnt4 == 8) { cnt4 = 0; }
+    if(!cnt0) { sampleArray[0][0][cnt1] = abs(sample[0] >> 7); sampleArray[1][0][cnt1] = abs(sample[1] >> 7); }
+    if(!cnt1) { sampleArray[0][1][cnt2] = largest(sampleArray[0][0]); sampleArray[1][1][cnt2] = largest(sampleArray[1][0]); }
+    if(!cnt2) { sampleArray[0][2][cnt3] = largest(sampleArray[0][1]); sampleArray[1][2][cnt3] = largest(sampleArray[1][1]); }
+    if(!cnt3) { sampleArray[0][3][cnt4] = avg(sampleArray[0][2]); sampleArray[1][3][cnt4] = avg(sampleArray[1][2]); }
+    if(f_vu) { f_vu = false; L->vuLeft = avg(sampleArray[0][3]); L->vuRight = avg(sampleArray[1][3]); }
+    cnt1++;
+}
+
+static void legacyIIR(legacy_t* L, int f, int16_t iir_in[2]) {
+    enum : uint8_t { z1 = 0, z2 = 1, in = 0, out = 1 };
+    static int16_t iir_out[3][2];
+    for(int ch = 0; ch < 2; ch++) {
+        float inSample = (float)iir_in[ch];
+        float outSample = L->filter[f].a0 * inSample + L->filter[f].a1 * L->filterBuff[f][z1][in][ch] +
+                          L->filter[f].a2 * L->filterBuff[f][z2][in][ch] - L->filter[f].b1 * L->filterBuff[f][z1][out][ch] -
+                          L->filter[f].b2 * L->filterBuff[f][z2][out][ch];
+        L->filterBuff[f][z2][in][ch] = L->filterBuff[f][z1][in][ch];
+        L->filterBuff[f][z1][in][ch] = inSample;
+        L->filterBuff[f][z2][out][ch] = L->filterBuff[f][z1][out][ch];
+        L->filterBuff[f][z1][out][ch] = outSample;
+        iir_out[f][ch] = (int16_t)outSample;
+    }
+    iir_in[0] = iir_out[f][0];
+    iir_in[1] = iir_out[f][1];
+}
+
+static void legacyGain(legacy_t* L, int16_t* sample) {
+    sample[0] *= L->limitLeft;
+    sample[1] *= L->limitRight;
+}
+
+static void legacyChunk(legacy_t* L, int16_t* buff, uint16_t frames) {
+    int16_t* s;
+    for(int i = 0; i < frames; i++) {
+        s = buff + 2 * i;
+        legacyVU(L, s);
+        if(L->corr > 1) {
+            s[0] /= L->corr;
+            s[1] /= L->corr;
+        }
+        legacyIIR(L, 0, s);
+        legacyIIR(L, 1, s);
+        legacyIIR(L, 2, s);
+        legacyGain(L, s);
+    }
+}
+
+static void legacySetup(legacy_t* L, uint32_t rate, int8_t G0, int8_t G1, int8_t G2, uint8_t vol) {
+    // the former setTone() and IIR_calculateCoefficients(), 500 Hz low shelf, 3 kHz peak, 6 kHz high shelf
+    L->corr = pow10f((float)max(G0, max(G1, G2)) / 20);
+    float K, norm, V;
+    K = tanf((float)PI * 500 / rate);
+    V = powf(10, fabs(G0) / 20.0);
+    if(G0 >= 0) {
+        norm = 1 / (1 + sqrtf(2) * K + K * K);
+        L->filter[0] = {(1 + sqrtf(2 * V) * K + V * K * K) * norm, 2 * (V * K * K - 1) * norm, (1 - sqrtf(2 * V) * K + V * K * K) * norm,
+                        2 * (K * K - 1) * norm, (1 - sqrtf(2) * K + K * K) * norm};
+    }
+    else {
+        norm = 1 / (1 + sqrtf(2 * V) * K + V * K * K);
+        L->filter[0] = {(1 + sqrtf(2) * K + K * K) * norm, 2 * (K * K - 1) * norm, (1 - sqrtf(2) * K + K * K) * norm,
+                        2 * (V * K * K - 1) * norm, (1 - sqrtf(2 * V) * K + V * K * K) * norm};
+    }
+    K = tanf((float)PI * 3000 / rate);
+    V = powf(10, fabs(G1) / 20.0);
+    float Q = 2.5;
+    if(G1 >= 0) {
+        norm = 1 / (1 + 1 / Q * K + K * K);
+        L->filter[1] = {(1 + V / Q * K + K * K) * norm, 2 * (K * K - 1) * norm, (1 - V / Q * K + K * K) * norm,
+                        2 * (K * K - 1) * norm, (1 - 1 / Q * K + K * K) * norm};
+    }
+    else {
+        norm = 1 / (1 + V / Q * K + K * K);
+        L->filter[1] = {(1 + 1 / Q * K + K * K) * norm, 2 * (K * K - 1) * norm, (1 - 1 / Q * K + K * K) * norm,
+                        2 * (K * K - 1) * norm, (1 - V / Q * K + K * K) * norm};
+    }
+    float FcHS = min(6000.0f, rate / 2.0f - 100);
+    K = tanf((float)PI * FcHS / rate);
+    V = powf(10, fabs(G2) / 20.0);
+    if(G2 >= 0) {
+        norm = 1 / (1 + sqrtf(2) * K + K * K);
+        L->filter[2] = {(V + sqrtf(2 * V) * K + K * K) * norm, 2 * (K * K - V) * norm, (V - sqrtf(2 * V) * K + K * K) * norm,
+                        2 * (K * K - 1) * norm, (1 - sqrtf(2) * K + K * K) * norm};
+    }
+    else {
+        norm = 1 / (V + sqrtf(2 * V) * K + K * K);
+        L->filter[2] = {(1 + sqrtf(2) * K + K * K) * norm, 2 * (K * K - 1) * norm, (1 - sqrtf(2) * K + K * K) * norm,
+                        2 * (K * K - V) * norm, (V - sqrtf(2 * V) * K + K * K) * norm};
+    }
+    L->limitLeft = L->limitRight = (double)pow(vol, 2) / pow(21, 2);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+int main() {
+    const int8_t  G0 = 4, G1 = -3, G2 = 5; // tone control on, so that no stage is bypassed
+    const uint8_t vol = 17;
+    struct { const char* path; uint16_t block; } files[] = {
+        {"/Olsen-Banden.mp3", 1152}, {"/Miss-Marple.m4a", 2048}, {"/Santiano-Wellerman.flac", 4096},
+        {"/Collide.ogg", 1024},      {"/sample.opus", 960},      {"/Pink-Panther.wav", 1024}};
+
+    Audio* audio = newAudio();
+    printf("%-26s %6s %9s %12s %12s %7s\n", "file", "block", "frames", "old ns/fr", "new ns/fr", "speedup");
+    for(auto& f : files) {
+        pcm_t pcm = playFile(audio, f.path);
+        CHECK(pcm.frames() > 0 && pcm.slotBits == 16);
+        uint32_t frames = pcm.frames();
+
+        legacy_t L;
+        legacySetup(&L, pcm.rate, G0, G1, G2, vol);
+        audio->setSampleRate(pcm.rate);
+        audio->setTone(G0, G1, G2);
+        audio->setVolume(vol);
+
+        std::vector<int16_t> block(2 * f.block);
+        uint64_t             tOld = 0, tNew = 0;
+        for(int pass = 0; pass < 2; pass++) { // old and new alternate per block, both see the same cache state
+            for(uint32_t pos = 0; pos + f.block <= frames; pos += f.block) {
+                memcpy(block.data(), pcm.s16() + 2 * pos, f.block * 4);
+                uint64_t t0 = host_cycles();
+                legacyChunk(&L, block.data(), f.block);
+                tOld += host_cycles() - t0;
+                memcpy(block.data(), pcm.s16() + 2 * pos, f.block * 4);
+                t0 = host_cycles();
+                audio->processDSP(block.data(), f.block);
+                tNew += host_cycles() - t0;
+            }
+        }
+        double n = 2.0 * (frames / f.block) * f.block;
+        printf("%-26s %6u %9u %12.2f %12.2f %6.2fx\n", f.path, f.block, frames, tOld / n, tNew / n, (double)tOld / tNew);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * bench_hires.cpp
+ *
+ *  24 bit WAV through the 24/32 bit path (setOutputBits(32)) and through the 16 bit path: the output must be the
+ *  source (32 bit slots) or its upper 16 bit, and the time per frame of the DSP chain is compared for both sample types
+ */
+#define private public // processDSP() is private
+#include "test_util.h"
+#undef private
+
+static const uint32_t rate = 48000, frames = 10 * rate;
+
+static std::vector<int32_t> source() { // 24 bit stereo, two sines and a little noise, -3 dBFS
+    std::vector<int32_t> s(2 * frames);
+    for(uint32_t i = 0; i < frames; i++) {
+        double t = (double)i / rate, noise = ((i * 2654435761u >> 16) & 0xFF) / 65536.0;
+        s[2 * i] = (int32_t)lrint((0.5 * sin(2 * M_PI * 441 * t) + 0.2 * sin(2 * M_PI * 5003 * t) + noise) * 8388607);
+        s[2 * i + 1] = (int32_t)lrint((0.5 * sin(2 * M_PI * 997 * t) + 0.2 * sin(2 * M_PI * 5003 * t) + noise) * 8388607);
+    }
+    return s;
+}
+
+static void writeWav(const char* name, const std::vector<int32_t>& src) {
+    FILE* f = fopen(name, "wb");
+    CHECK(f);
+    auto u32 = [f](uint32_t v) { fwrite(&v, 4, 1, f); };
+    auto u16 = [f](uint16_t v) { fwrite(&v, 2, 1, f); };
+    uint32_t data = frames * 2 * 3;
+    fwrite("RIFF", 1, 4, f); u32(36 + data); fwrite("WAVE", 1, 4, f);
+    fwrite("fmt ", 1, 4, f); u32(16); u16(1); u16(2); u32(rate); u32(rate * 6); u16(6); u16(24);
+    fwrite("data", 1, 4, f); u32(data);
+    for(int32_t s : src) fwrite(&s, 1, 3, f); // little endian
+    fclose(f);
+}
+
+template <typename T> static double dspTime(Audio* audio, const std::vector<int32_t>& src, uint16_t block) { // ns per frame
+    std::vector<T> buf(2 * block);
+    uint64_t       ns = 0, n = 0;
+    for(uint32_t pos = 0; pos + block <= frames; pos += block, n += block) {
+        for(int i = 0; i < 2 * block; i++) buf[i] = (sizeof(T) == sizeof(int16_t)) ? src[2 * pos + i] >> 8 : src[2 * pos + i];
+        uint64_t t0 = host_cycles();
+        audio->processDSP(buf.data(), block);
+        ns += host_cycles() - t0;
+    }
+    return (double)ns / n;
+}
+
+int main() {
+    std::vector<int32_t> src = source();
+    writeWav("hires24.wav", src); // in the working directory of the test
+    fs::FS tmp(".");
+    Audio* audio = newAudio();
+    int    port = audio->getI2sPort();
+
+    for(uint8_t bits : {32, 16}) {
+        CHECK(audio->setOutputBits(bits));
+        audio->setTone(0, 0, 0); // flat, the output is checked bit by bit
+        host_i2sTake(port);
+        CHECK(audio->connecttoFS(tmp, "/hires24.wav"));
+        pcm_t    pcm;
+        uint64_t t0 = host_cycles();
+        while(audio->isRunning()) {
+            audio->loop();
+            std::vector<uint8_t> b = host_i2sTake(port);
+            pcm.bytes.insert(pcm.bytes.end(), b.begin(), b.end());
+        }
+        uint64_t playNs = host_cycles() - t0;
+        std::vector<uint8_t> b = host_i2sTake(port);
+        pcm.bytes.insert(pcm.bytes.end(), b.begin(), b.end());
+        pcm.slotBits = host_i2sSlotBits(port);
+
+        CHECK(pcm.slotBits == bits);
+        CHECK(pcm.frames() == frames);
+        for(uint32_t i = 0; i < 2 * frames; i++) {
+            if(bits == 32) CHECK(pcm.s32()[i] == (int32_t)((uint32_t)src[i] << 8)); // 24 bit left justified in the slot
+            else CHECK(pcm.s16()[i] == (int16_t)(src[i] >> 8));
+        }
+        printf("%2u bit slots: bit exact, play (decode, DSP, I2S) %6.2f ns/frame\n", bits, (double)playNs / frames);
+    }
+
+    audio->setTone(4, -3, 5); // no stage is bypassed
+    audio->m_f_hiRes = true;  // processDSP() takes the sample type from m_f_hiRes
+    double t32 = dspTime<int32_t>(audio, src, 1024);
+    audio->m_f_hiRes = false;
+    double t16 = dspTime<int16_t>(audio, src, 1024);
+    printf("DSP chain with EQ: 24 bit %6.2f ns/frame, 16 bit %6.2f ns/frame\n", t32, t16);
+    remove("hires24.wav");
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * bench_src.cpp
+ *
+ *  sample rate converter: time per output frame and error against the ideal sine for each quality preset,
+ *  44.1 -> 48 kHz and 48 -> 44.1 kHz, 16 bit and 24 bit (hi-res) samples
+ */
+#define private public // SRC_process() and its state are private
+#include "test_util.h"
+#undef private
+
+template <typename S> static void run(Audio* audio, uint8_t quality, uint32_t inRate, uint32_t outRate, float minSNR) {
+    const char*    qName[] = {"SRC_LOW", "SRC_MEDIUM", "SRC_HIGH"};
+    const uint16_t block = 1152; // one mp3 frame
+    const uint32_t total = 200 * block;
+    const double   freq = 1000, amp = (sizeof(S) == sizeof(int16_t) ? 32767 : 8388607) * 0.89; // -1 dBFS
+
+    CHECK(audio->setOutputRate(outRate, quality));
+    audio->m_sampleRate = 0;
+    audio->setSampleRate(inRate);
+    CHECK(audio->m_f_srcActive);
+
+    S*       in = (S*)audio->m_srcIn + (audio->m_srcTaps - 1) * 2; // new frames behind the history
+    const S* out = (const S*)audio->m_srcBuff;
+    uint64_t ns = 0, outFrames = 0;
+    double   sig = 0, err = 0;
+    uint64_t pos = 0; // Q32, source frame of the next output frame
+    for(uint32_t t = 0; t < total; t += block) {
+        for(int i = 0; i < block; i++) in[2 * i] = in[2 * i + 1] = (S)lrint(amp * sin(2 * M_PI * freq * (t + i) / inRate));
+        audio->m_srcInFrames = block;
+        while(audio->m_srcInFrames) {
+            uint64_t t0 = host_cycles();
+            uint16_t n = audio->SRC_process<S>();
+            ns += host_cycles() - t0;
+            for(int i = 0; i < n; i++, outFrames++, pos += audio->m_srcStep) {
+                double x = (double)pos / 4294967296.0 - audio->m_srcTaps / 2; // the filter delays by taps / 2 source frames
+                if(outFrames < 100) continue;                                   // filter run-in
+                double ideal = amp * sin(2 * M_PI * freq * x / inRate);
+                sig += ideal * ideal;
+                err += (out[2 * i] - ideal) * (out[2 * i] - ideal);
+                CHECK(out[2 * i] == out[2 * i + 1]);
+            }
+        }
+    }
+    double snr = 10 * log10(sig / err);
+    printf("%-10s %2u bit %5u -> %5u: %7.2f ns/frame, %6.1f dB SNR\n", qName[quality], sizeof(S) == sizeof(int16_t) ? 16 : 24, inRate,
+           outRate, (double)ns / outFrames, snr);
+    CHECK(outFrames >= (uint64_t)total * outRate / inRate - 1 - audio->m_srcTaps);
+    CHECK(snr > minSNR);
+}
+
+int main() {
+    Audio* audio = newAudio();
+    for(uint8_t q = Audio::SRC_LOW; q <= Audio::SRC_HIGH; q++) { // the Q14 coefficients and the passband ripple limit the SNR
+        run<int16_t>(audio, q, 44100, 48000, 60);
+        run<int16_t>(audio, q, 48000, 44100, 60);
+        run<int32_t>(audio, q, 44100, 48000, 60);
+        run<int32_t>(audio, q, 48000, 44100, 60);
+    }
+    return 0;
+}
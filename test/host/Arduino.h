@@ -0,0 +1,184 @@
+/*
+ * Arduino.h
+ *
+ *  host replacement of the ESP32 Arduino core, just enough to build the library and the decoders on a PC.
+ *  FreeRTOS runs on std::thread, the I2S driver writes into memory (see host.h), the file system is the host's.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <stdarg.h>
+#include <assert.h>
+
+typedef int gpio_num_t;
+#define _min(a,b) ((a)<(b)?(a):(b))
+#define _max(a,b) ((a)>(b)?(a):(b))
+int toLowerCase(int c);
+using std::min; using std::max;
+template<class A,class B> auto min(A a, B b) -> decltype(a+b) { return a<b?a:b; }
+template<class A,class B> auto max(A a, B b) -> decltype(a+b) { return a>b?a:b; }
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+typedef bool boolean;
+typedef unsigned int uint;
+typedef int esp_err_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_IDF_VERSION_MAJOR 5
+#define ESP_IDF_VERSION_MINOR 1
+#define ESP_IDF_VERSION_VAL(a,b,c) (((a)<<16)|((b)<<8)|(c))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5,1,0)
+#define ESP_ARDUINO_VERSION_MAJOR 3
+#define ESP_ARDUINO_VERSION_MINOR 0
+#define ESP_ARDUINO_VERSION_PATCH 0
+#define ESP_ARDUINO_VERSION_VAL(a,b,c) (((a)<<16)|((b)<<8)|(c))
+#define ESP_ARDUINO_VERSION ESP_ARDUINO_VERSION_VAL(3,0,0)
+#define CONFIG_IDF_TARGET_ESP32 1
+#define IRAM_ATTR
+#define PROGMEM
+#define pgm_read_byte(a) (*(const uint8_t*)(a))
+#define pgm_read_word(a) (*(const uint16_t*)(a))
+#define pgm_read_dword(a) (*(const uint32_t*)(a))
+#define PI 3.1415926535897932384626433832795
+char* lltoa(long long val, char* buf, int radix);
+char* ltoa(long val, char* buf, int radix);
+char* itoa(int val, char* buf, int radix);
+char* ultoa(unsigned long val, char* buf, int radix);
+inline float pow10f(float x) { return powf(10, x); }
+
+extern bool host_verbose; // log_x() and printf of the library, off by default
+#define log_e(...) do { if(host_verbose) { printf(__VA_ARGS__); printf("\n"); } } while(0)
+#define log_w(...) log_e(__VA_ARGS__)
+#define log_i(...) log_e(__VA_ARGS__)
+#define log_d(...) log_e(__VA_ARGS__)
+#define log_v(...) log_e(__VA_ARGS__)
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+
+// heap, there is no PSRAM on the host but psramInit() says so to get the big buffers
+#define MALLOC_CAP_DEFAULT 1
+#define MALLOC_CAP_INTERNAL 2
+#define MALLOC_CAP_SPIRAM 4
+#define MALLOC_CAP_8BIT 8
+#define MALLOC_CAP_32BIT 16
+#define MALLOC_CAP_DMA 32
+bool psramInit();
+bool psramFound();
+void* ps_malloc(size_t size);
+void* ps_calloc(size_t n, size_t size);
+void* ps_realloc(void* p, size_t size);
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void* heap_caps_malloc_prefer(size_t size, size_t num, ...);
+void* heap_caps_calloc_prefer(size_t n, size_t size, size_t num, ...);
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps);
+void* heap_caps_realloc(void* p, size_t size, uint32_t caps);
+void  heap_caps_free(void* p);
+size_t heap_caps_get_free_size(uint32_t caps);
+uint32_t esp_cpu_get_cycle_count();
+int64_t  esp_timer_get_time();
+uint32_t xthal_get_ccount();
+struct EspClass {
+    uint32_t getCycleCount() { return esp_cpu_get_cycle_count(); }
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getCpuFreqMHz() { return 1000; } // the host cycle counter counts nanoseconds
+    uint32_t getFreePsram() { return 4000000; }
+};
+extern EspClass ESP;
+
+class String {
+  public:
+    String() {}
+    String(const char* s) : m_s(s ? s : "") {}
+    String(const std::string& s) : m_s(s) {}
+    String(int v) : m_s(std::to_string(v)) {}
+    const char* c_str() const { return m_s.c_str(); }
+    char        charAt(unsigned i) const { return i < m_s.size() ? m_s[i] : 0; }
+    void        toLowerCase() { for(auto& c : m_s) c = tolower((unsigned char)c); }
+    size_t      length() const { return m_s.size(); }
+    String&     operator+=(const char* s) { m_s += s; return *this; }
+    String&     operator+=(const String& s) { m_s += s.m_s; return *this; }
+    bool        operator==(const char* s) const { return m_s == s; }
+    bool        operator==(const String& s) const { return m_s == s.m_s; }
+    void        replace(const char* a, const char* b);
+    int         indexOf(const char* s) const { size_t p = m_s.find(s); return p == std::string::npos ? -1 : (int)p; }
+    String      substring(int from, int to = -1) const { return String(m_s.substr(from, to < 0 ? std::string::npos : to - from)); }
+    std::string m_s;
+};
+inline String operator+(const String& a, const String& b) { return String(a.m_s + b.m_s); }
+inline String operator+(const String& a, const char* b) { return String(a.m_s + b); }
+inline String operator+(const char* a, const String& b) { return String(a + b.m_s); }
+
+class Print {
+  public:
+    virtual ~Print() {}
+    size_t print(const char* s) { return strlen(s); }
+    size_t print(const String& s) { return s.length(); }
+    size_t println(const char* s) { return strlen(s) + 2; }
+    size_t printf(const char*, ...) { return 0; }
+    size_t write(const uint8_t*, size_t n) { return n; }
+    size_t write(uint8_t) { return 1; }
+};
+class Stream : public Print {
+  public:
+    int    available() { return 0; }
+    int    read() { return -1; }
+    int    read(uint8_t*, size_t) { return 0; }
+    size_t readBytes(char*, size_t) { return 0; }
+    size_t readBytes(uint8_t*, size_t) { return 0; }
+    void   setTimeout(unsigned long) {}
+    int    peek() { return -1; }
+    String readStringUntil(char) { return String(); }
+};
+
+// FreeRTOS
+typedef void* SemaphoreHandle_t;
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void (*TaskFunction_t)(void*);
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(x) (x)
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define portYIELD_FROM_ISR(x) (void)(x)
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t ticks);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t* woken);
+void       vSemaphoreDelete(SemaphoreHandle_t s);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* handle, BaseType_t core);
+void       vTaskDelete(TaskHandle_t t);
+void       vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+uint32_t   ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t t);
+void       vTaskNotifyGiveFromISR(TaskHandle_t t, BaseType_t* woken);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t  uxTaskGetStackHighWaterMark(TaskHandle_t t);
+inline BaseType_t xPortGetCoreID() { return 0; }
@@ -0,0 +1,46 @@
+/*
+ * FS.h
+ *
+ *  host replacement of the Arduino file system, fs::FS maps the paths below a directory of the PC
+ */
+#pragma once
+#include "Arduino.h"
+#include <memory>
+
+namespace fs {
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File : public Stream {
+  public:
+    File() {}
+    File(FILE* f, const char* path);
+    operator bool() const { return m_f != nullptr; }
+    size_t      size() const;
+    size_t      position() const;
+    bool        seek(uint32_t pos) { return seek(pos, SeekSet); }
+    bool        seek(uint32_t pos, SeekMode mode);
+    void        close() { m_f.reset(); }
+    const char* name() const;
+    const char* path() const { return m_path.c_str(); }
+    int         available();
+    int         read();
+    size_t      read(uint8_t* buf, size_t len);
+    size_t      readBytes(char* buf, size_t len) { return read((uint8_t*)buf, len); }
+    size_t      readBytes(uint8_t* buf, size_t len) { return read(buf, len); }
+    bool        isDirectory() { return false; }
+    File        openNextFile() { return File(); }
+  private:
+    std::shared_ptr<FILE> m_f;
+    std::string           m_path;
+};
+
+class FS {
+  public:
+    FS(const char* root = "") : m_root(root) {}
+    File open(const char* path, const char* mode = "r", bool create = false);
+    bool exists(const char* path);
+  private:
+    std::string m_root;
+};
+} // namespace fs
+using fs::File;
@@ -0,0 +1,22 @@
+/*
+ * WiFi.h
+ *
+ *  host replacement, there is no network: connect() fails, the tests play files
+ */
+#pragma once
+#include "Arduino.h"
+
+class IPAddress { public: IPAddress() {} };
+class WiFiClient : public Stream {
+  public:
+    virtual ~WiFiClient() {}
+    int  connect(const char*, uint16_t) { return 0; }
+    int  connect(const char*, uint16_t, int32_t) { return 0; }
+    bool connected() { return false; }
+    void stop() {}
+    void clear() {}
+    int  available() { return 0; }
+    int  read() { return -1; }
+    int  read(uint8_t*, size_t) { return 0; }
+    void flush() {}
+};
@@ -0,0 +1,4 @@
+#pragma once
+#include "WiFi.h"
+
+class WiFiClientSecure : public WiFiClient { public: void setInsecure() {} };
@@ -0,0 +1,33 @@
+#pragma once
+#include "Arduino.h"
+typedef int i2s_port_t; enum { I2S_NUM_0 = 0, I2S_NUM_1 = 1, I2S_NUM_AUTO = 2};
+typedef void* i2s_chan_handle_t;
+typedef enum { I2S_ROLE_MASTER, I2S_ROLE_SLAVE } i2s_role_t;
+typedef struct { i2s_port_t id; i2s_role_t role; uint32_t dma_desc_num; uint32_t dma_frame_num; bool auto_clear; int intr_priority; } i2s_chan_config_t;
+typedef enum { I2S_DATA_BIT_WIDTH_8BIT=8, I2S_DATA_BIT_WIDTH_16BIT=16, I2S_DATA_BIT_WIDTH_24BIT=24, I2S_DATA_BIT_WIDTH_32BIT=32 } i2s_data_bit_width_t;
+typedef enum { I2S_SLOT_BIT_WIDTH_AUTO=0, I2S_SLOT_BIT_WIDTH_16BIT=16, I2S_SLOT_BIT_WIDTH_32BIT=32 } i2s_slot_bit_width_t;
+typedef enum { I2S_SLOT_MODE_MONO=1, I2S_SLOT_MODE_STEREO=2 } i2s_slot_mode_t;
+typedef enum { I2S_STD_SLOT_LEFT=1, I2S_STD_SLOT_RIGHT=2, I2S_STD_SLOT_BOTH=3 } i2s_std_slot_mask_t;
+typedef struct { i2s_data_bit_width_t data_bit_width; i2s_slot_bit_width_t slot_bit_width; i2s_slot_mode_t slot_mode; i2s_std_slot_mask_t slot_mask; uint32_t ws_width; bool ws_pol; bool bit_shift; } i2s_std_slot_config_t;
+typedef enum { I2S_CLK_SRC_DEFAULT } i2s_clock_src_t;
+typedef enum { I2S_MCLK_MULTIPLE_128=128, I2S_MCLK_MULTIPLE_256=256, I2S_MCLK_MULTIPLE_384=384 } i2s_mclk_multiple_t;
+typedef struct { uint32_t sample_rate_hz; i2s_clock_src_t clk_src; i2s_mclk_multiple_t mclk_multiple; } i2s_std_clk_config_t;
+typedef struct { bool mclk_inv; bool bclk_inv; bool ws_inv; } i2s_invert_t;
+typedef struct { int mclk; int bclk; int ws; int dout; int din; i2s_invert_t invert_flags; } i2s_std_gpio_config_t;
+typedef struct { i2s_std_clk_config_t clk_cfg; i2s_std_slot_config_t slot_cfg; i2s_std_gpio_config_t gpio_cfg; } i2s_std_config_t;
+#define I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(b, m) { (i2s_data_bit_width_t)(b), I2S_SLOT_BIT_WIDTH_AUTO, m, I2S_STD_SLOT_BOTH, (uint32_t)(b), false, true }
+#define I2S_STD_PCM_SLOT_DEFAULT_CONFIG(b, m) { (i2s_data_bit_width_t)(b), I2S_SLOT_BIT_WIDTH_AUTO, m, I2S_STD_SLOT_BOTH, 1, true, true }
+#define I2S_STD_MSB_SLOT_DEFAULT_CONFIG(b, m) { (i2s_data_bit_width_t)(b), I2S_SLOT_BIT_WIDTH_AUTO, m, I2S_STD_SLOT_BOTH, (uint32_t)(b), false, false }
+typedef struct { void* data; size_t size; } i2s_event_data_t;
+typedef bool (*i2s_isr_callback_t)(i2s_chan_handle_t, i2s_event_data_t*, void*);
+typedef struct { i2s_isr_callback_t on_recv; i2s_isr_callback_t on_recv_q_ovf; i2s_isr_callback_t on_sent; i2s_isr_callback_t on_send_q_ovf; } i2s_event_callbacks_t;
+esp_err_t i2s_new_channel(const i2s_chan_config_t*, i2s_chan_handle_t*, i2s_chan_handle_t*);
+esp_err_t i2s_del_channel(i2s_chan_handle_t);
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t, const i2s_std_config_t*);
+esp_err_t i2s_channel_enable(i2s_chan_handle_t); esp_err_t i2s_channel_disable(i2s_chan_handle_t);
+esp_err_t i2s_channel_write(i2s_chan_handle_t, const void*, size_t, size_t*, uint32_t);
+esp_err_t i2s_channel_reconfig_std_clock(i2s_chan_handle_t, const i2s_std_clk_config_t*);
+esp_err_t i2s_channel_reconfig_std_slot(i2s_chan_handle_t, const i2s_std_slot_config_t*);
+esp_err_t i2s_channel_reconfig_std_gpio(i2s_chan_handle_t, const i2s_std_gpio_config_t*);
+esp_err_t i2s_channel_register_event_callback(i2s_chan_handle_t, const i2s_event_callbacks_t*, void*);
+esp_err_t i2s_channel_preload_data(i2s_chan_handle_t, const void*, size_t, size_t*);
@@ -0,0 +1,408 @@
+/*
+ * host.cpp
+ *
+ *  implementation of the host stubs: FreeRTOS on std::thread, an I2S driver that writes into memory, files of the PC
+ */
+#include "Arduino.h"
+#include "FS.h"
+#include "host.h"
+#include "driver/i2s_std.h"
+#include "libb64/cencode.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+bool     host_verbose = getenv("HOST_VERBOSE") != nullptr;
+EspClass ESP;
+
+static const auto s_t0 = std::chrono::steady_clock::now();
+
+unsigned long micros() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_t0).count(); }
+unsigned long millis() { return micros() / 1000; }
+void          delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+int64_t       esp_timer_get_time() { return micros(); }
+uint64_t      host_cycles() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_t0).count(); }
+uint32_t      esp_cpu_get_cycle_count() { return (uint32_t)host_cycles(); }
+uint32_t      xthal_get_ccount() { return (uint32_t)host_cycles(); }
+
+int toLowerCase(int c) { return tolower(c); }
+
+static char* host_toa(unsigned long long v, bool neg, char* buf, int radix) {
+    char tmp[72];
+    int  n = 0;
+    do { int d = v % radix; tmp[n++] = d < 10 ? '0' + d : 'a' + d - 10; v /= radix; } while(v);
+    char* p = buf;
+    if(neg) *p++ = '-';
+    while(n) *p++ = tmp[--n];
+    *p = 0;
+    return buf;
+}
+char* lltoa(long long v, char* buf, int radix) { return host_toa(v < 0 ? -(unsigned long long)v : v, v < 0, buf, radix); }
+char* ltoa(long v, char* buf, int radix) { return lltoa(v, buf, radix); }
+char* itoa(int v, char* buf, int radix) { return lltoa(v, buf, radix); }
+char* ultoa(unsigned long v, char* buf, int radix) { return host_toa(v, false, buf, radix); }
+
+void String::replace(const char* a, const char* b) {
+    size_t la = strlen(a), lb = strlen(b), pos = 0;
+    if(!la) return;
+    while((pos = m_s.find(a, pos)) != std::string::npos) { m_s.replace(pos, la, b); pos += lb; }
+}
+
+int  base64_encode_expected_len(int len) { return ((len + 2) / 3) * 4; }
+void base64_init_encodestate(base64_encodestate* state) { state->step = 0; state->result = 0; }
+int  base64_encode_block(const char*, int, char* out, base64_encodestate*) { *out = 0; return 0; }
+int  base64_encode_blockend(char* out, base64_encodestate*) { *out = 0; return 0; }
+
+//----------------------------------------------------------------------------------------------------------------------
+//  heap
+//----------------------------------------------------------------------------------------------------------------------
+bool   psramInit() { return true; }
+bool   psramFound() { return true; }
+void*  ps_malloc(size_t size) { return malloc(size); }
+void*  ps_calloc(size_t n, size_t size) { return calloc(n, size); }
+void*  ps_realloc(void* p, size_t size) { return realloc(p, size); }
+void*  heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+void*  heap_caps_calloc(size_t n, size_t size, uint32_t) { return calloc(n, size); }
+void*  heap_caps_malloc_prefer(size_t size, size_t, ...) { return malloc(size); }
+void*  heap_caps_calloc_prefer(size_t n, size_t size, size_t, ...) { return calloc(n, size); }
+void*  heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t) { return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment); }
+void*  heap_caps_realloc(void* p, size_t size, uint32_t) { return realloc(p, size); }
+void   heap_caps_free(void* p) { free(p); }
+size_t heap_caps_get_free_size(uint32_t) { return 4000000; }
+
+//----------------------------------------------------------------------------------------------------------------------
+//  FreeRTOS
+//----------------------------------------------------------------------------------------------------------------------
+struct host_sem_t {
+    std::mutex              m;
+    std::condition_variable cv;
+    int                     count;
+    bool                    recursive;
+    std::thread::id         owner;
+    int                     depth = 0;
+};
+struct host_task_t {
+    std::mutex              m;
+    std::condition_variable cv;
+    uint32_t                notify = 0;
+    std::string             name;
+    uint32_t                notified = 0; // ulTaskNotifyTake() returned with a notification
+    uint32_t                timedOut = 0; // ... after the timeout
+};
+static thread_local host_task_t* t_self = nullptr;
+static std::mutex                s_tasksLock;
+static std::vector<host_task_t*> s_tasks;
+
+static SemaphoreHandle_t host_semNew(int count, bool recursive) {
+    host_sem_t* s = new host_sem_t;
+    s->count = count;
+    s->recursive = recursive;
+    return s;
+}
+SemaphoreHandle_t xSemaphoreCreateMutex() { return host_semNew(1, false); }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return host_semNew(1, true); }
+SemaphoreHandle_t xSemaphoreCreateBinary() { return host_semNew(0, false); }
+void              vSemaphoreDelete(SemaphoreHandle_t s) { delete(host_sem_t*)s; }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t h, TickType_t ticks) {
+    host_sem_t*                  s = (host_sem_t*)h;
+    std::unique_lock<std::mutex> lk(s->m);
+    if(s->recursive && s->depth && s->owner == std::this_thread::get_id()) { s->depth++; return pdTRUE; }
+    auto ready = [s] { return s->count > 0; };
+    if(ticks == portMAX_DELAY) s->cv.wait(lk, ready);
+    else if(!s->cv.wait_for(lk, std::chrono::milliseconds(ticks), ready)) return pdFALSE;
+    s->count--;
+    s->owner = std::this_thread::get_id();
+    s->depth = 1;
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t h) {
+    host_sem_t*                 s = (host_sem_t*)h;
+    std::lock_guard<std::mutex> lk(s->m);
+    if(s->recursive && --s->depth > 0) return pdTRUE;
+    s->depth = 0;
+    s->count = 1;
+    s->cv.notify_one();
+    return pdTRUE;
+}
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t ticks) { return xSemaphoreTake(s, ticks); }
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s) { return xSemaphoreGive(s); }
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t* woken) {
+    if(woken) *woken = pdFALSE;
+    return xSemaphoreGive(s);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t, void* param, UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+    host_task_t* t = new host_task_t; // never freed, a deleted task may still be running its last lines
+    t->name = name;
+    {
+        std::lock_guard<std::mutex> lk(s_tasksLock);
+        s_tasks.push_back(t);
+    }
+    if(handle) *handle = t;
+    std::thread([fn, param, t] {
+        t_self = t;
+        fn(param);
+    }).detach();
+    return pdPASS;
+}
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* param, UBaseType_t prio, TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle, tskNO_AFFINITY);
+}
+void vTaskDelete(TaskHandle_t) {} // the library deletes a task after its loop has ended, the thread returns by itself
+void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks ? ticks : 1)); }
+TickType_t   xTaskGetTickCount() { return millis(); }
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if(!t_self) t_self = new host_task_t;
+    return t_self;
+}
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 1000; }
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    host_task_t*                 t = (host_task_t*)xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lk(t->m);
+    auto                         ready = [t] { return t->notify > 0; };
+    if(ticks == portMAX_DELAY) t->cv.wait(lk, ready);
+    else t->cv.wait_for(lk, std::chrono::milliseconds(ticks), ready);
+    uint32_t n = t->notify;
+    if(n) t->notify = clear ? 0 : n - 1;
+    if(n) t->notified++;
+    else t->timedOut++;
+    return n;
+}
+void host_taskWakeups(const char* name, uint32_t* notified, uint32_t* timedOut) {
+    *notified = *timedOut = 0;
+    std::lock_guard<std::mutex> lk(s_tasksLock);
+    for(host_task_t* t : s_tasks) {
+        if(t->name != name) continue;
+        std::lock_guard<std::mutex> tl(t->m);
+        *notified += t->notified;
+        *timedOut += t->timedOut;
+    }
+}
+BaseType_t xTaskNotifyGive(TaskHandle_t h) {
+    host_task_t*                t = (host_task_t*)h;
+    std::lock_guard<std::mutex> lk(t->m);
+    t->notify++;
+    t->cv.notify_one();
+    return pdPASS;
+}
+void vTaskNotifyGiveFromISR(TaskHandle_t h, BaseType_t* woken) {
+    xTaskNotifyGive(h);
+    if(woken) *woken = pdTRUE;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+//  I2S, IDF5 standard mode
+//----------------------------------------------------------------------------------------------------------------------
+struct host_i2s_t {
+    int                     port;
+    uint32_t                descNum;
+    uint32_t                frameNum;
+    uint32_t                rate = 44100;
+    uint8_t                 slotBits = 16;
+    bool                    enabled = false;
+    bool                    realtime = false;
+    i2s_event_callbacks_t   cb = {};
+    void*                   user = nullptr;
+    std::mutex              m;
+    std::condition_variable cv;
+    std::vector<uint8_t>    out;         // everything written, taken by host_i2sTake()
+    uint32_t                queued = 0;  // realtime: bytes in the DMA ring
+    bool                    started = false;
+    uint32_t                underruns = 0;
+    std::atomic<uint32_t>   wakeups{0};
+    std::thread             dma;
+    bool                    dmaRun = false;
+};
+static std::mutex                s_i2sLock;
+static std::map<int, host_i2s_t*> s_i2s;
+static bool                      s_realtime = false;
+
+static host_i2s_t* host_i2s(int port) {
+    std::lock_guard<std::mutex> lk(s_i2sLock);
+    auto                        it = s_i2s.find(port);
+    return it == s_i2s.end() ? nullptr : it->second;
+}
+static uint32_t host_frameBytes(host_i2s_t* c) { return 2 * c->slotBits / 8; }
+
+static void host_sent(host_i2s_t* c) { // "ISR", c->m is not held
+    if(!c->cb.on_sent) return;
+    i2s_event_data_t ev = {};
+    c->wakeups++;
+    c->cb.on_sent(c, &ev, c->user);
+}
+
+static void host_dmaTask(host_i2s_t* c) { // sends one DMA buffer per frameNum / rate seconds
+    auto next = std::chrono::steady_clock::now();
+    while(true) {
+        uint32_t rate;
+        {
+            std::lock_guard<std::mutex> lk(c->m);
+            if(!c->dmaRun) return;
+            rate = c->rate;
+            uint32_t bytes = c->frameNum * host_frameBytes(c);
+            if(c->queued >= bytes) c->queued -= bytes;
+            else {
+                if(c->started) c->underruns++; // auto_clear sends zeros
+                c->queued = 0;
+            }
+            c->cv.notify_all();
+        }
+        host_sent(c);
+        next += std::chrono::microseconds((uint64_t)c->frameNum * 1000000 / rate);
+        std::this_thread::sleep_until(next);
+    }
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t* cfg, i2s_chan_handle_t* tx, i2s_chan_handle_t* rx) {
+    host_i2s_t* c = new host_i2s_t;
+    c->port = cfg->id == I2S_NUM_AUTO ? 0 : cfg->id;
+    c->descNum = cfg->dma_desc_num;
+    c->frameNum = cfg->dma_frame_num;
+    c->realtime = s_realtime;
+    {
+        std::lock_guard<std::mutex> lk(s_i2sLock);
+        s_i2s[c->port] = c;
+    }
+    if(tx) *tx = c;
+    if(rx) *rx = nullptr;
+    return ESP_OK;
+}
+esp_err_t i2s_del_channel(i2s_chan_handle_t h) {
+    host_i2s_t* c = (host_i2s_t*)h;
+    i2s_channel_disable(h);
+    std::lock_guard<std::mutex> lk(s_i2sLock);
+    if(s_i2s[c->port] == c) s_i2s.erase(c->port);
+    return ESP_OK; // not freed, host_i2sTake() may still look at it
+}
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t h, const i2s_std_config_t* cfg) {
+    i2s_channel_reconfig_std_clock(h, &cfg->clk_cfg);
+    return i2s_channel_reconfig_std_slot(h, &cfg->slot_cfg);
+}
+esp_err_t i2s_channel_reconfig_std_clock(i2s_chan_handle_t h, const i2s_std_clk_config_t* cfg) {
+    host_i2s_t*                 c = (host_i2s_t*)h;
+    std::lock_guard<std::mutex> lk(c->m);
+    c->rate = cfg->sample_rate_hz ? cfg->sample_rate_hz : 44100;
+    return ESP_OK;
+}
+esp_err_t i2s_channel_reconfig_std_slot(i2s_chan_handle_t h, const i2s_std_slot_config_t* cfg) {
+    host_i2s_t*                 c = (host_i2s_t*)h;
+    std::lock_guard<std::mutex> lk(c->m);
+    c->slotBits = (cfg->slot_bit_width == I2S_SLOT_BIT_WIDTH_AUTO) ? (cfg->data_bit_width > 16 ? 32 : 16) : cfg->slot_bit_width;
+    return ESP_OK;
+}
+esp_err_t i2s_channel_reconfig_std_gpio(i2s_chan_handle_t, const i2s_std_gpio_config_t*) { return ESP_OK; }
+esp_err_t i2s_channel_register_event_callback(i2s_chan_handle_t h, const i2s_event_callbacks_t* cb, void* user) {
+    host_i2s_t* c = (host_i2s_t*)h;
+    c->cb = *cb;
+    c->user = user;
+    return ESP_OK;
+}
+esp_err_t i2s_channel_enable(i2s_chan_handle_t h) {
+    host_i2s_t*                 c = (host_i2s_t*)h;
+    std::lock_guard<std::mutex> lk(c->m);
+    if(c->enabled) return ESP_ERR_INVALID_STATE;
+    c->enabled = true;
+    if(c->realtime) {
+        c->dmaRun = true;
+        c->dma = std::thread(host_dmaTask, c);
+    }
+    return ESP_OK;
+}
+esp_err_t i2s_channel_disable(i2s_chan_handle_t h) {
+    host_i2s_t* c = (host_i2s_t*)h;
+    {
+        std::lock_guard<std::mutex> lk(c->m);
+        if(!c->enabled) return ESP_ERR_INVALID_STATE;
+        c->enabled = false;
+        c->dmaRun = false;
+        c->queued = 0;
+        c->started = false;
+        c->cv.notify_all();
+    }
+    if(c->dma.joinable()) c->dma.join();
+    return ESP_OK;
+}
+esp_err_t i2s_channel_preload_data(i2s_chan_handle_t, const void*, size_t, size_t* loaded) {
+    if(loaded) *loaded = 0;
+    return ESP_OK;
+}
+esp_err_t i2s_channel_write(i2s_chan_handle_t h, const void* src, size_t size, size_t* written, uint32_t timeout_ms) {
+    host_i2s_t* c = (host_i2s_t*)h;
+    size_t      n = size;
+    {
+        std::unique_lock<std::mutex> lk(c->m);
+        if(written) *written = 0;
+        if(!c->enabled) return ESP_ERR_INVALID_STATE;
+        if(c->realtime) { // block until all is in the DMA ring or the timeout, like the driver
+            uint32_t cap = c->descNum * c->frameNum * host_frameBytes(c);
+            auto     deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            n = 0;
+            while(n < size && c->enabled) {
+                if(!c->cv.wait_until(lk, deadline, [c, cap] { return c->queued < cap || !c->enabled; })) break;
+                size_t k = std::min<size_t>(size - n, cap - std::min(cap, c->queued));
+                c->queued += k;
+                c->out.insert(c->out.end(), (const uint8_t*)src + n, (const uint8_t*)src + n + k);
+                n += k;
+                if(k) c->started = true;
+            }
+        }
+        else c->out.insert(c->out.end(), (const uint8_t*)src, (const uint8_t*)src + n);
+        if(written) *written = n;
+    }
+    if(!c->realtime) host_sent(c); // the DMA is infinitely fast
+    return n == size ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+std::vector<uint8_t> host_i2sTake(int port) {
+    std::vector<uint8_t> v;
+    host_i2s_t*          c = host_i2s(port);
+    if(!c) return v;
+    std::lock_guard<std::mutex> lk(c->m);
+    v.swap(c->out);
+    return v;
+}
+uint32_t host_i2sRate(int port) { host_i2s_t* c = host_i2s(port); return c ? c->rate : 0; }
+uint8_t  host_i2sSlotBits(int port) { host_i2s_t* c = host_i2s(port); return c ? c->slotBits : 0; }
+uint32_t host_i2sUnderruns(int port) { host_i2s_t* c = host_i2s(port); return c ? c->underruns : 0; }
+uint32_t host_i2sWakeups(int port) { host_i2s_t* c = host_i2s(port); return c ? c->wakeups.load() : 0; }
+void     host_i2sRealtime(bool on) { s_realtime = on; }
+
+//----------------------------------------------------------------------------------------------------------------------
+//  files
+//----------------------------------------------------------------------------------------------------------------------
+namespace fs {
+File::File(FILE* f, const char* path) : m_f(f, fclose), m_path(path) {}
+size_t File::size() const {
+    if(!m_f) return 0;
+    long pos = ftell(m_f.get());
+    fseek(m_f.get(), 0, SEEK_END);
+    long size = ftell(m_f.get());
+    fseek(m_f.get(), pos, SEEK_SET);
+    return size;
+}
+size_t File::position() const { return m_f ? ftell(m_f.get()) : 0; }
+bool   File::seek(uint32_t pos, SeekMode mode) { return m_f && fseek(m_f.get(), pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0; }
+const char* File::name() const {
+    const char* p = strrchr(m_path.c_str(), '/');
+    return p ? p + 1 : m_path.c_str();
+}
+int    File::available() { return m_f ? (int)(size() - position()) : 0; }
+int    File::read() { return m_f ? fgetc(m_f.get()) : -1; }
+size_t File::read(uint8_t* buf, size_t len) { return m_f ? fread(buf, 1, len, m_f.get()) : 0; }
+
+File FS::open(const char* path, const char* mode, bool) {
+    std::string full = m_root + path;
+    FILE*       f = fopen(full.c_str(), *mode == 'w' ? "wb" : "rb");
+    return f ? File(f, path) : File();
+}
+bool FS::exists(const char* path) {
+    std::string full = m_root + path;
+    FILE*       f = fopen(full.c_str(), "rb");
+    if(f) fclose(f);
+    return f != nullptr;
+}
+} // namespace fs
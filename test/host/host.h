@@ -0,0 +1,19 @@
+/*
+ * host.h
+ *
+ *  test side of the host stubs: what the library wrote to I2S, DMA timing, cycle counter
+ */
+#pragma once
+#include "Arduino.h"
+#include <vector>
+
+std::vector<uint8_t> host_i2sTake(int port);      // bytes written to the I2S channel since the last call
+uint32_t             host_i2sRate(int port);      // current sample rate of the channel
+uint8_t              host_i2sSlotBits(int port);  // 16 or 32
+uint32_t             host_i2sUnderruns(int port); // DMA buffers sent without data (realtime mode only)
+uint32_t             host_i2sWakeups(int port);   // "sent" events given to the library
+void                 host_i2sRealtime(bool on);   // channels created afterwards drain the DMA ring at the sample rate,
+                                                  // i2s_channel_write() blocks like the real driver
+void                 host_taskWakeups(const char* name, uint32_t* notified, uint32_t* timedOut); // ulTaskNotifyTake() of
+                                                  // the tasks with this name, woken by a notification or by the timeout
+uint64_t             host_cycles();               // nanoseconds, what ESP.getCycleCount() counts on the host
@@ -0,0 +1,6 @@
+#pragma once
+typedef struct { int step; char result; } base64_encodestate;
+int  base64_encode_expected_len(int len);
+void base64_init_encodestate(base64_encodestate* state);
+int  base64_encode_block(const char* in, int len, char* out, base64_encodestate* state);
+int  base64_encode_blockend(char* out, base64_encodestate* state);
@@ -0,0 +1,111 @@
+/*
+ * test_audiobuffer.cpp
+ *
+ *  AudioBuffer as a single producer / single consumer ring: a producer thread writes a counting byte sequence in
+ *  random chunks (like the network or file reader), the consumer reads random frames up to maxBlockSize across the
+ *  end of the buffer (like the decoder) and checks every byte. Then the throughput with mp3 sized frames, against a
+ *  baseline that takes a recursive mutex in every accessor like AudioBuffer did before it became lock-free
+ */
+#include "test_util.h"
+#include <thread>
+
+static inline uint8_t seqByte(uint64_t k) { return (uint8_t)(k * 131 + (k >> 11)); } // not periodic in the buffer size
+
+struct rng_t { // xorshift, one per thread
+    uint32_t s;
+    uint32_t operator()() { s ^= s << 13; s ^= s >> 17; s ^= s << 5; return s; }
+};
+
+// the locking of the former AudioBuffer (xSemaphoreTakeRecursive with 3 s timeout) around the same ring, its own
+// index arithmetic can't be used: it takes an emptied ring for a full one
+struct MutexAudioBuffer : AudioBuffer {
+    SemaphoreHandle_t mutex_buffer = xSemaphoreCreateRecursiveMutex();
+    MutexAudioBuffer(size_t maxBlockSize) : AudioBuffer(maxBlockSize) {}
+    ~MutexAudioBuffer() { vSemaphoreDelete(mutex_buffer); }
+    template <typename F> auto locked(F f) {
+        xSemaphoreTakeRecursive(mutex_buffer, 3 * configTICK_RATE_HZ);
+        auto r = f();
+        xSemaphoreGiveRecursive(mutex_buffer);
+        return r;
+    }
+    size_t   writeSpace() { return locked([this] { return AudioBuffer::writeSpace(); }); }
+    size_t   bufferFilled() { return locked([this] { return AudioBuffer::bufferFilled(); }); }
+    uint8_t* getReadPtr() { return locked([this] { return AudioBuffer::getReadPtr(); }); }
+    void     bytesWritten(size_t bw) { locked([&] { AudioBuffer::bytesWritten(bw); return 0; }); }
+    void     bytesWasRead(size_t br) { locked([&] { AudioBuffer::bytesWasRead(br); return 0; }); }
+};
+
+// returns ns for the whole transfer, verify: check every byte (else only touch them)
+template <typename B> static uint64_t run(B& b, uint64_t total, uint32_t maxWrite, uint32_t maxRead, bool random, bool verify) {
+    std::thread producer([&] {
+        rng_t    rnd{12345};
+        uint64_t k = 0;
+        while(k < total) {
+            size_t n = std::min<uint64_t>(b.writeSpace(), total - k);
+            if(!n) { // full
+                std::this_thread::yield();
+                continue;
+            }
+            n = std::min<size_t>(n, random ? rnd() % maxWrite + 1 : maxWrite);
+            uint8_t* p = b.getWritePtr();
+            for(size_t i = 0; i < n; i++) p[i] = seqByte(k + i);
+            b.bytesWritten(n);
+            k += n;
+        }
+    });
+    rng_t    rnd{54321};
+    uint64_t k = 0, errors = 0, wraps = 0;
+    uint32_t sum = 0;
+    size_t   need = 0;
+    uint64_t t0 = host_cycles();
+    while(k < total) {
+        if(!need) need = std::min<uint64_t>(random ? rnd() % maxRead + 1 : maxRead, total - k); // the next frame
+        if(b.bufferFilled() < need) { // before getReadPtr(), the copy of the wrap-around needs the bytes
+            std::this_thread::yield();
+            continue;
+        }
+        size_t n = need;
+        need = 0;
+        if(b.getReadPos() + n > (size_t)b.getBufsize()) wraps++;
+        const uint8_t* p = b.getReadPtr();
+        if(verify) {
+            for(size_t i = 0; i < n; i++) errors += (p[i] != seqByte(k + i));
+        }
+        else {
+            for(size_t i = 0; i < n; i += 64) sum += p[i];
+        }
+        b.bytesWasRead(n);
+        k += n;
+    }
+    uint64_t ns = host_cycles() - t0;
+    producer.join();
+    if(verify) {
+        printf("%10llu bytes, buffer %6d, %7llu frames across the end, %llu wrong bytes\n", (unsigned long long)total, b.getBufsize(),
+               (unsigned long long)wraps, (unsigned long long)errors);
+        CHECK(errors == 0);
+    }
+    CHECK(b.bufferFilled() == 0 && sum != 1); // sum: the reads are not optimized away
+    return ns;
+}
+
+int main() {
+    AudioBuffer small(1600), big(1600);
+    small.setBufsize(-1, 4096 * 4 + 4000); // 4000 bytes of ring behind the reserved space, a wrap every few frames
+    CHECK(small.init() == 4000);
+    run(small, 20000000, 3000, 1600, true, true);
+    CHECK(big.init());
+    run(big, 50000000, 16384, 1600, true, true);
+
+    MutexAudioBuffer locked(1600);
+    CHECK(locked.init());
+    run(locked, 20000000, 16384, 1600, true, true);
+
+    const uint64_t total = 200000000;
+    big.resetBuffer();
+    uint64_t ns = run(big, total, 4096, 1600, false, false); // file reads of 4 KB, mp3 sized frames
+    locked.resetBuffer();
+    uint64_t nsLocked = run(locked, total, 4096, 1600, false, false);
+    printf("lock-free  %5.0f MB/s, %6.1f ns per 1600 byte frame\n", total * 1e3 / ns, (double)ns / (total / 1600));
+    printf("mutex      %5.0f MB/s, %6.1f ns per 1600 byte frame\n", total * 1e3 / nsLocked, (double)nsLocked / (total / 1600));
+    return 0;
+}
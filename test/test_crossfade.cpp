@@ -0,0 +1,54 @@
+/*
+ * test_crossfade.cpp
+ *
+ *  crossfade tail at another output rate: the next file reconfigures I2S, the rest of the captured tail (a sine
+ *  across the end of the ring) is converted to the new rate and mixed, not dropped
+ */
+#define private public
+#include "test_util.h"
+#include <cmath>
+
+static void run(Audio* audio, uint32_t from, uint32_t to) {
+    const uint8_t  seconds = 3;
+    const float    f = 1000;
+    const uint32_t fill = 2 * from; // 2 s of tail
+    audio->setSampleRate(from);
+    audio->xfStart();
+    CHECK(audio->m_xfState == Audio::XF_CAPTURE && audio->m_xfSize == seconds * from);
+    audio->m_xfRead = audio->m_xfWrite = audio->m_xfSize - 1000; // the tail crosses the end of the ring
+    std::vector<int16_t> b(2 * fill);
+    for(uint32_t i = 0; i < fill; i++) b[2 * i] = b[2 * i + 1] = (int16_t)(16000 * sinf(2 * (float)M_PI * f * i / from));
+    for(uint32_t i = 0; i < fill; i += 1000) audio->xfWrite(&b[2 * i], std::min(fill - i, 1000u));
+
+    audio->m_xfState = Audio::XF_MIX; // startNextFile()
+    audio->m_xfLen = audio->m_xfPos = 0;
+    audio->setSampleRate(to);         // setDecodeParams(), reconfigI2S()
+    uint32_t n = audio->m_xfFill;
+    CHECK(audio->xfResample(to));
+    uint32_t fill2 = audio->m_xfFill;
+    int      err = 0;
+    for(uint32_t j = 0; j < fill2; j++) {
+        int16_t ref = (int16_t)(16000 * sinf(2 * (float)M_PI * f * j / to));
+        uint32_t k = (audio->m_xfRead + j) % audio->m_xfSize;
+        err = std::max(err, abs(audio->m_xfBuff[2 * k] - ref));
+        err = std::max(err, abs(audio->m_xfBuff[2 * k + 1] - ref));
+    }
+    printf("%6u Hz -> %6u Hz: %7u tail frames -> %7u, max. error %d\n", from, to, n, fill2, err);
+    CHECK(fill2 + to / from + 1 >= (uint64_t)n * to / from && fill2 <= (uint64_t)n * to / from);
+    CHECK(err < 16000 / 50); // linear interpolation of a 1 kHz sine
+
+    std::vector<int16_t> head(2 * 1024, 0); // silent head, the result is the faded tail
+    audio->xfMix(head.data(), 1024);
+    CHECK(audio->m_xfState == Audio::XF_MIX && audio->m_xfPos == 1024 && audio->m_xfLen == fill2);
+    audio->setCrossfade(seconds); // off and on, XF_IDLE
+}
+
+int main() {
+    Audio* audio = newAudio();
+    CHECK(audio->setCrossfade(3));
+    run(audio, 44100, 48000);
+    run(audio, 48000, 44100);
+    run(audio, 22050, 48000);
+    run(audio, 96000, 32000);
+    return 0;
+}
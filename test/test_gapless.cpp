@@ -0,0 +1,84 @@
+/*
+ * test_gapless.cpp
+ *
+ *  gapless playback: a file followed by itself (queueNextFS) must give exactly twice the frames of the file alone,
+ *  the last, maybe partial, block is decoded before the next file starts. WAV and FLAC give their length in the header,
+ *  MP3 and M4A the encoder delay and padding (LAME, iTunSMPB or the m4a media duration): the trimmed length must match
+ */
+#include "test_util.h"
+
+static uint32_t be32(const uint8_t* p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+static const uint8_t* find(const std::vector<uint8_t>& h, const char* tag, size_t from = 0) {
+    for(size_t p = from; p + 4 <= h.size(); p++) if(!memcmp(&h[p], tag, 4)) return &h[p];
+    return nullptr;
+}
+
+// frames the container says are valid (length in the header, gapless info), 0 if it doesn't tell
+static uint32_t headerFrames(const char* path) {
+    fs::File f = testFiles.open(path, "r");
+    std::vector<uint8_t> h(f.size());
+    h.resize(f.read(h.data(), h.size()));
+    if(strstr(path, ".wav")) { // RIFF chunks, block align in "fmt ", size of "data"
+        uint16_t blockAlign = 0;
+        for(size_t p = 12; p + 8 <= h.size(); p += 8 + (h[p + 4] | h[p + 5] << 8 | h[p + 6] << 16 | h[p + 7] << 24)) {
+            if(!memcmp(&h[p], "fmt ", 4)) blockAlign = h[p + 20] | h[p + 21] << 8;
+            if(!memcmp(&h[p], "data", 4)) return (h[p + 4] | h[p + 5] << 8 | h[p + 6] << 16 | h[p + 7] << 24) / blockAlign;
+        }
+    }
+    if(strstr(path, ".flac") && !memcmp(h.data(), "fLaC", 4)) { // STREAMINFO, 36 bit total samples
+        const uint8_t* si = &h[8];
+        return (uint32_t)si[14] << 24 | si[15] << 16 | si[16] << 8 | si[17]; // the upper 4 bits (si[13]) are 0 here
+    }
+    if(strstr(path, ".mp3")) { // Xing: frames (MPEG-1 layer 3, 1152 per frame), LAME: 12 bit encoder delay and padding
+        const uint8_t* x = find(h, "Xing");
+        const uint8_t* l = x ? find(h, "LAME", x - h.data()) : nullptr;
+        if(!x || !(x[7] & 1) || !l) return 0;
+        uint32_t delay = l[21] << 4 | l[22] >> 4, padding = (l[22] & 0x0F) << 8 | l[23];
+        return be32(x + 8) * 1152 - delay - padding;
+    }
+    if(strstr(path, ".m4a")) { // iTunSMPB: valid samples, else the mdhd duration minus the media time of the first edit
+        const uint8_t* t = find(h, "iTunSMPB");
+        if(t) {
+            const uint8_t* d = find(h, "data", t - h.data());
+            unsigned long long samples = 0;
+            if(d && sscanf((const char*)d + 12, "%*x %*x %*x %llx", &samples) == 1) return samples;
+        }
+        const uint8_t* m = find(h, "mdhd");
+        const uint8_t* e = find(h, "elst");
+        if(!m || m[4] != 0) return 0; // version 0 only
+        int32_t mediaTime = (e && e[4] == 0 && be32(e + 8)) ? (int32_t)be32(e + 16) : 0;
+        return be32(m + 20) - (mediaTime > 0 ? mediaTime : 0);
+    }
+    return 0;
+}
+
+int main() {
+    Audio* audio = newAudio();
+    for(const char* path : testFileList) {
+        pcm_t one = playFile(audio, path);
+        CHECK(one.frames() > 0);
+        uint32_t expected = headerFrames(path);
+        if(strstr(path, ".mp3") || strstr(path, ".m4a")) CHECK(expected); // the fixtures carry the gapless info
+        if(expected) CHECK(one.frames() == expected);
+
+        int port = audio->getI2sPort();
+        host_i2sTake(port);
+        CHECK(audio->connecttoFS(testFiles, path));
+        CHECK(audio->queueNextFS(testFiles, path));
+        pcm_t    two;
+        uint32_t t0 = millis();
+        while(audio->isRunning() && millis() - t0 < 60000) {
+            audio->loop();
+            std::vector<uint8_t> b = host_i2sTake(port);
+            two.bytes.insert(two.bytes.end(), b.begin(), b.end());
+        }
+        std::vector<uint8_t> b = host_i2sTake(port);
+        two.bytes.insert(two.bytes.end(), b.begin(), b.end());
+        two.slotBits = host_i2sSlotBits(port);
+
+        printf("%-26s alone %8u frames (header %8u), followed by itself %8u frames\n", path, one.frames(), expected, two.frames());
+        CHECK(two.frames() == 2 * one.frames());
+        CHECK(memcmp(two.bytes.data(), one.bytes.data(), one.bytes.size()) == 0); // the first file is not touched
+    }
+    return 0;
+}
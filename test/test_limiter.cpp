@@ -0,0 +1,58 @@
+/*
+ * test_limiter.cpp
+ *
+ *  a full scale 100 Hz square wave with the low shelf at +6 dB through processDSP(), 16 and 24 bit samples, full
+ *  volume (Gain() at unity). Limiter off: the EQ overshoot is clipped, no sample wraps around in the 32 bit slot.
+ *  Limiter on (-1 dBFS, look-ahead, 24 bit: the boost is kept in the headroom): nothing above 0 dBFS reaches I2S,
+ *  the peaks stay at the threshold
+ */
+#define private public // processDSP() and the sample type are private
+#include "test_util.h"
+#include <cmath>
+
+template <typename T> static void run(Audio* audio, bool limiter) {
+    const bool     hiRes = sizeof(T) == sizeof(int32_t);
+    const int32_t  fs = hiRes ? 8388607 : 32767;
+    const uint32_t rate = 48000, frames = 1024, blocks = 2 * rate / frames; // 2 s
+    audio->setSampleRate(rate);
+    audio->m_f_hiRes = hiRes;
+    audio->m_iirDirty.store(true);
+    CHECK(audio->setLimiter(limiter, -1, 0, 5, 100, 5));
+    audio->setTone(6, 0, 0);
+
+    std::vector<T> b(2 * frames);
+    int32_t  peak = 0;
+    uint32_t wraps = 0, clipped = 0, n = 0;
+    for(uint32_t k = 0; k < blocks; k++) {
+        for(uint32_t i = 0; i < frames; i++, n++) b[2 * i] = b[2 * i + 1] = (T)(n % (rate / 100) < rate / 200 ? fs : -fs); // 100 Hz square
+        std::vector<T> in = b;
+        audio->processDSP(b.data(), frames);
+        for(uint32_t i = 0; i < 2 * frames; i++) {
+            int32_t y = hiRes ? (int32_t)b[i] >> 8 : b[i];
+            if(!limiter && abs(in[i]) > fs / 2 && (y < 0) != (in[i] < 0) && abs(y) > fs / 2) wraps++; // the limiter delays
+            if(k >= 2) { // the EQ coefficients are interpolated across the first block
+                peak = std::max(peak, abs(y));
+                if(abs(y) >= fs) clipped++;
+            }
+        }
+    }
+    printf("%2u bit, limiter %-3s: peak %5.2f dBFS, %6u samples at full scale, %u wrapped\n", hiRes ? 24 : 16, limiter ? "on" : "off",
+           20 * log10f((float)peak / fs), clipped, wraps);
+    CHECK(wraps == 0);
+    if(limiter) {
+        CHECK(clipped == 0);
+        CHECK(peak <= fs * powf(10, -0.5f / 20)); // -1 dBFS, a little overshoot at most
+    }
+    else CHECK(clipped > 0); // the overshoot is really there
+    audio->setTone(0, 0, 0);
+    audio->setLimiter(false);
+}
+
+int main() {
+    Audio* audio = newAudio();
+    run<int16_t>(audio, false);
+    run<int16_t>(audio, true);
+    run<int32_t>(audio, false);
+    run<int32_t>(audio, true);
+    return 0;
+}
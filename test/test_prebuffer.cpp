@@ -0,0 +1,96 @@
+/*
+ * test_prebuffer.cpp
+ *
+ *  start threshold of web streams: prebufferBytes() converts the prebuffer time with the measured bitrate, else the
+ *  one of the last connection to the same host or the m3u8 BANDWIDTH, else the announced one, else a guess. The
+ *  target grows by half after an underrun and shrinks by a quarter after a minute without one (streamDetection)
+ */
+#define private public // prebufferBytes(), streamDetection() and the input buffer are private
+#include "test_util.h"
+#undef private
+
+static void measure(Audio* a, uint32_t bitRate, uint32_t seconds) { // as if the decoder had returned seconds of audio
+    a->m_sampleRate = 44100;
+    a->m_brFrames = 44100 * seconds;
+    a->m_brBytes = bitRate / 8 * seconds;
+}
+
+static void fill(Audio* a, bool full) {
+    a->InBuff.resetBuffer();
+    if(full) a->InBuff.bytesWritten(a->InBuff.getMaxBlockSize());
+}
+
+int main() {
+    Audio* a = newAudio();
+    a->stopAudioTask(); // the test alone drives the input buffer
+    a->setDefaults();
+    uint32_t lo = a->InBuff.getMaxBlockSize(), hi = a->InBuff.getBufsize() * 3 / 4;
+    printf("input buffer %d bytes, prebuffer %u ... %u bytes\n", a->InBuff.getBufsize(), lo, hi);
+
+    // the fallbacks, in this order
+    a->m_codec = Audio::CODEC_MP3;
+    CHECK(a->prebufferBytes(2000) == 128000 / 8 * 2);
+    a->m_codec = Audio::CODEC_FLAC;
+    CHECK(a->prebufferBytes(1000) == 1411200 / 8);
+    a->m_bitRate = 64000; // icy-br or the header
+    CHECK(a->prebufferBytes(2000) == 64000 / 8 * 2);
+    a->m_brHint = 96000;
+    CHECK(a->prebufferBytes(2000) == 96000 / 8 * 2);
+    measure(a, 192000, 3);
+    CHECK(a->prebufferBytes(1000) == 192000 / 8);
+    a->m_brFrames = 44100 - 1; // less than one second decoded, not measured yet
+    CHECK(a->prebufferBytes(2000) == 96000 / 8 * 2);
+    measure(a, 192000, 3);
+    CHECK(a->prebufferBytes(1) == lo);
+    CHECK(a->prebufferBytes(100000) == hi);
+
+    // the measurement survives a reconnect to the same host, not a new station (connect() fails on the host)
+    a->connecttohost("http://radio.example:8000/stream");
+    measure(a, 192000, 20);
+    a->connecttohost("radio.example/stream");
+    CHECK(a->m_brFrames == 0 && a->m_brHint == 192000);
+    CHECK(a->prebufferBytes(1000) == 192000 / 8);
+    a->connecttohost("radio.example/stream"); // nothing measured meanwhile, the hint is kept
+    CHECK(a->m_brHint == 192000);
+    a->connecttohost("http://other.example/stream");
+    CHECK(a->m_brHint == 0);
+
+    // HLS: the BANDWIDTH of the chosen variant (not AVERAGE-BANDWIDTH)
+    strcpy(a->m_lastHost, "http://hls.example/live/master.m3u8");
+    const char* m3u8[] = {"#EXTM3U", "#EXT-X-STREAM-INF:AVERAGE-BANDWIDTH=117000,BANDWIDTH=117500,CODECS=\"mp4a.40.2\"",
+                          "112/playlist.m3u8", "#EXT-X-STREAM-INF:BANDWIDTH=69500,CODECS=\"mp4a.40.5\"", "64/playlist.m3u8"};
+    for(const char* line : m3u8) a->m_playlistContent.push_back(strdup(line));
+    uint8_t codec = Audio::CODEC_NONE;
+    const char* url = a->m3u8redirection(&codec);
+    CHECK(url && !strcmp(url, "http://hls.example/live/112/playlist.m3u8") && codec == Audio::CODEC_AAC);
+    CHECK(a->m_brHint == 117500);
+    a->m_sampleRate = 0;
+    CHECK(a->prebufferBytes(2000) == 117500 * 2 / 8);
+
+    // underruns: +50 % once per underrun up to the maximum
+    a->setPrebuffer(2000, 500, 5000);
+    struct { bool full; uint16_t ms; } steps[] = {{false, 3000}, {false, 3000}, {true, 3000}, {false, 4500}, {true, 4500},
+                                                  {false, 5000}, {true, 5000},  {false, 5000}, {true, 5000}};
+    for(auto& st : steps) {
+        fill(a, st.full);
+        a->streamDetection(1);
+        if(!st.full) printf("underrun: prebuffer %u ms, starved %d\n", a->m_prebuf_ms, a->m_f_starved);
+        CHECK(a->m_prebuf_ms == st.ms && a->m_f_starved == !st.full); // the second empty call is the same underrun
+    }
+
+    // a stable stream: -25 % per minute without underrun down to the minimum
+    fill(a, true);
+    int minutes = 0;
+    while(a->m_prebuf_ms > 500 && minutes < 20) {
+        uint16_t ms = a->m_prebuf_ms;
+        a->m_prebufStable = millis() - 60001;
+        a->streamDetection(1);
+        CHECK(a->m_prebuf_ms == std::max(500, ms * 3 / 4));
+        minutes++;
+    }
+    printf("stable: %u ms after %d minutes\n", a->m_prebuf_ms, minutes);
+    CHECK(a->m_prebuf_ms == 500 && minutes == 8);
+    a->streamDetection(1); // less than a minute since the last step
+    CHECK(a->m_prebuf_ms == 500);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * test_schedule.cpp
+ *
+ *  scheduling of the audio task in real time: the DMA ring drains at the sample rate, every sent DMA buffer gives an
+ *  on_sent event. The audio task must keep the ring filled (no underrun) and must be woken by the events, not by
+ *  its poll timeout (AUDIO_TASK_POLL_MS). With the PCM FIFO the I2S writer task wakes it instead of the ISR. What
+ *  reaches I2S must be the start of the file, as decoded without real time (no block written twice after a timeout).
+ *  A connecttoFS() in audio_eof_mp3() must not cut off the end of the finished file that is still in the FIFO
+ */
+#define private public
+#include "test_util.h"
+
+static pcm_t s_ref; // the whole file, decoded without real time
+
+static void run(Audio* audio, uint16_t fifo_ms, uint32_t seconds) {
+    int port = audio->getI2sPort();
+    CHECK(audio->setPcmFifo(fifo_ms));
+    CHECK(audio->connecttoFS(testFiles, "/Olsen-Banden.mp3"));
+
+    uint32_t n0, t0, sent0 = host_i2sWakeups(port), under0 = host_i2sUnderruns(port);
+    host_taskWakeups("PeriodicTask", &n0, &t0);
+    std::vector<uint8_t> out;
+    uint32_t start = millis();
+    while(millis() - start < seconds * 1000) { // like an Arduino loop() with a little work of its own
+        audio->loop();
+        std::vector<uint8_t> b = host_i2sTake(port);
+        out.insert(out.end(), b.begin(), b.end());
+        delay(1);
+    }
+    uint64_t bytes = out.size();
+    uint32_t n1, t1;
+    host_taskWakeups("PeriodicTask", &n1, &t1);
+    uint32_t sent = host_i2sWakeups(port) - sent0, underruns = host_i2sUnderruns(port) - under0;
+    audio->stopSong();
+    delay(50); // the block the audio task is writing just now still goes out
+    host_i2sTake(port);
+
+    double played = (double)bytes / 4 / host_i2sRate(port);
+    printf("FIFO %4u ms: %5.2f s played in %u s, %u DMA buffers sent, %u underruns, audio task woken %u x by an event, "
+           "%u x by the timeout\n", fifo_ms, played, seconds, sent, underruns, n1 - n0, t1 - t0);
+    CHECK(played > seconds - 1);             // the prebuffer (about 1 s) is still in the queue
+    CHECK(bytes <= s_ref.bytes.size() && memcmp(out.data(), s_ref.bytes.data(), bytes) == 0);
+    CHECK(underruns == 0);
+    CHECK((t1 - t0) * 10 < (n1 - n0));       // less than 10 % of the wakeups are polls
+}
+
+static Audio*      s_audio = nullptr;
+static const char* s_again = nullptr; // audio_eof_mp3() plays this file once more
+
+void audio_eof_mp3(const char*) {
+    if(!s_again) return;
+    const char* path = s_again;
+    s_again = nullptr;
+    s_audio->connecttoFS(testFiles, path);
+}
+
+static void runEof(Audio* audio, const char* path, const pcm_t& ref) {
+    int port = audio->getI2sPort();
+    CHECK(audio->setPcmFifo(500));
+    s_audio = audio;
+    s_again = path;
+    CHECK(audio->connecttoFS(testFiles, path));
+    std::vector<uint8_t> out;
+    uint32_t start = millis();
+    while((s_again || audio->isRunning()) && millis() - start < 20000) {
+        audio->loop();
+        std::vector<uint8_t> b = host_i2sTake(port);
+        out.insert(out.end(), b.begin(), b.end());
+        delay(1);
+    }
+    delay(700); // the FIFO still plays
+    std::vector<uint8_t> b = host_i2sTake(port);
+    out.insert(out.end(), b.begin(), b.end());
+
+    size_t n = ref.bytes.size();
+    bool   first = out.size() >= n && memcmp(out.data(), ref.bytes.data(), n) == 0;
+    bool   second = out.size() == 2 * n && memcmp(out.data() + n, ref.bytes.data(), n) == 0;
+    printf("FIFO  500 ms, %s twice, next file connected at the end: %.2f s of %.2f s played, %s\n", path,
+           (double)out.size() / 4 / host_i2sRate(port), 2.0 * n / 4 / ref.rate, first && second ? "complete" : "DIFFERENT");
+    CHECK(first && second);
+}
+
+int main() {
+    Audio* a = newAudio(I2S_NUM_1);
+    s_ref = playFile(a, "/Olsen-Banden.mp3");
+    pcm_t wav = playFile(a, "/test_16bit_stereo.wav");
+    a->stopAudioTask(); // it would count in host_taskWakeups()
+    host_i2sRealtime(true); // before the Audio object creates its channel
+    Audio* audio = newAudio();
+    run(audio, 0, 4);
+    run(audio, 200, 4);
+    runEof(audio, "/test_16bit_stereo.wav", wav);
+    return 0;
+}
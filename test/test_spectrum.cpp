@@ -0,0 +1,94 @@
+/*
+ * test_spectrum.cpp
+ *
+ *  spectrum analyzer: sines of several frequencies and levels through the DSP chain, the bands of the fixed point
+ *  R4FFT must agree with a double precision DFT of the same windowed samples
+ */
+#define private public // processDSP() and the ring are private
+#include "test_util.h"
+#undef private
+#include <complex>
+
+static const int N = 512;
+
+// band magnitudes in dBFS like spectrumTask(), DFT in double of the newest N samples of the ring
+static void referenceBands(Audio* a, float* out) {
+    uint32_t w = a->m_spWrite.load();
+    double   x[N];
+    for(int i = 0; i < N; i++) x[i] = a->m_spRing[(w - N + i) & (a->m_spRingSize - 1)] * (0.5 - 0.5 * cos(2 * M_PI * i / N));
+    const double fullScale = 32768.0 * N / 4; // |X| of a full scale sine at its bin, Hann window
+    for(int b = 0; b < a->m_spBands; b++) {
+        double pMax = 0;
+        for(int k = a->m_spEdge[b]; k < a->m_spEdge[b + 1]; k++) {
+            std::complex<double> X = 0;
+            for(int n = 0; n < N; n++) X += x[n] * std::polar(1.0, -2 * M_PI * k * n / N);
+            pMax = std::max(pMax, std::norm(X));
+        }
+        out[b] = pMax ? std::max(10 * log10(pMax / (fullScale * fullScale)), -96.0) : -96.0;
+    }
+}
+
+int main() {
+    const uint8_t bands = 16;
+    Audio*        audio = newAudio();
+    audio->setSampleRate(44100);
+    CHECK(audio->setSpectrumAnalyzer(bands, 50));
+
+    struct { float freq, dB; } tones[] = {{100, -3}, {440, 0}, {1000, -12}, {3000, -6}, {6000, -20}, {10000, -40}};
+    std::vector<int16_t> block(2 * 1024);
+    uint32_t             phase = 0;
+    float                maxErr = 0;
+    for(auto& t : tones) {
+        audio->m_f_running = false;
+        float amp = 32767 * powf(10, t.dB / 20);
+        for(int n = 0; n < 4; n++) { // 4096 frames, the ring (1024 after decimation) is full of the tone
+            for(int i = 0; i < 1024; i++, phase++) block[2 * i] = block[2 * i + 1] = (int16_t)lrintf(amp * sinf(2 * (float)M_PI * t.freq * phase / 44100));
+            audio->processDSP(block.data(), 1024); // flat EQ, volume 21: spectrumTap() sees the tone unchanged
+        }
+        uint32_t seq = audio->m_spSeq.load();
+        audio->m_f_running = true; // the analyzer task only runs while playing
+        uint32_t t0 = millis();
+        while(audio->m_spSeq.load() < seq + 4 && millis() - t0 < 2000) delay(5); // two complete updates
+        audio->m_f_running = false;
+        CHECK(audio->m_spSeq.load() >= seq + 4);
+
+        float out[bands], ref[bands];
+        CHECK(audio->getSpectrum(out, bands) == bands);
+        referenceBands(audio, ref);
+        int peak = 0, refPeak = 0;
+        for(int b = 0; b < bands; b++) {
+            if(out[b] > out[peak]) peak = b;
+            if(ref[b] > ref[refPeak]) refPeak = b;
+            if(ref[b] > -70) maxErr = std::max(maxErr, fabsf(out[b] - ref[b])); // below, the 16 bit ring dominates
+        }
+        float binHz = 44100.0f / 2 / N; // the ring is decimated by 2
+        printf("%6.0f Hz %4.0f dB: band %2d (bins %3u..%3u, %5.0f..%5.0f Hz) %6.2f dBFS, reference %6.2f dBFS\n", t.freq, t.dB, peak,
+               audio->m_spEdge[peak], audio->m_spEdge[peak + 1] - 1, audio->m_spEdge[peak] * binHz, audio->m_spEdge[peak + 1] * binHz,
+               out[peak], ref[peak]);
+        CHECK(peak == refPeak);
+        uint16_t bin = (uint16_t)lrintf(t.freq / binHz);
+        CHECK(bin >= audio->m_spEdge[peak] - 1 && bin <= audio->m_spEdge[peak + 1]); // Hann main lobe may spill into the neighbour
+        CHECK(fabsf(out[peak] - t.dB) < 3.0f); // Hann scalloping loss between two bins is 1.4 dB, the bins are 43 Hz apart
+    }
+    printf("max deviation from the reference %.2f dB\n", maxErr);
+    CHECK(maxErr < 1.0f);
+
+    // 96 kHz is decimated by 4: the ring runs at 24 kHz, a 5 kHz tone is at bin 107 (by 2 it would be at bin 53)
+    audio->setSampleRate(96000);
+    for(int n = 0; n < 8; n++) {
+        for(int i = 0; i < 1024; i++, phase++) block[2 * i] = block[2 * i + 1] = (int16_t)lrintf(16384 * sinf(2 * (float)M_PI * 5000 * phase / 96000));
+        audio->processDSP(block.data(), 1024);
+    }
+    uint32_t seq = audio->m_spSeq.load();
+    audio->m_f_running = true;
+    uint32_t t0 = millis();
+    while(audio->m_spSeq.load() < seq + 4 && millis() - t0 < 2000) delay(5);
+    audio->m_f_running = false;
+    float out[bands];
+    CHECK(audio->getSpectrum(out, bands) == bands);
+    int peak = 0;
+    for(int b = 0; b < bands; b++) if(out[b] > out[peak]) peak = b;
+    printf(" 5000 Hz at 96 kHz: band %2d (bins %3u..%3u)\n", peak, audio->m_spEdge[peak], audio->m_spEdge[peak + 1] - 1);
+    CHECK(107 >= audio->m_spEdge[peak] - 1 && 107 <= audio->m_spEdge[peak + 1]);
+    return 0;
+}
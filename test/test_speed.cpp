@@ -0,0 +1,31 @@
+/*
+ * test_speed.cpp
+ *
+ *  audioFileSeek(speed) changes the I2S clock only, the next file must start with the output rate again: a file of
+ *  the same rate and, with a fixed output rate, any file
+ */
+#include "test_util.h"
+
+static void run(Audio* audio, const char* first, const char* next, uint32_t rate) {
+    int port = audio->getI2sPort();
+    CHECK(audio->connecttoFS(testFiles, first));
+    uint32_t t0 = millis();
+    while(audio->isRunning() && audio->getAudioCurrentTime() < 1 && millis() - t0 < 10000) { audio->loop(); host_i2sTake(port); }
+    CHECK(host_i2sRate(port) == rate);
+    CHECK(audio->audioFileSeek(1.5f));
+    CHECK(host_i2sRate(port) == rate * 3 / 2);
+    CHECK(audio->connecttoFS(testFiles, next));
+    t0 = millis();
+    while(audio->isRunning() && audio->getAudioCurrentTime() < 1 && millis() - t0 < 10000) { audio->loop(); host_i2sTake(port); }
+    printf("%-20s -> %-26s I2S %6u Hz after the speed change, %6u Hz for the next file\n", first, next, rate * 3 / 2, host_i2sRate(port));
+    CHECK(host_i2sRate(port) == rate);
+    audio->stopSong();
+}
+
+int main() {
+    Audio* audio = newAudio();
+    run(audio, "/Olsen-Banden.mp3", "/Olsen-Banden.mp3", 44100); // same rate, the clock is kept
+    CHECK(audio->setOutputRate(48000));
+    run(audio, "/Olsen-Banden.mp3", "/Pink-Panther.wav", 48000); // 44.1 and 22.05 kHz, resampled
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * test_two_decoders.cpp
+ *
+ *  two Audio objects on I2S_NUM_0 and I2S_NUM_1 play at the same time (zone A / zone B), each output must be bit exact
+ *  with the file played alone. Each file with the next one of the list and with itself, the decoders and the header
+ *  parsers run interleaved
+ */
+#include "test_util.h"
+
+int main() {
+    Audio* a = newAudio(I2S_NUM_0);
+    Audio* b = newAudio(I2S_NUM_1);
+    const size_t n = sizeof(testFileList) / sizeof(testFileList[0]);
+    std::vector<pcm_t> alone;
+    for(const char* path : testFileList) {
+        alone.push_back(playFile(a, path));
+        CHECK(alone.back().frames() > 0);
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        size_t j = (i + 1) % n; // a different codec at the same time, and the same file on both
+        for(size_t k : {j, i}) {
+            pcm_t pa, pb;
+            host_i2sTake(I2S_NUM_0);
+            host_i2sTake(I2S_NUM_1);
+            CHECK(a->connecttoFS(testFiles, testFileList[i]));
+            CHECK(b->connecttoFS(testFiles, testFileList[k]));
+            uint32_t t0 = millis();
+            while((a->isRunning() || b->isRunning()) && millis() - t0 < 60000) {
+                a->loop();
+                b->loop();
+                std::vector<uint8_t> x = host_i2sTake(I2S_NUM_0), y = host_i2sTake(I2S_NUM_1);
+                pa.bytes.insert(pa.bytes.end(), x.begin(), x.end());
+                pb.bytes.insert(pb.bytes.end(), y.begin(), y.end());
+            }
+            std::vector<uint8_t> x = host_i2sTake(I2S_NUM_0), y = host_i2sTake(I2S_NUM_1);
+            pa.bytes.insert(pa.bytes.end(), x.begin(), x.end());
+            pb.bytes.insert(pb.bytes.end(), y.begin(), y.end());
+
+            bool okA = pa.bytes == alone[i].bytes, okB = pb.bytes == alone[k].bytes;
+            printf("%-26s + %-26s %s %s\n", testFileList[i], testFileList[k], okA ? "bit exact" : "DIFFERENT", okB ? "bit exact" : "DIFFERENT");
+            CHECK(okA && okB);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * test_util.h
+ *
+ *  helpers of the host tests: play a file through an Audio object and collect what it wrote to I2S
+ */
+#pragma once
+#include "Audio.h"
+#include "host.h"
+#include <vector>
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if(!(cond)) {                                                                 \
+            printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond);                  \
+            exit(1);                                                                  \
+        }                                                                             \
+    } while(0)
+
+static fs::FS testFiles(TESTFILES);
+
+struct pcm_t {
+    std::vector<uint8_t> bytes;    // interleaved stereo, 16 or 32 bit slots as written to I2S
+    uint32_t             rate = 0;
+    uint8_t              slotBits = 16;
+    uint32_t frames() const { return bytes.size() / (slotBits / 4); }
+    const int16_t* s16() const { return (const int16_t*)bytes.data(); }
+    const int32_t* s32() const { return (const int32_t*)bytes.data(); }
+};
+
+// connects the file and calls loop() until the file has ended, the audio task writes to the I2S port of the object
+inline pcm_t playFile(Audio* audio, const char* path, uint32_t timeout_ms = 60000) {
+    pcm_t pcm;
+    int   port = audio->getI2sPort();
+    host_i2sTake(port);
+    if(!audio->connecttoFS(testFiles, path)) return pcm;
+    uint32_t t0 = millis();
+    while(audio->isRunning() && millis() - t0 < timeout_ms) {
+        audio->loop();
+        std::vector<uint8_t> b = host_i2sTake(port);
+        pcm.bytes.insert(pcm.bytes.end(), b.begin(), b.end());
+    }
+    std::vector<uint8_t> b = host_i2sTake(port);
+    pcm.bytes.insert(pcm.bytes.end(), b.begin(), b.end());
+    pcm.rate = host_i2sRate(port);
+    pcm.slotBits = host_i2sSlotBits(port);
+    return pcm;
+}
+
+inline Audio* newAudio(uint8_t port = I2S_NUM_0) { // never deleted, the audio task runs until the process ends
+    Audio* audio = new Audio(false, 3, port);
+    audio->setPinout(1, 2, 3);
+    audio->setVolume(21);
+    return audio;
+}
+
+static const char* const testFileList[] = {"/Olsen-Banden.mp3", "/Miss-Marple.m4a", "/Santiano-Wellerman.flac",
+                                           "/Collide.ogg",       "/sample.opus",      "/Pink-Panther.wav"};